@@ -0,0 +1,285 @@
+/**
+ * @file atom.c
+ *
+ * Attribute names interned as small integers.
+ *
+ * Every name is stored once, and compared without regard to case. An atom
+ * is never freed, its id and spelling stay valid until shutdown. The first
+ * spelling seen is the one atom_name() returns. Record field names are
+ * interned before anything else, so code can switch on them.
+ *
+ * The table belongs to the game thread, it has no locking.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "atom.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fnv.h>
+#define LOG_SUBSYSTEM "atom"
+#include <log.h>
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+struct atom_table {
+	char **name; /**< spelling of each atom, indexed by id. */
+	uint32_t *hash; /**< hash of each atom, indexed by id. */
+	unsigned nr; /**< next id to hand out. */
+	unsigned max; /**< allocated entries in name and hash. */
+	unsigned *slot; /**< open addressed ids, 0 for an empty slot. */
+	unsigned slot_mask; /**< number of slots minus one. */
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+/** names of enum atom_wellknown, in order. */
+static const char *const atom_wellknown[NR_ATOM_WELLKNOWN] = {
+	[ATOM_ID] = "id",
+	[ATOM_NAME_SHORT] = "name.short",
+	[ATOM_NAME_LONG] = "name.long",
+	[ATOM_DESC_SHORT] = "desc.short",
+	[ATOM_DESC_LONG] = "desc.long",
+	[ATOM_OWNER] = "owner",
+	[ATOM_CREATOR] = "creator",
+	[ATOM_CONTROLLERS] = "controllers",
+	[ATOM_ROOM_CURRENT] = "room.current",
+	[ATOM_ROOM_HOME] = "room.home",
+	[ATOM_USERNAME] = "username",
+	[ATOM_PWCRYPT] = "pwcrypt",
+	[ATOM_EMAIL] = "email",
+	[ATOM_ACS_LEVEL] = "acs.level",
+	[ATOM_ACS_FLAGS] = "acs.flags",
+};
+
+static struct atom_table atoms;
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+/** find the slot holding name, or the empty slot it belongs in. */
+static unsigned *
+atom_slot(const char *name, uint32_t h)
+{
+	unsigned i = h & atoms.slot_mask;
+
+	while (atoms.slot[i]) {
+		unsigned id = atoms.slot[i];
+
+		if (atoms.hash[id] == h && !strcasecmp(atoms.name[id], name))
+			break;
+		i = (i + 1) & atoms.slot_mask;
+	}
+
+	return &atoms.slot[i];
+}
+
+/** double the slots, keeping the table under half full. */
+static int
+atom_rehash(void)
+{
+	unsigned newmask = atoms.slot_mask ? atoms.slot_mask * 2 + 1 : 63;
+	unsigned *newslot = calloc(newmask + 1, sizeof(*newslot));
+	unsigned id;
+
+	if (!newslot) {
+		LOG_PERROR("calloc()");
+		return 0; /* failure */
+	}
+
+	free(atoms.slot);
+	atoms.slot = newslot;
+	atoms.slot_mask = newmask;
+
+	for (id = 1; id < atoms.nr; id++)
+		*atom_slot(atoms.name[id], atoms.hash[id]) = id;
+
+	return 1; /* success */
+}
+
+/** add a name that is not in the table yet. */
+static unsigned
+atom_add(const char *name, uint32_t h)
+{
+	char *s;
+
+	if ((atoms.nr + 1) * 2 > atoms.slot_mask + 1 && !atom_rehash())
+		return ATOM_NONE;
+
+	if (atoms.nr >= atoms.max) {
+		unsigned newmax = atoms.max ? atoms.max * 2 : 64;
+		char **newname = realloc(atoms.name, newmax * sizeof(*newname));
+		uint32_t *newhash;
+
+		if (!newname) {
+			LOG_PERROR("realloc()");
+			return ATOM_NONE;
+		}
+		atoms.name = newname;
+
+		newhash = realloc(atoms.hash, newmax * sizeof(*newhash));
+		if (!newhash) {
+			LOG_PERROR("realloc()");
+			return ATOM_NONE;
+		}
+		atoms.hash = newhash;
+		atoms.max = newmax;
+	}
+
+	s = strdup(name);
+	if (!s) {
+		LOG_PERROR("strdup()");
+		return ATOM_NONE;
+	}
+
+	atoms.name[atoms.nr] = s;
+	atoms.hash[atoms.nr] = h;
+	*atom_slot(name, h) = atoms.nr;
+
+	return atoms.nr++;
+}
+
+/** the first call fills in the well-known atoms. */
+static int
+atom_init(void)
+{
+	unsigned i;
+
+	if (atoms.nr)
+		return 1; /* already done */
+
+	atoms.nr = 1; /* id 0 is ATOM_NONE */
+	for (i = 1; i < NR_ATOM_WELLKNOWN; i++) {
+		if (atom_add(atom_wellknown[i], fnv1a_strcase(atom_wellknown[i])) != i) {
+			LOG_CRITICAL("could not intern \"%s\"", atom_wellknown[i]);
+			return 0; /* failure */
+		}
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * get the atom for name, adding it if it is new.
+ * @return the atom, or ATOM_NONE if out of memory.
+ */
+unsigned
+atom_intern(const char *name)
+{
+	uint32_t h = fnv1a_strcase(name);
+	unsigned *slot;
+
+	if (!atom_init())
+		return ATOM_NONE;
+
+	slot = atom_slot(name, h);
+	if (*slot)
+		return *slot;
+
+	return atom_add(name, h);
+}
+
+/**
+ * get the atom for name without adding it.
+ * @return the atom, or ATOM_NONE if name was never interned.
+ */
+unsigned
+atom_lookup(const char *name)
+{
+	if (!atom_init())
+		return ATOM_NONE;
+
+	return *atom_slot(name, fnv1a_strcase(name));
+}
+
+/** spelling of an atom, NULL for ATOM_NONE or an unknown id. */
+const char *
+atom_name(unsigned atom)
+{
+	if (!atom_init() || atom == ATOM_NONE || atom >= atoms.nr)
+		return NULL;
+
+	return atoms.name[atom];
+}
+
+/** number of atoms, including the well-known ones. */
+unsigned
+atom_count(void)
+{
+	return atoms.nr ? atoms.nr - 1 : 0;
+}
+
+void
+atom_shutdown(void)
+{
+	unsigned id;
+
+	for (id = 1; id < atoms.nr; id++)
+		free(atoms.name[id]);
+	free(atoms.name);
+	free(atoms.hash);
+	free(atoms.slot);
+	memset(&atoms, 0, sizeof(atoms));
+}
+
+#ifndef NTEST
+void
+atom_test(void)
+{
+	char name[32];
+	unsigned a, i;
+
+	if (atom_lookup("NAME.Short") != ATOM_NAME_SHORT
+		|| strcmp(atom_name(ATOM_ACS_FLAGS), "acs.flags")) {
+		LOG_ERROR("atom well-known test failed");
+		exit(1);
+	}
+
+	a = atom_intern("Test.Color");
+	if (a == ATOM_NONE || atom_intern("test.color") != a
+		|| atom_lookup("TEST.COLOR") != a || strcmp(atom_name(a), "Test.Color")
+		|| atom_lookup("test.colour") != ATOM_NONE) {
+		LOG_ERROR("atom intern test failed");
+		exit(1);
+	}
+
+	/* enough names to rehash a few times. */
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "test.%u", i);
+		atom_intern(name);
+	}
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "TEST.%u", i);
+		a = atom_lookup(name);
+		if (a == ATOM_NONE || strcasecmp(atom_name(a), name)) {
+			LOG_ERROR("atom rehash test failed at %u", i);
+			exit(1);
+		}
+	}
+
+	atom_shutdown();
+	LOG_INFO("atom test passed");
+}
+#endif
@@ -0,0 +1,38 @@
+#ifndef ATOM_H_
+#define ATOM_H_
+
+/** no atom, returned for names that were never interned. */
+#define ATOM_NONE 0
+
+/**
+ * record field names, interned first so their ids are constants.
+ * keep in the same order as atom_wellknown[] in atom.c.
+ */
+enum atom_wellknown {
+	ATOM_ID = 1,
+	ATOM_NAME_SHORT,
+	ATOM_NAME_LONG,
+	ATOM_DESC_SHORT,
+	ATOM_DESC_LONG,
+	ATOM_OWNER,
+	ATOM_CREATOR,
+	ATOM_CONTROLLERS,
+	ATOM_ROOM_CURRENT,
+	ATOM_ROOM_HOME,
+	ATOM_USERNAME,
+	ATOM_PWCRYPT,
+	ATOM_EMAIL,
+	ATOM_ACS_LEVEL,
+	ATOM_ACS_FLAGS,
+	NR_ATOM_WELLKNOWN
+};
+
+unsigned atom_intern(const char *name);
+unsigned atom_lookup(const char *name);
+const char *atom_name(unsigned atom);
+unsigned atom_count(void);
+void atom_shutdown(void);
+#ifndef NTEST
+void atom_test(void);
+#endif
+#endif
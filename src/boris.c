@@ -37,10 +37,19 @@
 #include <debug.h>
 #include <dyad.h>
 #include <user.h>
+#include <pwhash.h>
+#include <throttle.h>
+#include <timer.h>
 #include <game.h>
 #include <mth.h>
 #include <form.h>
 #include <webserver.h>
+#include <webstate.h>
+#include <metrics.h>
+#include <atom.h>
+#include <slab.h>
+#include <crc32c.h>
+#include <fnv.h>
 
 /* make sure WIN32 is defined when building in a Windows environment */
 #if (defined(_MSC_VER) || defined(__WIN32__)) && !defined(WIN32)
@@ -89,6 +98,33 @@ sh_quit(int s UNUSED)
 	keep_going_fl = 0;
 }
 
+/** phases of one pass of the main loop. */
+enum loop_phase {
+	LOOP_OUTPUT, LOOP_PREPARE, LOOP_WAIT, LOOP_DISPATCH, LOOP_PWHASH,
+	LOOP_WEBSERVER, LOOP_INPUT, LOOP_TIMERS, NR_LOOP_PHASE
+};
+
+static struct metric *loop_phase_metric[NR_LOOP_PHASE], *loop_tick_metric;
+
+static void
+loop_metrics_init(void)
+{
+	static const char *names[NR_LOOP_PHASE] = {
+		"output", "prepare", "wait", "dispatch", "pwhash", "webserver", "input", "timers"
+	};
+	char labels[64];
+	unsigned i;
+
+	for (i = 0; i < NR_LOOP_PHASE; i++) {
+		snprintf(labels, sizeof(labels), "phase=\"%s\"", names[i]);
+		loop_phase_metric[i] = metrics_histogram("boris_loop_phase_seconds", labels,
+			"Time spent in each phase of the main loop.");
+	}
+
+	loop_tick_metric = metrics_histogram("boris_tick_seconds", NULL,
+		"Time the main loop spends working in one pass, not counting the wait.");
+}
+
 /**
  * display a program usage message and terminated with an exit code.
  */
@@ -221,6 +257,18 @@ main(int argc, char **argv)
 	heapqueue_test();
 	sha1_test();
 	sha1crypt_test();
+	scryptcrypt_test();
+	timer_test();
+	webqueue_test();
+	crc32c_test();
+	fnv1a_test();
+	throttle_test();
+	webstate_test();
+	slab_test();
+	/* drop slabs used by the tests, metrics_test() frees their statistics. */
+	slab_shutdown();
+	metrics_test();
+	atom_test();
 #endif
 
 	srand((unsigned)time(NULL));
@@ -243,6 +291,14 @@ main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	/* registered before dyad, so clients freed by dyad_shutdown() can
+	 * still give their objects back and update their metrics. */
+	atexit(metrics_shutdown);
+	atexit(atom_shutdown);
+	atexit(slab_shutdown);
+	if (mud_config.slab_poison)
+		slab_set_poison(1);
+
 	fds_init();
 	dyad_init();
 	atexit(dyad_shutdown);
@@ -297,6 +353,27 @@ main(int argc, char **argv)
 
 	atexit(user_shutdown);
 
+	if (!pwhash_init()) {
+		LOG_ERROR("could not start password hashing");
+		return EXIT_FAILURE;
+	}
+
+	atexit(pwhash_shutdown);
+
+	if (!timer_init()) {
+		LOG_ERROR("could not initialize timers");
+		return EXIT_FAILURE;
+	}
+
+	atexit(timer_shutdown);
+
+	if (!throttle_init()) {
+		LOG_ERROR("could not initialize login throttling");
+		return EXIT_FAILURE;
+	}
+
+	atexit(throttle_shutdown);
+
 	if (!form_module_init()) {
 		LOG_ERROR("could not initialize forms");
 		return EXIT_FAILURE;
@@ -306,24 +383,21 @@ main(int argc, char **argv)
 
 	/* start the webserver if webserver.port is defined. */
 	if (mud_config.webserver_port > 0) {
-		dyad_Stream *webserver_downstream = dyad_newStream();
-		dyad_addListener(webserver_downstream, DYAD_EVENT_ACCEPT, webserver_accept_callback, NULL);
-		if (dyad_listen(webserver_downstream, 4445)) {
-			LOG_ERROR("error creating webserver downstream socket");
+		if (webserver_init(mud_config.webserver_port, telnetclient_webevent) != OK) {
+			LOG_ERROR("could not initialize webserver");
 			return EXIT_FAILURE;
 		}
 
-		struct webserver_context web_ctx = {
-			.upstream_port = 4445,
-			.family = mud_config.default_family
-		};
+		atexit(webserver_shutdown);
 
-		if (webserver_init(web_ctx, mud_config.webserver_port) != OK) {
-			LOG_ERROR("could not initialize webserver");
+		if (!webstate_init()) {
+			LOG_ERROR("could not start game state updates");
 			return EXIT_FAILURE;
 		}
 
-		atexit(webserver_shutdown);
+		atexit(webstate_shutdown);
+		/* websocket clients have no stream for dyad_shutdown() to free. */
+		atexit(telnetclient_web_shutdown);
 	}
 
 	if (!game_init()) {
@@ -338,17 +412,54 @@ main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	LOG_TODO("use the next event for the timer");
-
-	dyad_setUpdateTimeout(10);
+	loop_metrics_init();
 
 	while (keep_going_fl && dyad_getStreamCount() > 0) {
 		struct telnetserver *cur;
+		uint64_t start = metrics_usec(), t[NR_LOOP_PHASE];
+		double prepare, wait, dispatch;
+
 		for (cur = telnetserver_first(); cur; cur = telnetserver_next(cur)) {
 			telnetclient_prompt_refresh_all(cur);
+			telnetclient_flush_all(cur);
 		}
+		t[LOOP_OUTPUT] = metrics_usec();
+
+		/* wake up for the next timer, or soon while password hashes are in flight */
+		double timeout = 10;
+		long next = timer_next();
+		if (next >= 0 && next < timeout * 1000)
+			timeout = next / 1000.0;
+		if ((pwhash_pending() || webserver_pending()) && timeout > 0.01)
+			timeout = 0.01;
+		/* queued input lines are run on the next pass without waiting */
+		if (telnetclient_input_pending())
+			timeout = 0;
+		dyad_setUpdateTimeout(timeout);
 
 		dyad_update();
+		t[LOOP_DISPATCH] = metrics_usec();
+
+		pwhash_poll();
+		t[LOOP_PWHASH] = metrics_usec();
+		webserver_poll();
+		t[LOOP_WEBSERVER] = metrics_usec();
+		telnetclient_input_all();
+		t[LOOP_INPUT] = metrics_usec();
+		timer_run();
+		t[LOOP_TIMERS] = metrics_usec();
+
+		dyad_getUpdateTimes(&prepare, &wait, &dispatch);
+		metrics_observe(loop_phase_metric[LOOP_OUTPUT], t[LOOP_OUTPUT] - start);
+		metrics_observe(loop_phase_metric[LOOP_PREPARE], prepare * 1e6);
+		metrics_observe(loop_phase_metric[LOOP_WAIT], wait * 1e6);
+		metrics_observe(loop_phase_metric[LOOP_DISPATCH], dispatch * 1e6);
+		metrics_observe(loop_phase_metric[LOOP_PWHASH], t[LOOP_PWHASH] - t[LOOP_DISPATCH]);
+		metrics_observe(loop_phase_metric[LOOP_WEBSERVER], t[LOOP_WEBSERVER] - t[LOOP_PWHASH]);
+		metrics_observe(loop_phase_metric[LOOP_INPUT], t[LOOP_INPUT] - t[LOOP_WEBSERVER]);
+		metrics_observe(loop_phase_metric[LOOP_TIMERS], t[LOOP_TIMERS] - t[LOOP_INPUT]);
+		if (t[LOOP_TIMERS] - start > wait * 1e6)
+			metrics_observe(loop_tick_metric, t[LOOP_TIMERS] - start - wait * 1e6);
 
 		LOG_INFO("Tick");
 	}
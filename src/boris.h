@@ -260,16 +260,19 @@ struct socketio_handle;
  * holds an entry.
  */
 struct attr_entry {
-	LIST_ENTRY(struct attr_entry) list;
-	char *name;
+	unsigned atom; /**< name, see atom.h. */
 	char *value;
 };
 
 /**
  * attribute list.
- * it's just a list of name=value pairs (all strings)
+ * a flat array of name=value pairs, in the order they were added.
+ * names are atoms, so they match without regard to case.
  */
-LIST_HEAD(struct attr_list, struct attr_entry);
+struct attr_list {
+	unsigned nr, max;
+	struct attr_entry *ent;
+};
 
 /**
  * used for value_set() and value_get().
@@ -301,6 +304,7 @@ int service_detach_log(void (*log)(int priority, const char *domain, const char
 void service_attach_log(void (*log)(int priority, const char *domain, const char *fmt, ...));
 
 struct attr_entry *attr_find(struct attr_list *al, const char *name);
+struct attr_entry *attr_find_atom(struct attr_list *al, unsigned atom);
 int attr_add(struct attr_list *al, const char *name, const char *value);
 void attr_list_free(struct attr_list *al);
 
@@ -6,6 +6,7 @@
 struct buf;
 
 struct buf *buf_new(void);
+void buf_set_limit(struct buf *b, size_t limit);
 void buf_free(struct buf *b);
 bool buf_check(struct buf *b);
 void buf_append(struct buf *b, char v);
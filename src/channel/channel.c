@@ -27,6 +27,7 @@
 #define LOG_SUBSYSTEM "channel"
 #include <log.h>
 #include <list.h>
+#include <grow.h>
 
 #include <assert.h>
 #include <stdarg.h>
@@ -51,7 +52,7 @@
 
 struct channel {
 	/* array of members */
-	unsigned nr_member;
+	unsigned nr_member, max_member;
 	struct channel_member **member;
 };
 
@@ -76,6 +77,7 @@ static void
 channel_init(struct channel *ch)
 {
 	ch->nr_member = 0;
+	ch->max_member = 0;
 	ch->member = NULL;
 }
 
@@ -108,8 +110,6 @@ channel_find_member(struct channel *ch, struct channel_member *cm)
 static int
 channel_add_member(struct channel *ch, struct channel_member *cm)
 {
-	struct channel_member **newlist;
-
 	assert(ch != NULL);
 	assert(cm != NULL);
 
@@ -117,14 +117,12 @@ channel_add_member(struct channel *ch, struct channel_member *cm)
 
 	if (channel_find_member(ch, cm)) return 0; /* already a member */
 
-	newlist = realloc(ch->member, sizeof * ch->member * (ch->nr_member + 1));
-
-	if (!newlist) {
+	/* capacity doubles, so a join storm does not realloc for every member. */
+	if (grow((void**)&ch->member, &ch->max_member, ch->nr_member + 1, sizeof(*ch->member))) {
 		LOG_ERROR("could not add member to channel.");
 		return 0; /* could not allocate. */
 	}
 
-	ch->member = newlist;
 	ch->member[ch->nr_member++] = cm;
 	return 1; /* success */
 }
@@ -160,6 +158,7 @@ channel_delete_member(struct channel *ch, struct channel_member *cm)
 	if (!ch->nr_member) {
 		free(ch->member);
 		ch->member = NULL;
+		ch->max_member = 0;
 	}
 
 	return OK; /* success */
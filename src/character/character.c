@@ -24,8 +24,10 @@
 
 #include "character.h"
 #include "boris.h"
+#include "atom.h"
 #include "freelist.h"
 #include "fdb.h"
+#include "slab.h"
 
 #define LOG_SUBSYSTEM "character"
 #include "log.h"
@@ -61,25 +63,28 @@ LIST_HEAD(struct character_cache, struct character);
  * definition of every attribute in character record.
  */
 static const struct {
+	unsigned atom;
 	char *name;
 	enum value_type type;
 	size_t ofs;
 } attrinfo[] = {
-	{"id", VALUE_TYPE_UINT, offsetof(struct character, id), },
-	{"name.short", VALUE_TYPE_STRING, offsetof(struct character, name.short_str), },
-	{"name.long", VALUE_TYPE_STRING, offsetof(struct character, name.long_str), },
-	{"desc.short", VALUE_TYPE_STRING, offsetof(struct character, desc.short_str), },
-	{"desc.long", VALUE_TYPE_STRING, offsetof(struct character, desc.long_str), },
-	{"owner", VALUE_TYPE_STRING, offsetof(struct character, owner), },
-	{"controllers", VALUE_TYPE_STRING, offsetof(struct character, controllers), },
-	{"room.current", VALUE_TYPE_UINT, offsetof(struct character, room_current), },
-	{"room.home", VALUE_TYPE_UINT, offsetof(struct character, room_home), },
+	{ATOM_ID, "id", VALUE_TYPE_UINT, offsetof(struct character, id), },
+	{ATOM_NAME_SHORT, "name.short", VALUE_TYPE_STRING, offsetof(struct character, name.short_str), },
+	{ATOM_NAME_LONG, "name.long", VALUE_TYPE_STRING, offsetof(struct character, name.long_str), },
+	{ATOM_DESC_SHORT, "desc.short", VALUE_TYPE_STRING, offsetof(struct character, desc.short_str), },
+	{ATOM_DESC_LONG, "desc.long", VALUE_TYPE_STRING, offsetof(struct character, desc.long_str), },
+	{ATOM_OWNER, "owner", VALUE_TYPE_STRING, offsetof(struct character, owner), },
+	{ATOM_CONTROLLERS, "controllers", VALUE_TYPE_STRING, offsetof(struct character, controllers), },
+	{ATOM_ROOM_CURRENT, "room.current", VALUE_TYPE_UINT, offsetof(struct character, room_current), },
+	{ATOM_ROOM_HOME, "room.home", VALUE_TYPE_UINT, offsetof(struct character, room_home), },
 };
 
 /** list of all loaded characters. */
 static struct character_cache character_cache;
 
 static struct freelist *character_id_freelist;
+
+static struct slab character_slab = SLAB_INIT("character", struct character);
 /******************************************************************************
  * Functions
  ******************************************************************************/
@@ -109,7 +114,7 @@ character_ll_free(struct character *ch)
 
 	attr_list_free(&ch->extra_values);
 
-	free(ch);
+	slab_free(&character_slab, ch);
 }
 
 /**
@@ -119,7 +124,7 @@ static struct character *
 character_ll_alloc(void)
 {
 	struct character *ret;
-	ret = calloc(1, sizeof * ret);
+	ret = slab_alloc(&character_slab);
 
 	if (!ret) {
 		LOG_CRITICAL("out of memory");
@@ -129,32 +134,64 @@ character_ll_alloc(void)
 }
 
 /**
- *
+ * find the attrinfo entry for an atom.
+ * @return index into attrinfo, or -1 if it is not a record field.
+ */
+static int
+character_attrinfo(unsigned atom)
+{
+	unsigned i;
+
+	for (i = 0; i < NR(attrinfo); i++) {
+		if (attrinfo[i].atom == atom) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * set an attribute in memory.
+ */
+static int
+character_attr_apply(struct character *ch, const char *name, const char *value)
+{
+	int i = character_attrinfo(atom_lookup(name));
+
+	if (i >= 0) {
+		return value_set(value, attrinfo[i].type, (char*)ch + attrinfo[i].ofs);
+	}
+
+	return parse_attr(name, value, &ch->extra_values);
+}
+
+/**
+ * set an attribute. the change is journaled, or the character is marked
+ * for a full save if that is not possible.
  */
 int
 character_attr_set(struct character *ch, const char *name, const char *value)
 {
-	unsigned i;
-	int res;
+	char numbuf[22]; /* big enough for a signed 64-bit decimal */
 
 	assert(ch != NULL);
 
 	if (!ch) return 0;
 
-	for (i = 0; i < NR(attrinfo); i++) {
-		if (!strcasecmp(name, attrinfo[i].name)) {
-			ch->dirty_fl = 1;
-			return value_set(value, attrinfo[i].type, (char*)ch + attrinfo[i].ofs);
-		}
-	}
+	if (!character_attr_apply(ch, name, value))
+		return 0;
+
+	if (ch->dirty_fl)
+		return 1; /* the next save writes it */
 
-	res = parse_attr(name, value, &ch->extra_values);
+	snprintf(numbuf, sizeof numbuf, "%u", ch->id);
 
-	if (res) {
+	if (!ch->id || !fdb_journal_append(DOMAIN_CHARACTER, numbuf, name, value)) {
 		ch->dirty_fl = 1;
 	}
 
-	return res;
+	return 1;
 }
 
 /**
@@ -163,20 +200,22 @@ character_attr_set(struct character *ch, const char *name, const char *value)
 const char *
 character_attr_get(struct character *ch, const char *name)
 {
-	unsigned i;
+	unsigned atom;
+	int i;
 	struct attr_entry *at;
 
 	assert(ch != NULL);
 
 	if (!ch) return NULL;
 
-	for (i = 0; i < NR(attrinfo); i++) {
-		if (!strcasecmp(name, attrinfo[i].name)) {
-			return value_get(attrinfo[i].type, (char*)ch + attrinfo[i].ofs);
-		}
+	atom = atom_lookup(name);
+	i = character_attrinfo(atom);
+
+	if (i >= 0) {
+		return value_get(attrinfo[i].type, (char*)ch + attrinfo[i].ofs);
 	}
 
-	at = attr_find(&ch->extra_values, name);
+	at = attr_find_atom(&ch->extra_values, atom);
 
 	return at ? at->value : NULL;
 }
@@ -210,7 +249,7 @@ character_load(unsigned character_id)
 	}
 
 	while (fdb_read_next(h, &name, &value)) {
-		if (!character_attr_set(ch, name, value)) {
+		if (!character_attr_apply(ch, name, value)) {
 			LOG_ERROR("could not load character \"%u\"", character_id);
 			character_ll_free(ch);
 			fdb_read_end(h);
@@ -235,7 +274,6 @@ character_load(unsigned character_id)
 int
 character_save(struct character *ch)
 {
-	struct attr_entry *curr;
 	struct fdb_write_handle *h;
 	unsigned i;
 
@@ -266,8 +304,10 @@ character_save(struct character *ch)
 		}
 	}
 
-	for (curr = LIST_TOP(ch->extra_values); curr; curr = LIST_NEXT(curr, list)) {
-		fdb_write_pair(h, curr->name, curr->value);
+	for (i = 0; i < ch->extra_values.nr; i++) {
+		struct attr_entry *curr = &ch->extra_values.ent[i];
+
+		fdb_write_pair(h, atom_name(curr->atom), curr->value);
 	}
 
 	if (!fdb_write_end(h)) {
@@ -281,6 +321,19 @@ character_save(struct character *ch)
 	return 1;
 }
 
+/**
+ * save every dirty character in the cache.
+ */
+void
+character_save_all(void)
+{
+	struct character *curr;
+
+	for (curr = LIST_TOP(character_cache); curr; curr = LIST_NEXT(curr, character_cache)) {
+		character_save(curr);
+	}
+}
+
 /**
  * load character into active list, if not already loaded, then increase
  * reference count of character.
@@ -453,5 +506,7 @@ void
 character_shutdown(void)
 {
 	LOG_INFO("Character sub-system shutting down...");
+	freelist_free(character_id_freelist);
+	character_id_freelist = NULL;
 	LOG_INFO("Character sub-system ended.");
 }
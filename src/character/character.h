@@ -31,5 +31,9 @@ const char *character_attr_get(struct character *ch, const char *name);
  * save a character to disk (only if it is dirty).
  */
 int character_save(struct character *ch);
+/**
+ * save every dirty character that is loaded.
+ */
+void character_save_all(void);
 
 #endif
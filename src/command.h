@@ -11,5 +11,6 @@ int command_do_quit(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd
 int command_do_roomget(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg);
 int command_do_character(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg);
 int command_do_time(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg UNUSED);
+int command_do_save(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg UNUSED);
 void command_start(void *p, long unused2 UNUSED, void *unused3 UNUSED);
 #endif
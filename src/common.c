@@ -122,6 +122,7 @@
 #include <dyad.h>
 
 #include "boris.h"
+#include "atom.h"
 #include "mud.h"
 #include "command.h"
 #include "channel.h"
@@ -131,6 +132,7 @@
 #include "eventlog.h"
 #include "fdb.h"
 #include "freelist.h"
+#include "grow.h"
 #include "list.h"
 #include "sha1.h"
 #include "sha1crypt.h"
@@ -216,6 +218,7 @@ int
 parse_attr(const char *name, const char *value, struct attr_list *al)
 {
 	struct attr_entry *at;
+	char *v;
 
 	assert(name != NULL);
 	assert(value != NULL);
@@ -227,8 +230,15 @@ parse_attr(const char *name, const char *value, struct attr_list *al)
 		return attr_add(al, name, value);
 	}
 
+	v = strdup(value);
+
+	if (!v) {
+		LOG_PERROR("strdup()");
+		return 0; /* error */
+	}
+
 	free(at->value);
-	at->value = strdup(value);
+	at->value = v;
 	return 1; /* success. */
 }
 
@@ -1102,22 +1112,34 @@ bitmap_test(void)
  ******************************************************************************/
 
 /**
- * find an attr by name.
+ * find an attr by atom.
  */
-struct attr_entry *attr_find(struct attr_list *al, const char *name)
+struct attr_entry *
+attr_find_atom(struct attr_list *al, unsigned atom)
 {
-	struct attr_entry *curr;
+	unsigned i;
 
-	for (curr = LIST_TOP(*al); curr; curr = LIST_NEXT(curr, list)) {
-		/* case sensitive. */
-		if (!strcmp(curr->name, name)) {
-			return curr;
+	if (atom == ATOM_NONE)
+		return NULL; /* not found. */
+
+	for (i = 0; i < al->nr; i++) {
+		if (al->ent[i].atom == atom) {
+			return &al->ent[i];
 		}
 	}
 
 	return NULL; /* not found. */
 }
 
+/**
+ * find an attr by name. case insensitive.
+ */
+struct attr_entry *
+attr_find(struct attr_list *al, const char *name)
+{
+	return attr_find_atom(al, atom_lookup(name));
+}
+
 /**
  * add an entry to the end, preserves the order.
  * refuse to add a duplicate entry.
@@ -1125,55 +1147,38 @@ struct attr_entry *attr_find(struct attr_list *al, const char *name)
 int
 attr_add(struct attr_list *al, const char *name, const char *value)
 {
-	struct attr_entry *curr, *prev, *item;
+	struct attr_entry *item;
+	unsigned atom;
+	char *v;
 
 	assert(al != NULL);
 
-	/* track prev to use later as a tail. */
-	prev = NULL;
+	atom = atom_intern(name);
 
-	for (curr = LIST_TOP(*al); curr; curr = LIST_NEXT(curr, list)) {
-		/* case sensitive. */
-		if (!strcmp(curr->name, name)) {
-			LOG_ERROR("WARNING:attribute '%s' already exists.", curr->name);
-			return 0; /**< duplicate found, refuse to add. */
-		}
-
-		prev = curr;
-	}
-
-	/* create the new entry. */
-	item = calloc(1, sizeof * item);
-
-	if (!item) {
-		LOG_PERROR("calloc()");
+	if (atom == ATOM_NONE) {
 		return 0; /**< out of memory. */
 	}
 
-	item->name = strdup(name);
+	if (attr_find_atom(al, atom)) {
+		LOG_ERROR("WARNING:attribute '%s' already exists.", atom_name(atom));
+		return 0; /**< duplicate found, refuse to add. */
+	}
 
-	if (!item->name) {
-		LOG_PERROR("strdup()");
-		free(item);
+	if (grow((void**)&al->ent, &al->max, al->nr + 1, sizeof(*al->ent))) {
+		LOG_ERROR("unable to grow attribute list");
 		return 0; /**< out of memory. */
 	}
 
-	item->value = strdup(value);
+	v = strdup(value);
 
-	if (!item->value) {
+	if (!v) {
 		LOG_PERROR("strdup()");
-		free(item->name);
-		free(item);
 		return 0; /**< out of memory. */
 	}
 
-	/* if head of list use LIST_INSERT_HEAD, else insert after curr. */
-	if (prev) {
-		assert(curr == NULL);
-		LIST_INSERT_AFTER(prev, item, list);
-	} else {
-		LIST_INSERT_HEAD(al, item, list);
-	}
+	item = &al->ent[al->nr++];
+	item->atom = atom;
+	item->value = v;
 
 	return 1; /**< success. */
 }
@@ -1184,18 +1189,17 @@ attr_add(struct attr_list *al, const char *name, const char *value)
 void
 attr_list_free(struct attr_list *al)
 {
-	struct attr_entry *curr;
+	unsigned i;
 
 	assert(al != NULL);
 
-	while ((curr = LIST_TOP(*al))) {
-		LIST_REMOVE(curr, list);
-		free(curr->name);
-		curr->name = NULL;
-		free(curr->value);
-		curr->value = NULL;
-		free(curr);
+	for (i = 0; i < al->nr; i++) {
+		free(al->ent[i].value);
 	}
+
+	free(al->ent);
+	al->ent = NULL;
+	al->nr = al->max = 0;
 }
 
 /******************************************************************************
@@ -1385,13 +1389,35 @@ mud_config_init(void)
 	mud_config.newuser_level = 5;
 	mud_config.newuser_flags = 0;
 	mud_config.newuser_allowed = 0;
+	mud_config.admin_level = 10;
 	mud_config.eventlog_filename = strdup("boris.log\n");
 	mud_config.eventlog_timeformat = strdup("%y%m%d-%H%M"); /* another good one: %Y.%j-%H%M */
 	mud_config.msgfile_newuser_create = strdup("\nPlease enter only correct information in this application.\n\n");
 	mud_config.msgfile_newuser_deny = strdup("\nNot accepting new user applications!\n\n");
 	mud_config.default_channels = strdup("@system,@wiz,OOC,auction,chat,newbie");
 	mud_config.webserver_port = 0; /* default is to disable. */
+	mud_config.webserver_deflate = 1;
+	mud_config.webstate_interval = 500;
 	mud_config.form_newuser_filename = strdup("data/forms/newuser.form");
+	mud_config.input_buffer = 4096;
+	mud_config.input_rate = 4;
+	mud_config.input_budget = 256;
+	mud_config.output_high = 65536;
+	mud_config.output_low = 16384;
+	mud_config.output_max = 262144;
+	mud_config.slab_poison = 0;
+	mud_config.pwhash_threads = 2;
+	mud_config.scrypt_log2n = 14; /* 16 MiB per hash with r=8 */
+	mud_config.scrypt_r = 8;
+	mud_config.scrypt_p = 1;
+	mud_config.throttle_burst = 5;
+	mud_config.throttle_rate = 6;
+	mud_config.throttle_hosts = 1024;
+	mud_config.throttle_tarpit = 3000;
+	mud_config.fdb_sync = strdup("batch");
+	mud_config.fdb_layout = strdup("flat");
+	mud_config.fdb_commit_window = 100;
+	mud_config.fdb_journal_max = 1048576;
 	mud_config.default_family = 0;
 }
 
@@ -1424,6 +1450,8 @@ mud_config_shutdown(void)
 		&mud_config.msgfile_newuser_deny,
 		&mud_config.default_channels,
 		&mud_config.form_newuser_filename,
+		&mud_config.fdb_sync,
+		&mud_config.fdb_layout,
 	};
 	unsigned i;
 
@@ -1459,13 +1487,35 @@ mud_config_process(void)
 	config_watch(&cfg, "msg.*", do_config_msg, 0);
 	config_watch(&cfg, "msgfile.*", do_config_msgfile, 0);
 	config_watch(&cfg, "newuser.level", do_config_uint, &mud_config.newuser_level);
+	config_watch(&cfg, "admin.level", do_config_uint, &mud_config.admin_level);
 	config_watch(&cfg, "newuser.allowed", do_config_uint, &mud_config.newuser_allowed);
 	config_watch(&cfg, "newuser.flags", do_config_uint, &mud_config.newuser_flags);
 	config_watch(&cfg, "eventlog.filename", do_config_string, &mud_config.eventlog_filename);
 	config_watch(&cfg, "eventlog.timeformat", do_config_string, &mud_config.eventlog_timeformat);
 	config_watch(&cfg, "channels.default", do_config_string, &mud_config.default_channels);
 	config_watch(&cfg, "webserver.port", do_config_uint, &mud_config.webserver_port);
+	config_watch(&cfg, "webserver.deflate", do_config_uint, &mud_config.webserver_deflate);
+	config_watch(&cfg, "webserver.state_interval", do_config_uint, &mud_config.webstate_interval);
 	config_watch(&cfg, "form.newuser.filename", do_config_string, &mud_config.form_newuser_filename);
+	config_watch(&cfg, "input.buffer", do_config_uint, &mud_config.input_buffer);
+	config_watch(&cfg, "input.rate", do_config_uint, &mud_config.input_rate);
+	config_watch(&cfg, "input.budget", do_config_uint, &mud_config.input_budget);
+	config_watch(&cfg, "output.high", do_config_uint, &mud_config.output_high);
+	config_watch(&cfg, "output.low", do_config_uint, &mud_config.output_low);
+	config_watch(&cfg, "output.max", do_config_uint, &mud_config.output_max);
+	config_watch(&cfg, "slab.poison", do_config_uint, &mud_config.slab_poison);
+	config_watch(&cfg, "password.threads", do_config_uint, &mud_config.pwhash_threads);
+	config_watch(&cfg, "password.scrypt.log2n", do_config_uint, &mud_config.scrypt_log2n);
+	config_watch(&cfg, "password.scrypt.r", do_config_uint, &mud_config.scrypt_r);
+	config_watch(&cfg, "password.scrypt.p", do_config_uint, &mud_config.scrypt_p);
+	config_watch(&cfg, "login.throttle.burst", do_config_uint, &mud_config.throttle_burst);
+	config_watch(&cfg, "login.throttle.rate", do_config_uint, &mud_config.throttle_rate);
+	config_watch(&cfg, "login.throttle.hosts", do_config_uint, &mud_config.throttle_hosts);
+	config_watch(&cfg, "login.throttle.tarpit", do_config_uint, &mud_config.throttle_tarpit);
+	config_watch(&cfg, "fdb.sync", do_config_string, &mud_config.fdb_sync);
+	config_watch(&cfg, "fdb.layout", do_config_string, &mud_config.fdb_layout);
+	config_watch(&cfg, "fdb.commit_window", do_config_uint, &mud_config.fdb_commit_window);
+	config_watch(&cfg, "fdb.journal_max", do_config_uint, &mud_config.fdb_journal_max);
 #if !defined(NDEBUG) && !defined(NTEST)
 	config_watch(&cfg, "*", mud_config_show, 0);
 #endif
@@ -26,7 +26,6 @@
 #include "debug.h"
 
 static const uint8_t base64enc_tab[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-static uint8_t *base64dec_tab; /* initialized by base64_decode. */
 
 /**
  * base64_encodes as ./0123456789a-zA-Z.
@@ -77,6 +76,23 @@ int base64_encode(size_t in_len, const unsigned char *in, size_t out_len, char *
 	return io;
 }
 
+/* value of a base64 character, or 255 for a bad value.
+ * no lookup table so it is safe to call from any thread. */
+static unsigned char base64_value(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '+')
+		return 62;
+	if (c == '/')
+		return 63;
+	return 255;
+}
+
 /* decode a base64 string in one shot */
 int base64_decode(size_t in_len, const char *in, size_t out_len, unsigned char *out)
 {
@@ -84,23 +100,6 @@ int base64_decode(size_t in_len, const char *in, size_t out_len, unsigned char *
 	uint_least32_t v;
 	unsigned rem;
 
-	/* initialize base64dec_tab if not initialized. */
-	if (!base64dec_tab) {
-		unsigned i;
-		base64dec_tab = malloc(256);
-
-		if (!base64dec_tab) {
-			LOG_PERROR("malloc()");
-			return 0;
-		}
-
-		memset(base64dec_tab, 255, 256); /**< use 255 indicates a bad value. */
-
-		for (i = 0; i < NR(base64enc_tab); i++) {
-			base64dec_tab[base64enc_tab[i]] = i;
-		}
-	}
-
 	for (io = 0, ii = 0, v = 0, rem = 0; ii < in_len; ii++) {
 		unsigned char ch;
 
@@ -110,7 +109,7 @@ int base64_decode(size_t in_len, const char *in, size_t out_len, unsigned char *
 		if (in[ii] == '=')
 			break; /* stop at = */
 
-		ch = base64dec_tab[(unsigned)in[ii]];
+		ch = base64_value(in[ii]);
 
 		if (ch == 255)
 			break; /* stop at a parse error */
@@ -0,0 +1,282 @@
+/**
+ * @file scryptcrypt.c
+ *
+ * scrypt password hashing
+ *
+ * Hashes are stored as:
+ *   $scrypt$ln=<log2 N>,r=<r>,p=<p>$<base64 salt>$<base64 hash>
+ *
+ * Everything except scryptcrypt_gensalt() is safe to call from any thread.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Written in 2026 by Jon Mayo <jon@rm-f.net>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide.  This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <crypto_entropy.h>
+#include <crypto_scrypt.h>
+#include "base64.h"
+#define LOG_SUBSYSTEM "crypt"
+#include "log.h"
+#include "debug.h"
+#include "scryptcrypt.h"
+
+/** largest salt or hash we will decode. */
+#define SCRYPTCRYPT_DECODE_MAX 64
+
+/** refuse parameters that need more memory than this. (128 * r * N) */
+#define SCRYPTCRYPT_MEMORY_MAX (256ul << 20)
+
+/** parse an unsigned decimal number and the character following it. */
+static const char *
+parse_number(const char *s, unsigned *out, char term)
+{
+	unsigned long v = 0;
+
+	if (*s < '0' || *s > '9')
+		return NULL;
+
+	while (*s >= '0' && *s <= '9') {
+		v = v * 10 + (*s++ - '0');
+		if (v > 0xffffffful)
+			return NULL; /* too large */
+	}
+
+	if (*s != term)
+		return NULL;
+
+	*out = v;
+
+	return s + 1;
+}
+
+/** parse the cost parameters. @return pointer to the salt, or NULL. */
+static const char *
+parse_params(const char *crypttext, struct scryptcrypt_params *params)
+{
+	const char *s = crypttext;
+
+	if (strncmp(s, SCRYPTPASSWD_MAGIC, SCRYPTPASSWD_MAGIC_LEN))
+		return NULL; /* not an scrypt crypt */
+	s += SCRYPTPASSWD_MAGIC_LEN;
+
+	if (strncmp(s, "ln=", 3) || !(s = parse_number(s + 3, &params->log2_n, ',')))
+		return NULL;
+	if (strncmp(s, "r=", 2) || !(s = parse_number(s + 2, &params->r, ',')))
+		return NULL;
+	if (strncmp(s, "p=", 2) || !(s = parse_number(s + 2, &params->p, '$')))
+		return NULL;
+
+	return s;
+}
+
+/** compare without leaking the position of the first difference. */
+static int
+hash_equal(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	unsigned char diff = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		diff |= a[i] ^ b[i];
+
+	return diff == 0;
+}
+
+/**
+ * check that the parameters are usable and do not need too much memory.
+ * @return 1 if valid, 0 if not.
+ */
+int
+scryptcrypt_params_valid(const struct scryptcrypt_params *params)
+{
+	if (!params || params->log2_n < 1 || params->log2_n > 24)
+		return 0;
+	if (params->r < 1 || params->p < 1 || params->p > 16)
+		return 0;
+	if (params->r > SCRYPTCRYPT_MEMORY_MAX / 128 >> params->log2_n)
+		return 0;
+
+	return 1;
+}
+
+/**
+ * generate a random salt.
+ * uses a shared PRNG, only call this from the main thread.
+ */
+int
+scryptcrypt_gensalt(unsigned char salt[SCRYPTCRYPT_SALT_LEN])
+{
+	if (crypto_entropy_read(salt, SCRYPTCRYPT_SALT_LEN)) {
+		LOG_ERROR("Could not generate salt.");
+		return 0; /* failure */
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * hash a password with the given salt and cost.
+ * @param buf output buffer, at least SCRYPTPASSWD_MAX.
+ */
+int
+scryptcrypt_makepass(char *buf, size_t max, const char *plaintext, const unsigned char salt[SCRYPTCRYPT_SALT_LEN], const struct scryptcrypt_params *params)
+{
+	unsigned char hash[SCRYPTCRYPT_HASH_LEN];
+	char salt64[(SCRYPTCRYPT_SALT_LEN + 2) / 3 * 4 + 1];
+	char hash64[(SCRYPTCRYPT_HASH_LEN + 2) / 3 * 4 + 1];
+	int res;
+
+	assert(max > 0);
+
+	if (!scryptcrypt_params_valid(params)) {
+		LOG_ERROR("Invalid scrypt parameters.");
+		return 0; /* failure */
+	}
+
+	if (crypto_scrypt((const uint8_t*)plaintext, strlen(plaintext),
+			salt, SCRYPTCRYPT_SALT_LEN, (uint64_t)1 << params->log2_n,
+			params->r, params->p, hash, sizeof hash)) {
+		LOG_PERROR("crypto_scrypt()");
+		return 0; /* failure */
+	}
+
+	if (base64_encode(SCRYPTCRYPT_SALT_LEN, salt, sizeof salt64, salt64) < 0
+	    || base64_encode(sizeof hash, hash, sizeof hash64, hash64) < 0) {
+		LOG_ERROR("Buffer cannot hold password.");
+		return 0; /* failure */
+	}
+
+	res = snprintf(buf, max, "%sln=%u,r=%u,p=%u$%s$%s", SCRYPTPASSWD_MAGIC,
+		params->log2_n, params->r, params->p, salt64, hash64);
+	if (res < 0 || (size_t)res >= max) {
+		LOG_ERROR("Buffer cannot hold password.");
+		return 0; /* failure */
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * check a password against an scrypt hash.
+ * @return 1 if the password matches, 0 if it does not or on error.
+ */
+int
+scryptcrypt_checkpass(const char *crypttext, const char *plaintext)
+{
+	struct scryptcrypt_params params;
+	unsigned char salt[SCRYPTCRYPT_DECODE_MAX];
+	unsigned char expected[SCRYPTCRYPT_DECODE_MAX];
+	unsigned char hash[SCRYPTCRYPT_DECODE_MAX];
+	const char *salt64, *hash64;
+	int salt_len, hash_len;
+
+	salt64 = parse_params(crypttext, &params);
+	if (!salt64 || !scryptcrypt_params_valid(&params)) {
+		LOG_ERROR("not an scrypt crypt.");
+		return 0; /* failure */
+	}
+
+	hash64 = strchr(salt64, '$');
+	if (!hash64) {
+		LOG_ERROR("crypt decode error.");
+		return 0; /* failure */
+	}
+	hash64++;
+
+	salt_len = base64_decode(hash64 - salt64 - 1, salt64, sizeof salt, salt);
+	hash_len = base64_decode(strlen(hash64), hash64, sizeof expected, expected);
+	if (salt_len <= 0 || hash_len < 16) {
+		LOG_ERROR("crypt decode error.");
+		return 0; /* failure */
+	}
+
+	if (crypto_scrypt((const uint8_t*)plaintext, strlen(plaintext),
+			salt, salt_len, (uint64_t)1 << params.log2_n,
+			params.r, params.p, hash, hash_len)) {
+		LOG_PERROR("crypto_scrypt()");
+		return 0; /* failure */
+	}
+
+	return hash_equal(hash, expected, hash_len);
+}
+
+/**
+ * decide if a stored hash should be replaced by one using params.
+ * any non-scrypt hash, or an scrypt hash with different cost, needs a rehash.
+ */
+int
+scryptcrypt_needs_rehash(const char *crypttext, const struct scryptcrypt_params *params)
+{
+	struct scryptcrypt_params old;
+
+	if (!crypttext || !parse_params(crypttext, &old))
+		return 1;
+
+	return old.log2_n != params->log2_n || old.r != params->r || old.p != params->p;
+}
+
+#ifndef NTEST
+#include "boris.h"
+
+void scryptcrypt_test(void)
+{
+	const struct scryptcrypt_params params = { 10, 8, 1 };
+	const struct scryptcrypt_params stronger = { 11, 8, 1 };
+	unsigned char salt[SCRYPTCRYPT_SALT_LEN];
+	char buf[SCRYPTPASSWD_MAX];
+	struct {
+		char *pass, *hash;
+	} examples[] = {
+		/* from the scrypt paper, N=1024 r=8 p=16 */
+		{ "password", "$scrypt$ln=10,r=8,p=16$TmFDbA==$/bq+HJ00cgB4VucZDQHp/nxq18vII3gw53N2Y0s3MWIurzDZLiKjiG/xCSedmDDaxyevuUqD7m2DYMvfoswGQA==" },
+		{ "secret", "$scrypt$ln=10,r=8,p=1$Ym9yaXMtdGVzdC1zYWx0IQ==$G4O9oqgpHsP0DwbK2iC9Vrv/6BnV0k7EzCL11Px/NeU=" },
+	};
+	unsigned i;
+
+	/* password creation and checking. - positive testing. */
+	if (!scryptcrypt_gensalt(salt) || !scryptcrypt_makepass(buf, sizeof buf, "abcdef", salt, &params)) {
+		LOG_ERROR("scryptcrypt_makepass() failed.");
+		exit(1);
+	}
+	printf("buf=\"%s\"\n", buf);
+
+	if (!scryptcrypt_checkpass(buf, "abcdef")) {
+		LOG_ERROR("scryptcrypt_checkpass() must succeed on positive test.");
+		exit(1);
+	}
+
+	/* checking - negative testing. */
+	if (scryptcrypt_checkpass(buf, "abcdeg")) {
+		LOG_ERROR("scryptcrypt_checkpass() must fail on negative test.");
+		exit(1);
+	}
+
+	if (scryptcrypt_needs_rehash(buf, &params) || !scryptcrypt_needs_rehash(buf, &stronger)
+	    || !scryptcrypt_needs_rehash("{SSHA}2gDsLm/57U00KyShbiYsgvPIsQtzYWx0", &params)) {
+		LOG_ERROR("scryptcrypt_needs_rehash() failed.");
+		exit(1);
+	}
+
+	/* loop through all hardcoded examples. */
+	for (i = 0; i < NR(examples); i++) {
+		if (!scryptcrypt_checkpass(examples[i].hash, examples[i].pass)) {
+			LOG_ERROR("Example %d:FAILED hash:%s", i + 1, examples[i].hash);
+			exit(1);
+		}
+		LOG_DEBUG("Example %d:PASSED hash:%s", i + 1, examples[i].hash);
+	}
+}
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file scryptcrypt.h
+ *
+ * scrypt password hashing
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Written in 2026 by Jon Mayo <jon@rm-f.net>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide.  This software is distributed without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication along with
+ * this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef SCRYPTCRYPT_H_
+#define SCRYPTCRYPT_H_
+
+#include <stddef.h>
+
+/** prefix for scrypt password hash. */
+#define SCRYPTPASSWD_MAGIC "$scrypt$"
+
+/** length of SCRYPTPASSWD_MAGIC. */
+#define SCRYPTPASSWD_MAGIC_LEN 8
+
+/** length of the random salt. */
+#define SCRYPTCRYPT_SALT_LEN 16
+
+/** length of the derived key. */
+#define SCRYPTCRYPT_HASH_LEN 32
+
+/** maximum length of crypted password including null termination. */
+#define SCRYPTPASSWD_MAX 128
+
+/** cost parameters of a scrypt hash. N is stored as log2(N). */
+struct scryptcrypt_params {
+	unsigned log2_n;
+	unsigned r;
+	unsigned p;
+};
+
+int scryptcrypt_params_valid(const struct scryptcrypt_params *params);
+int scryptcrypt_gensalt(unsigned char salt[SCRYPTCRYPT_SALT_LEN]);
+int scryptcrypt_makepass(char *buf, size_t max, const char *plaintext, const unsigned char salt[SCRYPTCRYPT_SALT_LEN], const struct scryptcrypt_params *params);
+int scryptcrypt_checkpass(const char *crypttext, const char *plaintext);
+int scryptcrypt_needs_rehash(const char *crypttext, const struct scryptcrypt_params *params);
+void scryptcrypt_test(void);
+#endif
@@ -13,6 +13,9 @@ int fdb_write_pair(struct fdb_write_handle *h, const char *name, const char *val
 int fdb_write_format(struct fdb_write_handle *h, const char *name, const char *value_fmt, ...);
 int fdb_write_end(struct fdb_write_handle *h);
 void fdb_write_abort(struct fdb_write_handle *h);
+int fdb_flush(void);
+int fdb_migrate(void);
+int fdb_journal_append(const char *domain, const char *id, const char *name, const char *value);
 struct fdb_read_handle *fdb_read_begin(const char *domain, const char *id);
 struct fdb_read_handle *fdb_read_begin_uint(const char *domain, unsigned id);
 int fdb_read_next(struct fdb_read_handle *h, const char **name, const char **value);
@@ -0,0 +1,157 @@
+/**
+ * @file fdbcheck.c
+ *
+ * Checksums of fdb records and journal lines, shared by the server and
+ * boris-fsck.
+ *
+ * A record starts with the line ".format     = 2" and ends with the line
+ * ".crc32c     = XXXXXXXX", the CRC-32C of everything before it. The first
+ * line tells a record that was cut short from one written before records
+ * had checksums. A journal line starts with the CRC-32C of the rest of the
+ * line.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fdbcheck.h"
+#include <crc32c.h>
+#include <string.h>
+
+/**
+ * parse exactly 8 hex digits.
+ */
+static int
+fdb_check_hex32(const char *s, uint32_t *out)
+{
+	uint32_t v = 0;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		int c = s[i], d;
+
+		if (c >= '0' && c <= '9')
+			d = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			d = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			d = c - 'A' + 10;
+		else
+			return 0; /* failure */
+
+		v = v << 4 | d;
+	}
+
+	*out = v;
+
+	return 1; /* success */
+}
+
+/**
+ * true if the first line of a record is the format line.
+ */
+static int
+fdb_check_format(const char *buf, size_t len)
+{
+	size_t n = sizeof(FDB_FORMAT_NAME) - 1;
+
+	return len > n && !memcmp(buf, FDB_FORMAT_NAME, n)
+		&& (buf[n] == ' ' || buf[n] == '=');
+}
+
+/**
+ * verify the checksum line at the end of a record.
+ * on success len is shortened to leave the checksum line out, and
+ * crc_out is the checksum of what remains.
+ */
+enum fdb_check
+fdb_check_record(const char *buf, size_t *len, uint32_t *crc_out)
+{
+	const char *t, *eq, *end = buf + *len;
+	uint32_t stored;
+
+	/* start of the last line. */
+	t = end;
+	if (t > buf && t[-1] == '\n')
+		t--;
+	while (t > buf && t[-1] != '\n')
+		t--;
+
+	if ((size_t)(end - t) < sizeof(FDB_CRC_NAME) - 1
+		|| memcmp(t, FDB_CRC_NAME, sizeof(FDB_CRC_NAME) - 1)) {
+		/* a record that starts like a sealed one lost its end. */
+		if (fdb_check_format(buf, *len))
+			return FDB_CHECK_DAMAGED;
+		*crc_out = crc32c(0, buf, *len);
+		return FDB_CHECK_UNSEALED;
+	}
+
+	eq = memchr(t, '=', end - t);
+
+	if (!eq || end - eq < 10 || eq[1] != ' ' || !fdb_check_hex32(eq + 2, &stored))
+		return FDB_CHECK_DAMAGED;
+
+	*crc_out = crc32c(0, buf, t - buf);
+
+	if (*crc_out != stored)
+		return FDB_CHECK_DAMAGED;
+
+	*len = t - buf;
+
+	return FDB_CHECK_OK;
+}
+
+/**
+ * check that every line of a record is "name = value" and ends in a newline.
+ * @return 0 if all lines are good, otherwise the number of the first bad line.
+ */
+size_t
+fdb_check_lines(const char *buf, size_t len)
+{
+	const char *b, *nl, *end = buf + len;
+	size_t line;
+
+	for (b = buf, line = 1; b < end; b = nl + 1, line++) {
+		const char *eq;
+
+		nl = memchr(b, '\n', end - b);
+
+		if (!nl)
+			return line; /* missing newline before EOF */
+
+		eq = memchr(b, '=', nl - b);
+
+		if (!eq || eq == b)
+			return line;
+	}
+
+	return 0;
+}
+
+/**
+ * verify a journal line, "crc32c payload", where e is the newline.
+ */
+int
+fdb_check_journal_line(const char *b, const char *e)
+{
+	uint32_t stored;
+
+	if (e - b < 9 || b[8] != ' ' || !fdb_check_hex32(b, &stored))
+		return 0; /* failure */
+
+	return crc32c(0, b + 9, e - (b + 9)) == stored;
+}
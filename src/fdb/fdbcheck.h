@@ -0,0 +1,22 @@
+#ifndef BORIS_FDBCHECK_H_
+#define BORIS_FDBCHECK_H_
+#include <stddef.h>
+#include <stdint.h>
+
+/** name of the checksum line that ends every record. */
+#define FDB_CRC_NAME ".crc32c"
+/** name of the line that starts every record with a checksum line. */
+#define FDB_FORMAT_NAME ".format"
+/** value of the format line. */
+#define FDB_FORMAT 2
+
+enum fdb_check {
+	FDB_CHECK_OK,
+	FDB_CHECK_UNSEALED, /**< written before records had checksums. */
+	FDB_CHECK_DAMAGED,
+};
+
+enum fdb_check fdb_check_record(const char *buf, size_t *len, uint32_t *crc_out);
+size_t fdb_check_lines(const char *buf, size_t len);
+int fdb_check_journal_line(const char *b, const char *e);
+#endif
@@ -0,0 +1,610 @@
+/**
+ * @file fdbcommit.c
+ *
+ * Persistence thread of the file backend.
+ *
+ * Finished records, journal appends and compactions are queued here and
+ * written in batches by one thread, so the game loop never waits on the
+ * disk. Commits that fail stay queued and are written again later.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fdb.h"
+#include "fdbfile.h"
+#define LOG_SUBSYSTEM "fdb"
+#include <log.h>
+#include <metrics.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum fdb_sync fdb_sync = FDB_SYNC_BATCH;
+unsigned fdb_commit_window = 100; /**< ms to collect a batch. */
+#define FDB_RETRY_MS 1000 /**< wait before writing failed commits again. */
+
+static pthread_t fdb_thread;
+int fdb_thread_fl; /**< persistence thread is running. */
+pthread_mutex_t fdb_commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fdb_commit_work = PTHREAD_COND_INITIALIZER; /**< new records. */
+static pthread_cond_t fdb_commit_wake = PTHREAD_COND_INITIALIZER; /**< end the batch window early. */
+static pthread_cond_t fdb_commit_done = PTHREAD_COND_INITIALIZER; /**< a batch finished. */
+static struct fdb_commit *fdb_pending, **fdb_pending_tail = &fdb_pending;
+static struct fdb_commit *fdb_inflight; /**< batch being written, still readable. */
+static struct fdb_commit *fdb_retry, **fdb_retry_tail = &fdb_retry; /**< failed, tried again later. */
+static struct timespec fdb_retry_at; /**< when fdb_retry is due. */
+static unsigned fdb_nr_retry; /**< failed commits not written yet, counting a retry in progress. */
+static unsigned long fdb_seq_queued, fdb_seq_done;
+static unsigned fdb_flush_waiters;
+static int fdb_quit_fl;
+static struct metric *fdb_write_metric, *fdb_batch_metric;
+
+void
+fdb_commit_free(struct fdb_commit *c)
+{
+	free(c->filename);
+	free(c->filename_tmp);
+	free(c->filename_old);
+	free(c->buf);
+	free(c);
+}
+
+/**
+ * write all of buf to fd, retrying short writes.
+ */
+int
+fdb_write_all(int fd, const char *buf, size_t len)
+{
+	size_t ofs;
+
+	for (ofs = 0; ofs < len; ) {
+		ssize_t res = write(fd, buf + ofs, len - ofs);
+
+		if (res < 0 && errno == EINTR)
+			continue;
+
+		if (res < 0)
+			return 0; /* failure */
+
+		ofs += res;
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * write the record to a temp file. a partial temp file is removed.
+ */
+int
+fdb_write_file(const struct fdb_commit *c, int sync_fl)
+{
+	uint64_t start = metrics_usec();
+	int fd;
+
+	fd = open(c->filename_tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+	if (fd == -1) {
+		LOG_PERROR(c->filename_tmp);
+		return 0; /* failure */
+	}
+
+	if (!fdb_write_all(fd, c->buf, c->len))
+		goto failure;
+
+	if (sync_fl && fsync(fd))
+		goto failure;
+
+	if (close(fd)) {
+		fd = -1;
+		goto failure;
+	}
+
+	metrics_observe(fdb_write_metric, metrics_usec() - start);
+
+	return 1; /* success */
+failure:
+	LOG_PERROR(c->filename_tmp);
+	if (fd != -1)
+		close(fd);
+	remove(c->filename_tmp);
+	return 0; /* failure */
+}
+
+/**
+ * move a written temp file over the real file.
+ */
+int
+fdb_commit_rename(const struct fdb_commit *c)
+{
+	if (rename(c->filename_tmp, c->filename)) {
+		LOG_PERROR(c->filename_tmp);
+		remove(c->filename_tmp);
+		return 0; /* failure */
+	}
+
+	if (c->filename_old && remove(c->filename_old) && errno != ENOENT)
+		LOG_PERROR(c->filename_old);
+
+	return 1; /* success */
+}
+
+/**
+ * length of the directory part of filename.
+ */
+static size_t
+fdb_dirlen(const char *filename)
+{
+	const char *slash = strrchr(filename, '/');
+
+	return slash ? (size_t)(slash - filename) : 0;
+}
+
+/**
+ * fsync the directory holding filename, so a rename in it is durable.
+ */
+void
+fdb_sync_dir(const char *filename)
+{
+	char dir[PATH_MAX];
+	int fd;
+
+	snprintf(dir, sizeof dir, "%.*s", (int)fdb_dirlen(filename), filename);
+
+	fd = open(dir[0] ? dir : ".", O_RDONLY | O_DIRECTORY);
+
+	if (fd == -1 || fsync(fd)) {
+		LOG_PERROR(dir);
+	}
+
+	if (fd != -1)
+		close(fd);
+}
+
+/**
+ * write a batch of commits. with FDB_SYNC_BATCH every record is synced
+ * before any is renamed, then each directory and journal is synced once.
+ * journal appends and compactions are done in the order they were made.
+ */
+static void
+fdb_commit_batch(struct fdb_commit *batch)
+{
+	struct fdb_commit *c, *prev;
+	uint64_t start = metrics_usec();
+
+	if (fdb_sync == FDB_SYNC_EVERY) {
+		for (c = batch; c; c = c->next) {
+			if (c->kind != FDB_COMMIT_RECORD)
+				continue;
+			c->ok = fdb_write_file(c, 1) && fdb_commit_rename(c);
+			if (c->ok)
+				fdb_sync_dir(c->filename);
+		}
+	} else {
+		for (c = batch; c; c = c->next) {
+			if (c->kind == FDB_COMMIT_RECORD)
+				c->ok = fdb_write_file(c, fdb_sync == FDB_SYNC_BATCH);
+		}
+
+		for (c = batch; c; c = c->next) {
+			if (c->kind == FDB_COMMIT_RECORD && c->ok)
+				c->ok = fdb_commit_rename(c);
+		}
+	}
+
+	for (c = batch; c && fdb_sync == FDB_SYNC_BATCH; c = c->next) {
+		size_t dirlen;
+
+		if (c->kind != FDB_COMMIT_RECORD || !c->ok)
+			continue;
+
+		dirlen = fdb_dirlen(c->filename);
+
+		/* skip directories already synced in this batch. */
+		for (prev = batch; prev != c; prev = prev->next) {
+			if (prev->kind == FDB_COMMIT_RECORD && prev->ok
+				&& fdb_dirlen(prev->filename) == dirlen
+				&& !memcmp(prev->filename, c->filename, dirlen))
+				break;
+		}
+
+		if (prev == c)
+			fdb_sync_dir(c->filename);
+	}
+
+	for (c = batch; c; c = c->next) {
+		if (c->kind != FDB_COMMIT_RECORD)
+			c->journal->failed_fl = 0;
+	}
+
+	/* once a journal falls behind, the rest of its entries wait for the
+	 * retry so they stay in order. */
+	for (c = batch; c; c = c->next) {
+		struct fdb_journal *j = c->journal;
+
+		if (c->kind == FDB_COMMIT_APPEND) {
+			c->ok = !j->failed_fl && fdb_journal_write(c);
+			if (!c->ok)
+				j->failed_fl = 1;
+		} else if (c->kind == FDB_COMMIT_COMPACT && !j->rotated_fl) {
+			j->rotated_fl = fdb_journal_rotate(j);
+			if (!j->rotated_fl)
+				j->failed_fl = 1;
+		}
+	}
+
+	for (c = batch; c && fdb_sync == FDB_SYNC_BATCH; c = c->next) {
+		if (c->kind == FDB_COMMIT_APPEND && c->journal->dirty_fl) {
+			if (fsync(c->journal->fd))
+				LOG_PERROR(c->journal->filename);
+			c->journal->dirty_fl = 0;
+		}
+	}
+
+	for (c = batch; c; c = c->next) {
+		if (c->kind == FDB_COMMIT_COMPACT)
+			c->ok = c->journal->rotated_fl && fdb_journal_compact(c->journal);
+	}
+
+	metrics_observe(fdb_batch_metric, metrics_usec() - start);
+}
+
+/**
+ * keep the failed commits of a finished batch to be written again, unless
+ * a newer copy of the record is already waiting. journal entries and
+ * compactions keep their order. the caller holds fdb_commit_mutex.
+ * @return the rest of the batch, to be freed.
+ */
+static struct fdb_commit *
+fdb_commit_requeue(struct fdb_commit *batch)
+{
+	struct fdb_commit *done = NULL, **done_tail = &done, *c, *next, *curr;
+
+	fdb_nr_retry = 0; /* the batch held every earlier failure */
+
+	for (c = batch; c; c = next) {
+		next = c->next;
+		c->next = NULL;
+
+		curr = NULL;
+		if (!c->ok && c->kind == FDB_COMMIT_RECORD) {
+			for (curr = fdb_pending; curr; curr = curr->next) {
+				if (curr->kind == FDB_COMMIT_RECORD && !strcmp(curr->filename, c->filename))
+					break;
+			}
+		}
+
+		if (c->ok || curr) {
+			*done_tail = c;
+			done_tail = &c->next;
+			continue;
+		}
+
+		*fdb_retry_tail = c;
+		fdb_retry_tail = &c->next;
+		fdb_nr_retry++;
+	}
+
+	if (fdb_retry) {
+		LOG_WARNING("%u changes could not be written, trying again in %u ms", fdb_nr_retry, FDB_RETRY_MS);
+		clock_gettime(CLOCK_REALTIME, &fdb_retry_at);
+		fdb_retry_at.tv_sec += FDB_RETRY_MS / 1000;
+		fdb_retry_at.tv_nsec += (FDB_RETRY_MS % 1000) * 1000000L;
+		if (fdb_retry_at.tv_nsec >= 1000000000L) {
+			fdb_retry_at.tv_sec++;
+			fdb_retry_at.tv_nsec -= 1000000000L;
+		}
+	}
+
+	return done;
+}
+
+/**
+ * persistence thread. takes everything pending once the batch window has
+ * passed and writes it out, so repeated saves of a record inside the
+ * window reach the disk once.
+ */
+static void *
+fdb_commit_thread(void *arg)
+{
+	struct fdb_commit *batch, *next;
+	unsigned long seq;
+
+	(void)arg;
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	for (;;) {
+		/* fdb_flush asks for a retry by counting one more commit. */
+		while (!fdb_pending && !fdb_quit_fl) {
+			if (fdb_retry) {
+				if (fdb_seq_done != fdb_seq_queued
+					|| pthread_cond_timedwait(&fdb_commit_work, &fdb_commit_mutex, &fdb_retry_at))
+					break; /* retry is due */
+			} else if (fdb_seq_done != fdb_seq_queued) {
+				/* the retry it asked for was already running. */
+				fdb_seq_done = fdb_seq_queued;
+				pthread_cond_broadcast(&fdb_commit_done);
+			} else {
+				pthread_cond_wait(&fdb_commit_work, &fdb_commit_mutex);
+			}
+		}
+
+		if (!fdb_pending && !fdb_retry)
+			break; /* quit with nothing left to write */
+
+		if (fdb_pending && fdb_sync != FDB_SYNC_EVERY && fdb_commit_window) {
+			struct timespec deadline;
+
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += fdb_commit_window / 1000;
+			deadline.tv_nsec += (fdb_commit_window % 1000) * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+
+			while (!fdb_flush_waiters && !fdb_quit_fl) {
+				if (pthread_cond_timedwait(&fdb_commit_wake, &fdb_commit_mutex, &deadline))
+					break; /* window closed */
+			}
+		}
+
+		/* failed commits go first, they are older. */
+		*fdb_retry_tail = fdb_pending;
+		batch = fdb_retry;
+		fdb_retry = fdb_pending = NULL;
+		fdb_retry_tail = &fdb_retry;
+		fdb_pending_tail = &fdb_pending;
+		fdb_inflight = batch;
+		seq = fdb_seq_queued;
+
+		pthread_mutex_unlock(&fdb_commit_mutex);
+		fdb_commit_batch(batch);
+		pthread_mutex_lock(&fdb_commit_mutex);
+
+		fdb_inflight = NULL;
+		batch = fdb_commit_requeue(batch);
+		fdb_seq_done = seq;
+		pthread_cond_broadcast(&fdb_commit_done);
+
+		pthread_mutex_unlock(&fdb_commit_mutex);
+		for (; batch; batch = next) {
+			next = batch->next;
+			fdb_commit_free(batch);
+		}
+		pthread_mutex_lock(&fdb_commit_mutex);
+
+		if (fdb_quit_fl && !fdb_pending && fdb_retry) {
+			/* the last try at shutdown failed. */
+			LOG_ERROR("giving up on %u changes that could not be written", fdb_nr_retry);
+			batch = fdb_retry;
+			fdb_retry = NULL;
+			fdb_retry_tail = &fdb_retry;
+			fdb_nr_retry = 0;
+			pthread_mutex_unlock(&fdb_commit_mutex);
+			for (; batch; batch = next) {
+				next = batch->next;
+				fdb_commit_free(batch);
+			}
+			pthread_mutex_lock(&fdb_commit_mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	return NULL;
+}
+
+/**
+ * hand a record to the persistence thread. if the same record is still
+ * waiting, its contents are replaced by the newer copy.
+ */
+static void
+fdb_commit_queue(struct fdb_commit *c)
+{
+	struct fdb_commit *curr;
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	fdb_seq_queued++;
+
+	/* a failed copy waiting for a retry is replaced too. */
+	for (curr = fdb_retry; curr && c->kind == FDB_COMMIT_RECORD; curr = curr->next) {
+		if (curr->kind == FDB_COMMIT_RECORD && !strcmp(curr->filename, c->filename)) {
+			char *buf = curr->buf;
+
+			curr->buf = c->buf;
+			curr->len = c->len;
+			c->buf = buf;
+			pthread_mutex_unlock(&fdb_commit_mutex);
+			fdb_commit_free(c);
+			return; /* coalesced */
+		}
+	}
+
+	for (curr = fdb_pending; curr && c->kind == FDB_COMMIT_RECORD; curr = curr->next) {
+		if (curr->kind == FDB_COMMIT_RECORD && !strcmp(curr->filename, c->filename)) {
+			char *buf = curr->buf;
+
+			curr->buf = c->buf;
+			curr->len = c->len;
+			c->buf = buf;
+			pthread_mutex_unlock(&fdb_commit_mutex);
+			fdb_commit_free(c);
+			return; /* coalesced */
+		}
+	}
+
+	c->next = NULL;
+	*fdb_pending_tail = c;
+	fdb_pending_tail = &c->next;
+	pthread_cond_signal(&fdb_commit_work);
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+}
+
+/**
+ * copy the newest unwritten version of filename.
+ * @return NUL terminated buffer, or NULL if nothing is waiting.
+ */
+char *
+fdb_commit_lookup(const char *filename, size_t *len_out)
+{
+	struct fdb_commit *curr, *found = NULL;
+	char *buf = NULL;
+
+	if (!fdb_thread_fl)
+		return NULL;
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	for (curr = fdb_pending; curr && !found; curr = curr->next) {
+		if (curr->kind == FDB_COMMIT_RECORD && !strcmp(curr->filename, filename))
+			found = curr;
+	}
+
+	for (curr = fdb_inflight; curr && !found; curr = curr->next) {
+		if (curr->kind == FDB_COMMIT_RECORD && !strcmp(curr->filename, filename))
+			found = curr;
+	}
+
+	for (curr = fdb_retry; curr && !found; curr = curr->next) {
+		if (curr->kind == FDB_COMMIT_RECORD && !strcmp(curr->filename, filename))
+			found = curr;
+	}
+
+	if (found) {
+		buf = malloc(found->len + 1);
+
+		if (buf) {
+			if (found->len)
+				memcpy(buf, found->buf, found->len);
+			buf[found->len] = 0;
+			*len_out = found->len;
+		} else {
+			LOG_PERROR("malloc()");
+		}
+	}
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	return buf;
+}
+
+/**
+ * wait until every record finished before this call is on disk. records
+ * that failed earlier are tried again right away.
+ * @return 1 if all were written, 0 if some are still waiting for a retry.
+ */
+int
+fdb_flush(void)
+{
+	unsigned long target;
+	int ret;
+
+	if (!fdb_thread_fl)
+		return 1; /* success - written as they were made */
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	if (fdb_nr_retry)
+		fdb_seq_queued++; /* wait for a retry too */
+	target = fdb_seq_queued;
+	fdb_flush_waiters++;
+	pthread_cond_signal(&fdb_commit_work);
+	pthread_cond_signal(&fdb_commit_wake);
+
+	while (fdb_seq_done < target)
+		pthread_cond_wait(&fdb_commit_done, &fdb_commit_mutex);
+
+	fdb_flush_waiters--;
+	ret = !fdb_nr_retry;
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	return ret;
+}
+
+/**
+ * run a commit on the persistence thread, or right away if it is not running.
+ */
+int
+fdb_commit_submit(struct fdb_commit *c)
+{
+	int ret;
+
+	if (fdb_thread_fl) {
+		fdb_commit_queue(c);
+		return 1; /* success */
+	}
+
+	c->next = NULL;
+	fdb_commit_batch(c);
+	ret = c->ok;
+	fdb_commit_free(c);
+
+	return ret;
+}
+
+/**
+ * start the persistence thread. without it records are written on the
+ * calling thread.
+ */
+void
+fdb_commit_start(void)
+{
+	fdb_write_metric = metrics_histogram("boris_fdb_write_seconds", NULL,
+		"Time to write a record to its temp file.");
+	fdb_batch_metric = metrics_histogram("boris_fdb_batch_seconds", NULL,
+		"Time to commit a batch of records and journal entries.");
+
+	fdb_quit_fl = 0;
+
+	if (pthread_create(&fdb_thread, NULL, fdb_commit_thread, NULL)) {
+		LOG_ERROR("could not start persistence thread, saving on the main thread");
+		fdb_thread_fl = 0;
+	} else {
+		fdb_thread_fl = 1;
+	}
+}
+
+/**
+ * write out everything that is pending and stop the persistence thread.
+ */
+void
+fdb_commit_stop(void)
+{
+	if (!fdb_thread_fl)
+		return;
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+	fdb_quit_fl = 1;
+	pthread_cond_signal(&fdb_commit_work);
+	pthread_cond_signal(&fdb_commit_wake);
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	pthread_join(fdb_thread, NULL);
+	fdb_thread_fl = 0;
+}
@@ -3,6 +3,10 @@
  *
  * fdb - database using text files as the backend.
  *
+ * Records are built, read and listed here. The persistence thread is in
+ * fdbcommit.c, the journal in fdbjournal.c, the manifest in fdbmanifest.c
+ * and the on-disk layout in fdblayout.c.
+ *
  * @author Jon Mayo <jon@rm-f.net>
  * @date 2022 Aug 17
  *
@@ -22,48 +26,42 @@
  */
 
 #include "fdb.h"
+#include "fdbfile.h"
 #include "boris.h"
 #define LOG_SUBSYSTEM "fdb"
 #include <log.h>
+#include <crc32c.h>
+#include "fdbcheck.h"
+#include <metrics.h>
 
 #include <assert.h>
 #include <ctype.h>
-#include <dirent.h>
 #include <errno.h>
-#include <limits.h>
+#include <fcntl.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
-#define MKDIR(d) mkdir(d, 0777)
-
-#define FDB_VALUE_MAX 4096
-
-/**
- * handle used for writing.
- * see fdb_write_begin, fdb_write_pair, fdb_write_format, fdb_write_end.
- */
-struct fdb_write_handle {
-	FILE *f;
-	char *filename_tmp;
-	char *domain, *id;
-	int error_fl; /**< flag indicates there was an error. */
-};
+/** width that names are padded to when writing. */
+#define FDB_NAME_WIDTH 12
 
 /**
  * handle used for reading a record.
  * see fdb_read_begin, fdb_read_next, fdb_read_end.
  */
 struct fdb_read_handle {
-	FILE *f;
 	char *filename;
 	int line_number;
 	int error_fl; /**< flag indicates there was an error. */
-	size_t alloc_len;
-	char *line; /**< buffer for current line. */
+	char *buf; /**< whole record, name and value are returned from here. */
+	char *pos; /**< start of the next line. */
+	char *end;
 };
 
 /**
@@ -71,132 +69,95 @@ struct fdb_read_handle {
  * see fdb_iterator_begin, fdb_iterator_next, fdb_iterator_next.
  */
 struct fdb_iterator {
-	DIR *d;
-	char *pathname;
-	char *curr_id;
-	char *domain;
+	const char **ids; /**< owned by the manifest. */
+	unsigned nr_ids, pos;
 };
 
-/**
- * return true if 2 characters are valid hexidecimal.
- */
-static int
-ishex(const char code[2])
-{
-	return isxdigit(code[0]) && isxdigit(code[0]);
-}
+static struct metric *fdb_read_metric;
 
 /**
- * verify with ishex() before calling.
+ * bitmap of characters written without an escape: printable, not a space,
+ * not '%' and not '"'.
  */
-static unsigned
-unhex(const char code[2])
-{
-	const char hextab[] = {
-		['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
-		['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
-		['a'] = 0xa, ['b'] = 0xc, ['c'] = 0xc, ['d'] = 0xd, ['e'] = 0xe, ['f'] = 0xf,
-		['A'] = 0xa, ['B'] = 0xb, ['C'] = 0xc, ['D'] = 0xd, ['E'] = 0xe, ['F'] = 0xf,
-	};
+static const uint32_t fdb_plain[8] = {
+	0x00000000, 0xffffffda, 0xffffffff, 0x7fffffff,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000,
+};
 
-	return hextab[(unsigned)code[0]] * 16 + hextab[(unsigned)code[1]];
-}
+#define FDB_PLAIN(c) ((fdb_plain[(unsigned char)(c) >> 5] >> ((unsigned char)(c) & 31)) & 1)
+
+const char fdb_hexdigits[] = "0123456789ABCDEF";
 
 /**
- * process %XX escapes in-place. removes trailing whitespace too.
+ * write str with %XX escapes to out, which needs room for 3 times its length.
+ * @return end of the output.
  */
-static void
-unescape(char *str)
+char *
+fdb_escape(char *out, const char *str)
 {
-	char *e;
+	for (; *str; str++) {
+		unsigned char c = *str;
 
-	/* remove trailing whitespace */
-	for (e = str + strlen(str); e > str && isspace(e[-1]); e--)
-		;
-
-	*e = 0;
-
-	/* replace %XX
-	 * line is the input pointer,
-	 * e is the output pointer.
-	 */
-	for (e = str; *str; str++) {
-		if (*str == '%') {
-			if (ishex(str + 1)) {
-				*e++ = unhex(str + 1);
-				str += 2;
-			} else {
-				*e++ = *str;
-			}
+		if (FDB_PLAIN(c)) {
+			*out++ = c;
 		} else {
-			*e++ = *str;
+			*out++ = '%';
+			*out++ = fdb_hexdigits[c >> 4];
+			*out++ = fdb_hexdigits[c & 15];
 		}
 	}
 
-	*e = 0;
-}
-
-/**
- * generate the directory used for a domain.
- */
-static char *
-fdb_basepath(const char *domain)
-{
-	char path[PATH_MAX];
-
-	snprintf(path, sizeof path, "data/%s", domain);
-
-	return strdup(path);
-}
-
-/**
- * creates a filename name.
- */
-static char *
-fdb_makepath(const char *domain, const char *id)
-{
-	char path[PATH_MAX];
-
-	snprintf(path, sizeof path, "data/%s/%s", domain, id);
-
-	return strdup(path);
+	return out;
 }
 
 /**
- * creates a temporary name.
+ * value of a hexidecimal digit, or -1.
  */
-static char *
-fdb_makepath_tmp(const char *domain, const char *id)
+static int
+hexdigit(int c)
 {
-	char path[PATH_MAX];
-
-	snprintf(path, sizeof path, "data/%s/%s.tmp", domain, id);
-
-	return strdup(path);
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
 }
 
 /**
- * checks to see if filename is a temp filename.
- * must work with or without a path part.
+ * process %XX escapes in-place, starting at the first '%'.
+ * str is len bytes long, the result is NUL terminated.
  */
-static int
-fdb_istempname(const char *filename)
+void
+fdb_unescape(char *str, size_t len)
 {
-	size_t len, extlen = strlen(".tmp");
+	char *in, *out, *end = str + len;
 
-	if (!filename)
-		return 0;
+	in = memchr(str, '%', len);
+	if (!in) {
+		*end = 0;
+		return; /* nothing to decode */
+	}
 
-	len = strlen(filename);
+	for (out = in; in < end; ) {
+		if (*in == '%' && in + 2 < end) {
+			int hi = hexdigit(in[1]), lo = hexdigit(in[2]);
 
-	if (len > extlen && !strcmp(filename + len - extlen, ".tmp"))
-		return 1; /* found extension. */
+			if (hi >= 0 && lo >= 0) {
+				*out++ = hi * 16 + lo;
+				in += 3;
+				continue;
+			}
+		}
+		*out++ = *in++;
+	}
 
-	return 0; /* not a temp filename. */
+	*out = 0;
 }
 
 /**
- * frees a write handle. assumes f has already been closed.
+ * frees a write handle.
  */
 static void
 fdb_write_handle_free(struct fdb_write_handle *h)
@@ -207,111 +168,209 @@ fdb_write_handle_free(struct fdb_write_handle *h)
 	h->domain = NULL;
 	free(h->id);
 	h->id = NULL;
+	free(h->buf);
+	h->buf = NULL;
+	free(h->scratch);
+	h->scratch = NULL;
 	free(h);
 }
 
 /**
- * frees a read handle. assumes f has already been closed.
+ * frees a read handle.
  */
 static void
 fdb_read_handle_free(struct fdb_read_handle *h)
 {
 	free(h->filename);
 	h->filename = NULL;
-	free(h->line);
-	h->line = NULL;
+	free(h->buf);
+	h->buf = NULL;
 	free(h);
 }
 
 /**
- * modifies line and points name and value to the correct positions.
- * dequotes the value portion.
+ * split the line from b to e and point name and value into it.
+ * modifies the line to terminate both and decode %XX escapes in the value.
  */
 static int
-fdb_parse_line(char *line, const char **name, const char **value)
+fdb_parse_line(char *b, char *e, const char **name, const char **value)
 {
-	char *e, *b;
+	char *eq, *t;
 
-	while (isspace(*line))
-		line++;
-
-	*name = line;
+	while (b < e && isspace(*b))
+		b++;
 
 	/* name part */
-	for (e = line; *e && *e != '='; e++)
-		;
+	eq = memchr(b, '=', e - b);
 
-	if (!*e)
+	if (!eq)
 		return 0; /* failure. */
 
 	/* remove trailing whitespace */
-	for (b = e; b > line && isspace(b[-1]); b--)
+	for (t = eq; t > b && isspace(t[-1]); t--)
 		;
 
-	*b = 0;
-
-	*(e++) = 0;
-	line = e;
+	*t = 0;
+	*name = b;
 
 	/* value part */
-	while (isspace(*line))
-		line++;
+	for (b = eq + 1; b < e && isspace(*b); b++)
+		;
+
+	for (; e > b && isspace(e[-1]); e--)
+		;
+
+	*value = b;
+
+	/* deal with %XX escapes, only when the value has any. */
+	fdb_unescape(b, e - b);
+
+	return 1; /* success. */
+}
+
+/**
+ * load a whole file into a NUL terminated buffer.
+ * mtime_out is optional.
+ */
+char *
+fdb_load(const char *filename, size_t *len_out, long long *mtime_out)
+{
+	struct stat st;
+	size_t len;
+	char *buf;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
 
-	*value = line;
+	if (fd == -1) {
+		LOG_PERROR(filename);
+		return NULL; /* failure. */
+	}
+
+	if (fstat(fd, &st)) {
+		LOG_PERROR(filename);
+		close(fd);
+		return NULL; /* failure. */
+	}
+
+	buf = malloc((size_t)st.st_size + 1);
+
+	if (!buf) {
+		LOG_PERROR("malloc()");
+		close(fd);
+		return NULL; /* failure. */
+	}
+
+	for (len = 0; len < (size_t)st.st_size; ) {
+		ssize_t res = read(fd, buf + len, (size_t)st.st_size - len);
+
+		if (res < 0 && errno == EINTR)
+			continue;
+
+		if (res < 0) {
+			LOG_PERROR(filename);
+			free(buf);
+			close(fd);
+			return NULL; /* failure. */
+		}
+
+		if (res == 0)
+			break; /* file was truncated while we read it */
+
+		len += res;
+	}
 
-	/* deal with %XX escapes and trailing newline. */
-	unescape(line);
+	close(fd);
+	buf[len] = 0;
+	*len_out = len;
+	if (mtime_out)
+		*mtime_out = st.st_mtime;
 
-	return 1; /* failure. */
+	return buf;
+}
+
+/**
+ * check the checksum line of a loaded record and leave it out of len.
+ * records saved before checksums were added have none and are accepted,
+ * a record with a format line and no checksum line was cut short.
+ */
+int
+fdb_verify(const char *filename, char *buf, size_t *len, uint32_t *crc_out)
+{
+	switch (fdb_check_record(buf, len, crc_out)) {
+	case FDB_CHECK_OK:
+		buf[*len] = 0;
+		return 1; /* success */
+	case FDB_CHECK_UNSEALED:
+		return 1; /* success - gets a checksum when next saved */
+	case FDB_CHECK_DAMAGED:
+		break;
+	}
+
+	LOG_ERROR("%s:checksum does not match, record is damaged", filename);
+
+	return 0; /* failure */
 }
 
 /*** External Functions ***/
 
 /**
- * initializes a domain.
- * (creates a directory to hold files)
+ * make room for n more bytes in the write buffer.
  */
 int
-fdb_domain_init(const char *domain)
+fdb_write_reserve(struct fdb_write_handle *h, size_t n)
 {
-	char *pathname;
-	pathname = fdb_basepath(domain);
+	size_t newmax;
+	char *newbuf;
 
-	if (MKDIR(pathname) == -1 && errno != EEXIST) {
-		LOG_PERROR(pathname);
-		free(pathname);
-		return 0;
+	if (h->len + n <= h->max)
+		return 1; /* success */
+
+	for (newmax = h->max ? h->max : 4096; newmax < h->len + n; newmax *= 2)
+		;
+
+	newbuf = realloc(h->buf, newmax);
+
+	if (!newbuf) {
+		LOG_PERROR("realloc()");
+		h->error_fl = 1;
+		return 0; /* failure */
 	}
 
-	free(pathname);
+	h->buf = newbuf;
+	h->max = newmax;
 
 	return 1; /* success */
 }
+
 /**
- * open the file and start writing to it.
+ * start a record. nothing is written to disk until fdb_write_end().
  */
 struct fdb_write_handle *fdb_write_begin(const char *domain, const char *id)
 {
 	struct fdb_write_handle *ret;
-	FILE *f;
-	char *filename_tmp;
 
-	filename_tmp = fdb_makepath_tmp(domain, id);
-	f = fopen(filename_tmp, "w");
+	ret = calloc(1, sizeof * ret);
 
-	if (!f) {
-		LOG_PERROR(filename_tmp);
-		free(filename_tmp);
+	if (!ret) {
+		LOG_PERROR("calloc()");
 		return 0; /* failure. */
 	}
 
-	ret = calloc(1, sizeof * ret);
-	ret->f = f;
-	ret->filename_tmp = filename_tmp;
+	ret->filename_tmp = fdb_makepath_tmp(domain, id);
 	ret->domain = strdup(domain);
 	ret->id = strdup(id);
 	ret->error_fl = 0;
 
+	if (!ret->filename_tmp || !ret->domain || !ret->id) {
+		LOG_PERROR("strdup()");
+		fdb_write_handle_free(ret);
+		return 0; /* failure. */
+	}
+
+	/* marks the record as sealed, see fdb_seal(). */
+	fdb_write_format(ret, FDB_FORMAT_NAME, "%d", FDB_FORMAT);
+
 	return ret;
 }
 
@@ -332,9 +391,8 @@ struct fdb_write_handle *fdb_write_begin_uint(const char *domain, unsigned id)
 int
 fdb_write_pair(struct fdb_write_handle *h, const char *name, const char *value_str)
 {
-	int res;
-	size_t escaped_len, i;
-	char *escaped_value;
+	size_t name_len, value_len;
+	char *out;
 
 	assert(h != NULL);
 	assert(name != NULL);
@@ -343,121 +401,242 @@ fdb_write_pair(struct fdb_write_handle *h, const char *name, const char *value_s
 	if (h->error_fl)
 		return 0; /* ignore any more writes while there is an error. */
 
-	/* calculate the length of the escaped string. */
-	for (i = 0, escaped_len = 0; value_str[i]; i++) {
-		if (isprint(value_str[i]) && !isspace(value_str[i]) && value_str[i] != '%' && value_str[i] != '"') {
-			escaped_len++;
-		} else {
-			escaped_len += 3;
-		}
-	}
-
-	/* TODO: if escape_len is the same as the original then don't do escapes. */
-
-	/* apply the escapes */
-	escaped_value = malloc(escaped_len + 1);
+	name_len = strlen(name);
+	value_len = strlen(value_str);
 
-	if (!escaped_value) {
-		LOG_PERROR("malloc()");
-		return 0;
-	}
+	/* worst case is every character of the value escaped. */
+	if (!fdb_write_reserve(h, (name_len > FDB_NAME_WIDTH ? name_len : FDB_NAME_WIDTH) + 3 + value_len * 3))
+		return 0; /* failure */
 
-	for (i = 0; *value_str; value_str++) {
-		if (isprint(*value_str) && !isspace(*value_str) && *value_str != '%' && *value_str != '"') {
-			escaped_value[i++] = *value_str;
-		} else {
-			/* insert an escape. */
-			escaped_value[i] = '%';
-			sprintf(escaped_value + i + 1, "%02hhX", (unsigned char)*value_str);
-			i += 3;
-		}
-	}
+	out = h->buf + h->len;
+	memcpy(out, name, name_len);
+	out += name_len;
 
-	assert(escaped_value != NULL);
-	escaped_value[i] = 0;
+	while (name_len++ < FDB_NAME_WIDTH)
+		*out++ = ' ';
 
-	res = fprintf(h->f, "%-12s= %s\n", name, escaped_value);
-	free(escaped_value);
+	*out++ = '=';
+	*out++ = ' ';
 
-	if (res < 0)
-		h->error_fl = 1; /* error occured. */
+	out = fdb_escape(out, value_str);
+	*out++ = '\n';
+	h->len = out - h->buf;
 
-	return res >= 0;
+	return 1; /* success */
 }
 
 /**
- * write a string to an open record. this interface is limited to FDB_VALUE_MAX.
+ * write a formatted string to an open record.
  * you can only use a name once per transaction (begin/end)
- * @todo make this interface not limit the value.
  */
 int
 fdb_write_format(struct fdb_write_handle *h, const char *name, const char *value_fmt, ...)
 {
-	char buf[FDB_VALUE_MAX]; /**< holds the largest possible value. */
 	va_list ap;
+	int n;
 
 	if (h->error_fl)
 		return 0; /* ignore any more writes while there is an error. */
 
 	va_start(ap, value_fmt);
-	vsnprintf(buf, sizeof buf, value_fmt, ap);
+	n = vsnprintf(h->scratch, h->scratch_max, value_fmt, ap);
 	va_end(ap);
 
-	return fdb_write_pair(h, name, buf);
+	if (n < 0) {
+		h->error_fl = 1;
+		return 0; /* failure */
+	}
+
+	if ((size_t)n >= h->scratch_max) {
+		size_t newmax = (size_t)n + 1 > 256 ? (size_t)n + 1 : 256;
+		char *newscratch = realloc(h->scratch, newmax);
+
+		if (!newscratch) {
+			LOG_PERROR("realloc()");
+			h->error_fl = 1;
+			return 0; /* failure */
+		}
+
+		h->scratch = newscratch;
+		h->scratch_max = newmax;
+
+		va_start(ap, value_fmt);
+		vsnprintf(h->scratch, h->scratch_max, value_fmt, ap);
+		va_end(ap);
+	}
+
+	return fdb_write_pair(h, name, h->scratch);
+}
+
+/**
+ * end a record with its checksum line.
+ * @return the checksum.
+ */
+static uint32_t
+fdb_seal(struct fdb_write_handle *h)
+{
+	uint32_t crc = crc32c(0, h->buf, h->len);
+
+	fdb_write_format(h, FDB_CRC_NAME, "%08X", (unsigned)crc);
+
+	return crc;
+}
+
+/**
+ * rebuild a record from base with the changes in cur and old applied,
+ * where cur is newer. base is modified. the result ends with a checksum
+ * line if crc_out is given.
+ * @return 1 and a new NUL terminated buffer in buf_out, or 0 on failure.
+ */
+int
+fdb_merge(char *base, size_t len, struct fdb_delta *cur, struct fdb_delta *old, char **buf_out, size_t *len_out, uint32_t *crc_out)
+{
+	struct fdb_write_handle out;
+	struct fdb_delta *d;
+	const char *name, *value;
+	char *b, *nl, *end = base + len;
+
+	memset(&out, 0, sizeof(out));
+	fdb_write_format(&out, FDB_FORMAT_NAME, "%d", FDB_FORMAT);
+
+	for (b = base; b < end; b = nl + 1) {
+		nl = memchr(b, '\n', end - b);
+
+		if (!nl)
+			nl = end;
+
+		if (!fdb_parse_line(b, nl, &name, &value) || !strcmp(name, FDB_FORMAT_NAME))
+			continue;
+
+		if (!fdb_delta_find(cur, name) && !fdb_delta_find(old, name))
+			fdb_write_pair(&out, name, value);
+	}
+
+	for (d = old; d; d = d->next) {
+		if (!fdb_delta_find(cur, d->name))
+			fdb_write_pair(&out, d->name, d->value);
+	}
+
+	for (d = cur; d; d = d->next)
+		fdb_write_pair(&out, d->name, d->value);
+
+	if (crc_out)
+		*crc_out = fdb_seal(&out);
+
+	if (out.error_fl || !fdb_write_reserve(&out, 1)) {
+		free(out.buf);
+		return 0; /* failure */
+	}
+
+	out.buf[out.len] = 0;
+	*buf_out = out.buf;
+	*len_out = out.len;
+
+	return 1; /* success */
+}
+
+/**
+ * initializes a domain.
+ * (creates a directory to hold files, loads the manifest and folds in
+ * any journal)
+ */
+int
+fdb_domain_init(const char *domain)
+{
+	char *pathname;
+	pathname = fdb_basepath(domain);
+
+	if (MKDIR(pathname) == -1 && errno != EEXIST) {
+		LOG_PERROR(pathname);
+		free(pathname);
+		return 0;
+	}
+
+	free(pathname);
+
+	if (fdb_layout == FDB_LAYOUT_HASHED && !fdb_mkshards(domain))
+		return 0;
+
+	if (!fdb_manifest_get(domain)) {
+		LOG_ERROR("could not list the records of %s", domain);
+		return 0;
+	}
+
+	if (!fdb_journal_boot(domain)) {
+		LOG_ERROR("could not replay the journal for %s", domain);
+		return 0;
+	}
+
+	return 1; /* success */
 }
 
 /**
- * move the temp file over the real file then close it.
+ * finish the record. the persistence thread writes it out later, or it is
+ * written right away if that thread is not running.
  */
 int
 fdb_write_end(struct fdb_write_handle *h)
 {
-	char *filename;
+	struct fdb_commit *c;
+	uint32_t crc;
 
 	assert(h != NULL);
-	assert(h->f != NULL);
 	assert(h->filename_tmp != NULL);
 	assert(h->domain != NULL);
 	assert(h->id != NULL);
 
-	/* close the temp file. */
-	if (h->f) {
-		if (fclose(h->f)) {
-			perror(h->filename_tmp);
-			h->error_fl = 1;
-		}
+	crc = fdb_seal(h);
 
-		h->f = NULL;
+	if (h->error_fl) {
+		/* clean up */
+		fdb_write_handle_free(h);
+		return 0; /* failure */
 	}
 
-	if (h->error_fl) {
-		/* remove the temp file. */
-		if (!remove(h->filename_tmp)) {
-			perror(h->filename_tmp);
-		}
+	c = calloc(1, sizeof(*c));
 
-		/* clean up */
+	if (!c) {
+		LOG_PERROR("calloc()");
 		fdb_write_handle_free(h);
 		return 0; /* failure */
-	} else {
-		/* cleanly close */
+	}
 
-		/* move temp file over the real file. */
-		filename = fdb_makepath(h->domain, h->id);
+	/* list the record now, so iterators see it before it is written. */
+	if (fdb_manifest_get(h->domain))
+		fdb_manifest_update(h->domain, h->id, h->len, time(NULL), crc, 1);
 
-		if (rename(h->filename_tmp, filename)) {
-			perror(h->filename_tmp);
-			free(filename);
-			fdb_write_handle_free(h);
-			return 0; /* failure */
-		}
+	/* the commit takes over the buffer and the temp name. */
+	c->kind = FDB_COMMIT_RECORD;
+	c->filename = fdb_makepath(h->domain, h->id);
+	c->filename_tmp = h->filename_tmp;
+	c->filename_old = fdb_record_altpath(h->domain, h->id);
+	c->buf = h->buf;
+	c->len = h->len;
 
-		free(filename);
+	/* a record written in the new layout leaves the domain mixed. */
+	if (c->filename_old)
+		fdb_manifest_set_layout(fdb_manifest_find(h->domain), FDB_LAYOUT_MIXED);
 
-		/* clean up */
+	h->filename_tmp = NULL;
+	h->buf = NULL;
+
+	if (!c->filename) {
+		LOG_PERROR("strdup()");
+		fdb_commit_free(c);
 		fdb_write_handle_free(h);
-		return 1; /* success */
+		return 0; /* failure */
+	}
+
+	if (!fdb_commit_submit(c)) {
+		fdb_write_handle_free(h);
+		return 0; /* failure */
 	}
+
+	/* queued after the record, so the marker is never on disk first. */
+	fdb_journal_saved(h->domain, h->id);
+	fdb_write_handle_free(h);
+
+	return 1; /* success */
 }
 
 /**
@@ -471,34 +650,86 @@ fdb_write_abort(struct fdb_write_handle *h)
 }
 
 /**
- * start reading.
+ * load a record with its journal changes applied.
  */
-struct fdb_read_handle *fdb_read_begin(const char *domain, const char *id)
+static struct fdb_read_handle *
+fdb_read_load(const char *domain, const char *id)
 {
 	struct fdb_read_handle *ret;
-	FILE *f;
-	char *filename;
+	char *filename, *buf;
+	long long mtime = 0;
+	size_t len, size;
+	uint32_t crc;
 
 	filename = fdb_makepath(domain, id);
-	f = fopen(filename, "r");
 
-	if (!f) {
-		LOG_PERROR(filename);
+	/* a record waiting to be written is newer than the file. */
+	buf = fdb_commit_lookup(filename, &len);
+
+	if (!buf) {
+		/* while migrating, a record may still be in the old layout. */
+		char *alt = fdb_record_altpath(domain, id);
+
+		buf = fdb_load(alt && access(filename, F_OK) ? alt : filename, &len, &mtime);
+		free(alt);
+
+		if (!buf) {
+			free(filename);
+			return 0; /* failure. */
+		}
+	}
+
+	size = len;
+
+	if (!fdb_verify(filename, buf, &len, &crc)) {
+		free(buf);
+		free(filename);
+		return 0; /* failure. */
+	}
+
+	/* pending records have no mtime, the manifest learns it when written. */
+	if (mtime)
+		fdb_manifest_update(domain, id, size, mtime, crc, 0);
+
+	/* apply attribute changes that are only in the journal. */
+	if (!fdb_journal_overlay(domain, id, &buf, &len)) {
+		free(buf);
 		free(filename);
 		return 0; /* failure. */
 	}
 
 	ret = calloc(1, sizeof * ret);
-	ret->f = f;
+
+	if (!ret) {
+		LOG_PERROR("calloc()");
+		free(buf);
+		free(filename);
+		return 0; /* failure. */
+	}
+
 	ret->filename = filename;
 	ret->line_number = 0;
 	ret->error_fl = 0;
-	ret->alloc_len = 4;
-	ret->line = malloc(ret->alloc_len);
+	ret->buf = buf;
+	ret->pos = buf;
+	ret->end = buf + len;
 
 	return ret;
 }
 
+/**
+ * start reading. the whole record is loaded at once.
+ */
+struct fdb_read_handle *fdb_read_begin(const char *domain, const char *id)
+{
+	uint64_t start = metrics_usec();
+	struct fdb_read_handle *h = fdb_read_load(domain, id);
+
+	metrics_observe(fdb_read_metric, metrics_usec() - start);
+
+	return h;
+}
+
 struct fdb_read_handle *fdb_read_begin_uint(const char *domain, unsigned id)
 {
 	char numbuf[22]; /* big enough for a signed 64-bit decimal */
@@ -509,63 +740,43 @@ struct fdb_read_handle *fdb_read_begin_uint(const char *domain, unsigned id)
 }
 
 /**
- * read a line of data from the file.
+ * parse the next line of the record.
+ * name and value point into the handle and are valid until the next call.
  */
 int
 fdb_read_next(struct fdb_read_handle *h, const char **name, const char **value)
 {
-	size_t ofs, newofs;
+	char *b, *nl;
+	int ret;
 
 	assert(h != NULL);
-	assert(h->f != NULL);
-	assert(h->alloc_len > 0);
+	assert(h->buf != NULL);
 
-	h->line_number++;
-	ofs = 0;
+	do {
+		if (h->pos >= h->end)
+			return 0; /* end of record. */
 
-	while (!feof(h->f)) {
-		if (!fgets(h->line + ofs, h->alloc_len - ofs, h->f)) {
-			if (ofs) {
-				LOG_INFO("%s:%d:missing newline before EOF.", h->filename, h->line_number);
-				h->error_fl = 1;
-			}
+		h->line_number++;
+		b = h->pos;
+		nl = memchr(b, '\n', h->end - b);
 
+		if (!nl) {
+			LOG_INFO("%s:%d:missing newline before EOF.", h->filename, h->line_number);
+			h->error_fl = 1;
+			h->pos = h->end;
 			return 0;
 		}
 
-		newofs = ofs + strlen(h->line + ofs);
-
-		if (strchr(h->line + ofs, '\n')) {
-			/* complete line has been read. */
-			return fdb_parse_line(h->line, name, value);
-		}
-
-		ofs = newofs;
-
-		/* if buffer is more than half used, double it. */
-		if (newofs * 2 >= h->alloc_len) {
-			char *newline;
-			size_t newlen;
-			/* round up in 4K chunks. */
-			newlen = ((newofs * 2) + 4096 - 1) * 4096 / 4096;
-			newline = realloc(h->line, newlen);
-
-			if (!newline) {
-				LOG_PERROR(h->filename);
-				h->error_fl = 1;
-				return 0;
-			}
-
-			h->line = newline;
-			h->alloc_len = newlen;
-		}
-	}
+		h->pos = nl + 1;
+		ret = fdb_parse_line(b, nl, name, value);
+		/* the format line is for fdb, not the caller. */
+	} while (ret && !strcmp(*name, FDB_FORMAT_NAME));
 
-	return 0;
+	return ret;
 }
 
 /**
- * end reading process, close the file and free the handle.
+ * end reading process and free the handle.
  */
 int
 fdb_read_end(struct fdb_read_handle *h)
@@ -573,15 +784,9 @@ fdb_read_end(struct fdb_read_handle *h)
 	int ret;
 
 	assert(h != NULL);
-	assert(h->f != NULL);
 
 	ret = !h->error_fl;
 
-	if (h->f) {
-		fclose(h->f);
-		h->f = NULL;
-	}
-
 	fdb_read_handle_free(h);
 
 	return ret;
@@ -592,34 +797,38 @@ fdb_read_end(struct fdb_read_handle *h)
  */
 struct fdb_iterator *fdb_iterator_begin(const char *domain)
 {
-	char *pathname;
-	DIR *d;
+	struct fdb_manifest *m;
 	struct fdb_iterator *it;
+	unsigned i;
 
 	assert(domain != NULL);
 
-	pathname = fdb_basepath(domain);
-
-	d = opendir(pathname);
+	m = fdb_manifest_get(domain);
 
-	if (!d) {
-		LOG_PERROR(pathname);
-		free(pathname);
+	if (!m)
 		return 0; /* failure */
-	}
 
 	it = calloc(1, sizeof * it);
 
-	if (!it) {
+	if (it)
+		it->ids = malloc((m->count + 1) * sizeof(*it->ids));
+
+	if (!it || !it->ids) {
 		LOG_PERROR("calloc()");
-		free(pathname);
+		free(it);
 		return 0;
 	}
 
-	it->d = d;
-	it->pathname = pathname;
-	it->curr_id = NULL;
-	it->domain = strdup(domain);
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	for (i = 0; i < FDB_MANIFEST_BUCKETS; i++) {
+		struct fdb_manifest_entry *e;
+
+		for (e = m->bucket[i]; e; e = e->next)
+			it->ids[it->nr_ids++] = e->id;
+	}
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
 
 	return it;
 }
@@ -631,51 +840,12 @@ struct fdb_iterator *fdb_iterator_begin(const char *domain)
 const char *
 fdb_iterator_next(struct fdb_iterator *it)
 {
-	struct dirent *de;
-	struct stat st;
-	char *filename;
-
 	assert(it != NULL);
-	assert(it->d != NULL);
-
-	/* read files and filter out junk filenames. */
-next:
-	de = readdir(it->d);
 
-	if (!de)
+	if (it->pos >= it->nr_ids)
 		return NULL;
 
-	if (de->d_name[0] == '.')
-		goto next; /* ignore hidden files */
-
-	if (fdb_istempname(de->d_name)) {
-		goto next; /* ignore temp files. */
-	}
-
-	if (de->d_name[0] && de->d_name[strlen(de->d_name) - 1] == '~') {
-		LOG_INFO("skip things that don't look like data files:%s", de->d_name);
-		goto next; /* ignore temp files. */
-	}
-
-	/* stat the file - ignore directories and non-regular files. */
-	filename = fdb_makepath(it->domain, de->d_name);
-
-	if (stat(filename, &st)) {
-		LOG_PERROR(filename);
-		free(filename);
-		goto next;
-	}
-
-	free(filename);
-
-	if (!S_ISREG(st.st_mode)) {
-		LOG_INFO("Ignoring directories and other non-regular files:%s", de->d_name);
-		goto next;
-	}
-
-	free(it->curr_id);
-
-	return it->curr_id = strdup(de->d_name);
+	return it->ids[it->pos++];
 }
 
 /**
@@ -685,32 +855,64 @@ void
 fdb_iterator_end(struct fdb_iterator *it)
 {
 	assert(it != NULL);
-	closedir(it->d);
-	free(it->pathname);
-	it->pathname = NULL;
-	free(it->curr_id);
-	it->curr_id = NULL;
-	free(it->domain);
-	it->domain = NULL;
+	free(it->ids);
+	it->ids = NULL;
 	free(it);
 }
 
 int
 fdb_initialize(void)
 {
+#ifndef STAND_ALONE_TEST
+	if (!strcasecmp(mud_config.fdb_sync, "none")) {
+		fdb_sync = FDB_SYNC_NONE;
+	} else if (!strcasecmp(mud_config.fdb_sync, "batch")) {
+		fdb_sync = FDB_SYNC_BATCH;
+	} else if (!strcasecmp(mud_config.fdb_sync, "every")) {
+		fdb_sync = FDB_SYNC_EVERY;
+	} else {
+		LOG_ERROR("fdb.sync must be none, batch or every (not \"%s\")", mud_config.fdb_sync);
+		return -1;
+	}
+
+	if (!strcasecmp(mud_config.fdb_layout, "flat")) {
+		fdb_layout = FDB_LAYOUT_FLAT;
+	} else if (!strcasecmp(mud_config.fdb_layout, "hashed")) {
+		fdb_layout = FDB_LAYOUT_HASHED;
+	} else {
+		LOG_ERROR("fdb.layout must be flat or hashed (not \"%s\")", mud_config.fdb_layout);
+		return -1;
+	}
+
+	fdb_commit_window = mud_config.fdb_commit_window;
+	fdb_journal_max = mud_config.fdb_journal_max;
+#endif
+	fdb_read_metric = metrics_histogram("boris_fdb_read_seconds", NULL,
+		"Time to load a record, including journal changes.");
+
+	fdb_commit_start();
+
 	fprintf(stderr, "loaded %s\n", "fdb");
 	LOG_INFO("FDB-file system loaded (" __FILE__ " compiled " __TIME__ " " __DATE__ ")");
 
 	return 0;
 }
 
+/**
+ * write out everything that is pending and stop the persistence thread.
+ */
 void
 fdb_shutdown(void)
 {
+	fdb_commit_stop();
+
+	fdb_journal_free_all();
+	fdb_manifest_free_all();
 }
 
 /* compile with STAND_ALONE_TEST for unit test. */
 #ifdef STAND_ALONE_TEST
+
 static int
 fdb_test1(void)
 {
@@ -767,6 +969,11 @@ fdb_test3(void)
 
 	while (fdb_read_next(h, &name, &id)) {
 		LOG_INFO("Read \"%s\"=\"%s\"", name, id);
+		if (!strcmp(name, "description") && strcmp(id, "  Hello World\nThis is great stuff.")) {
+			LOG_INFO("Escaped value did not survive.");
+			fdb_read_end(h);
+			return 0;
+		}
 	}
 
 	res = fdb_read_end(h);
@@ -778,6 +985,323 @@ fdb_test3(void)
 	return res;
 }
 
+static int
+fdb_test4(void)
+{
+	struct fdb_read_handle *h;
+	const char *name, *value;
+	int found = 0;
+
+	fdb_domain_init("room");
+
+	if (!fdb_journal_append("room", "123", "owner", "apple")
+		|| !fdb_journal_append("room", "123", "color", "dark red")
+		|| !fdb_journal_append("room", "123", "OWNER", "pear"))
+		return 0;
+
+	h = fdb_read_begin("room", "123");
+
+	if (!h) return 0;
+
+	while (fdb_read_next(h, &name, &value)) {
+		LOG_INFO("Read \"%s\"=\"%s\"", name, value);
+		if (!strcasecmp(name, "owner") && !strcmp(value, "pear"))
+			found |= 1;
+		else if (!strcmp(name, "color") && !strcmp(value, "dark red"))
+			found |= 2;
+		else if (!strcasecmp(name, "owner") || !strcmp(name, "color"))
+			found |= 4;
+	}
+
+	if (!fdb_read_end(h) || found != 3) {
+		LOG_INFO("Journaled values were not applied.");
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+fdb_test5(void)
+{
+	struct fdb_write_handle *w;
+	struct fdb_read_handle *h;
+	char *filename, *buf, *p;
+	size_t len;
+	FILE *f;
+
+	fdb_domain_init("room");
+
+	w = fdb_write_begin("room", "124");
+
+	if (!w)
+		return 0;
+
+	fdb_write_pair(w, "owner", "orange");
+	fdb_write_end(w);
+	fdb_flush();
+
+	/* change one byte of the value behind the checksum's back. */
+	filename = fdb_makepath("room", "124");
+	buf = filename ? fdb_load(filename, &len, NULL) : NULL;
+	p = buf ? strstr(buf, "orange") : NULL;
+
+	if (!p || !(f = fopen(filename, "w"))) {
+		free(buf);
+		free(filename);
+		return 0;
+	}
+
+	*p = 'O';
+	fwrite(buf, 1, len, f);
+	fclose(f);
+	free(buf);
+	free(filename);
+
+	h = fdb_read_begin("room", "124");
+
+	if (h) {
+		LOG_INFO("Damaged record was not detected.");
+		fdb_read_end(h);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+fdb_test6(void)
+{
+	struct fdb_write_handle *w;
+	struct fdb_read_handle *h;
+	struct fdb_overlay **set;
+	const char *name, *value;
+	char *filename;
+	int found = 0, replayed;
+
+	fdb_domain_init("room");
+
+	/* a change journaled before a whole save must not come back. */
+	if (!fdb_journal_append("room", "125", "owner", "pear"))
+		return 0;
+
+	w = fdb_write_begin("room", "125");
+
+	if (!w)
+		return 0;
+
+	fdb_write_pair(w, "owner", "apple");
+
+	if (!fdb_write_end(w))
+		return 0;
+
+	fdb_flush();
+
+	h = fdb_read_begin("room", "125");
+
+	if (!h) return 0;
+
+	while (fdb_read_next(h, &name, &value)) {
+		if (!strcmp(name, "owner"))
+			found = !strcmp(value, "apple") ? 1 : 2;
+	}
+
+	if (!fdb_read_end(h) || found != 1) {
+		LOG_INFO("Journaled value overrode the saved record.");
+		return 0;
+	}
+
+	/* and the journal replayed at the next start agrees. */
+	set = fdb_overlay_new();
+	filename = fdb_makepath("room", FDB_JOURNAL);
+	replayed = set && filename && fdb_journal_replay(filename, set)
+		&& !fdb_overlay_find(set, "125");
+
+	if (set) {
+		fdb_overlay_clear(set);
+		free(set);
+	}
+	free(filename);
+
+	if (!replayed) {
+		LOG_INFO("Journal replay did not drop changes to a saved record.");
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+fdb_test7(void)
+{
+	struct fdb_write_handle *w;
+	struct fdb_read_handle *h;
+	const char *name, *value;
+	char *filename, *buf, *p;
+	size_t len;
+	FILE *f;
+
+	fdb_domain_init("room");
+
+	w = fdb_write_begin("room", "126");
+
+	if (!w)
+		return 0;
+
+	fdb_write_pair(w, "owner", "plum");
+	fdb_write_end(w);
+	fdb_flush();
+
+	/* the format line is not handed to readers. */
+	h = fdb_read_begin("room", "126");
+
+	if (!h) return 0;
+
+	while (fdb_read_next(h, &name, &value)) {
+		if (name[0] == '.') {
+			LOG_INFO("Read internal line \"%s\".", name);
+			fdb_read_end(h);
+			return 0;
+		}
+	}
+
+	fdb_read_end(h);
+
+	/* cut the record off before its checksum line. */
+	filename = fdb_makepath("room", "126");
+	buf = filename ? fdb_load(filename, &len, NULL) : NULL;
+	p = buf ? strstr(buf, FDB_CRC_NAME) : NULL;
+
+	if (!p || !(f = fopen(filename, "w"))) {
+		free(buf);
+		free(filename);
+		return 0;
+	}
+
+	fwrite(buf, 1, p - buf, f);
+	fclose(f);
+	free(buf);
+	free(filename);
+
+	h = fdb_read_begin("room", "126");
+
+	if (h) {
+		LOG_INFO("Truncated record was not detected.");
+		fdb_read_end(h);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+fdb_test8(void)
+{
+	struct fdb_write_handle *w;
+	struct fdb_read_handle *h;
+	const char *name, *value;
+	char *filename;
+	int found = 0;
+
+	fdb_domain_init("room");
+
+	/* a directory in the way makes the rename fail. */
+	filename = fdb_makepath("room", "127");
+
+	if (!filename || mkdir(filename, 0777)) {
+		free(filename);
+		return 0;
+	}
+
+	w = fdb_write_begin("room", "127");
+
+	if (!w || !fdb_write_pair(w, "owner", "plum") || !fdb_write_end(w))
+		goto failure;
+
+	if (fdb_flush()) {
+		LOG_INFO("Failed record was reported as written.");
+		goto failure;
+	}
+
+	/* the record waiting for a retry is still what readers see. */
+	h = fdb_read_begin("room", "127");
+
+	if (!h)
+		goto failure;
+
+	while (fdb_read_next(h, &name, &value)) {
+		if (!strcmp(name, "owner") && !strcmp(value, "plum"))
+			found = 1;
+	}
+
+	if (!fdb_read_end(h) || !found)
+		goto failure;
+
+	rmdir(filename);
+
+	if (!fdb_flush() || access(filename, F_OK)) {
+		LOG_INFO("Failed record was not written again.");
+		goto failure;
+	}
+
+	free(filename);
+
+	return 1;
+failure:
+	rmdir(filename);
+	free(filename);
+	return 0;
+}
+
+static int
+fdb_test9(void)
+{
+	char *filename, *buf = NULL, *fig, *kiwi;
+	size_t len;
+	int ret = 0;
+
+	if (!fdb_domain_init("zone"))
+		return 0;
+
+	/* a directory in the way makes the journal fail to open. */
+	filename = fdb_makepath("zone", FDB_JOURNAL);
+
+	if (!filename || mkdir(filename, 0777)) {
+		free(filename);
+		return 0;
+	}
+
+	if (!fdb_journal_append("zone", "1", "owner", "fig")
+		|| !fdb_journal_append("zone", "1", "owner", "kiwi"))
+		goto failure;
+
+	if (fdb_flush()) {
+		LOG_INFO("Failed journal entry was reported as written.");
+		goto failure;
+	}
+
+	rmdir(filename);
+
+	if (!fdb_flush()) {
+		LOG_INFO("Failed journal entry was not written again.");
+		goto failure;
+	}
+
+	/* both entries are there, in the order they were made. */
+	buf = fdb_load(filename, &len, NULL);
+	fig = buf ? strstr(buf, "fig") : NULL;
+	kiwi = buf ? strstr(buf, "kiwi") : NULL;
+	ret = fig && kiwi && fig < kiwi;
+
+	if (!ret)
+		LOG_INFO("Journal entries were lost or reordered.");
+failure:
+	rmdir(filename);
+	free(buf);
+	free(filename);
+	return ret;
+}
+
 /**
  * domain/id/name=value
  */
@@ -801,6 +1325,36 @@ main()
 	if (!fdb_test3())
 		goto failure;
 
+	LOG_INFO("*** TEST 4 ***");
+
+	if (!fdb_test4())
+		goto failure;
+
+	LOG_INFO("*** TEST 5 ***");
+
+	if (!fdb_test5())
+		goto failure;
+
+	LOG_INFO("*** TEST 6 ***");
+
+	if (!fdb_test6())
+		goto failure;
+
+	LOG_INFO("*** TEST 7 ***");
+
+	if (!fdb_test7())
+		goto failure;
+
+	LOG_INFO("*** TEST 8 ***");
+
+	if (!fdb_test8())
+		goto failure;
+
+	LOG_INFO("*** TEST 9 ***");
+
+	if (!fdb_test9())
+		goto failure;
+
 	fdb_shutdown();
 	return 0;
 failure:
@@ -809,5 +1363,6 @@ failure:
 	fdb_shutdown();
 	return 1;
 }
+
 #else
 #endif
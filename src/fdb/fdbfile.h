@@ -0,0 +1,191 @@
+#ifndef BORIS_FDBFILE_H_
+#define BORIS_FDBFILE_H_
+/* internals shared by the modules of the file backend, not for callers of fdb.h */
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define MKDIR(d) mkdir(d, 0777)
+
+/**
+ * handle used for writing.
+ * see fdb_write_begin, fdb_write_pair, fdb_write_format, fdb_write_end.
+ * the record is built in buf and written out all at once by fdb_write_end.
+ */
+struct fdb_write_handle {
+	char *filename_tmp;
+	char *domain, *id;
+	int error_fl; /**< flag indicates there was an error. */
+	char *buf; /**< the record so far. */
+	size_t len, max;
+	char *scratch; /**< fdb_write_format() output, reused between calls. */
+	size_t scratch_max;
+};
+
+/**
+ * work waiting for the persistence thread: a finished record, a journal
+ * append or a compaction. see fdb_write_end, fdb_commit_thread.
+ */
+struct fdb_commit {
+	struct fdb_commit *next;
+	enum {
+		FDB_COMMIT_RECORD, /**< replace filename with buf. */
+		FDB_COMMIT_APPEND, /**< append buf to the journal. */
+		FDB_COMMIT_COMPACT, /**< fold the journal into its records. */
+	} kind;
+	struct fdb_journal *journal;
+	char *filename, *filename_tmp;
+	char *filename_old; /**< copy in the old layout, removed after the rename. */
+	char *buf;
+	size_t len;
+	int ok; /**< record or journal entry was written. */
+};
+
+/** one changed attribute. */
+struct fdb_delta {
+	struct fdb_delta *next;
+	char *name, *value;
+};
+
+/** attributes changed on one record since the last compaction. */
+struct fdb_overlay {
+	struct fdb_overlay *next;
+	char *id;
+	struct fdb_delta *deltas;
+	int saved_fl; /**< the whole record was saved since, protected by fdb_commit_mutex. */
+};
+
+#define FDB_OVERLAY_BUCKETS 256
+#define FDB_JOURNAL ".journal"
+#define FDB_JOURNAL_OLD ".journal.old" /**< moved aside while it is folded. */
+#define FDB_JOURNAL_SAVED ".saved" /**< journal name that drops earlier changes to a record. */
+
+/**
+ * append-only journal of attribute changes for a domain.
+ * lines are "crc32c id name value", the fields escaped like record values.
+ * the main thread owns overlay and size, the persistence thread owns fd.
+ */
+struct fdb_journal {
+	struct fdb_journal *next;
+	char *domain;
+	char *filename, *filename_old;
+	int fd;
+	int dirty_fl; /**< appended since the last fsync. */
+	size_t size; /**< bytes appended since the last compaction. */
+	struct fdb_overlay **overlay; /**< changes not in the journal being folded. */
+	struct fdb_overlay **compacting; /**< changes being folded into records. */
+	int compacting_fl; /**< protected by fdb_commit_mutex. */
+	int rotated_fl; /**< moved aside, only the fold is left. */
+	int failed_fl; /**< an append failed, hold back the rest of the batch. */
+};
+
+/** where records are kept, set with fdb.layout. */
+enum fdb_layout {
+	FDB_LAYOUT_FLAT, /**< data/<domain>/<id> */
+	FDB_LAYOUT_HASHED, /**< data/<domain>/.<hh>/<id> */
+	FDB_LAYOUT_MIXED, /**< some of each, until fdb_migrate() is done. */
+};
+
+/**
+ * number of shard directories in the hashed layout. they are named with a
+ * leading '.', which no record id has, so a shard never collides with a
+ * record like room "10" while a domain is migrated.
+ */
+#define FDB_SHARDS 256
+
+/** summary of one record, see struct fdb_manifest. */
+struct fdb_manifest_entry {
+	struct fdb_manifest_entry *next;
+	char *id;
+	size_t size; /**< 0 until the record is read or written. */
+	long long mtime;
+	uint32_t crc; /**< crc32c of the contents. */
+};
+
+#define FDB_MANIFEST_BUCKETS 256
+
+/**
+ * index of the records in a domain, so listing a domain needs no
+ * directory scan. saved to .manifest at shutdown. the main thread adds
+ * entries, fdb_commit_mutex protects the list and the entries.
+ */
+struct fdb_manifest {
+	struct fdb_manifest *next;
+	char *domain;
+	struct fdb_manifest_entry *bucket[FDB_MANIFEST_BUCKETS];
+	unsigned count;
+	enum fdb_layout layout; /**< where the records are. */
+	int dirty_fl; /**< differs from the file. */
+};
+
+/** durability policy, set with fdb.sync. */
+enum fdb_sync {
+	FDB_SYNC_NONE, /**< leave it to the OS. */
+	FDB_SYNC_BATCH, /**< fsync files and directories once per batch. */
+	FDB_SYNC_EVERY, /**< commit each record on its own, without waiting. */
+};
+
+extern enum fdb_sync fdb_sync;
+extern unsigned fdb_commit_window;
+extern int fdb_thread_fl;
+extern pthread_mutex_t fdb_commit_mutex;
+extern size_t fdb_journal_max;
+extern struct fdb_manifest *fdb_manifests;
+extern const char *fdb_layout_names[];
+extern enum fdb_layout fdb_layout;
+extern const char fdb_hexdigits[];
+
+/* fdbfile.c */
+char *fdb_escape(char *out, const char *str);
+void fdb_unescape(char *str, size_t len);
+char *fdb_load(const char *filename, size_t *len_out, long long *mtime_out);
+int fdb_verify(const char *filename, char *buf, size_t *len, uint32_t *crc_out);
+int fdb_write_reserve(struct fdb_write_handle *h, size_t n);
+int fdb_merge(char *base, size_t len, struct fdb_delta *cur, struct fdb_delta *old,
+	char **buf_out, size_t *len_out, uint32_t *crc_out);
+
+/* fdbcommit.c */
+void fdb_commit_start(void);
+void fdb_commit_stop(void);
+int fdb_write_all(int fd, const char *buf, size_t len);
+int fdb_write_file(const struct fdb_commit *c, int sync_fl);
+int fdb_commit_rename(const struct fdb_commit *c);
+void fdb_sync_dir(const char *filename);
+void fdb_commit_free(struct fdb_commit *c);
+char *fdb_commit_lookup(const char *filename, size_t *len_out);
+int fdb_commit_submit(struct fdb_commit *c);
+
+/* fdbjournal.c */
+struct fdb_overlay **fdb_overlay_new(void);
+struct fdb_overlay *fdb_overlay_find(struct fdb_overlay **set, const char *id);
+struct fdb_delta *fdb_delta_find(struct fdb_delta *d, const char *name);
+void fdb_overlay_clear(struct fdb_overlay **set);
+void fdb_journal_free_all(void);
+int fdb_journal_write(struct fdb_commit *c);
+int fdb_journal_rotate(struct fdb_journal *j);
+int fdb_journal_compact(struct fdb_journal *j);
+int fdb_journal_replay(const char *filename, struct fdb_overlay **set);
+int fdb_journal_boot(const char *domain);
+int fdb_journal_overlay(const char *domain, const char *id, char **buf, size_t *len);
+void fdb_journal_saved(const char *domain, const char *id);
+
+/* fdbmanifest.c */
+struct fdb_manifest *fdb_manifest_find(const char *domain);
+struct fdb_manifest_entry *fdb_manifest_entry(struct fdb_manifest *m, const char *id, int create_fl);
+void fdb_manifest_update(const char *domain, const char *id, size_t size, long long mtime, uint32_t crc, int create_fl);
+struct fdb_manifest *fdb_manifest_get(const char *domain);
+void fdb_manifest_set_layout(struct fdb_manifest *m, enum fdb_layout layout);
+void fdb_manifest_free_all(void);
+
+/* fdblayout.c */
+char *fdb_basepath(const char *domain);
+char *fdb_makepath(const char *domain, const char *id);
+char *fdb_makepath_tmp(const char *domain, const char *id);
+char *fdb_shardpath(const char *domain, unsigned shard);
+int fdb_isshardname(const char *name);
+int fdb_istempname(const char *filename);
+int fdb_layout_parse(const char *name);
+char *fdb_record_altpath(const char *domain, const char *id);
+int fdb_mkshards(const char *domain);
+#endif
@@ -0,0 +1,767 @@
+/**
+ * @file fdbjournal.c
+ *
+ * Journal of attribute changes for the file backend.
+ *
+ * Small changes are appended to a per-domain journal instead of rewriting
+ * the record, and kept in an in-memory overlay that reads are merged with.
+ * Once the journal grows past fdb.journal_max it is folded into the records
+ * on the persistence thread.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fdb.h"
+#include "fdbfile.h"
+#define LOG_SUBSYSTEM "fdb"
+#include <log.h>
+#include <crc32c.h>
+#include <fnv.h>
+#include "fdbcheck.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct fdb_journal *fdb_journals;
+size_t fdb_journal_max = 1048576; /**< compact after this many bytes, 0 to disable. */
+
+static unsigned
+fdb_overlay_hash(const char *id)
+{
+	return fnv1a_str(id) % FDB_OVERLAY_BUCKETS;
+}
+
+struct fdb_overlay **
+fdb_overlay_new(void)
+{
+	struct fdb_overlay **set = calloc(FDB_OVERLAY_BUCKETS, sizeof(*set));
+
+	if (!set)
+		LOG_PERROR("calloc()");
+
+	return set;
+}
+
+struct fdb_overlay *
+fdb_overlay_find(struct fdb_overlay **set, const char *id)
+{
+	struct fdb_overlay *o;
+
+	for (o = set[fdb_overlay_hash(id)]; o; o = o->next) {
+		if (!strcmp(o->id, id))
+			return o;
+	}
+
+	return NULL;
+}
+
+struct fdb_delta *
+fdb_delta_find(struct fdb_delta *d, const char *name)
+{
+	for (; d; d = d->next) {
+		if (!strcasecmp(d->name, name))
+			return d;
+	}
+
+	return NULL;
+}
+
+/**
+ * remember name=value for record id, replacing an earlier change.
+ */
+static int
+fdb_overlay_set(struct fdb_overlay **set, const char *id, const char *name, const char *value)
+{
+	struct fdb_overlay *o;
+	struct fdb_delta *d;
+	char *new_value;
+
+	o = fdb_overlay_find(set, id);
+
+	if (!o) {
+		unsigned bucket = fdb_overlay_hash(id);
+
+		o = calloc(1, sizeof(*o));
+
+		if (!o || !(o->id = strdup(id))) {
+			LOG_PERROR("calloc()");
+			free(o);
+			return 0; /* failure */
+		}
+
+		o->next = set[bucket];
+		set[bucket] = o;
+	}
+
+	new_value = strdup(value);
+
+	if (!new_value) {
+		LOG_PERROR("strdup()");
+		return 0; /* failure */
+	}
+
+	d = fdb_delta_find(o->deltas, name);
+
+	if (d) {
+		free(d->value);
+		d->value = new_value;
+		return 1; /* success */
+	}
+
+	d = calloc(1, sizeof(*d));
+
+	if (!d || !(d->name = strdup(name))) {
+		LOG_PERROR("calloc()");
+		free(d);
+		free(new_value);
+		return 0; /* failure */
+	}
+
+	d->value = new_value;
+	d->next = o->deltas;
+	o->deltas = d;
+
+	return 1; /* success */
+}
+
+static void
+fdb_overlay_free(struct fdb_overlay *o)
+{
+	while (o->deltas) {
+		struct fdb_delta *d = o->deltas;
+
+		o->deltas = d->next;
+		free(d->name);
+		free(d->value);
+		free(d);
+	}
+
+	free(o->id);
+	free(o);
+}
+
+/**
+ * forget the changes to record id.
+ * @return 1 if there were any.
+ */
+static int
+fdb_overlay_remove(struct fdb_overlay **set, const char *id)
+{
+	struct fdb_overlay **prev, *o;
+
+	for (prev = &set[fdb_overlay_hash(id)]; (o = *prev); prev = &o->next) {
+		if (!strcmp(o->id, id)) {
+			*prev = o->next;
+			fdb_overlay_free(o);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * forget every change in set.
+ */
+void
+fdb_overlay_clear(struct fdb_overlay **set)
+{
+	unsigned i;
+
+	for (i = 0; i < FDB_OVERLAY_BUCKETS; i++) {
+		while (set[i]) {
+			struct fdb_overlay *o = set[i];
+
+			set[i] = o->next;
+			fdb_overlay_free(o);
+		}
+	}
+}
+
+static struct fdb_journal *
+fdb_journal_find(const char *domain)
+{
+	struct fdb_journal *j;
+
+	for (j = fdb_journals; j; j = j->next) {
+		if (!strcmp(j->domain, domain))
+			return j;
+	}
+
+	return NULL;
+}
+
+static void
+fdb_journal_free(struct fdb_journal *j)
+{
+	if (j->fd != -1)
+		close(j->fd);
+
+	if (j->overlay) {
+		fdb_overlay_clear(j->overlay);
+		free(j->overlay);
+	}
+
+	if (j->compacting) {
+		fdb_overlay_clear(j->compacting);
+		free(j->compacting);
+	}
+
+	free(j->domain);
+	free(j->filename);
+	free(j->filename_old);
+	free(j);
+}
+
+/**
+ * free all journals. the persistence thread must be stopped.
+ */
+void
+fdb_journal_free_all(void)
+{
+	while (fdb_journals) {
+		struct fdb_journal *j = fdb_journals;
+
+		fdb_journals = j->next;
+		fdb_journal_free(j);
+	}
+}
+
+/**
+ * find the journal for a domain, starting one if needed.
+ */
+static struct fdb_journal *
+fdb_journal_get(const char *domain)
+{
+	struct fdb_journal *j = fdb_journal_find(domain);
+
+	if (j)
+		return j;
+
+	j = calloc(1, sizeof(*j));
+
+	if (!j) {
+		LOG_PERROR("calloc()");
+		return NULL; /* failure */
+	}
+
+	j->fd = -1;
+	j->domain = strdup(domain);
+	j->filename = fdb_makepath(domain, FDB_JOURNAL);
+	j->filename_old = fdb_makepath(domain, FDB_JOURNAL_OLD);
+	j->overlay = fdb_overlay_new();
+	j->compacting = fdb_overlay_new();
+
+	if (!j->domain || !j->filename || !j->filename_old || !j->overlay || !j->compacting) {
+		LOG_ERROR("could not start journal for %s", domain);
+		fdb_journal_free(j);
+		return NULL; /* failure */
+	}
+
+	j->next = fdb_journals;
+	fdb_journals = j;
+
+	return j;
+}
+
+/**
+ * append a line to the journal, on the persistence thread.
+ */
+int
+fdb_journal_write(struct fdb_commit *c)
+{
+	struct fdb_journal *j = c->journal;
+
+	if (j->fd == -1) {
+		j->fd = open(j->filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+
+		if (j->fd == -1) {
+			LOG_PERROR(j->filename);
+			return 0; /* failure */
+		}
+
+		if (fdb_sync != FDB_SYNC_NONE)
+			fdb_sync_dir(j->filename);
+	}
+
+	if (!fdb_write_all(j->fd, c->buf, c->len)) {
+		LOG_PERROR(j->filename);
+		return 0; /* failure */
+	}
+
+	if (fdb_sync == FDB_SYNC_EVERY) {
+		if (fsync(j->fd)) {
+			LOG_PERROR(j->filename);
+			return 0; /* failure */
+		}
+	} else {
+		j->dirty_fl = 1;
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * close the journal and move it aside to be folded, on the persistence
+ * thread. appends after this start a new journal.
+ */
+int
+fdb_journal_rotate(struct fdb_journal *j)
+{
+	if (j->fd != -1) {
+		if (fdb_sync != FDB_SYNC_NONE && fsync(j->fd))
+			LOG_PERROR(j->filename);
+
+		close(j->fd);
+		j->fd = -1;
+		j->dirty_fl = 0;
+	}
+
+	if (rename(j->filename, j->filename_old) && errno != ENOENT) {
+		LOG_PERROR(j->filename);
+		return 0; /* failure */
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * rewrite each record of domain that has changes in set.
+ */
+static int
+fdb_journal_fold(const char *domain, struct fdb_overlay **set)
+{
+	int sync_fl = fdb_sync != FDB_SYNC_NONE;
+	int ret = 1, nr_folded = 0;
+	struct fdb_overlay *o;
+	unsigned i;
+
+	for (i = 0; i < FDB_OVERLAY_BUCKETS; i++) {
+		for (o = set[i]; o; o = o->next) {
+			struct fdb_commit rec;
+			const char *src;
+			uint32_t crc;
+			char *base = NULL;
+			size_t len;
+			int saved_fl;
+
+			/* a record saved whole after these changes already has
+			 * newer values, and is written after this fold. */
+			pthread_mutex_lock(&fdb_commit_mutex);
+			saved_fl = o->saved_fl;
+			pthread_mutex_unlock(&fdb_commit_mutex);
+
+			if (saved_fl)
+				continue;
+
+			memset(&rec, 0, sizeof(rec));
+			rec.filename = fdb_makepath(domain, o->id);
+			rec.filename_tmp = fdb_makepath_tmp(domain, o->id);
+			rec.filename_old = fdb_record_altpath(domain, o->id);
+			src = rec.filename_old && access(rec.filename, F_OK) ? rec.filename_old : rec.filename;
+
+			if (!rec.filename || !rec.filename_tmp) {
+				LOG_PERROR("strdup()");
+				ret = 0;
+			} else if (access(src, F_OK) && errno == ENOENT) {
+				LOG_WARNING("dropping journal changes for missing record %s", rec.filename);
+			} else if (!(base = fdb_load(src, &len, NULL))
+				|| !fdb_verify(src, base, &len, &crc)
+				|| !fdb_merge(base, len, o->deltas, NULL, &rec.buf, &rec.len, &crc)
+				|| !fdb_write_file(&rec, sync_fl)
+				|| !fdb_commit_rename(&rec)) {
+				ret = 0;
+			} else {
+				fdb_manifest_update(domain, o->id, rec.len, time(NULL), crc, 0);
+				nr_folded++;
+			}
+
+			free(base);
+			free(rec.filename);
+			free(rec.filename_tmp);
+			free(rec.filename_old);
+			free(rec.buf);
+		}
+	}
+
+	if (nr_folded && sync_fl) {
+		char *dirfile = fdb_makepath(domain, "");
+
+		if (dirfile)
+			fdb_sync_dir(dirfile);
+		free(dirfile);
+	}
+
+	if (nr_folded)
+		LOG_INFO("folded journal changes into %d records of %s", nr_folded, domain);
+
+	return ret;
+}
+
+/**
+ * fold the journal moved aside by fdb_journal_rotate() into its records,
+ * on the persistence thread.
+ */
+int
+fdb_journal_compact(struct fdb_journal *j)
+{
+	if (!fdb_journal_fold(j->domain, j->compacting)) {
+		/* leave compacting_fl set so the old journal is not replaced. */
+		LOG_ERROR("could not compact %s", j->filename_old);
+		return 0; /* failure */
+	}
+
+	if (remove(j->filename_old) && errno != ENOENT)
+		LOG_PERROR(j->filename_old);
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+	fdb_overlay_clear(j->compacting);
+	j->compacting_fl = 0;
+	pthread_mutex_unlock(&fdb_commit_mutex);
+	j->rotated_fl = 0;
+
+	return 1; /* success */
+}
+
+/**
+ * hand the current changes to the persistence thread to fold into records.
+ */
+static void
+fdb_journal_start_compact(struct fdb_journal *j)
+{
+	struct fdb_overlay **tmp;
+	struct fdb_commit *c;
+
+	c = calloc(1, sizeof(*c));
+
+	if (!c) {
+		LOG_PERROR("calloc()");
+		return;
+	}
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	if (j->compacting_fl && fdb_thread_fl) {
+		pthread_mutex_unlock(&fdb_commit_mutex);
+		free(c);
+		return; /* still folding the last one, or waiting for its retry */
+	}
+
+	/* without the thread a failed fold is tried again here. */
+	if (!j->compacting_fl) {
+		tmp = j->compacting;
+		j->compacting = j->overlay;
+		j->overlay = tmp;
+		j->compacting_fl = 1;
+	}
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	j->size = 0;
+	c->kind = FDB_COMMIT_COMPACT;
+	c->journal = j;
+	fdb_commit_submit(c);
+}
+
+/**
+ * split a journal line into id, name and value, checking its checksum.
+ */
+static int
+fdb_journal_parse(char *b, char *e, char *field[3])
+{
+	int i;
+
+	if (!fdb_check_journal_line(b, e))
+		return 0; /* failure */
+
+	b += 9;
+
+	for (i = 0; i < 3; i++) {
+		char *sp = i < 2 ? memchr(b, ' ', e - b) : e;
+
+		if (!sp)
+			return 0; /* failure */
+
+		fdb_unescape(b, sp - b);
+		field[i] = b;
+		b = sp + 1;
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * load a journal into set. stops at the first damaged line, which is
+ * usually a write that was cut short.
+ */
+int
+fdb_journal_replay(const char *filename, struct fdb_overlay **set)
+{
+	struct stat st;
+	char *buf, *b, *nl, *end;
+	size_t len;
+	int line;
+
+	if (stat(filename, &st)) {
+		if (errno == ENOENT)
+			return 1; /* no journal */
+		LOG_PERROR(filename);
+		return 0; /* failure */
+	}
+
+	buf = fdb_load(filename, &len, NULL);
+
+	if (!buf)
+		return 0; /* failure */
+
+	end = buf + len;
+
+	for (b = buf, line = 1; b < end; b = nl + 1, line++) {
+		char *field[3];
+
+		nl = memchr(b, '\n', end - b);
+
+		if (!nl || !fdb_journal_parse(b, nl, field)) {
+			LOG_WARNING("%s:%d:damaged entry, ignoring the rest of the journal", filename, line);
+			break;
+		}
+
+		if (!strcmp(field[1], FDB_JOURNAL_SAVED)) {
+			/* the record was saved whole, earlier changes are in it. */
+			fdb_overlay_remove(set, field[0]);
+		} else if (!fdb_overlay_set(set, field[0], field[1], field[2])) {
+			free(buf);
+			return 0; /* failure */
+		}
+	}
+
+	free(buf);
+
+	return 1; /* success */
+}
+
+/**
+ * fold journals left from the last run into the records of domain.
+ */
+int
+fdb_journal_boot(const char *domain)
+{
+	struct fdb_overlay **set = fdb_overlay_new();
+	char *filename = fdb_makepath(domain, FDB_JOURNAL);
+	char *filename_old = fdb_makepath(domain, FDB_JOURNAL_OLD);
+	int ret = 0;
+
+	if (!set || !filename || !filename_old)
+		goto done;
+
+	if (!fdb_journal_replay(filename_old, set) || !fdb_journal_replay(filename, set))
+		goto done;
+
+	if (!fdb_journal_fold(domain, set))
+		goto done;
+
+	/* the records are on disk, the journals can go. */
+	if (remove(filename_old) && errno != ENOENT)
+		LOG_PERROR(filename_old);
+
+	if (remove(filename) && errno != ENOENT)
+		LOG_PERROR(filename);
+
+	ret = 1;
+done:
+	if (set) {
+		fdb_overlay_clear(set);
+		free(set);
+	}
+
+	free(filename);
+	free(filename_old);
+
+	return ret;
+}
+
+/**
+ * apply changes that are only in the journal to a record loaded into buf.
+ */
+int
+fdb_journal_overlay(const char *domain, const char *id, char **buf, size_t *len)
+{
+	struct fdb_journal *j = fdb_journal_find(domain);
+	struct fdb_overlay *cur, *old;
+	char *merged;
+	size_t merged_len;
+	int ret = 1;
+
+	if (!j)
+		return 1; /* nothing journaled */
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	cur = fdb_overlay_find(j->overlay, id);
+	old = j->compacting_fl ? fdb_overlay_find(j->compacting, id) : NULL;
+
+	if (old && old->saved_fl)
+		old = NULL;
+
+	if (cur || old) {
+		ret = fdb_merge(*buf, *len, cur ? cur->deltas : NULL,
+			old ? old->deltas : NULL, &merged, &merged_len, NULL);
+
+		if (ret) {
+			free(*buf);
+			*buf = merged;
+			*len = merged_len;
+		}
+	}
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	return ret;
+}
+
+/**
+ * make the journal line "crc32c id name value" for j.
+ */
+static struct fdb_commit *
+fdb_journal_entry(struct fdb_journal *j, const char *id, const char *name, const char *value)
+{
+	struct fdb_commit *c;
+	uint32_t crc;
+	char *p;
+	int i;
+
+	c = calloc(1, sizeof(*c));
+
+	if (!c || !(c->buf = malloc(9 + 3 * (strlen(id) + strlen(name) + strlen(value)) + 3))) {
+		LOG_PERROR("malloc()");
+		free(c);
+		return NULL; /* failure */
+	}
+
+	p = fdb_escape(c->buf + 9, id);
+	*p++ = ' ';
+	p = fdb_escape(p, name);
+	*p++ = ' ';
+	p = fdb_escape(p, value);
+
+	crc = crc32c(0, c->buf + 9, p - (c->buf + 9));
+
+	for (i = 7; i >= 0; i--, crc >>= 4)
+		c->buf[i] = fdb_hexdigits[crc & 15];
+
+	c->buf[8] = ' ';
+	*p++ = '\n';
+	c->len = p - c->buf;
+	c->kind = FDB_COMMIT_APPEND;
+	c->journal = j;
+
+	return c;
+}
+
+/**
+ * record one changed attribute with a small append to the domain's
+ * journal instead of rewriting the record.
+ * @return 1 if the change was journaled, 0 if the record must be saved.
+ */
+int
+fdb_journal_append(const char *domain, const char *id, const char *name, const char *value)
+{
+	struct fdb_journal *j;
+	struct fdb_commit *c;
+	int ret;
+
+	assert(domain != NULL);
+	assert(id != NULL);
+	assert(name != NULL);
+	assert(value != NULL);
+
+	if (!fdb_journal_max || name[0] == '.')
+		return 0; /* journal is disabled, or the name is reserved */
+
+	j = fdb_journal_get(domain);
+
+	if (!j)
+		return 0; /* failure */
+
+	c = fdb_journal_entry(j, id, name, value);
+
+	if (!c)
+		return 0; /* failure */
+
+	if (!fdb_overlay_set(j->overlay, id, name, value)) {
+		fdb_commit_free(c);
+		return 0; /* failure */
+	}
+
+	j->size += c->len;
+	ret = fdb_commit_submit(c);
+
+	if (j->size >= fdb_journal_max)
+		fdb_journal_start_compact(j);
+
+	return ret;
+}
+
+/**
+ * forget journaled changes to a record that was just saved whole, so they
+ * are not applied over the newer values. the marker tells the replay at
+ * the next start to do the same.
+ */
+void
+fdb_journal_saved(const char *domain, const char *id)
+{
+	struct fdb_journal *j = fdb_journal_find(domain);
+	struct fdb_overlay *old;
+	struct fdb_commit *c;
+	int found;
+
+	if (!j)
+		return; /* nothing journaled */
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	found = fdb_overlay_remove(j->overlay, id);
+	old = j->compacting_fl ? fdb_overlay_find(j->compacting, id) : NULL;
+
+	/* the persistence thread may be folding it, so only mark it. */
+	if (old && !old->saved_fl) {
+		old->saved_fl = 1;
+		found = 1;
+	}
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	if (!found)
+		return; /* no changes since the journal was last folded */
+
+	c = fdb_journal_entry(j, id, FDB_JOURNAL_SAVED, "");
+
+	if (!c) {
+		LOG_ERROR("%s:could not journal the save of %s", j->filename, id);
+		return;
+	}
+
+	j->size += c->len;
+	fdb_commit_submit(c);
+}
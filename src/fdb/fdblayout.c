@@ -0,0 +1,304 @@
+/**
+ * @file fdblayout.c
+ *
+ * Where the file backend keeps records on disk.
+ *
+ * Records are either flat in the domain's directory or spread over shard
+ * directories by a hash of their id, chosen with fdb.layout. fdb_migrate()
+ * moves a domain from one layout to the other.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fdb.h"
+#include "fdbfile.h"
+#define LOG_SUBSYSTEM "fdb"
+#include <log.h>
+#include <fnv.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const char *fdb_layout_names[] = { "flat", "hashed", "mixed" };
+enum fdb_layout fdb_layout = FDB_LAYOUT_FLAT;
+
+/**
+ * generate the directory used for a domain.
+ */
+char *
+fdb_basepath(const char *domain)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof path, "data/%s", domain);
+
+	return strdup(path);
+}
+
+/**
+ * creates a filename name in the given layout. names starting with '.'
+ * are not records and always stay at the top of the domain.
+ */
+static char *
+fdb_makepath_layout(const char *domain, const char *id, enum fdb_layout layout)
+{
+	char path[PATH_MAX];
+
+	if (layout == FDB_LAYOUT_HASHED && id[0] && id[0] != '.')
+		snprintf(path, sizeof path, "data/%s/.%02x/%s", domain, (unsigned)(fnv1a_str(id) % FDB_SHARDS), id);
+	else
+		snprintf(path, sizeof path, "data/%s/%s", domain, id);
+
+	return strdup(path);
+}
+
+/**
+ * creates a filename name.
+ */
+char *
+fdb_makepath(const char *domain, const char *id)
+{
+	return fdb_makepath_layout(domain, id, fdb_layout);
+}
+
+/**
+ * creates a temporary name, next to the file it replaces.
+ */
+char *
+fdb_makepath_tmp(const char *domain, const char *id)
+{
+	char path[PATH_MAX];
+	char *filename;
+
+	filename = fdb_makepath(domain, id);
+
+	if (!filename)
+		return NULL;
+
+	snprintf(path, sizeof path, "%s.tmp", filename);
+	free(filename);
+
+	return strdup(path);
+}
+
+/**
+ * name of a shard directory, with a trailing '/'.
+ */
+char *
+fdb_shardpath(const char *domain, unsigned shard)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof path, "data/%s/.%02x/", domain, shard);
+
+	return strdup(path);
+}
+
+/**
+ * checks if a name in a domain's directory is a shard directory.
+ */
+int
+fdb_isshardname(const char *name)
+{
+	return name[0] == '.' && isxdigit((unsigned char)name[1])
+		&& isxdigit((unsigned char)name[2]) && !name[3];
+}
+
+/**
+ * checks to see if filename is a temp filename.
+ * must work with or without a path part.
+ */
+int
+fdb_istempname(const char *filename)
+{
+	size_t len, extlen = strlen(".tmp");
+
+	if (!filename)
+		return 0;
+
+	len = strlen(filename);
+
+	if (len > extlen && !strcmp(filename + len - extlen, ".tmp"))
+		return 1; /* found extension. */
+
+	return 0; /* not a temp filename. */
+}
+
+/**
+ * look up a layout by name.
+ * @return the layout, or -1 if name is unknown.
+ */
+int
+fdb_layout_parse(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(fdb_layout_names) / sizeof(*fdb_layout_names); i++) {
+		if (!strcasecmp(fdb_layout_names[i], name))
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * the name a record has in the layout being migrated away from, or NULL
+ * if the domain is not being migrated.
+ */
+char *
+fdb_record_altpath(const char *domain, const char *id)
+{
+	struct fdb_manifest *m;
+	int migrating_fl;
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+	m = fdb_manifest_find(domain);
+	migrating_fl = m && m->layout != fdb_layout;
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	if (!migrating_fl)
+		return NULL;
+
+	return fdb_makepath_layout(domain, id,
+		fdb_layout == FDB_LAYOUT_FLAT ? FDB_LAYOUT_HASHED : FDB_LAYOUT_FLAT);
+}
+
+/**
+ * create the shard directories of a domain.
+ */
+int
+fdb_mkshards(const char *domain)
+{
+	unsigned i;
+
+	for (i = 0; i < FDB_SHARDS; i++) {
+		char *pathname = fdb_shardpath(domain, i);
+
+		if (!pathname || (MKDIR(pathname) == -1 && errno != EEXIST)) {
+			LOG_PERROR(pathname);
+			free(pathname);
+			return 0; /* failure */
+		}
+
+		free(pathname);
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * move every record of a domain to the configured layout.
+ */
+static int
+fdb_migrate_domain(struct fdb_manifest *m)
+{
+	enum fdb_layout from = fdb_layout == FDB_LAYOUT_FLAT ? FDB_LAYOUT_HASHED : FDB_LAYOUT_FLAT;
+	unsigned i, nr_moved = 0, nr_failed = 0;
+	char *pathname;
+
+	if (fdb_layout == FDB_LAYOUT_HASHED && !fdb_mkshards(m->domain))
+		return 0; /* failure */
+
+	for (i = 0; i < FDB_MANIFEST_BUCKETS; i++) {
+		struct fdb_manifest_entry *e;
+
+		for (e = m->bucket[i]; e; e = e->next) {
+			char *oldname = fdb_makepath_layout(m->domain, e->id, from);
+			char *newname = fdb_makepath(m->domain, e->id);
+
+			if (!oldname || !newname) {
+				LOG_PERROR("strdup()");
+				nr_failed++;
+			} else if (!access(newname, F_OK)) {
+				/* saved in the new layout since, the old copy is stale. */
+				if (remove(oldname) && errno != ENOENT) {
+					LOG_PERROR(oldname);
+					nr_failed++;
+				}
+			} else if (rename(oldname, newname)) {
+				if (errno != ENOENT) {
+					LOG_PERROR(oldname);
+					nr_failed++;
+				}
+			} else {
+				nr_moved++;
+			}
+
+			free(oldname);
+			free(newname);
+		}
+	}
+
+	for (i = 0; i < FDB_SHARDS; i++) {
+		pathname = fdb_shardpath(m->domain, i);
+
+		if (!pathname)
+			continue;
+
+		if (from == FDB_LAYOUT_HASHED)
+			rmdir(pathname); /* fails if something is left in it */
+		else if (fdb_sync != FDB_SYNC_NONE)
+			fdb_sync_dir(pathname);
+
+		free(pathname);
+	}
+
+	if (fdb_sync != FDB_SYNC_NONE) {
+		pathname = fdb_makepath(m->domain, "");
+		if (pathname)
+			fdb_sync_dir(pathname);
+		free(pathname);
+	}
+
+	LOG_INFO("moved %u records of %s to the %s layout", nr_moved, m->domain, fdb_layout_names[fdb_layout]);
+
+	if (nr_failed) {
+		LOG_ERROR("could not move %u records of %s", nr_failed, m->domain);
+		return 0; /* failure */
+	}
+
+	fdb_manifest_set_layout(m, fdb_layout);
+
+	return 1; /* success */
+}
+
+/**
+ * move the records of every domain in use to the layout set by fdb.layout.
+ * until then records are read from either layout.
+ */
+int
+fdb_migrate(void)
+{
+	struct fdb_manifest *m;
+	int ret = 1;
+
+	/* nothing else may move records meanwhile. */
+	fdb_flush();
+
+	for (m = fdb_manifests; m; m = m->next) {
+		if (m->layout != fdb_layout && !fdb_migrate_domain(m))
+			ret = 0;
+	}
+
+	return ret;
+}
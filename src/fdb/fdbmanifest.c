@@ -0,0 +1,575 @@
+/**
+ * @file fdbmanifest.c
+ *
+ * Manifest of the records in each domain of the file backend.
+ *
+ * Listing a domain reads its .manifest instead of scanning the directory.
+ * The file is rebuilt from a scan when it is missing, damaged or older than
+ * the directory.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fdb.h"
+#include "fdbfile.h"
+#define LOG_SUBSYSTEM "fdb"
+#include <log.h>
+#include <crc32c.h>
+#include <fnv.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FDB_MANIFEST ".manifest"
+
+struct fdb_manifest *fdb_manifests;
+
+/**
+ * check if a directory entry looks like a record.
+ */
+static int
+fdb_isrecordname(const char *name)
+{
+	if (name[0] == '.')
+		return 0; /* ignore hidden files */
+
+	if (fdb_istempname(name))
+		return 0; /* ignore temp files. */
+
+	if (name[0] && name[strlen(name) - 1] == '~') {
+		LOG_INFO("skip things that don't look like data files:%s", name);
+		return 0; /* ignore backup files. */
+	}
+
+	return 1;
+}
+
+static unsigned
+fdb_manifest_hash(const char *id)
+{
+	return fnv1a_str(id) % FDB_MANIFEST_BUCKETS;
+}
+
+struct fdb_manifest *
+fdb_manifest_find(const char *domain)
+{
+	struct fdb_manifest *m;
+
+	for (m = fdb_manifests; m; m = m->next) {
+		if (!strcmp(m->domain, domain))
+			return m;
+	}
+
+	return NULL;
+}
+
+/**
+ * find the entry for id, adding it if create_fl is set.
+ */
+struct fdb_manifest_entry *
+fdb_manifest_entry(struct fdb_manifest *m, const char *id, int create_fl)
+{
+	unsigned bucket = fdb_manifest_hash(id);
+	struct fdb_manifest_entry *e;
+
+	for (e = m->bucket[bucket]; e; e = e->next) {
+		if (!strcmp(e->id, id))
+			return e;
+	}
+
+	if (!create_fl)
+		return NULL;
+
+	e = calloc(1, sizeof(*e));
+
+	if (!e || !(e->id = strdup(id))) {
+		LOG_PERROR("calloc()");
+		free(e);
+		return NULL; /* failure */
+	}
+
+	e->next = m->bucket[bucket];
+	m->bucket[bucket] = e;
+	m->count++;
+	m->dirty_fl = 1;
+
+	return e;
+}
+
+static void
+fdb_manifest_clear(struct fdb_manifest *m)
+{
+	unsigned i;
+
+	for (i = 0; i < FDB_MANIFEST_BUCKETS; i++) {
+		while (m->bucket[i]) {
+			struct fdb_manifest_entry *e = m->bucket[i];
+
+			m->bucket[i] = e->next;
+			free(e->id);
+			free(e);
+		}
+	}
+
+	m->count = 0;
+}
+
+/**
+ * record the size, time and checksum of a record. ignored if the domain
+ * has no manifest loaded, or if id is not listed and create_fl is not set.
+ */
+void
+fdb_manifest_update(const char *domain, const char *id, size_t size, long long mtime, uint32_t crc, int create_fl)
+{
+	struct fdb_manifest *m;
+	struct fdb_manifest_entry *e;
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+
+	m = fdb_manifest_find(domain);
+	e = m ? fdb_manifest_entry(m, id, create_fl) : NULL;
+
+	if (e && (e->size != size || e->mtime != mtime || e->crc != crc)) {
+		e->size = size;
+		e->mtime = mtime;
+		e->crc = crc;
+		m->dirty_fl = 1;
+	}
+
+	pthread_mutex_unlock(&fdb_commit_mutex);
+}
+
+/**
+ * newest mtime of the domain's directory and, unless the layout is flat,
+ * its shard directories. adding, removing or renaming a record changes it.
+ */
+static int
+fdb_manifest_dirtime(const char *domain, enum fdb_layout layout, struct timespec *ts)
+{
+	struct stat st;
+	char *pathname;
+	unsigned i;
+
+	pathname = fdb_basepath(domain);
+
+	if (!pathname || stat(pathname, &st)) {
+		LOG_PERROR(pathname);
+		free(pathname);
+		return 0; /* failure */
+	}
+
+	free(pathname);
+	*ts = st.st_mtim;
+
+	for (i = 0; layout != FDB_LAYOUT_FLAT && i < FDB_SHARDS; i++) {
+		pathname = fdb_shardpath(domain, i);
+
+		if (pathname && !stat(pathname, &st)
+			&& (st.st_mtim.tv_sec > ts->tv_sec
+			|| (st.st_mtim.tv_sec == ts->tv_sec && st.st_mtim.tv_nsec > ts->tv_nsec)))
+			*ts = st.st_mtim;
+
+		free(pathname);
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * check that nothing in the domain changed since the manifest was saved.
+ * fdb_manifest_write() gives the file the mtime from fdb_manifest_dirtime().
+ */
+static int
+fdb_manifest_current(const struct fdb_manifest *m)
+{
+	struct timespec ts;
+	struct stat st;
+	char *filename;
+	int ret;
+
+	filename = fdb_makepath(m->domain, FDB_MANIFEST);
+
+	ret = filename && !stat(filename, &st)
+		&& fdb_manifest_dirtime(m->domain, m->layout, &ts)
+		&& st.st_mtim.tv_sec == ts.tv_sec
+		&& st.st_mtim.tv_nsec == ts.tv_nsec;
+
+	free(filename);
+
+	return ret;
+}
+
+/**
+ * load the manifest file. it starts with "layout name", has a line
+ * "id size mtime crc32c" for each record and ends with "end crc32c", the
+ * checksum of the lines before it.
+ */
+static int
+fdb_manifest_read(struct fdb_manifest *m)
+{
+	char *filename, *buf, *b, *nl, *t, *end;
+	unsigned crc;
+	size_t len;
+	int layout;
+
+	filename = fdb_makepath(m->domain, FDB_MANIFEST);
+
+	if (!filename || access(filename, F_OK)) {
+		free(filename);
+		return 0; /* missing */
+	}
+
+	buf = fdb_load(filename, &len, NULL);
+
+	if (!buf) {
+		free(filename);
+		return 0; /* failure */
+	}
+
+	end = buf + len;
+
+	/* check the last line before parsing changes the buffer. */
+	for (t = end; t > buf && t[-1] == '\n'; t--)
+		;
+	while (t > buf && t[-1] != '\n')
+		t--;
+
+	if (strncmp(t, "end ", 4) || sscanf(t + 4, "%x", &crc) != 1 || crc != crc32c(0, buf, t - buf))
+		goto damaged;
+
+	nl = memchr(buf, '\n', t - buf);
+
+	if (!nl || strncmp(buf, "layout ", 7))
+		goto damaged;
+
+	*nl = 0;
+	layout = fdb_layout_parse(buf + 7);
+
+	if (layout < 0)
+		goto damaged;
+
+	m->layout = layout;
+
+	for (b = nl + 1; b < t; b = nl + 1) {
+		struct fdb_manifest_entry *e;
+		unsigned long long size;
+		long long mtime;
+		char *sp;
+
+		nl = memchr(b, '\n', t - b);
+		*nl = 0;
+		sp = strchr(b, ' ');
+
+		if (!sp || sscanf(sp + 1, "%llu %lld %x", &size, &mtime, &crc) != 3)
+			goto damaged;
+
+		fdb_unescape(b, sp - b);
+		e = fdb_manifest_entry(m, b, 1);
+
+		if (!e)
+			goto damaged;
+
+		e->size = size;
+		e->mtime = mtime;
+		e->crc = crc;
+	}
+
+	free(buf);
+
+	if (!fdb_manifest_current(m)) {
+		LOG_INFO("%s:out of date, rebuilding it", filename);
+		fdb_manifest_clear(m);
+		free(filename);
+		return 0; /* stale */
+	}
+
+	free(filename);
+	m->dirty_fl = 0;
+
+	return 1; /* success */
+damaged:
+	LOG_WARNING("%s:damaged manifest, rebuilding it", filename);
+	fdb_manifest_clear(m);
+	free(buf);
+	free(filename);
+
+	return 0; /* failure */
+}
+
+/**
+ * what a directory entry is, trusting d_type when the filesystem has it.
+ * @return 'f' for a regular file, 'd' for a directory, or 0.
+ */
+static int
+fdb_entrytype(const struct dirent *de, const char *filename)
+{
+	struct stat st;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+	if (de->d_type == DT_REG)
+		return 'f';
+
+	if (de->d_type == DT_DIR)
+		return 'd';
+
+	if (de->d_type != DT_UNKNOWN && de->d_type != DT_LNK)
+		return 0;
+#else
+	(void)de;
+#endif
+
+	/* only stat when the filesystem does not say what it is. */
+	if (stat(filename, &st)) {
+		LOG_PERROR(filename);
+		return 0;
+	}
+
+	return S_ISREG(st.st_mode) ? 'f' : S_ISDIR(st.st_mode) ? 'd' : 0;
+}
+
+/**
+ * add the records in pathname to a manifest, and those in its shard
+ * directories if top_fl is set. nr counts the records in each layout.
+ */
+static int
+fdb_manifest_scan_dir(struct fdb_manifest *m, const char *pathname, int top_fl, unsigned nr[2])
+{
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(pathname);
+
+	if (!d) {
+		LOG_PERROR(pathname);
+		return 0; /* failure */
+	}
+
+	while ((de = readdir(d))) {
+		char filename[PATH_MAX];
+		int shard_fl = top_fl && fdb_isshardname(de->d_name);
+		int type;
+
+		if (!shard_fl && !fdb_isrecordname(de->d_name))
+			continue;
+
+		snprintf(filename, sizeof filename, "%s/%s", pathname, de->d_name);
+		type = fdb_entrytype(de, filename);
+
+		if (shard_fl && type == 'd') {
+			if (!fdb_manifest_scan_dir(m, filename, 0, nr))
+				goto failure;
+		} else if (!shard_fl && type == 'f') {
+			if (!fdb_manifest_entry(m, de->d_name, 1))
+				goto failure;
+			nr[top_fl ? FDB_LAYOUT_FLAT : FDB_LAYOUT_HASHED]++;
+		} else {
+			LOG_INFO("Ignoring directories and other non-regular files:%s", filename);
+		}
+	}
+
+	closedir(d);
+
+	return 1; /* success */
+failure:
+	closedir(d);
+
+	return 0; /* failure */
+}
+
+/**
+ * rebuild a manifest from the directory. the size, time and checksum of
+ * each record are filled in when it is next read or written.
+ */
+static int
+fdb_manifest_scan(struct fdb_manifest *m)
+{
+	unsigned nr[2] = { 0, 0 };
+	char *pathname;
+	int ret;
+
+	pathname = fdb_basepath(m->domain);
+	ret = pathname && fdb_manifest_scan_dir(m, pathname, 1, nr);
+	free(pathname);
+
+	if (!ret) {
+		fdb_manifest_clear(m);
+		return 0; /* failure */
+	}
+
+	if (nr[FDB_LAYOUT_FLAT] && nr[FDB_LAYOUT_HASHED])
+		m->layout = FDB_LAYOUT_MIXED;
+	else if (nr[FDB_LAYOUT_FLAT])
+		m->layout = FDB_LAYOUT_FLAT;
+	else if (nr[FDB_LAYOUT_HASHED])
+		m->layout = FDB_LAYOUT_HASHED;
+	else
+		m->layout = fdb_layout;
+
+	m->dirty_fl = 1;
+
+	LOG_INFO("rebuilt manifest of %s with %u records (%s layout)", m->domain, m->count, fdb_layout_names[m->layout]);
+
+	return 1; /* success */
+}
+
+/**
+ * save the manifest, then give it the mtime of the domain's directories.
+ * must not run while the persistence thread is busy.
+ */
+static int
+fdb_manifest_write(struct fdb_manifest *m)
+{
+	struct fdb_write_handle out;
+	struct fdb_commit rec;
+	struct timespec times[2];
+	unsigned i;
+	int ret = 0;
+
+	memset(&out, 0, sizeof(out));
+	memset(&rec, 0, sizeof(rec));
+
+	if (!fdb_write_reserve(&out, 32))
+		goto done;
+
+	out.len += sprintf(out.buf, "layout %s\n", fdb_layout_names[m->layout]);
+
+	for (i = 0; i < FDB_MANIFEST_BUCKETS; i++) {
+		struct fdb_manifest_entry *e;
+
+		for (e = m->bucket[i]; e; e = e->next) {
+			char *p;
+
+			if (!fdb_write_reserve(&out, 3 * strlen(e->id) + 64))
+				goto done;
+
+			p = fdb_escape(out.buf + out.len, e->id);
+			out.len = p - out.buf;
+			out.len += sprintf(p, " %llu %lld %08X\n",
+				(unsigned long long)e->size, e->mtime, (unsigned)e->crc);
+		}
+	}
+
+	if (!fdb_write_reserve(&out, 16))
+		goto done;
+
+	out.len += sprintf(out.buf + out.len, "end %08X\n", (unsigned)crc32c(0, out.buf, out.len));
+
+	rec.filename = fdb_makepath(m->domain, FDB_MANIFEST);
+	rec.filename_tmp = fdb_makepath_tmp(m->domain, FDB_MANIFEST);
+	rec.buf = out.buf;
+	rec.len = out.len;
+
+	if (!rec.filename || !rec.filename_tmp)
+		goto done;
+
+	if (!fdb_write_file(&rec, fdb_sync != FDB_SYNC_NONE) || !fdb_commit_rename(&rec))
+		goto done;
+
+	if (!fdb_manifest_dirtime(m->domain, m->layout, &times[1]))
+		goto done;
+
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_OMIT;
+
+	if (utimensat(AT_FDCWD, rec.filename, times, 0)) {
+		LOG_PERROR(rec.filename);
+		goto done;
+	}
+
+	m->dirty_fl = 0;
+	ret = 1;
+done:
+	free(out.buf);
+	free(rec.filename);
+	free(rec.filename_tmp);
+
+	return ret;
+}
+
+/**
+ * find the manifest of a domain, loading or rebuilding it if needed.
+ * only called from the main thread.
+ */
+struct fdb_manifest *
+fdb_manifest_get(const char *domain)
+{
+	struct fdb_manifest *m = fdb_manifest_find(domain);
+
+	if (m)
+		return m;
+
+	m = calloc(1, sizeof(*m));
+
+	if (!m || !(m->domain = strdup(domain))) {
+		LOG_PERROR("calloc()");
+		free(m);
+		return NULL; /* failure */
+	}
+
+	if (!fdb_manifest_read(m) && !fdb_manifest_scan(m)) {
+		free(m->domain);
+		free(m);
+		return NULL; /* failure */
+	}
+
+	pthread_mutex_lock(&fdb_commit_mutex);
+	m->next = fdb_manifests;
+	fdb_manifests = m;
+	pthread_mutex_unlock(&fdb_commit_mutex);
+
+	return m;
+}
+
+void
+fdb_manifest_set_layout(struct fdb_manifest *m, enum fdb_layout layout)
+{
+	pthread_mutex_lock(&fdb_commit_mutex);
+	if (m->layout != layout) {
+		m->layout = layout;
+		m->dirty_fl = 1;
+	}
+	pthread_mutex_unlock(&fdb_commit_mutex);
+}
+
+/**
+ * save changed manifests and free them all.
+ * the persistence thread must be stopped.
+ */
+void
+fdb_manifest_free_all(void)
+{
+	while (fdb_manifests) {
+		struct fdb_manifest *m = fdb_manifests;
+
+		fdb_manifests = m->next;
+
+		if ((m->dirty_fl || !fdb_manifest_current(m)) && !fdb_manifest_write(m))
+			LOG_ERROR("could not save manifest of %s, it will be rebuilt", m->domain);
+
+		fdb_manifest_clear(m);
+		free(m->domain);
+		free(m);
+	}
+}
@@ -0,0 +1,417 @@
+/**
+ * @file fsck.c
+ *
+ * boris-fsck - verify the checksums of an fdb data directory.
+ *
+ * Reads every record and journal of the given domains, or of every domain
+ * in the data directory, on all cores and reports the files that are damaged. Run it while the server is stopped,
+ * or expect a few false reports for files that are being replaced.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fdbcheck.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+enum fsck_kind {
+	FSCK_RECORD,
+	FSCK_JOURNAL,
+};
+
+enum fsck_result {
+	FSCK_OK,
+	FSCK_UNSEALED,
+	FSCK_DAMAGED,
+};
+
+struct fsck_file {
+	char *path;
+	enum fsck_kind kind;
+	enum fsck_result result;
+	char reason[96];
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static struct fsck_file *fsck_files;
+static size_t fsck_nr_files, fsck_max_files;
+static size_t fsck_next_file;
+static pthread_mutex_t fsck_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned fsck_leftovers;
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+static int
+fsck_add(const char *dir, const char *name, enum fsck_kind kind)
+{
+	struct fsck_file *f;
+	size_t len;
+
+	if (fsck_nr_files >= fsck_max_files) {
+		size_t new_max = fsck_max_files ? fsck_max_files * 2 : 256;
+
+		f = realloc(fsck_files, new_max * sizeof(*f));
+		if (!f) {
+			perror("realloc()");
+			return 0; /* failure */
+		}
+		fsck_files = f;
+		fsck_max_files = new_max;
+	}
+
+	f = &fsck_files[fsck_nr_files];
+	len = strlen(dir) + 1 + strlen(name) + 1;
+	f->path = malloc(len);
+	if (!f->path) {
+		perror("malloc()");
+		return 0; /* failure */
+	}
+	snprintf(f->path, len, "%s/%s", dir, name);
+	f->kind = kind;
+	f->result = FSCK_OK;
+	f->reason[0] = 0;
+	fsck_nr_files++;
+
+	return 1; /* success */
+}
+
+/** shard directories of the hashed layout are named ".hh". */
+static int
+fsck_isshardname(const char *name)
+{
+	return name[0] == '.' && isxdigit((unsigned char)name[1])
+		&& isxdigit((unsigned char)name[2]) && !name[3];
+}
+
+static int
+fsck_hassuffix(const char *name, const char *suffix)
+{
+	size_t len = strlen(name), slen = strlen(suffix);
+
+	return len > slen && !strcmp(name + len - slen, suffix);
+}
+
+/**
+ * collect the files of one directory of a domain.
+ * top is set for the domain itself, where journals and shards live.
+ */
+static int
+fsck_scan(const char *dir, int top)
+{
+	struct dirent *d;
+	DIR *dh;
+	int ret = 1;
+
+	dh = opendir(dir);
+	if (!dh) {
+		perror(dir);
+		return 0; /* failure */
+	}
+
+	while (ret && (d = readdir(dh))) {
+		const char *name = d->d_name;
+
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+
+		if (top && fsck_isshardname(name)) {
+			char sub[1024];
+
+			snprintf(sub, sizeof(sub), "%s/%s", dir, name);
+			ret = fsck_scan(sub, 0);
+		} else if (top && (!strcmp(name, ".journal") || !strcmp(name, ".journal.old"))) {
+			ret = fsck_add(dir, name, FSCK_JOURNAL);
+		} else if (fsck_hassuffix(name, ".tmp")) {
+			printf("%s/%s: left over from an unfinished write\n", dir, name);
+			fsck_leftovers++;
+		} else if (name[0] != '.' && !fsck_hassuffix(name, "~")) {
+			ret = fsck_add(dir, name, FSCK_RECORD);
+		}
+	}
+
+	closedir(dh);
+
+	return ret;
+}
+
+/**
+ * scan every domain of datadir, each one a directory.
+ */
+static int
+fsck_scan_all(const char *datadir)
+{
+	struct dirent *d;
+	DIR *dh;
+	int ret = 1;
+
+	dh = opendir(datadir);
+	if (!dh) {
+		perror(datadir);
+		return 0; /* failure */
+	}
+
+	while (ret && (d = readdir(dh))) {
+		char dir[1024];
+		struct stat st;
+
+		if (d->d_name[0] == '.')
+			continue; /* ., .. and hidden files */
+
+		snprintf(dir, sizeof(dir), "%s/%s", datadir, d->d_name);
+		if (stat(dir, &st)) {
+			perror(dir);
+			ret = 0;
+		} else if (S_ISDIR(st.st_mode)) {
+			ret = fsck_scan(dir, 1);
+		}
+	}
+
+	closedir(dh);
+
+	return ret;
+}
+
+static char *
+fsck_load(const char *path, size_t *len_out)
+{
+	struct stat st;
+	char *buf;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	if (fstat(fileno(f), &st) || !(buf = malloc(st.st_size + 1))) {
+		fclose(f);
+		return NULL;
+	}
+
+	*len_out = fread(buf, 1, st.st_size, f);
+	buf[*len_out] = 0;
+
+	if (ferror(f)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+
+	return buf;
+}
+
+static void
+fsck_check_record(struct fsck_file *f, const char *buf, size_t len)
+{
+	uint32_t crc;
+	size_t line;
+
+	switch (fdb_check_record(buf, &len, &crc)) {
+	case FDB_CHECK_OK:
+		break;
+	case FDB_CHECK_UNSEALED:
+		f->result = FSCK_UNSEALED;
+		break;
+	case FDB_CHECK_DAMAGED:
+		f->result = FSCK_DAMAGED;
+		snprintf(f->reason, sizeof(f->reason), "checksum does not match");
+		return;
+	}
+
+	line = fdb_check_lines(buf, len);
+	if (line) {
+		f->result = FSCK_DAMAGED;
+		snprintf(f->reason, sizeof(f->reason), "line %zu is not a name and value", line);
+	}
+}
+
+/**
+ * the server stops replaying at the first bad journal line, so only a
+ * bad line with good lines after it loses changes. a cut short last line
+ * is a write that never finished and is not reported.
+ */
+static void
+fsck_check_journal(struct fsck_file *f, const char *buf, size_t len)
+{
+	const char *b, *nl, *end = buf + len;
+	size_t line, bad = 0;
+
+	for (b = buf, line = 1; b < end; b = nl + 1, line++) {
+		nl = memchr(b, '\n', end - b);
+
+		if (!nl)
+			break; /* unfinished write */
+
+		if (!fdb_check_journal_line(b, nl)) {
+			if (!bad)
+				bad = line;
+		} else if (bad) {
+			f->result = FSCK_DAMAGED;
+			snprintf(f->reason, sizeof(f->reason), "line %zu is damaged, later changes will be lost", bad);
+			return;
+		}
+	}
+}
+
+static void *
+fsck_worker(void *p)
+{
+	(void)p;
+
+	for (;;) {
+		struct fsck_file *f;
+		size_t len;
+		char *buf;
+
+		pthread_mutex_lock(&fsck_mutex);
+		f = fsck_next_file < fsck_nr_files ? &fsck_files[fsck_next_file++] : NULL;
+		pthread_mutex_unlock(&fsck_mutex);
+
+		if (!f)
+			break;
+
+		buf = fsck_load(f->path, &len);
+		if (!buf) {
+			f->result = FSCK_DAMAGED;
+			snprintf(f->reason, sizeof(f->reason), "%s", strerror(errno));
+			continue;
+		}
+
+		if (f->kind == FSCK_JOURNAL)
+			fsck_check_journal(f, buf, len);
+		else
+			fsck_check_record(f, buf, len);
+
+		free(buf);
+	}
+
+	return NULL;
+}
+
+static int
+fsck_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct fsck_file*)a)->path, ((const struct fsck_file*)b)->path);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-j threads] [-d datadir] [domain...]\n", prog);
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *datadir = "data";
+	unsigned nr_damaged = 0, nr_unsealed = 0;
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *threads;
+	size_t i;
+	long t;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hj:d:")) != -1) {
+		switch (opt) {
+		case 'j':
+			nr_threads = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			datadir = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	if (optind == argc && !fsck_scan_all(datadir))
+		return 2;
+
+	/* a domain asked for by name must exist. */
+	for (; optind < argc; optind++) {
+		char dir[1024];
+
+		snprintf(dir, sizeof(dir), "%s/%s", datadir, argv[optind]);
+		if (!fsck_scan(dir, 1))
+			return 2;
+	}
+
+	qsort(fsck_files, fsck_nr_files, sizeof(*fsck_files), fsck_compare);
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads) {
+		perror("calloc()");
+		return 2;
+	}
+
+	for (t = 0; t < nr_threads; t++) {
+		if (pthread_create(&threads[t], NULL, fsck_worker, NULL)) {
+			perror("pthread_create()");
+			break;
+		}
+	}
+
+	if (!t)
+		fsck_worker(NULL);
+
+	while (t > 0)
+		pthread_join(threads[--t], NULL);
+
+	free(threads);
+
+	for (i = 0; i < fsck_nr_files; i++) {
+		struct fsck_file *f = &fsck_files[i];
+
+		if (f->result == FSCK_DAMAGED) {
+			printf("%s: %s\n", f->path, f->reason);
+			nr_damaged++;
+		} else if (f->result == FSCK_UNSEALED) {
+			nr_unsealed++;
+		}
+
+		free(f->path);
+	}
+
+	free(fsck_files);
+
+	printf("%zu files checked, %u damaged, %u without checksums, %u left over\n",
+		fsck_nr_files, nr_damaged, nr_unsealed, fsck_leftovers);
+
+	return nr_damaged ? 1 : 0;
+}
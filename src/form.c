@@ -32,6 +32,8 @@
 #include <debug.h>
 #include <game.h>
 #include <user.h>
+#include <login.h>
+#include <pwhash.h>
 
 /******************************************************************************
  * Types and data structures
@@ -474,30 +476,45 @@ form_createaccount_password2_check(DESCRIPTOR_DATA *cl, const char *str)
 	return 0;
 }
 
-/** undocumented - please add documentation. */
+/** create the account once the password has been hashed on the pool. */
 static void
-form_createaccount_close(DESCRIPTOR_DATA *cl, struct form_state *fs)
+form_createaccount_done(DESCRIPTOR_DATA *cl, int result, const char *crypttext, void *p)
 {
-	const char *username, *password, *email;
+	const char *username, *email;
+	struct form_state *fs;
+	const struct form *f;
 	struct user *u;
-	const struct form *f = fs->form;
 
+	(void)p;
+
+	if (!cl) {
+		return; /* client disconnected, the form is gone */
+	}
+
+	fs = cl->state.form;
+	f = fs->form;
 	username = form_getvalue(f, fs->nr_value, fs->value, "USERNAME");
-	password = form_getvalue(f, fs->nr_value, fs->value, "PASSWORD");
 	email = form_getvalue(f, fs->nr_value, fs->value, "EMAIL");
 
-	LOG_DEBUG("%s:create account: '%s'", telnetclient_socket_name(cl), username);
+	if (!result || !crypttext) {
+		LOG_ERROR("%s:could not hash password", telnetclient_socket_name(cl));
+		telnetclient_printf(cl, "Could not create user named '%s'\n", username);
+		menu_start_input(cl, &gamemenu_login);
+		return;
+	}
 
+	/* someone may have taken the name while the password was hashed */
 	if (user_exists(username)) {
 		telnetclient_puts(cl, mud_config.msg_userexists);
+		menu_start_input(cl, &gamemenu_login);
 		return;
 	}
 
-	LOG_TODO("u = user_create(\"%s\", \"%s\", \"%s\");", username, password, email);
-	u = user_create(username, password, email);
+	u = user_create(username, crypttext, email);
 
 	if (!u) {
 		telnetclient_printf(cl, "Could not create user named '%s'\n", username);
+		menu_start_input(cl, &gamemenu_login);
 		return;
 	}
 
@@ -507,6 +524,32 @@ form_createaccount_close(DESCRIPTOR_DATA *cl, struct form_state *fs)
 	menu_start_input(cl, &gamemenu_login);
 }
 
+/** hash the new password on the pool, see form_createaccount_done(). */
+static void
+form_createaccount_close(DESCRIPTOR_DATA *cl, struct form_state *fs)
+{
+	const char *username, *password;
+	const struct form *f = fs->form;
+
+	username = form_getvalue(f, fs->nr_value, fs->value, "USERNAME");
+	password = form_getvalue(f, fs->nr_value, fs->value, "PASSWORD");
+
+	LOG_DEBUG("%s:create account: '%s'", telnetclient_socket_name(cl), username);
+
+	if (user_exists(username)) {
+		telnetclient_puts(cl, mud_config.msg_userexists);
+		return;
+	}
+
+	if (!pwhash_make(cl, password, form_createaccount_done, NULL)) {
+		telnetclient_printf(cl, "Could not create user named '%s'\n", username);
+		return;
+	}
+
+	/* form state stays intact until the hash is done */
+	telnetclient_start_lineinput(cl, login_wait_lineinput, "");
+}
+
 /** undocumented - please add documentation. */
 static void
 form_start(void *p, long unused2, void *form)
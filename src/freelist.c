@@ -27,6 +27,7 @@
 #define LOG_SUBSYSTEM "freelist"
 #include "log.h"
 #include "debug.h"
+#include "slab.h"
 #include <stdlib.h>
 
 struct freelist_entry;
@@ -55,6 +56,9 @@ struct freelist_entry {
 	struct freelist_extent extent;
 };
 
+/** entries of every freelist. */
+static struct slab freelist_entry_slab = SLAB_INIT("freelist_entry", struct freelist_entry);
+
 #if !defined(NTEST) || !defined(NDEBUG)
 /** print a freelist to stderr. */
 static void
@@ -78,12 +82,8 @@ freelist_ll_free(struct freelist_entry *e)
 {
 	assert(e != NULL);
 	assert(e->global._prev != NULL);
-	assert(e->global._prev != (void*)0x99999999);
 	LIST_REMOVE(e, global);
-#ifndef NDEBUG
-	memset(e, 0x99, sizeof * e); /* fill with fake data before freeing */
-#endif
-	free(e);
+	slab_free(&freelist_entry_slab, e);
 }
 
 /**
@@ -94,12 +94,10 @@ freelist_ll_new(struct freelist_entry **prev, unsigned ofs, unsigned count)
 {
 	struct freelist_entry *new;
 	assert(prev != NULL);
-	assert(prev != (void*)0x99999999);
-	new = malloc(sizeof * new);
-	assert(new != NULL);
+	new = slab_alloc(&freelist_entry_slab);
 
 	if (!new) {
-		LOG_PERROR("malloc()");
+		LOG_ERROR("could not allocate freelist entry");
 		return 0;
 	}
 
@@ -211,7 +209,6 @@ freelist_pool(struct freelist *fl, unsigned ofs, unsigned count)
 
 	for (curr = LIST_TOP(fl->global); curr; curr = LIST_NEXT(curr, global)) {
 		assert(curr != last);
-		assert(curr != (void*)0x99999999);
 
 		if (last) {
 			assert(LIST_NEXT(last, global) == curr); /* sanity check */
@@ -239,7 +236,6 @@ freelist_pool(struct freelist *fl, unsigned ofs, unsigned count)
 			assert(LIST_PREVPTR(curr, global) == &LIST_NEXT(last, global));
 			freelist_ll_free(curr);
 			assert(LIST_TOP(fl->global) != curr);
-			assert(LIST_NEXT(last, global) != (void*)0x99999999);
 			assert(LIST_NEXT(last, global) != curr); /* deleting it must take it off the list */
 			new = curr = last;
 			break;
@@ -64,11 +64,4 @@
 /** DIE - print the function and line number then abort. */
 #define DIE() do { LOG_ERROR("abort!"); abort(); } while(0)
 
-#ifndef NDEBUG
-#include <string.h>
-/** initialize with junk - used to find unitialized values. */
-#  define JUNKINIT(ptr, len) memset((ptr), 0xBB, (len))
-#else
-#  define JUNKINIT(ptr, len) /* do nothing */
-#endif
 #endif
@@ -99,7 +99,7 @@ eventlog(const char *type, const char *fmt, ...)
 
 	/* make certain the last character is a newline */
 	if (n > 0 && buf[n - 1] != '\n') {
-		if (n == sizeof buf) n--;
+		if (n > (int)sizeof buf - 2) n = sizeof buf - 2;
 
 		buf[n] = '\n';
 		buf[n + 1] = 0;
@@ -138,11 +138,14 @@ eventlog_server_shutdown(void)
 	eventlog("SHUTDOWN", "\n");
 }
 
-/** report a failed login attempt. */
+/**
+ * report a failed login attempt.
+ * fails and throttled are the running counts for the remote address.
+ */
 void
-eventlog_login_failattempt(const char *username, const char *peer_str)
+eventlog_login_failattempt(const char *username, const char *peer_str, unsigned fails, unsigned throttled)
 {
-	eventlog("LOGINFAIL", "remote=%s name='%s'\n", peer_str, username);
+	eventlog("LOGINFAIL", "remote=%s name='%s' fails=%u throttled=%u\n", peer_str, username, fails, throttled);
 }
 
 /** report a successful login(sign-on) to eventlog. */
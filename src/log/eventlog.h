@@ -7,7 +7,7 @@ void eventlog(const char *type, const char *fmt, ...);
 void eventlog_connect(const char *peer_str);
 void eventlog_server_startup(void);
 void eventlog_server_shutdown(void);
-void eventlog_login_failattempt(const char *username, const char *peer_str);
+void eventlog_login_failattempt(const char *username, const char *peer_str, unsigned fails, unsigned throttled);
 void eventlog_signon(const char *username, const char *peer_str);
 void eventlog_signoff(const char *username, const char *peer_str);
 void eventlog_toomany(void);
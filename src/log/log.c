@@ -55,6 +55,10 @@ log_vlogf(int level, const char *subsystem, const char *fmt, va_list ap)
 	/* apply format string. */
 	i += vsnprintf(buf + i, sizeof buf - i - 1, fmt, ap);
 
+	/* long messages are truncated, leave room for the newline. */
+	if (i > (int)sizeof buf - 2)
+		i = sizeof buf - 2;
+
 	/* add newline if one not found. */
 	if (i && buf[i - 1] != '\n') strcpy(buf + i, "\n");
 
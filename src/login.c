@@ -31,8 +31,86 @@
 #include <eventlog.h>
 #include <game.h>
 #include <user.h>
+#include <pwhash.h>
+#include <throttle.h>
+#include <timer.h>
 
-/** undocumented - please add documentation. */
+/** ignore input while a password is being hashed. */
+void
+login_wait_lineinput(DESCRIPTOR_DATA *cl, const char *line)
+{
+	(void)line;
+
+	telnetclient_puts(cl, "Please wait...\n");
+}
+
+/** remote address used for login throttling, without the port. */
+static const char *
+login_remote_addr(DESCRIPTOR_DATA *cl)
+{
+	return telnetclient_remote_addr(cl);
+}
+
+/** report a failed attempt with the running counts for its address. */
+static void
+login_report_failure(DESCRIPTOR_DATA *cl)
+{
+	unsigned fails, throttled;
+
+	throttle_login_counters(login_remote_addr(cl), &fails, &throttled);
+	eventlog_login_failattempt(cl->state.login.username, telnetclient_socket_name(cl), fails, throttled);
+}
+
+/** answer a throttled attempt once its tarpit delay has passed. */
+static void
+login_tarpit_done(void *p)
+{
+	DESCRIPTOR_DATA *cl = p;
+
+	telnetclient_puts(cl, mud_config.msgfile_badpassword);
+	login_report_failure(cl);
+	menu_start_input(cl, &gamemenu_login);
+}
+
+/** finish the login after the password check ran on the hashing pool. */
+static void
+login_password_done(DESCRIPTOR_DATA *cl, int result, const char *crypttext, void *p)
+{
+	struct user *u = p;
+
+	/* a correct password upgrades an old hash, even if the client left */
+	if (u && result && crypttext) {
+		if (user_password_set(u, crypttext)) {
+			LOG_INFO("Upgraded password hash for '%s'", user_username(u));
+		}
+	}
+
+	if (!cl) {
+		user_put(&u);
+		return; /* client disconnected */
+	}
+
+	if (u && result) {
+		telnetclient_setuser(cl, u);
+		eventlog_signon(cl->state.login.username, telnetclient_socket_name(cl));
+		telnetclient_printf(cl, "Hello, %s.\n\n", user_username(u));
+		menu_start_input(cl, &gamemenu_main);
+		user_put(&u);
+		return; /* success */
+	}
+
+	telnetclient_puts(cl, u ? mud_config.msgfile_badpassword : mud_config.msgfile_noaccount);
+	user_put(&u);
+
+	/* report the attempt */
+	throttle_login_failed(login_remote_addr(cl));
+	login_report_failure(cl);
+
+	/* failed logins go back to the login menu or disconnect */
+	menu_start_input(cl, &gamemenu_login);
+}
+
+/** verify the password on the hashing pool, see login_password_done(). */
 void
 login_password_lineinput(DESCRIPTOR_DATA *cl, const char *line)
 {
@@ -42,32 +120,33 @@ login_password_lineinput(DESCRIPTOR_DATA *cl, const char *line)
 	assert(line != NULL);
 	assert(cl->state.login.username[0] != '\0'); /* must have a valid username */
 
-	LOG_TODO("complete login process");
 	LOG_DEBUG("Login attempt: Username='%s'", cl->state.login.username);
 
+	/* refuse to hash anything for an address that is out of attempts */
+	if (!throttle_login_allow(login_remote_addr(cl))) {
+		LOG_INFO("Login throttled for %s", telnetclient_socket_name(cl));
+		telnetclient_start_lineinput(cl, login_wait_lineinput, "");
+		if (!timer_add(mud_config.throttle_tarpit, login_tarpit_done, cl))
+			login_tarpit_done(cl);
+		return;
+	}
+
 	u = user_lookup(cl->state.login.username);
 
 	if (u) {
 		LOG_INFO("User '%s' found!", cl->state.login.username);
-		/* verify the password */
-		if (user_password_check(u, line)) {
-			telnetclient_setuser(cl, u);
-			eventlog_signon(cl->state.login.username, telnetclient_socket_name(cl));
-			telnetclient_printf(cl, "Hello, %s.\n\n", user_username(u));
-			menu_start_input(cl, &gamemenu_main);
-			return; /* success */
-		}
-
-		telnetclient_puts(cl, mud_config.msgfile_badpassword);
-	} else {
-		telnetclient_puts(cl, mud_config.msgfile_noaccount);
+		user_get(u); /* hold until login_password_done() */
 	}
 
-	/* report the attempt */
-	eventlog_login_failattempt(cl->state.login.username, telnetclient_socket_name(cl));
+	/* a missing account is hashed too, so both take the same time */
+	if (!pwhash_check(cl, user_password_crypt(u), line, login_password_done, u)) {
+		user_put(&u);
+		telnetclient_puts(cl, mud_config.msg_tryagain);
+		menu_start_input(cl, &gamemenu_login);
+		return; /* failure */
+	}
 
-	/* failed logins go back to the login menu or disconnect */
-	menu_start_input(cl, &gamemenu_login);
+	telnetclient_start_lineinput(cl, login_wait_lineinput, "");
 }
 
 /** undocumented - please add documentation. */
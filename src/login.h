@@ -3,6 +3,7 @@
 #include <boris.h>
 #include <mud.h>
 
+void login_wait_lineinput(DESCRIPTOR_DATA *cl, const char *line);
 void login_password_lineinput(DESCRIPTOR_DATA *cl, const char *line);
 void login_password_start(void *p, long unused2, void *unused3);
 void login_username_lineinput(DESCRIPTOR_DATA *cl, const char *line);
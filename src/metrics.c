@@ -0,0 +1,512 @@
+/**
+ * @file metrics.c
+ *
+ * Runtime counters, gauges and latency histograms.
+ *
+ * Metrics are registered by name and label set, and updated with relaxed
+ * atomics so the game loop and the persistence thread never wait for each
+ * other or for a reader. Registration and reading take a mutex, both are
+ * rare. Nothing is removed until shutdown, so a pointer to a metric can
+ * be kept for the life of the server.
+ *
+ * Histograms keep microseconds in log buckets, four per power of two, so
+ * every bucket is within 25% of its values from 1us to days. The text
+ * format reports cumulative buckets at powers of four, in seconds, the way
+ * Prometheus expects them.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "metrics.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define LOG_SUBSYSTEM "metrics"
+#include <log.h>
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+/** sub-buckets per power of two. */
+#define METRICS_SUB 4
+#define METRICS_SUB_BITS 2
+/** powers of two kept, larger values land in the last bucket. */
+#define METRICS_OCTAVES 40
+#define METRICS_BUCKETS (METRICS_OCTAVES * METRICS_SUB)
+/** largest reported bucket is 4^METRICS_LE_MAX microseconds (67s). */
+#define METRICS_LE_MAX 13
+
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+struct metric {
+	struct metric *next;
+	char *labels;
+	_Atomic uint64_t value; /**< count, or the bits of a gauge's double. */
+	_Atomic uint64_t sum; /**< histogram total in microseconds. */
+	_Atomic uint64_t *bucket;
+};
+
+struct metric_family {
+	struct metric_family *next;
+	enum metric_type type;
+	char *name;
+	char *help;
+	struct metric *head, **tail;
+};
+
+/** text being built for a reader. */
+struct metrics_out {
+	char *s;
+	size_t len, max;
+	int error_fl;
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct metric_family *metrics_head, **metrics_tail = &metrics_head;
+
+static const char *metrics_type_names[] = { "counter", "gauge", "histogram" };
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+/** find the bucket for a value. */
+static unsigned
+metrics_bucket(uint64_t v)
+{
+	unsigned e, i;
+
+	if (v < METRICS_SUB)
+		return v;
+
+	e = 63 - __builtin_clzll(v);
+	i = (e - METRICS_SUB_BITS + 1) * METRICS_SUB + ((v >> (e - METRICS_SUB_BITS)) & (METRICS_SUB - 1));
+
+	return i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1;
+}
+
+/** find or add a metric. the caller holds metrics_mutex. */
+static struct metric *
+metrics_find(enum metric_type type, const char *name, const char *labels, const char *help)
+{
+	struct metric_family *f;
+	struct metric *m;
+
+	if (!labels)
+		labels = "";
+
+	for (f = metrics_head; f; f = f->next) {
+		if (!strcmp(f->name, name))
+			break;
+	}
+
+	if (f && f->type != type) {
+		LOG_ERROR("metric %s registered as a %s and a %s", name,
+			metrics_type_names[f->type], metrics_type_names[type]);
+		return NULL;
+	}
+
+	if (!f) {
+		f = calloc(1, sizeof(*f));
+		if (!f) {
+			LOG_PERROR("calloc()");
+			return NULL;
+		}
+		f->type = type;
+		f->name = strdup(name);
+		f->help = strdup(help ? help : "");
+		if (!f->name || !f->help) {
+			LOG_PERROR("strdup()");
+			free(f->name);
+			free(f->help);
+			free(f);
+			return NULL;
+		}
+		f->tail = &f->head;
+		*metrics_tail = f;
+		metrics_tail = &f->next;
+	}
+
+	for (m = f->head; m; m = m->next) {
+		if (!strcmp(m->labels, labels))
+			return m;
+	}
+
+	m = calloc(1, sizeof(*m));
+	if (!m) {
+		LOG_PERROR("calloc()");
+		return NULL;
+	}
+
+	m->labels = strdup(labels);
+	if (type == METRIC_HISTOGRAM)
+		m->bucket = calloc(METRICS_BUCKETS, sizeof(*m->bucket));
+	if (!m->labels || (type == METRIC_HISTOGRAM && !m->bucket)) {
+		LOG_PERROR("calloc()");
+		free(m->labels);
+		free(m->bucket);
+		free(m);
+		return NULL;
+	}
+
+	*f->tail = m;
+	f->tail = &m->next;
+
+	return m;
+}
+
+static struct metric *
+metrics_register(enum metric_type type, const char *name, const char *labels, const char *help)
+{
+	struct metric *m;
+
+	pthread_mutex_lock(&metrics_mutex);
+	m = metrics_find(type, name, labels, help);
+	pthread_mutex_unlock(&metrics_mutex);
+
+	return m;
+}
+
+/**
+ * find or register a counter.
+ * @param labels a Prometheus label list such as transport="telnet", or NULL.
+ */
+struct metric *
+metrics_counter(const char *name, const char *labels, const char *help)
+{
+	return metrics_register(METRIC_COUNTER, name, labels, help);
+}
+
+/** find or register a gauge. */
+struct metric *
+metrics_gauge(const char *name, const char *labels, const char *help)
+{
+	return metrics_register(METRIC_GAUGE, name, labels, help);
+}
+
+/** find or register a histogram of microseconds. */
+struct metric *
+metrics_histogram(const char *name, const char *labels, const char *help)
+{
+	return metrics_register(METRIC_HISTOGRAM, name, labels, help);
+}
+
+/** increase a counter. m may be NULL if registration failed. */
+void
+metrics_add(struct metric *m, uint64_t n)
+{
+	if (m)
+		atomic_fetch_add_explicit(&m->value, n, memory_order_relaxed);
+}
+
+/** set a gauge. */
+void
+metrics_set(struct metric *m, double v)
+{
+	uint64_t bits;
+
+	if (!m)
+		return;
+
+	memcpy(&bits, &v, sizeof(bits));
+	atomic_store_explicit(&m->value, bits, memory_order_relaxed);
+}
+
+/** add d to a gauge, which may be changed from several threads. */
+void
+metrics_adjust(struct metric *m, double d)
+{
+	uint64_t old, bits;
+	double v;
+
+	if (!m)
+		return;
+
+	old = atomic_load_explicit(&m->value, memory_order_relaxed);
+	do {
+		memcpy(&v, &old, sizeof(v));
+		v += d;
+		memcpy(&bits, &v, sizeof(bits));
+	} while (!atomic_compare_exchange_weak_explicit(&m->value, &old, bits,
+		memory_order_relaxed, memory_order_relaxed));
+}
+
+/** count a duration in a histogram. */
+void
+metrics_observe(struct metric *m, uint64_t usec)
+{
+	if (!m)
+		return;
+
+	/* a bucket holds values above its lower bound up to and including its
+	 * upper bound, so a value on an le boundary is counted in that le. */
+	atomic_fetch_add_explicit(&m->bucket[metrics_bucket(usec ? usec - 1 : 0)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&m->sum, usec, memory_order_relaxed);
+	atomic_fetch_add_explicit(&m->value, 1, memory_order_relaxed);
+}
+
+/** monotonic time for measuring durations. */
+uint64_t
+metrics_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+metrics_printf(struct metrics_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (out->error_fl)
+		return;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(out->s + out->len, out->max - out->len, fmt, ap);
+		va_end(ap);
+
+		if (n < 0) {
+			out->error_fl = 1;
+			return;
+		}
+
+		if (out->len + n < out->max) {
+			out->len += n;
+			return;
+		}
+
+		size_t max = out->max * 2 + n;
+		char *s = realloc(out->s, max);
+
+		if (!s) {
+			LOG_PERROR("realloc()");
+			out->error_fl = 1;
+			return;
+		}
+
+		out->s = s;
+		out->max = max;
+	}
+}
+
+/** write the label list with one more label added. */
+static const char *
+metrics_labels(char *buf, size_t max, const char *labels, const char *extra)
+{
+	if (!*labels && !extra)
+		return "";
+
+	snprintf(buf, max, "{%s%s%s}", labels, *labels && extra ? "," : "", extra ? extra : "");
+
+	return buf;
+}
+
+static void
+metrics_write_histogram(struct metrics_out *out, const struct metric_family *f, const struct metric *m)
+{
+	char labels[256], le[64];
+	uint64_t cumulative = 0, count;
+	unsigned i = 0, k;
+
+	for (k = 0; k <= METRICS_LE_MAX; k++) {
+		uint64_t limit = 1ull << (2 * k);
+		unsigned end = metrics_bucket(limit);
+
+		for (; i < end; i++)
+			cumulative += atomic_load_explicit(&m->bucket[i], memory_order_relaxed);
+
+		snprintf(le, sizeof(le), "le=\"%.9g\"", limit / 1e6);
+		metrics_printf(out, "%s_bucket%s %llu\n", f->name,
+			metrics_labels(labels, sizeof(labels), m->labels, le),
+			(unsigned long long)cumulative);
+	}
+
+	/* count is read last, so +Inf is never below a bucket. */
+	for (; i < METRICS_BUCKETS; i++)
+		cumulative += atomic_load_explicit(&m->bucket[i], memory_order_relaxed);
+	count = atomic_load_explicit(&m->value, memory_order_relaxed);
+	if (count < cumulative)
+		count = cumulative;
+
+	metrics_printf(out, "%s_bucket%s %llu\n", f->name,
+		metrics_labels(labels, sizeof(labels), m->labels, "le=\"+Inf\""),
+		(unsigned long long)count);
+	metrics_printf(out, "%s_sum%s %.6f\n", f->name,
+		metrics_labels(labels, sizeof(labels), m->labels, NULL),
+		atomic_load_explicit(&m->sum, memory_order_relaxed) / 1e6);
+	metrics_printf(out, "%s_count%s %llu\n", f->name,
+		metrics_labels(labels, sizeof(labels), m->labels, NULL),
+		(unsigned long long)count);
+}
+
+/**
+ * every metric in the Prometheus text format.
+ * @return a string for the caller to free, or NULL if out of memory.
+ */
+char *
+metrics_text(size_t *len_out)
+{
+	struct metrics_out out = { NULL, 0, 0, 0 };
+	const struct metric_family *f;
+	const struct metric *m;
+	char labels[256];
+
+	out.max = 4096;
+	out.s = malloc(out.max);
+	if (!out.s) {
+		LOG_PERROR("malloc()");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&metrics_mutex);
+	for (f = metrics_head; f; f = f->next) {
+		metrics_printf(&out, "# HELP %s %s\n", f->name, f->help);
+		metrics_printf(&out, "# TYPE %s %s\n", f->name, metrics_type_names[f->type]);
+
+		for (m = f->head; m; m = m->next) {
+			uint64_t bits = atomic_load_explicit(&m->value, memory_order_relaxed);
+			double v;
+
+			switch (f->type) {
+			case METRIC_COUNTER:
+				metrics_printf(&out, "%s%s %llu\n", f->name,
+					metrics_labels(labels, sizeof(labels), m->labels, NULL),
+					(unsigned long long)bits);
+				break;
+			case METRIC_GAUGE:
+				memcpy(&v, &bits, sizeof(v));
+				metrics_printf(&out, "%s%s %.9g\n", f->name,
+					metrics_labels(labels, sizeof(labels), m->labels, NULL), v);
+				break;
+			case METRIC_HISTOGRAM:
+				metrics_write_histogram(&out, f, m);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+
+	if (out.error_fl) {
+		free(out.s);
+		return NULL;
+	}
+
+	*len_out = out.len;
+
+	return out.s;
+}
+
+/** free every metric. nothing may update them afterwards. */
+void
+metrics_shutdown(void)
+{
+	struct metric_family *f;
+	struct metric *m;
+
+	pthread_mutex_lock(&metrics_mutex);
+	while ((f = metrics_head)) {
+		metrics_head = f->next;
+		while ((m = f->head)) {
+			f->head = m->next;
+			free(m->labels);
+			free(m->bucket);
+			free(m);
+		}
+		free(f->name);
+		free(f->help);
+		free(f);
+	}
+	metrics_tail = &metrics_head;
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+#ifndef NTEST
+/** test bucket boundaries and the text format. */
+void
+metrics_test(void)
+{
+	struct metric *c, *g, *h;
+	uint64_t v;
+	unsigned prev = 0;
+	size_t len;
+	char *s;
+
+	/* buckets never go backwards and a bucket is within 25% of its values. */
+	for (v = 1; v < (1ull << 36); v += v / 7 + 1) {
+		unsigned b = metrics_bucket(v);
+
+		if (b < prev || (v >= METRICS_SUB && metrics_bucket(v + v / 4 + 1) == b)) {
+			LOG_ERROR("metrics bucket test failed at %llu", (unsigned long long)v);
+			exit(1);
+		}
+		prev = b;
+	}
+
+	c = metrics_counter("test_total", "kind=\"a\"", "A test counter.");
+	g = metrics_gauge("test_gauge", NULL, "A test gauge.");
+	h = metrics_histogram("test_seconds", NULL, "A test histogram.");
+	if (!c || !g || !h || c != metrics_counter("test_total", "kind=\"a\"", NULL)
+		|| metrics_gauge("test_total", NULL, NULL)) {
+		LOG_ERROR("metrics registration test failed");
+		exit(1);
+	}
+
+	metrics_add(c, 3);
+	metrics_set(g, 1.5);
+	metrics_adjust(g, -0.5);
+	metrics_observe(h, 3);
+	metrics_observe(h, 4);
+	metrics_observe(h, 5);
+	metrics_observe(h, 1048576);
+	metrics_observe(h, 100000000);
+
+	s = metrics_text(&len);
+	if (!s || !strstr(s, "test_total{kind=\"a\"} 3\n") || !strstr(s, "test_gauge 1\n")
+		|| !strstr(s, "test_seconds_bucket{le=\"4e-06\"} 2\n")
+		|| !strstr(s, "test_seconds_bucket{le=\"1.6e-05\"} 3\n")
+		|| !strstr(s, "test_seconds_bucket{le=\"0.262144\"} 3\n")
+		|| !strstr(s, "test_seconds_bucket{le=\"1.048576\"} 4\n")
+		|| !strstr(s, "test_seconds_bucket{le=\"67.108864\"} 4\n")
+		|| !strstr(s, "test_seconds_bucket{le=\"+Inf\"} 5\n")
+		|| !strstr(s, "test_seconds_count 5\n")) {
+		LOG_ERROR("metrics text test failed:\n%s", s ? s : "(null)");
+		exit(1);
+	}
+	free(s);
+
+	metrics_shutdown();
+	LOG_DEBUG("metrics test PASSED");
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+#include <stddef.h>
+#include <stdint.h>
+
+struct metric;
+
+struct metric *metrics_counter(const char *name, const char *labels, const char *help);
+struct metric *metrics_gauge(const char *name, const char *labels, const char *help);
+struct metric *metrics_histogram(const char *name, const char *labels, const char *help);
+void metrics_add(struct metric *m, uint64_t n);
+void metrics_set(struct metric *m, double v);
+void metrics_adjust(struct metric *m, double d);
+void metrics_observe(struct metric *m, uint64_t usec);
+uint64_t metrics_usec(void);
+char *metrics_text(size_t *len_out);
+void metrics_shutdown(void);
+#ifndef NTEST
+void metrics_test(void);
+#endif
+#endif
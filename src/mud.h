@@ -1,5 +1,6 @@
 #ifndef MUD_H_
 #define MUD_H_
+#include <stddef.h>
 #include <dyad.h>
 #include <terminal.h>
 #include <channel.h>
@@ -14,12 +15,15 @@ struct buf;
 typedef struct descriptor_data DESCRIPTOR_DATA;
 struct descriptor_data {
 	dyad_Stream *stream;
+	unsigned long web_conn; /**< websocket connection id, 0 for telnet. */
+	struct buf *outbuf; /**< websocket output waiting for the next flush. */
 	struct mth_data *mth;
 	LIST_ENTRY(DESCRIPTOR_DATA) list;
 	enum client_type { CLIENT_TYPE_USER = 1 } type;
 	char *host;
 	char *name;
 	struct buf *linebuf; /**< command input buffer */
+	size_t linescan; /**< bytes of linebuf already searched for a newline. */
 	struct user *user;
 	struct acs_info acs;
 	struct terminal terminal;
@@ -34,6 +38,12 @@ struct descriptor_data {
 	void (*line_input)(DESCRIPTOR_DATA *cl, const char *line);
 	char *prompt_string;
 	int prompt_flag:1;
+	int web_closed:1; /**< websocket client is freed on the next flush. */
+	int input_paused:1; /**< reading stopped until linebuf drains. */
+	int input_discard:1; /**< dropping an overlong line up to its newline. */
+	int output_congested:1; /**< over output.high, channel messages are dropped. */
+	unsigned output_dropped; /**< channel messages dropped since congested. */
+	unsigned long output_dropped_total; /**< channel messages dropped on this connection. */
 	unsigned nr_channel; /**< number of channels monitoring. */
 	struct channel **channel; /**< pointer to every monitoring channel. */
 	struct channel_member channel_member;
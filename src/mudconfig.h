@@ -22,13 +22,35 @@ struct mud_config {
 	unsigned newuser_level;
 	unsigned newuser_flags;
 	unsigned newuser_allowed; /* true if we're allowing newuser applications */
+	unsigned admin_level; /* lowest acs.level allowed to run operator commands */
 	char *eventlog_filename;
 	char *eventlog_timeformat;
 	char *msgfile_newuser_create;
 	char *msgfile_newuser_deny;
 	char *default_channels;
 	unsigned webserver_port;
+	unsigned webserver_deflate; /* offer permessage-deflate to websocket clients */
+	unsigned webstate_interval; /* ms between game state updates, 0 to disable */
 	char *form_newuser_filename;
+	unsigned input_buffer; /* unprocessed input bytes per connection before reading pauses */
+	unsigned input_rate; /* lines per connection each pass of the main loop, 0 for no limit */
+	unsigned input_budget; /* lines for all connections each pass, 0 for no limit */
+	unsigned output_high; /* queued output bytes where channel traffic is dropped */
+	unsigned output_low; /* queued output bytes where channel traffic resumes */
+	unsigned output_max; /* queued output bytes where the client is disconnected */
+	unsigned slab_poison; /* fill freed objects and check them on reuse */
+	unsigned pwhash_threads; /* 0 to hash on the main thread */
+	unsigned scrypt_log2n;
+	unsigned scrypt_r;
+	unsigned scrypt_p;
+	unsigned throttle_burst; /* login attempts per address, 0 to disable */
+	unsigned throttle_rate; /* attempts regained per minute */
+	unsigned throttle_hosts; /* addresses remembered */
+	unsigned throttle_tarpit; /* ms before a throttled attempt is answered */
+	char *fdb_sync; /* none, batch or every */
+	char *fdb_layout; /* flat or hashed */
+	unsigned fdb_commit_window; /* ms to collect saves into one batch */
+	unsigned fdb_journal_max; /* journal bytes before folding into records, 0 disables */
 	int default_family; /* IPv4 or IPv6 */
 };
 
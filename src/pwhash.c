@@ -0,0 +1,482 @@
+/**
+ * @file pwhash.c
+ *
+ * Password hashing on a pool of worker threads.
+ *
+ * Hashing with a slow KDF must not stall the game loop. Jobs are queued here
+ * and run on worker threads. Finished jobs wait on a completion queue until
+ * pwhash_poll() runs their callbacks on the main thread, so callbacks are
+ * free to touch descriptors and game state.
+ *
+ * Only the main thread touches a job's descriptor pointer. If a descriptor
+ * is destroyed while a job is in flight, pwhash_cancel() clears it and the
+ * callback receives NULL.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @version 0.7
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2008-2026, Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define _DEFAULT_SOURCE /* explicit_bzero */
+#include "pwhash.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <boris.h>
+#define LOG_SUBSYSTEM "pwhash"
+#include <log.h>
+#include <debug.h>
+#include <sha1crypt.h>
+#include <scryptcrypt.h>
+
+/** maximum number of jobs waiting for a worker. */
+#define PWHASH_QUEUE_MAX 256
+
+/** maximum number of worker threads. */
+#define PWHASH_THREADS_MAX 64
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+struct pwhash_job {
+	struct pwhash_job *next;
+	enum pwhash_type { PWHASH_CHECK, PWHASH_MAKE } type;
+	DESCRIPTOR_DATA *cl; /**< only used on the main thread. */
+	pwhash_done_fn done;
+	void *p;
+	char *crypttext; /**< stored hash to check against, NULL for no account. */
+	char *password;
+	int rehash; /**< make a new hash if the check succeeds. */
+	struct scryptcrypt_params params;
+	unsigned char salt[SCRYPTCRYPT_SALT_LEN];
+	int result;
+	char newcrypt[SCRYPTPASSWD_MAX]; /**< empty if no new hash. */
+};
+
+/** singly linked FIFO of jobs. */
+struct pwhash_queue {
+	struct pwhash_job *head, **tail;
+	unsigned count;
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static struct pwhash_queue pending, completed;
+static pthread_mutex_t pwhash_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pwhash_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t *pwhash_threads;
+static struct pwhash_job **pwhash_running; /**< job each worker is running. */
+static unsigned pwhash_nr_threads;
+static int pwhash_shutdown_fl;
+static unsigned pwhash_outstanding; /**< submitted but not delivered. main thread only. */
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+static void
+queue_init(struct pwhash_queue *q)
+{
+	q->head = NULL;
+	q->tail = &q->head;
+	q->count = 0;
+}
+
+static void
+queue_push(struct pwhash_queue *q, struct pwhash_job *job)
+{
+	job->next = NULL;
+	*q->tail = job;
+	q->tail = &job->next;
+	q->count++;
+}
+
+static struct pwhash_job *
+queue_pop(struct pwhash_queue *q)
+{
+	struct pwhash_job *job = q->head;
+
+	if (job) {
+		q->head = job->next;
+		if (!q->head)
+			q->tail = &q->head;
+		q->count--;
+	}
+
+	return job;
+}
+
+/** current cost parameters from mud_config. */
+static void
+current_params(struct scryptcrypt_params *params)
+{
+	params->log2_n = mud_config.scrypt_log2n;
+	params->r = mud_config.scrypt_r;
+	params->p = mud_config.scrypt_p;
+}
+
+/**
+ * check a password against a stored hash of any supported format.
+ * safe to call from any thread.
+ */
+int
+pwhash_checkpass(const char *crypttext, const char *plaintext)
+{
+	if (!crypttext || !plaintext)
+		return 0; /* failure */
+
+	if (!strncmp(crypttext, SCRYPTPASSWD_MAGIC, SCRYPTPASSWD_MAGIC_LEN))
+		return scryptcrypt_checkpass(crypttext, plaintext);
+
+	return sha1crypt_checkpass(crypttext, plaintext);
+}
+
+/** spend the time of a scrypt check with the job's parameters, and discard it. */
+static void
+job_dummy(struct pwhash_job *job)
+{
+	scryptcrypt_makepass(job->newcrypt, sizeof job->newcrypt,
+		job->password, job->salt, &job->params);
+	job->newcrypt[0] = 0;
+}
+
+/** do the expensive part of a job. runs on a worker thread. */
+static void
+job_run(struct pwhash_job *job)
+{
+	job->newcrypt[0] = 0;
+
+	switch (job->type) {
+	case PWHASH_CHECK:
+		if (!job->crypttext) {
+			/* no account - spend the same time as a real check */
+			job_dummy(job);
+			job->result = 0;
+			break;
+		}
+
+		job->result = pwhash_checkpass(job->crypttext, job->password);
+
+		/* a legacy hash fails fast, take as long as a missing account. */
+		if (!job->result && strncmp(job->crypttext, SCRYPTPASSWD_MAGIC, SCRYPTPASSWD_MAGIC_LEN))
+			job_dummy(job);
+
+		if (job->result && job->rehash
+		    && !scryptcrypt_makepass(job->newcrypt, sizeof job->newcrypt,
+				job->password, job->salt, &job->params)) {
+			job->newcrypt[0] = 0; /* keep the old hash */
+		}
+		break;
+	case PWHASH_MAKE:
+		job->result = scryptcrypt_makepass(job->newcrypt, sizeof job->newcrypt,
+			job->password, job->salt, &job->params);
+		if (!job->result)
+			job->newcrypt[0] = 0;
+		break;
+	}
+
+	/* the cleartext is not needed anymore */
+	explicit_bzero(job->password, strlen(job->password));
+}
+
+static void
+job_free(struct pwhash_job *job)
+{
+	if (!job)
+		return;
+
+	if (job->password) {
+		explicit_bzero(job->password, strlen(job->password));
+		free(job->password);
+	}
+	free(job->crypttext);
+	free(job);
+}
+
+static void *
+pwhash_worker(void *arg)
+{
+	unsigned self = (uintptr_t)arg;
+	struct pwhash_job *job;
+
+	pthread_mutex_lock(&pwhash_lock);
+	for (;;) {
+		while (!pending.head && !pwhash_shutdown_fl)
+			pthread_cond_wait(&pwhash_cond, &pwhash_lock);
+		if (pwhash_shutdown_fl)
+			break;
+		job = queue_pop(&pending);
+		pwhash_running[self] = job;
+		pthread_mutex_unlock(&pwhash_lock);
+
+		job_run(job);
+
+		pthread_mutex_lock(&pwhash_lock);
+		pwhash_running[self] = NULL;
+		queue_push(&completed, job);
+	}
+	pthread_mutex_unlock(&pwhash_lock);
+
+	return NULL;
+}
+
+/** queue a job for the workers, or run it now if there are no workers. */
+static int
+job_submit(struct pwhash_job *job)
+{
+	if (!pwhash_nr_threads) {
+		job_run(job);
+		queue_push(&completed, job);
+		pwhash_outstanding++;
+		return 1; /* success */
+	}
+
+	pthread_mutex_lock(&pwhash_lock);
+	if (pending.count >= PWHASH_QUEUE_MAX) {
+		pthread_mutex_unlock(&pwhash_lock);
+		LOG_WARNING("password hash queue is full");
+		return 0; /* failure */
+	}
+	queue_push(&pending, job);
+	pthread_cond_signal(&pwhash_cond);
+	pthread_mutex_unlock(&pwhash_lock);
+	pwhash_outstanding++;
+
+	return 1; /* success */
+}
+
+static struct pwhash_job *
+job_new(DESCRIPTOR_DATA *cl, enum pwhash_type type, const char *password, pwhash_done_fn done, void *p)
+{
+	struct pwhash_job *job = calloc(1, sizeof(*job));
+
+	if (!job) {
+		LOG_PERROR("calloc()");
+		return NULL;
+	}
+
+	job->type = type;
+	job->cl = cl;
+	job->done = done;
+	job->p = p;
+	job->password = strdup(password);
+	current_params(&job->params);
+
+	/* the salt PRNG is not thread safe, make it here */
+	if (!job->password || !scryptcrypt_gensalt(job->salt)) {
+		job_free(job);
+		return NULL;
+	}
+
+	return job;
+}
+
+/**
+ * check a password on the worker pool.
+ * if the check succeeds and crypttext is not a current scrypt hash, the
+ * callback receives a replacement hash.
+ * @param crypttext stored hash, or NULL if there is no such account.
+ * @return 1 if queued, 0 on failure. done is not called on failure.
+ */
+int
+pwhash_check(DESCRIPTOR_DATA *cl, const char *crypttext, const char *password, pwhash_done_fn done, void *p)
+{
+	struct pwhash_job *job;
+
+	assert(done != NULL);
+
+	job = job_new(cl, PWHASH_CHECK, password, done, p);
+	if (!job)
+		return 0; /* failure */
+
+	if (crypttext) {
+		job->crypttext = strdup(crypttext);
+		if (!job->crypttext) {
+			job_free(job);
+			return 0; /* failure */
+		}
+		job->rehash = scryptcrypt_needs_rehash(crypttext, &job->params);
+	}
+
+	if (!job_submit(job)) {
+		job_free(job);
+		return 0; /* failure */
+	}
+
+	return 1; /* success */
+}
+
+/**
+ * create a new hash on the worker pool.
+ * @return 1 if queued, 0 on failure. done is not called on failure.
+ */
+int
+pwhash_make(DESCRIPTOR_DATA *cl, const char *password, pwhash_done_fn done, void *p)
+{
+	struct pwhash_job *job;
+
+	assert(done != NULL);
+
+	job = job_new(cl, PWHASH_MAKE, password, done, p);
+	if (!job)
+		return 0; /* failure */
+
+	if (!job_submit(job)) {
+		job_free(job);
+		return 0; /* failure */
+	}
+
+	return 1; /* success */
+}
+
+/** detach a descriptor from its jobs. call before the descriptor is freed. */
+void
+pwhash_cancel(DESCRIPTOR_DATA *cl)
+{
+	struct pwhash_job *job;
+	unsigned i;
+
+	pthread_mutex_lock(&pwhash_lock);
+	for (i = 0; i < pwhash_nr_threads; i++) {
+		if (pwhash_running[i] && pwhash_running[i]->cl == cl)
+			pwhash_running[i]->cl = NULL;
+	}
+	for (job = pending.head; job; job = job->next) {
+		if (job->cl == cl)
+			job->cl = NULL;
+	}
+	for (job = completed.head; job; job = job->next) {
+		if (job->cl == cl)
+			job->cl = NULL;
+	}
+	pthread_mutex_unlock(&pwhash_lock);
+}
+
+/** run callbacks for finished jobs. call from the main loop. */
+void
+pwhash_poll(void)
+{
+	struct pwhash_queue done;
+	struct pwhash_job *job;
+
+	pthread_mutex_lock(&pwhash_lock);
+	done = completed;
+	if (!done.head)
+		done.tail = &done.head;
+	queue_init(&completed);
+	pthread_mutex_unlock(&pwhash_lock);
+
+	while ((job = queue_pop(&done))) {
+		pwhash_outstanding--;
+		job->done(job->cl, job->result, job->newcrypt[0] ? job->newcrypt : NULL, job->p);
+		job_free(job);
+	}
+}
+
+/** number of jobs whose callback has not run yet. */
+unsigned
+pwhash_pending(void)
+{
+	return pwhash_outstanding;
+}
+
+/** start the worker threads. */
+int
+pwhash_init(void)
+{
+	struct scryptcrypt_params params;
+	unsigned i;
+
+	current_params(&params);
+	if (!scryptcrypt_params_valid(&params)) {
+		LOG_ERROR("invalid scrypt parameters (log2n=%u r=%u p=%u)", params.log2_n, params.r, params.p);
+		return 0; /* failure */
+	}
+
+	queue_init(&pending);
+	queue_init(&completed);
+	pwhash_shutdown_fl = 0;
+
+	pwhash_nr_threads = mud_config.pwhash_threads;
+	if (pwhash_nr_threads > PWHASH_THREADS_MAX)
+		pwhash_nr_threads = PWHASH_THREADS_MAX;
+
+	if (pwhash_nr_threads) {
+		pwhash_threads = calloc(pwhash_nr_threads, sizeof(*pwhash_threads));
+		pwhash_running = calloc(pwhash_nr_threads, sizeof(*pwhash_running));
+		if (!pwhash_threads || !pwhash_running) {
+			LOG_PERROR("calloc()");
+			free(pwhash_threads);
+			free(pwhash_running);
+			pwhash_threads = NULL;
+			pwhash_running = NULL;
+			pwhash_nr_threads = 0;
+			return 0; /* failure */
+		}
+	}
+
+	for (i = 0; i < pwhash_nr_threads; i++) {
+		if (pthread_create(&pwhash_threads[i], NULL, pwhash_worker, (void*)(uintptr_t)i)) {
+			LOG_ERROR("could not start password hash thread");
+			pwhash_nr_threads = i;
+			pwhash_shutdown();
+			return 0; /* failure */
+		}
+	}
+
+	LOG_INFO("password hashing: %u threads, scrypt log2n=%u r=%u p=%u",
+		pwhash_nr_threads, params.log2_n, params.r, params.p);
+
+	return 1; /* success */
+}
+
+/** stop the workers. unfinished jobs get their callback with a NULL descriptor. */
+void
+pwhash_shutdown(void)
+{
+	struct pwhash_job *job;
+	unsigned i;
+
+	pthread_mutex_lock(&pwhash_lock);
+	pwhash_shutdown_fl = 1;
+	pthread_cond_broadcast(&pwhash_cond);
+	pthread_mutex_unlock(&pwhash_lock);
+
+	for (i = 0; i < pwhash_nr_threads; i++)
+		pthread_join(pwhash_threads[i], NULL);
+	free(pwhash_threads);
+	free(pwhash_running);
+	pwhash_threads = NULL;
+	pwhash_running = NULL;
+	pwhash_nr_threads = 0;
+
+	pwhash_outstanding = 0;
+
+	/* release anything the callbacks own */
+	while ((job = queue_pop(&pending))) {
+		job->done(NULL, 0, NULL, job->p);
+		job_free(job);
+	}
+	while ((job = queue_pop(&completed))) {
+		job->done(NULL, job->result, job->newcrypt[0] ? job->newcrypt : NULL, job->p);
+		job_free(job);
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef PWHASH_H_
+#define PWHASH_H_
+#include <mud.h>
+
+/**
+ * called on the main thread when a hash job finishes.
+ * @param cl descriptor that submitted the job, or NULL if it went away.
+ * @param result 1 on success (password matched or hash created), 0 on failure.
+ * @param crypttext a new hash to store, or NULL.
+ */
+typedef void (*pwhash_done_fn)(DESCRIPTOR_DATA *cl, int result, const char *crypttext, void *p);
+
+int pwhash_init(void);
+void pwhash_shutdown(void);
+int pwhash_checkpass(const char *crypttext, const char *plaintext);
+int pwhash_check(DESCRIPTOR_DATA *cl, const char *crypttext, const char *password, pwhash_done_fn done, void *p);
+int pwhash_make(DESCRIPTOR_DATA *cl, const char *password, pwhash_done_fn done, void *p);
+void pwhash_cancel(DESCRIPTOR_DATA *cl);
+void pwhash_poll(void);
+unsigned pwhash_pending(void);
+#endif
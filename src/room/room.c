@@ -24,8 +24,10 @@
 
 #include "room.h"
 #include "boris.h"
+#include "atom.h"
 #include "list.h"
 #include "fdb.h"
+#include "slab.h"
 
 #define LOG_SUBSYSTEM "room"
 #include <log.h>
@@ -66,6 +68,8 @@ LIST_HEAD(struct room_cache, struct room);
 /** list of all loaded rooms. */
 static struct room_cache room_cache;
 
+static struct slab room_slab = SLAB_INIT("room", struct room);
+
 /******************************************************************************
  * Functions
  ******************************************************************************/
@@ -98,45 +102,74 @@ room_ll_free(struct room *r)
 
 	attr_list_free(&r->extra_values);
 
-	free(r);
+	slab_free(&room_slab, r);
 }
 
 /**
- * set an attribute on a room.
+ * set an attribute on a room in memory.
  */
-int
-room_attr_set(struct room *r, const char *name, const char *value)
+static int
+room_attr_apply(struct room *r, const char *name, const char *value)
 {
 	int res;
 
-	assert(r != NULL);
-	assert(name != NULL);
-	assert(value != NULL);
-
-	if (!r)
-		return 0;
-
-	if (!strcasecmp("id", name))
+	switch (atom_lookup(name)) {
+	case ATOM_ID:
 		res = parse_uint(name, value, &r->id);
-	else if (!strcasecmp("name.short", name))
+		break;
+	case ATOM_NAME_SHORT:
 		res = parse_str(name, value, &r->name.short_str);
-	else if (!strcasecmp("name.long", name))
+		break;
+	case ATOM_NAME_LONG:
 		res = parse_str(name, value, &r->name.long_str);
-	else if (!strcasecmp("desc.short", name))
+		break;
+	case ATOM_DESC_SHORT:
 		res = parse_str(name, value, &r->desc.short_str);
-	else if (!strcasecmp("desc.long", name))
+		break;
+	case ATOM_DESC_LONG:
 		res = parse_str(name, value, &r->desc.long_str);
-	else if (!strcasecmp("creator", name))
+		break;
+	case ATOM_CREATOR:
 		res = parse_str(name, value, &r->creator);
-	else if (!strcasecmp("owner", name))
+		break;
+	case ATOM_OWNER:
 		res = parse_str(name, value, &r->owner);
-	else
+		break;
+	default:
 		res = parse_attr(name, value, &r->extra_values);
+	}
+
+	return res;
+}
+
+/**
+ * set an attribute on a room. the change is journaled, or the room is
+ * marked for a full save if that is not possible.
+ */
+int
+room_attr_set(struct room *r, const char *name, const char *value)
+{
+	char numbuf[22]; /* big enough for a signed 64-bit decimal */
+
+	assert(r != NULL);
+	assert(name != NULL);
+	assert(value != NULL);
 
-	if (res)
+	if (!r)
+		return 0;
+
+	if (!room_attr_apply(r, name, value))
+		return 0; /* failure */
+
+	if (r->dirty_fl)
+		return 1; /* the next save writes it */
+
+	snprintf(numbuf, sizeof numbuf, "%u", r->id);
+
+	if (!r->id || !fdb_journal_append(DOMAIN_ROOM, numbuf, name, value))
 		r->dirty_fl = 1;
 
-	return res;
+	return 1; /* success */
 }
 
 const char *
@@ -144,29 +177,32 @@ room_attr_get(struct room *r, const char *name)
 {
 	static char numbuf[22]; /* big enough for a signed 64-bit decimal */
 
-	if (!strcasecmp("id", name)) {
+	struct attr_entry *at;
+	unsigned atom = atom_lookup(name);
+
+	switch (atom) {
+	case ATOM_ID:
 		snprintf(numbuf, sizeof numbuf, "%u", r->id);
 		return numbuf;
-	} else if (!strcasecmp("name.short", name))
+	case ATOM_NAME_SHORT:
 		return r->name.short_str;
-	else if (!strcasecmp("name.long", name))
+	case ATOM_NAME_LONG:
 		return r->name.long_str;
-	else if (!strcasecmp("desc.short", name))
+	case ATOM_DESC_SHORT:
 		return r->desc.short_str;
-	else if (!strcasecmp("desc.long", name))
+	case ATOM_DESC_LONG:
 		return r->desc.long_str;
-	else if (!strcasecmp("creator", name))
+	case ATOM_CREATOR:
 		return r->creator;
-	else if (!strcasecmp("owner", name))
+	case ATOM_OWNER:
 		return r->owner;
-	else {
-		struct attr_entry *at;
-		at = attr_find(&r->extra_values, name);
-
-		if (at)
-			return at->value;
 	}
 
+	at = attr_find_atom(&r->extra_values, atom);
+
+	if (at)
+		return at->value;
+
 	return NULL; /* failure - not found. */
 }
 
@@ -192,7 +228,7 @@ room_load(unsigned room_id)
 		return NULL;
 	}
 
-	r = calloc(1, sizeof * r);
+	r = slab_alloc(&room_slab);
 
 	if (!r) {
 		/* TODO: do perror? */
@@ -202,7 +238,7 @@ room_load(unsigned room_id)
 	}
 
 	while (fdb_read_next(h, &name, &value)) {
-		if (!room_attr_set(r, name, value)) {
+		if (!room_attr_apply(r, name, value)) {
 			LOG_ERROR("could not load room \"%s\"", numbuf);
 			room_ll_free(r);
 			fdb_read_end(h);
@@ -235,7 +271,7 @@ room_load(unsigned room_id)
 int
 room_save(struct room *r)
 {
-	struct attr_entry *curr;
+	unsigned i;
 	struct fdb_write_handle *h;
 	char numbuf[22]; /* big enough for a signed 64-bit decimal */
 
@@ -279,8 +315,10 @@ room_save(struct room *r)
 	if (r->creator)
 		fdb_write_pair(h, "creator", r->creator);
 
-	for (curr = LIST_TOP(r->extra_values); curr; curr = LIST_NEXT(curr, list)) {
-		fdb_write_pair(h, curr->name, curr->value);
+	for (i = 0; i < r->extra_values.nr; i++) {
+		struct attr_entry *curr = &r->extra_values.ent[i];
+
+		fdb_write_pair(h, atom_name(curr->atom), curr->value);
 	}
 
 	if (!fdb_write_end(h)) {
@@ -293,6 +331,19 @@ room_save(struct room *r)
 	return 1;
 }
 
+/**
+ * save every dirty room in the cache.
+ */
+void
+room_save_all(void)
+{
+	struct room *curr;
+
+	for (curr = LIST_TOP(room_cache); curr; curr = LIST_NEXT(curr, room_cache)) {
+		room_save(curr);
+	}
+}
+
 /**
  * load room into cache, if not already loaded, then increase reference count
  * of room.
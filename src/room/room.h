@@ -23,5 +23,9 @@ const char *room_attr_get(struct room *r, const char *name);
  * save a room to disk (only if it is dirty).
  */
 int room_save(struct room *r);
+/**
+ * save every dirty room that is loaded.
+ */
+void room_save_all(void);
 
 #endif
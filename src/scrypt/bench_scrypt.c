@@ -0,0 +1,139 @@
+/*
+ * bench_scrypt.c - scrypt hashes per second on one core
+ *
+ * Runs every available smix implementation over the parameter sets we
+ * would configure in boris.cfg (password.scrypt.*), or a single set given
+ * with -n/-r/-p.
+ *
+ * Written in 2026 by Jon Mayo <jon@rm-f.net>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide.  This software is distributed without any warranty.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crypto_scrypt.h"
+
+struct bench_params {
+	unsigned log2_n;
+	uint32_t r;
+	uint32_t p;
+};
+
+static const struct bench_params default_params[] = {
+	{ 12, 8, 1 },
+	{ 14, 8, 1 },
+	{ 15, 8, 1 },
+	{ 16, 8, 1 },
+	{ 17, 8, 1 },
+};
+
+static const char * impls[] = { "generic", "sse2", "avx2" };
+
+static double opt_seconds = 1.0;
+
+static double
+timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec + ((double)ts.tv_nsec / 1e9));
+}
+
+/* hash repeatedly for opt_seconds. return hashes per second, or -1. */
+static double
+bench(const struct bench_params * params)
+{
+	uint8_t salt[16] = "boris-bench-salt";
+	uint8_t buf[32];
+	double start, elapsed;
+	unsigned count = 0;
+
+	start = timer_now();
+	do {
+		if (crypto_scrypt((const uint8_t *)"password", 8, salt,
+		    sizeof(salt), (uint64_t)1 << params->log2_n, params->r,
+		    params->p, buf, sizeof(buf)))
+			return (-1);
+		salt[0]++;
+		count++;
+		elapsed = timer_now() - start;
+	} while (elapsed < opt_seconds);
+
+	return (count / elapsed);
+}
+
+static void
+usage(const char * prog)
+{
+	fprintf(stderr, "%s [-h] [-t seconds] [-n log2N -r r -p p]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char * argv[])
+{
+	struct bench_params single = { 0, 8, 1 };
+	const struct bench_params * params = default_params;
+	size_t nr_params = sizeof(default_params) / sizeof(default_params[0]);
+	size_t i, k;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ht:n:r:p:")) != -1) {
+		switch (opt) {
+		case 't':
+			opt_seconds = strtod(optarg, NULL);
+			break;
+		case 'n':
+			single.log2_n = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			single.r = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			single.p = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (single.log2_n) {
+		params = &single;
+		nr_params = 1;
+	}
+
+	printf("%-8s %6s %3s %3s %8s %12s %8s\n",
+	    "smix", "log2N", "r", "p", "memory", "hashes/sec", "ms/hash");
+
+	for (k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+		if (crypto_scrypt_smix_select(impls[k])) {
+			printf("%-8s not supported\n", impls[k]);
+			continue;
+		}
+		for (i = 0; i < nr_params; i++) {
+			double rate = bench(&params[i]);
+
+			if (rate < 0) {
+				perror("crypto_scrypt");
+				return (1);
+			}
+			printf("%-8s %6u %3u %3u %6lluMi %12.1f %8.2f\n",
+			    impls[k], params[i].log2_n,
+			    (unsigned)params[i].r, (unsigned)params[i].p,
+			    (unsigned long long)128 * params[i].r <<
+			    params[i].log2_n >> 20,
+			    rate, 1000.0 / rate);
+		}
+	}
+
+	return (0);
+}
@@ -0,0 +1,28 @@
+#ifndef _CPUSUPPORT_H_
+#define _CPUSUPPORT_H_
+
+/*
+ * CPUSUPPORT_X86_SSE2 and CPUSUPPORT_X86_AVX2 are defined by the build when
+ * the matching smix code is compiled in. The functions below check at
+ * runtime that the CPU (and for AVX2, the OS) can actually run it.
+ */
+
+/**
+ * cpusupport_x86_sse2(void):
+ * Return non-zero if the CPU supports SSE2.
+ */
+int cpusupport_x86_sse2(void);
+
+/**
+ * cpusupport_x86_sse42(void):
+ * Return non-zero if the CPU supports SSE4.2.
+ */
+int cpusupport_x86_sse42(void);
+
+/**
+ * cpusupport_x86_avx2(void):
+ * Return non-zero if the CPU supports AVX2 and the OS saves the YMM state.
+ */
+int cpusupport_x86_avx2(void);
+
+#endif /* !_CPUSUPPORT_H_ */
@@ -0,0 +1,99 @@
+/*
+ * cpusupport_x86.c - runtime detection of x86 SIMD extensions with cpuid
+ *
+ * Written in 2026 by Jon Mayo <jon@rm-f.net>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide.  This software is distributed without any warranty.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpusupport.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+#define CPUID_1_EDX_SSE2	(1u << 26)
+#define CPUID_1_ECX_SSE42	(1u << 20)
+#define CPUID_1_ECX_OSXSAVE	(1u << 27)
+#define CPUID_1_ECX_AVX		(1u << 28)
+#define CPUID_7_EBX_AVX2	(1u << 5)
+#define XCR0_SSE_AVX		0x6	/* XMM and YMM state enabled */
+
+static uint64_t
+xgetbv(uint32_t index)
+{
+	uint32_t eax, edx;
+
+	__asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (index));
+
+	return (((uint64_t)edx << 32) | eax);
+}
+
+int
+cpusupport_x86_sse2(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return (0);
+
+	return ((edx & CPUID_1_EDX_SSE2) != 0);
+}
+
+int
+cpusupport_x86_sse42(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return (0);
+
+	return ((ecx & CPUID_1_ECX_SSE42) != 0);
+}
+
+int
+cpusupport_x86_avx2(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return (0);
+
+	/* The OS must save YMM registers on a context switch. */
+	if ((ecx & (CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX)) !=
+	    (CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX))
+		return (0);
+	if ((xgetbv(0) & XCR0_SSE_AVX) != XCR0_SSE_AVX)
+		return (0);
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return (0);
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return ((ebx & CPUID_7_EBX_AVX2) != 0);
+}
+#else
+int
+cpusupport_x86_sse2(void)
+{
+
+	return (0);
+}
+
+int
+cpusupport_x86_sse42(void)
+{
+
+	return (0);
+}
+
+int
+cpusupport_x86_avx2(void)
+{
+
+	return (0);
+}
+#endif
@@ -32,21 +32,40 @@
 #include <sys/mman.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// #include "cpusupport.h"
+#include "cpusupport.h"
 #include "sha256.h"
 // #include "warnp.h"
 
 #include "crypto_scrypt_smix.h"
-// #include "crypto_scrypt_smix_sse2.h"
+#include "crypto_scrypt_smix_sse2.h"
 
 #include "crypto_scrypt.h"
 
-static void (*smix_func)(uint8_t *, size_t, uint64_t, void *, void *) = NULL;
+typedef void (*smix_fn)(uint8_t *, size_t, uint64_t, void *, void *);
+
+/* Available smix implementations, best first. */
+static const struct smix_impl {
+	const char * name;
+	smix_fn smix;
+	int (*supported)(void);
+} smix_impls[] = {
+#ifdef CPUSUPPORT_X86_AVX2
+	{ "avx2", crypto_scrypt_smix_avx2, cpusupport_x86_avx2 },
+#endif
+#ifdef CPUSUPPORT_X86_SSE2
+	{ "sse2", crypto_scrypt_smix_sse2, cpusupport_x86_sse2 },
+#endif
+	{ "generic", crypto_scrypt_smix, NULL },
+};
+
+static const struct smix_impl * smix_selected = NULL;
+static pthread_once_t smix_once = PTHREAD_ONCE_INIT;
 
 /**
  * _crypto_scrypt(passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen, smix):
@@ -206,30 +225,78 @@ testsmix(void (*smix)(uint8_t *, size_t, uint64_t, void *, void *))
 static void
 selectsmix(void)
 {
+	size_t i;
 
-#ifdef CPUSUPPORT_X86_SSE2
-	/* If we're running on an SSE2-capable CPU, try that code. */
-	if (cpusupport_x86_sse2()) {
-		/* If SSE2ized smix works, use it. */
-		if (!testsmix(crypto_scrypt_smix_sse2)) {
-			smix_func = crypto_scrypt_smix_sse2;
+	for (i = 0; i < sizeof(smix_impls) / sizeof(smix_impls[0]); i++) {
+		const struct smix_impl * impl = &smix_impls[i];
+
+		/* Skip code this CPU cannot run. */
+		if (impl->supported && !impl->supported())
+			continue;
+
+		/* If it works, use it. */
+		if (!testsmix(impl->smix)) {
+			smix_selected = impl;
 			return;
 		}
-		fprintf(stderr, "WARNING:Disabling broken SSE2 scrypt support - please report bug!");
+		fprintf(stderr, "WARNING:Disabling broken %s scrypt support - please report bug!\n",
+		    impl->name);
 	}
-#endif
-
-	/* If generic smix works, use it. */
-	if (!testsmix(crypto_scrypt_smix)) {
-		smix_func = crypto_scrypt_smix;
-		return;
-	}
-	fprintf(stderr, "WARNING:Generic scrypt code is broken - please report bug!");
 
 	/* If we get here, something really bad happened. */
 	abort();
 }
 
+/**
+ * crypto_scrypt_smix_select(name):
+ * Use the named smix implementation ("generic", "sse2" or "avx2") for all
+ * following crypto_scrypt() calls.  A NULL name restores the automatic
+ * choice.  Not safe to call while other threads are hashing.
+ *
+ * Return 0 on success; or -1 if it is not available on this CPU.
+ */
+int
+crypto_scrypt_smix_select(const char * name)
+{
+	size_t i;
+
+	pthread_once(&smix_once, selectsmix);
+
+	if (name == NULL) {
+		smix_selected = NULL;
+		selectsmix();
+		return (0);
+	}
+
+	for (i = 0; i < sizeof(smix_impls) / sizeof(smix_impls[0]); i++) {
+		const struct smix_impl * impl = &smix_impls[i];
+
+		if (strcmp(impl->name, name))
+			continue;
+		if (impl->supported && !impl->supported())
+			return (-1);
+		if (testsmix(impl->smix))
+			return (-1);
+		smix_selected = impl;
+		return (0);
+	}
+
+	return (-1);
+}
+
+/**
+ * crypto_scrypt_smix_name(void):
+ * Return the name of the smix implementation in use.
+ */
+const char *
+crypto_scrypt_smix_name(void)
+{
+
+	pthread_once(&smix_once, selectsmix);
+
+	return (smix_selected->name);
+}
+
 /**
  * crypto_scrypt(passwd, passwdlen, salt, saltlen, N, r, p, buf, buflen):
  * Compute scrypt(passwd[0 .. passwdlen - 1], salt[0 .. saltlen - 1], N, r,
@@ -245,9 +312,8 @@ crypto_scrypt(const uint8_t * passwd, size_t passwdlen,
     uint8_t * buf, size_t buflen)
 {
 
-	if (smix_func == NULL)
-		selectsmix();
+	pthread_once(&smix_once, selectsmix);
 
 	return (_crypto_scrypt(passwd, passwdlen, salt, saltlen, N, _r, _p,
-	    buf, buflen, smix_func));
+	    buf, buflen, smix_selected->smix));
 }
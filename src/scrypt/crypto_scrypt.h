@@ -44,4 +44,20 @@
 int crypto_scrypt(const uint8_t *, size_t, const uint8_t *, size_t, uint64_t,
     uint32_t, uint32_t, uint8_t *, size_t);
 
+/**
+ * crypto_scrypt_smix_select(name):
+ * Use the named smix implementation ("generic", "sse2" or "avx2") for all
+ * following crypto_scrypt() calls.  A NULL name restores the automatic
+ * choice.  Not safe to call while other threads are hashing.
+ *
+ * Return 0 on success; or -1 if it is not available on this CPU.
+ */
+int crypto_scrypt_smix_select(const char *);
+
+/**
+ * crypto_scrypt_smix_name(void):
+ * Return the name of the smix implementation in use.
+ */
+const char * crypto_scrypt_smix_name(void);
+
 #endif /* !_CRYPTO_SCRYPT_H_ */
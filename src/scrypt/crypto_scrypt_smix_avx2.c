@@ -0,0 +1,203 @@
+/*
+ * crypto_scrypt_smix_avx2.c - AVX2 version of crypto_scrypt_smix()
+ *
+ * Written in 2026 by Jon Mayo <jon@rm-f.net>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide.  This software is distributed without any warranty.
+ */
+#include "cpusupport.h"
+#ifdef CPUSUPPORT_X86_AVX2
+
+#include <immintrin.h>
+#include <stdint.h>
+
+#include "sysendian.h"
+
+#include "crypto_scrypt_smix_sse2.h"
+
+/*
+ * Uses the same shuffled block layout as crypto_scrypt_smix_sse2.c.
+ *
+ * Salsa20/8 has no parallelism wider than the four 128-bit rows, so the
+ * core stays 128 bits wide (but VEX encoded). The gain over SSE2 comes from
+ * keeping X in registers for a whole BlockMix, fusing the X ^ V_j of step 8
+ * into BlockMix instead of writing it back, and 256-bit copies into V.
+ */
+
+static void blkcpy(void *, const void *, size_t);
+static uint64_t integerify(const void *, size_t);
+
+static void
+blkcpy(void * dest, const void * src, size_t len)
+{
+	__m256i * D = dest;
+	const __m256i * S = src;
+	size_t L = len / 32;
+	size_t i;
+
+	for (i = 0; i < L; i++)
+		_mm256_store_si256(&D[i], _mm256_load_si256(&S[i]));
+}
+
+/* one salsa20/8 core on the rows X0..X3, with the input feed-forward */
+#define SALSA20_8(X0, X1, X2, X3) do { \
+	__m128i Y0 = X0, Y1 = X1, Y2 = X2, Y3 = X3, T; \
+	size_t n; \
+	for (n = 0; n < 8; n += 2) { \
+		T = _mm_add_epi32(Y0, Y3); Y1 = R(Y1, T, 7); \
+		T = _mm_add_epi32(Y1, Y0); Y2 = R(Y2, T, 9); \
+		T = _mm_add_epi32(Y2, Y1); Y3 = R(Y3, T, 13); \
+		T = _mm_add_epi32(Y3, Y2); Y0 = R(Y0, T, 18); \
+		Y1 = _mm_shuffle_epi32(Y1, 0x93); \
+		Y2 = _mm_shuffle_epi32(Y2, 0x4E); \
+		Y3 = _mm_shuffle_epi32(Y3, 0x39); \
+		T = _mm_add_epi32(Y0, Y1); Y3 = R(Y3, T, 7); \
+		T = _mm_add_epi32(Y3, Y0); Y2 = R(Y2, T, 9); \
+		T = _mm_add_epi32(Y2, Y3); Y1 = R(Y1, T, 13); \
+		T = _mm_add_epi32(Y1, Y2); Y0 = R(Y0, T, 18); \
+		Y1 = _mm_shuffle_epi32(Y1, 0x39); \
+		Y2 = _mm_shuffle_epi32(Y2, 0x4E); \
+		Y3 = _mm_shuffle_epi32(Y3, 0x93); \
+	} \
+	X0 = _mm_add_epi32(X0, Y0); \
+	X1 = _mm_add_epi32(X1, Y1); \
+	X2 = _mm_add_epi32(X2, Y2); \
+	X3 = _mm_add_epi32(X3, Y3); \
+} while (0)
+
+#define R(x, t, b) _mm_xor_si128(_mm_xor_si128((x), _mm_slli_epi32((t), (b))), _mm_srli_epi32((t), 32 - (b)))
+
+/**
+ * blockmix_salsa8_xor(Bin1, Bin2, Bout, r):
+ * Compute Bout = BlockMix_{salsa20/8, r}(Bin1 \xor Bin2). Bin2 may be NULL,
+ * then Bout = BlockMix_{salsa20/8, r}(Bin1). All are 128r bytes in length.
+ */
+static inline void
+blockmix_salsa8_xor(const __m128i * Bin1, const __m128i * Bin2,
+    __m128i * Bout, size_t r)
+{
+	__m128i X0, X1, X2, X3;
+	size_t i;
+
+	/* 1: X <-- B_{2r - 1} */
+	X0 = Bin1[8 * r - 4];
+	X1 = Bin1[8 * r - 3];
+	X2 = Bin1[8 * r - 2];
+	X3 = Bin1[8 * r - 1];
+	if (Bin2) {
+		X0 = _mm_xor_si128(X0, Bin2[8 * r - 4]);
+		X1 = _mm_xor_si128(X1, Bin2[8 * r - 3]);
+		X2 = _mm_xor_si128(X2, Bin2[8 * r - 2]);
+		X3 = _mm_xor_si128(X3, Bin2[8 * r - 1]);
+	}
+
+	/* 2: for i = 0 to 2r - 1 do */
+	for (i = 0; i < 2 * r; i++) {
+		/* 3: X <-- H(X \xor B_i) */
+		X0 = _mm_xor_si128(X0, Bin1[i * 4]);
+		X1 = _mm_xor_si128(X1, Bin1[i * 4 + 1]);
+		X2 = _mm_xor_si128(X2, Bin1[i * 4 + 2]);
+		X3 = _mm_xor_si128(X3, Bin1[i * 4 + 3]);
+		if (Bin2) {
+			X0 = _mm_xor_si128(X0, Bin2[i * 4]);
+			X1 = _mm_xor_si128(X1, Bin2[i * 4 + 1]);
+			X2 = _mm_xor_si128(X2, Bin2[i * 4 + 2]);
+			X3 = _mm_xor_si128(X3, Bin2[i * 4 + 3]);
+		}
+		SALSA20_8(X0, X1, X2, X3);
+
+		/* 4: Y_i <-- X */
+		/* 6: B' <-- (Y_0, Y_2 ... Y_{2r-2}, Y_1, Y_3 ... Y_{2r-1}) */
+		__m128i * out = &Bout[((i & 1) * r + i / 2) * 4];
+		out[0] = X0;
+		out[1] = X1;
+		out[2] = X2;
+		out[3] = X3;
+	}
+}
+
+#undef R
+
+/**
+ * integerify(B, r):
+ * Return the result of parsing B_{2r-1} as a little-endian integer.
+ * Word 1 is at position 13 in the shuffled layout.
+ */
+static uint64_t
+integerify(const void * B, size_t r)
+{
+	const uint32_t * X = (const void *)((uintptr_t)(B) + (2 * r - 1) * 64);
+
+	return (((uint64_t)(X[13]) << 32) + X[0]);
+}
+
+/**
+ * crypto_scrypt_smix_avx2(B, r, N, V, XY):
+ * Compute B = SMix_r(B, N).  The input B must be 128r bytes in length;
+ * the temporary storage V must be 128rN bytes in length; the temporary
+ * storage XY must be 256r + 64 bytes in length.  The value N must be a
+ * power of 2 greater than 1.  The arrays B, V, and XY must be aligned to a
+ * multiple of 64 bytes.
+ */
+void
+crypto_scrypt_smix_avx2(uint8_t * B, size_t r, uint64_t N, void * V, void * XY)
+{
+	__m128i * X = XY;
+	__m128i * Y = (void *)((uintptr_t)(XY) + 128 * r);
+	uint32_t * X32 = (void *)X;
+	uint64_t i, j;
+	size_t k;
+
+	/* 1: X <-- B */
+	for (k = 0; k < 2 * r; k++) {
+		for (i = 0; i < 16; i++) {
+			X32[k * 16 + i] =
+			    le32dec(&B[(k * 16 + (i * 5 % 16)) * 4]);
+		}
+	}
+
+	/* 2: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		/* 3: V_i <-- X */
+		blkcpy((void *)((uintptr_t)(V) + i * 128 * r), X, 128 * r);
+
+		/* 4: X <-- H(X) */
+		blockmix_salsa8_xor(X, NULL, Y, r);
+
+		/* 3: V_i <-- X */
+		blkcpy((void *)((uintptr_t)(V) + (i + 1) * 128 * r),
+		    Y, 128 * r);
+
+		/* 4: X <-- H(X) */
+		blockmix_salsa8_xor(Y, NULL, X, r);
+	}
+
+	/* 6: for i = 0 to N - 1 do */
+	for (i = 0; i < N; i += 2) {
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify(X, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_xor(X,
+		    (void *)((uintptr_t)(V) + j * 128 * r), Y, r);
+
+		/* 7: j <-- Integerify(X) mod N */
+		j = integerify(Y, r) & (N - 1);
+
+		/* 8: X <-- H(X \xor V_j) */
+		blockmix_salsa8_xor(Y,
+		    (void *)((uintptr_t)(V) + j * 128 * r), X, r);
+	}
+
+	/* 10: B' <-- X */
+	for (k = 0; k < 2 * r; k++) {
+		for (i = 0; i < 16; i++) {
+			le32enc(&B[(k * 16 + (i * 5 % 16)) * 4],
+			    X32[k * 16 + i]);
+		}
+	}
+}
+
+#endif /* CPUSUPPORT_X86_AVX2 */
@@ -0,0 +1,49 @@
+/*
+ * entropy.c - operating system entropy source for crypto_entropy.c
+ *
+ * Written in 2026 by Jon Mayo <jon@rm-f.net>
+ *
+ * To the extent possible under law, the author(s) have dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide.  This software is distributed without any warranty.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "entropy.h"
+
+/**
+ * entropy_read(buf, buflen):
+ * Fill the given buffer with random bytes provided by the operating system.
+ */
+int
+entropy_read(uint8_t * buf, size_t buflen)
+{
+	ssize_t lenread;
+	int fd;
+
+	if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) == -1)
+		return (-1);
+
+	while (buflen > 0) {
+		if ((lenread = read(fd, buf, buflen)) == -1) {
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return (-1);
+		}
+		if (lenread == 0) {
+			close(fd);
+			return (-1);
+		}
+		buf += lenread;
+		buflen -= lenread;
+	}
+
+	if (close(fd))
+		return (-1);
+
+	return (0);
+}
@@ -17,12 +17,31 @@ static struct scrypt_test {
 	{ "pleaseletmein", "SodiumChloride", 1048576, 8, 1 }
 };
 
+/* smix implementations to compare against the generic one */
+static const char * impls[] = { "sse2", "avx2" };
+
+static int
+run_test(const struct scrypt_test * test, char kbuf[64])
+{
+	int result;
+
+	result = crypto_scrypt((const uint8_t *)test->passwd,
+	    strlen(test->passwd), (const uint8_t *)test->salt,
+	    strlen(test->salt), test->N, test->r, test->p,
+	    (uint8_t *)kbuf, 64);
+	if (result)
+		fprintf(stderr, "error! code=%d\n", result);
+
+	return (result);
+}
+
 int
 main(int argc, char * argv[])
 {
 	struct scrypt_test * test;
-	char kbuf[64];
-	size_t i;
+	char kbuf[64], kbuf_impl[64];
+	size_t i, k;
+	int failed = 0;
 
 	(void)argc; /* UNUSED */
 	(void)argv; /* UNUSED */
@@ -30,15 +49,30 @@ main(int argc, char * argv[])
 	for (test = tests;
 	    test < tests + sizeof(tests) / sizeof(tests[0]);
 	    test++) {
-		int result;
-		result = crypto_scrypt((const uint8_t *)test->passwd,
-		    strlen(test->passwd), (const uint8_t *)test->salt,
-		    strlen(test->salt), test->N, test->r, test->p,
-		    (uint8_t *)kbuf, 64);
-		if (result) {
-			fprintf(stderr, "error! code=%d\n", result);
+		/* The reference result, printed for test_scrypt.good. */
+		if (crypto_scrypt_smix_select("generic") ||
+		    run_test(test, kbuf))
 			return (1);
+
+		/* Every SIMD path must be bit-identical. */
+		for (k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+			if (crypto_scrypt_smix_select(impls[k])) {
+				fprintf(stderr, "%s: not supported, skipped\n",
+				    impls[k]);
+				continue;
+			}
+			if (run_test(test, kbuf_impl))
+				return (1);
+			if (memcmp(kbuf, kbuf_impl, 64)) {
+				fprintf(stderr, "%s: MISMATCH for N=%u\n",
+				    impls[k], (unsigned int)test->N);
+				failed = 1;
+			} else {
+				fprintf(stderr, "%s: ok for N=%u\n",
+				    impls[k], (unsigned int)test->N);
+			}
 		}
+
 		printf("scrypt(\"%s\", \"%s\", %u, %u, %u, 64) =\n",
 		    test->passwd, test->salt, (unsigned int)test->N,
 		    (unsigned int)(test->r), (unsigned int)test->p);
@@ -49,5 +83,5 @@ main(int argc, char * argv[])
 		}
 	}
 
-	return (0);
+	return (failed);
 }
@@ -0,0 +1,369 @@
+/**
+ * @file slab.c
+ *
+ * Pools of fixed-size objects.
+ *
+ * Each type gets its own struct slab. Objects are carved out of 16 KiB
+ * chunks and kept on a per-type free list when released, so connect storms
+ * and area loads reuse memory of the right size instead of scattering small
+ * blocks over the heap. Chunks are only given back at shutdown.
+ *
+ * With poisoning on, free objects are filled with 0xBB. A write to a free
+ * object is reported when it is next handed out, and freeing an object
+ * twice or freeing a pointer the slab does not own is reported and ignored.
+ *
+ * Slabs belong to the game thread, they have no locking.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "slab.h"
+#include "metrics.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define LOG_SUBSYSTEM "slab"
+#include <log.h>
+
+/******************************************************************************
+ * Defines
+ ******************************************************************************/
+
+/** bytes asked of malloc for each chunk. */
+#define SLAB_CHUNK_SIZE 16384
+/** fewest objects in a chunk, for types larger than a chunk. */
+#define SLAB_CHUNK_MIN 4
+/** alignment of every object. */
+#define SLAB_ALIGN 16
+/** fill byte for free objects. */
+#define SLAB_POISON 0xBB
+
+#define SLAB_ROUNDUP(n) (((n) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+struct slab_chunk {
+	struct slab_chunk *next;
+};
+
+/** objects start here, past the chunk header. */
+#define SLAB_CHUNK_HEADER SLAB_ROUNDUP(sizeof(struct slab_chunk))
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static struct slab *slab_head;
+
+#ifndef NDEBUG
+static int slab_poison = 1;
+#else
+static int slab_poison;
+#endif
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+/** the link to the next free object, kept in the first word. */
+static void **
+slab_link(void *p)
+{
+	return p;
+}
+
+static void
+slab_poison_obj(const struct slab *s, void *p)
+{
+	memset((char*)p + sizeof(void*), SLAB_POISON, s->stride - sizeof(void*));
+}
+
+/** true if a free object still holds only poison. */
+static int
+slab_is_poisoned(const struct slab *s, const void *p)
+{
+	const unsigned char *b = (const unsigned char*)p + sizeof(void*);
+	size_t i, len = s->stride - sizeof(void*);
+
+	for (i = 0; i < len; i++) {
+		if (b[i] != SLAB_POISON)
+			return 0;
+	}
+
+	return 1;
+}
+
+/** true if p is the start of an object in one of the chunks of s. */
+static int
+slab_owns(const struct slab *s, const void *p)
+{
+	const struct slab_chunk *c;
+
+	for (c = s->chunk; c; c = c->next) {
+		const char *first = (const char*)c + SLAB_CHUNK_HEADER;
+		const char *end = first + s->per_chunk * s->stride;
+
+		if ((const char*)p >= first && (const char*)p < end)
+			return ((const char*)p - first) % s->stride == 0;
+	}
+
+	return 0;
+}
+
+/** set the layout of s and register its statistics. */
+static void
+slab_register(struct slab *s)
+{
+	char labels[64];
+
+	s->stride = SLAB_ROUNDUP(s->size < sizeof(void*) ? sizeof(void*) : s->size);
+	s->per_chunk = (SLAB_CHUNK_SIZE - SLAB_CHUNK_HEADER) / s->stride;
+	if (s->per_chunk < SLAB_CHUNK_MIN)
+		s->per_chunk = SLAB_CHUNK_MIN;
+
+	snprintf(labels, sizeof(labels), "slab=\"%s\"", s->name);
+	s->metric_objects = metrics_gauge("boris_slab_objects", labels,
+		"Objects handed out by a slab.");
+	s->metric_bytes = metrics_gauge("boris_slab_bytes", labels,
+		"Bytes held in slab chunks, in use or free.");
+	s->metric_allocs = metrics_counter("boris_slab_allocs_total", labels,
+		"Objects allocated from a slab.");
+
+	s->next = slab_head;
+	slab_head = s;
+}
+
+/** add a chunk of free objects. */
+static int
+slab_grow(struct slab *s)
+{
+	size_t bytes = SLAB_CHUNK_HEADER + s->per_chunk * s->stride;
+	struct slab_chunk *c = malloc(bytes);
+	char *p;
+	unsigned i;
+
+	if (!c) {
+		LOG_PERROR("malloc()");
+		return 0; /* failure */
+	}
+
+	c->next = s->chunk;
+	s->chunk = c;
+	s->nr_chunk++;
+
+	/* push in reverse, so objects are handed out in address order. */
+	p = (char*)c + SLAB_CHUNK_HEADER + s->per_chunk * s->stride;
+	for (i = 0; i < s->per_chunk; i++) {
+		p -= s->stride;
+		if (slab_poison)
+			slab_poison_obj(s, p);
+		*slab_link(p) = s->free;
+		s->free = p;
+	}
+	s->nr_free += s->per_chunk;
+
+	metrics_set(s->metric_bytes, (double)s->nr_chunk * bytes);
+
+	return 1; /* success */
+}
+
+/**
+ * get a zeroed object.
+ * @return the object, or NULL if out of memory.
+ */
+void *
+slab_alloc(struct slab *s)
+{
+	void *p;
+
+	if (!s->stride)
+		slab_register(s);
+
+	if (!s->free && !slab_grow(s))
+		return NULL;
+
+	p = s->free;
+	s->free = *slab_link(p);
+	s->nr_free--;
+	s->nr_inuse++;
+
+	if (slab_poison && !slab_is_poisoned(s, p))
+		LOG_ERROR("%s:object %p was written after it was freed", s->name, p);
+
+	memset(p, 0, s->stride);
+
+	metrics_set(s->metric_objects, s->nr_inuse);
+	metrics_add(s->metric_allocs, 1);
+
+	return p;
+}
+
+/** give an object back to its slab. p may be NULL. */
+void
+slab_free(struct slab *s, void *p)
+{
+	if (!p)
+		return;
+
+	if (slab_poison) {
+		if (!slab_owns(s, p)) {
+			LOG_ERROR("%s:%p is not from this slab", s->name, p);
+			return;
+		}
+		if (slab_is_poisoned(s, p)) {
+			LOG_ERROR("%s:object %p freed twice", s->name, p);
+			return;
+		}
+		slab_poison_obj(s, p);
+	}
+
+	*slab_link(p) = s->free;
+	s->free = p;
+	s->nr_free++;
+	s->nr_inuse--;
+
+	metrics_set(s->metric_objects, s->nr_inuse);
+}
+
+/**
+ * turn poisoning of free objects on or off.
+ * objects already free are poisoned when it is turned on.
+ */
+void
+slab_set_poison(int enable)
+{
+	struct slab *s;
+	void *p;
+
+	if (enable && !slab_poison) {
+		for (s = slab_head; s; s = s->next) {
+			for (p = s->free; p; p = *slab_link(p))
+				slab_poison_obj(s, p);
+		}
+	}
+
+	slab_poison = !!enable;
+}
+
+/** free the chunks of a slab, leaving it ready to be used again. */
+static void
+slab_destroy(struct slab *s)
+{
+	struct slab_chunk *c;
+
+	if (s->nr_inuse)
+		LOG_WARNING("%s:%lu objects still in use", s->name, s->nr_inuse);
+
+	LOG_INFO("%s:%lu chunks of %u objects", s->name, s->nr_chunk, s->per_chunk);
+
+	while ((c = s->chunk)) {
+		s->chunk = c->next;
+		free(c);
+	}
+
+	s->stride = 0;
+	s->per_chunk = 0;
+	s->free = NULL;
+	s->next = NULL;
+	s->nr_inuse = s->nr_free = s->nr_chunk = 0;
+	s->metric_objects = s->metric_bytes = s->metric_allocs = NULL;
+}
+
+/** free every slab. nothing may be allocated from them afterwards. */
+void
+slab_shutdown(void)
+{
+	struct slab *s;
+
+	while ((s = slab_head)) {
+		slab_head = s->next;
+		slab_destroy(s);
+	}
+}
+
+#ifndef NTEST
+struct slab_test_obj {
+	unsigned id;
+	char pad[40];
+};
+
+void
+slab_test(void)
+{
+	struct slab test_slab = SLAB_INIT("test", struct slab_test_obj);
+	struct slab_test_obj *obj[1000], *o;
+	unsigned i, n = sizeof(obj) / sizeof(*obj);
+	int old_poison = slab_poison;
+
+	slab_set_poison(1);
+
+	for (i = 0; i < n; i++) {
+		obj[i] = slab_alloc(&test_slab);
+		if (!obj[i] || obj[i]->id || ((uintptr_t)obj[i] % SLAB_ALIGN)) {
+			LOG_ERROR("slab allocation test failed at %u", i);
+			exit(1);
+		}
+		obj[i]->id = i + 1;
+	}
+
+	for (i = 0; i < n; i += 2)
+		slab_free(&test_slab, obj[i]);
+
+	/* freed objects come back zeroed, and live ones are untouched. */
+	for (i = 0; i < n; i += 2) {
+		obj[i] = slab_alloc(&test_slab);
+		if (!obj[i] || obj[i]->id) {
+			LOG_ERROR("slab reuse test failed at %u", i);
+			exit(1);
+		}
+		obj[i]->id = i + 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (obj[i]->id != i + 1) {
+			LOG_ERROR("slab overlap test failed at %u", i);
+			exit(1);
+		}
+	}
+
+	if (test_slab.nr_inuse != n
+		|| test_slab.nr_chunk != (n + test_slab.per_chunk - 1) / test_slab.per_chunk) {
+		LOG_ERROR("slab statistics test failed");
+		exit(1);
+	}
+
+	/* a double free is caught and does not corrupt the free list. */
+	o = obj[0];
+	slab_free(&test_slab, o);
+	slab_free(&test_slab, o);
+	if (test_slab.nr_inuse != n - 1 || slab_alloc(&test_slab) != o
+		|| slab_alloc(&test_slab) == o) {
+		LOG_ERROR("slab double free test failed");
+		exit(1);
+	}
+
+	/* remove the test slab from the list before it goes out of scope. */
+	slab_head = test_slab.next;
+	test_slab.nr_inuse = 0;
+	slab_destroy(&test_slab);
+	slab_poison = old_poison;
+
+	LOG_INFO("slab test passed");
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+#include <stddef.h>
+
+struct slab_chunk;
+struct metric;
+
+/**
+ * a pool of fixed-size objects of one type.
+ * only name and size are set by the user, see SLAB_INIT().
+ */
+struct slab {
+	const char *name;
+	size_t size;
+	/* managed by slab.c */
+	size_t stride; /**< size rounded up, 0 until the first allocation. */
+	unsigned per_chunk;
+	void *free; /**< free objects, linked through their first word. */
+	struct slab_chunk *chunk;
+	struct slab *next; /**< all slabs in use. */
+	unsigned long nr_inuse, nr_free, nr_chunk;
+	struct metric *metric_objects, *metric_bytes, *metric_allocs;
+};
+
+/** static initializer for a slab of type. */
+#define SLAB_INIT(name_, type) { .name = (name_), .size = sizeof(type) }
+
+void *slab_alloc(struct slab *s);
+void slab_free(struct slab *s, void *p);
+void slab_set_poison(int enable);
+void slab_shutdown(void);
+#ifndef NTEST
+void slab_test(void);
+#endif
+#endif
@@ -0,0 +1,221 @@
+/* slab_soak.c - RSS and allocator time under connect/load churn */
+/* PUBLIC DOMAIN - Jon Mayo */
+/* Replays a churn of the objects the game allocates most: clients that
+ * connect and drop, each with a few strings of random length, and rooms,
+ * characters and freelist entries loaded and unloaded around them. The
+ * fixed-size objects come from malloc or from slabs, the strings always
+ * from malloc, so the two runs differ only in how the hot objects are kept.
+ *
+ * Each allocator runs in its own process, so RSS is not shared between them.
+ *
+ * usage: slab_soak [-r rounds] [-n live-sessions] [-m malloc|slab]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mud.h"
+#include "slab.h"
+
+/* the room, character and freelist structures are private to their
+ * modules, these are their sizes on x86-64. */
+#define ROOM_SIZE 96
+#define CHARACTER_SIZE 104
+#define FREELIST_ENTRY_SIZE 24
+
+enum soak_type { SOAK_CLIENT, SOAK_ROOM, SOAK_CHARACTER, SOAK_FREELIST, NR_SOAK_TYPE };
+
+/* objects of each type owned by one session. */
+static const unsigned soak_count[NR_SOAK_TYPE] = { 1, 4, 2, 6 };
+#define SOAK_STRINGS 3
+#define SOAK_OBJECTS (1 + 4 + 2 + 6)
+
+struct soak_session {
+	void *obj[SOAK_OBJECTS];
+	char *str[SOAK_STRINGS];
+	int live;
+};
+
+static struct slab soak_slab[NR_SOAK_TYPE] = {
+	{ .name = "client", .size = sizeof(DESCRIPTOR_DATA) },
+	{ .name = "room", .size = ROOM_SIZE },
+	{ .name = "character", .size = CHARACTER_SIZE },
+	{ .name = "freelist_entry", .size = FREELIST_ENTRY_SIZE },
+};
+
+static unsigned opt_rounds = 2000000;
+static unsigned opt_sessions = 20000;
+static int use_slab;
+
+static double
+timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec + ((double)ts.tv_nsec / 1e9));
+}
+
+/* resident set size in KiB. */
+static long
+rss_kib(void)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	long pages = 0, rss = 0;
+
+	if (!f)
+		return -1;
+	if (fscanf(f, "%ld %ld", &pages, &rss) != 2)
+		rss = -1;
+	fclose(f);
+
+	return rss < 0 ? -1 : rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void *
+soak_alloc(enum soak_type t)
+{
+	if (use_slab)
+		return slab_alloc(&soak_slab[t]);
+	return calloc(1, soak_slab[t].size);
+}
+
+static void
+soak_free(enum soak_type t, void *p)
+{
+	if (use_slab)
+		slab_free(&soak_slab[t], p);
+	else
+		free(p);
+}
+
+/* allocate or release every object of a session. */
+static void
+soak_toggle(struct soak_session *s)
+{
+	unsigned t, i, n;
+
+	for (t = 0, n = 0; t < NR_SOAK_TYPE; t++) {
+		for (i = 0; i < soak_count[t]; i++, n++) {
+			if (s->live)
+				soak_free(t, s->obj[n]);
+			else if (!(s->obj[n] = soak_alloc(t)))
+				abort();
+		}
+	}
+
+	for (i = 0; i < SOAK_STRINGS; i++) {
+		if (s->live) {
+			free(s->str[i]);
+		} else {
+			size_t len = 8 + rand() % 120;
+
+			if (!(s->str[i] = malloc(len)))
+				abort();
+			memset(s->str[i], 'x', len);
+		}
+	}
+
+	s->live = !s->live;
+}
+
+static int
+soak(void)
+{
+	struct soak_session *session = calloc(opt_sessions, sizeof(*session));
+	long rss_start, rss_peak = 0, rss;
+	double start, elapsed;
+	unsigned r;
+
+	if (!session) {
+		perror("calloc()");
+		return 1;
+	}
+
+	srand(1);
+	rss_start = rss_kib();
+	start = timer_now();
+
+	for (r = 0; r < opt_rounds; r++) {
+		soak_toggle(&session[rand() % opt_sessions]);
+
+		if (r % 65536 == 0 && (rss = rss_kib()) > rss_peak)
+			rss_peak = rss;
+	}
+
+	elapsed = timer_now() - start;
+	rss = rss_kib();
+	if (rss > rss_peak)
+		rss_peak = rss;
+
+	printf("%-6s %10u toggles %8.1f ns/object   RSS start %6ld KiB  peak %6ld KiB  end %6ld KiB\n",
+		use_slab ? "slab" : "malloc", opt_rounds,
+		elapsed * 1e9 / ((double)opt_rounds * SOAK_OBJECTS),
+		rss_start, rss_peak, rss);
+
+	return 0;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-r rounds] [-n live-sessions] [-m malloc|slab]\n", argv0);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *mode = NULL;
+	int c, status, fail = 0;
+	unsigned i;
+
+	while ((c = getopt(argc, argv, "r:n:m:")) != -1) {
+		switch (c) {
+		case 'r':
+			opt_rounds = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opt_sessions = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!opt_sessions)
+		usage(argv[0]);
+
+	if (mode) {
+		if (strcmp(mode, "malloc") && strcmp(mode, "slab"))
+			usage(argv[0]);
+		use_slab = !strcmp(mode, "slab");
+		return soak();
+	}
+
+	/* each allocator in a fresh process. */
+	for (i = 0; i < 2; i++) {
+		pid_t pid;
+
+		fflush(stdout);
+		pid = fork();
+		if (pid < 0) {
+			perror("fork()");
+			return 1;
+		}
+		if (pid == 0) {
+			use_slab = i;
+			exit(soak());
+		}
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			fail = 1;
+	}
+
+	return fail;
+}
@@ -0,0 +1,128 @@
+/* genqvm.c - generate a small qvm for benchmarks */
+/* PUBLIC DOMAIN - Jon Mayo */
+/* The program is generated here so benchmarks do not depend on the
+ * q3lcc tools:
+ *
+ *	int main(void) {
+ *		unsigned i = ITERATIONS, acc = 0;
+ *		do acc = acc * 31 + i; while (--i);
+ *		return acc;
+ *	}
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "genqvm.h"
+
+#define GENQVM_ALIGN 4096
+
+static unsigned char *
+emit(unsigned char *p, unsigned op, int has_param, uint32_t param)
+{
+	*p++ = op;
+	if (has_param) {
+		*p++ = param;
+		*p++ = param >> 8;
+		*p++ = param >> 16;
+		*p++ = param >> 24;
+	}
+	return p;
+}
+
+#define OP(op) p = emit(p, (op), 0, 0)
+#define OPX(op, x) p = emit(p, (op), 1, (x))
+
+static int
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			perror(__func__);
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* write the test program to fd. data_length bytes of initialized data are
+ * added, page_align places them at a page boundary in the file.
+ * return 0 on success, -1 on error */
+int
+genqvm_write(int fd, unsigned iterations, size_t data_length, int page_align)
+{
+	unsigned char code[256], *p = code;
+	uint32_t header[9];
+	size_t code_end, data_offset;
+	unsigned char *pad;
+	int e;
+
+	OPX(0x03, 8);			/* 0: ENTER 8 */
+	OPX(0x09, 0);			/* 1: LOCAL 0 */
+	OPX(0x08, iterations);		/* 2: CONST iterations */
+	OP(0x20);			/* 3: STORE4 */
+	OPX(0x09, 4);			/* 4: LOCAL 4 */
+	OPX(0x08, 0);			/* 5: CONST 0 */
+	OP(0x20);			/* 6: STORE4 */
+	OPX(0x09, 4);			/* 7: LOCAL 4 */
+	OPX(0x09, 4);			/* 8: LOCAL 4 */
+	OP(0x1d);			/* 9: LOAD4 */
+	OPX(0x08, 31);			/* 10: CONST 31 */
+	OP(0x2d);			/* 11: MULU */
+	OPX(0x09, 0);			/* 12: LOCAL 0 */
+	OP(0x1d);			/* 13: LOAD4 */
+	OP(0x26);			/* 14: ADD */
+	OP(0x20);			/* 15: STORE4 */
+	OPX(0x09, 0);			/* 16: LOCAL 0 */
+	OPX(0x09, 0);			/* 17: LOCAL 0 */
+	OP(0x1d);			/* 18: LOAD4 */
+	OPX(0x08, 1);			/* 19: CONST 1 */
+	OP(0x27);			/* 20: SUB */
+	OP(0x20);			/* 21: STORE4 */
+	OPX(0x09, 0);			/* 22: LOCAL 0 */
+	OP(0x1d);			/* 23: LOAD4 */
+	OPX(0x08, 0);			/* 24: CONST 0 */
+	OPX(0x0c, 7);			/* 25: NE 7 */
+	OPX(0x09, 4);			/* 26: LOCAL 4 */
+	OP(0x1d);			/* 27: LOAD4 */
+	OPX(0x04, 8);			/* 28: LEAVE 8 */
+
+	data_length &= ~(size_t)3;
+	code_end = sizeof(header) + (p - code);
+	data_offset = code_end;
+	if (page_align)
+		data_offset = (code_end + GENQVM_ALIGN - 1) & ~(size_t)(GENQVM_ALIGN - 1);
+
+	header[0] = 0x12721445; /* VM_MAGIC_VER2 */
+	header[1] = 29; /* instruction_count */
+	header[2] = sizeof(header); /* code_offset */
+	header[3] = p - code; /* code_length */
+	header[4] = data_offset; /* data_offset */
+	header[5] = data_length; /* data_length */
+	header[6] = 0; /* lit_length */
+	header[7] = 0x20000; /* bss_length */
+	header[8] = 0; /* jtrg_length */
+
+	/* padding followed by the data segment */
+	pad = malloc(data_offset - code_end + data_length + 1);
+	if (!pad)
+		return -1;
+	memset(pad, 0, data_offset - code_end);
+	for (size_t i = 0; i < data_length; i++)
+		pad[data_offset - code_end + i] = i * 7 + 1;
+
+	e = write_all(fd, header, sizeof(header)) ||
+	    write_all(fd, code, p - code) ||
+	    write_all(fd, pad, data_offset - code_end + data_length);
+	free(pad);
+
+	return e ? -1 : 0;
+}
@@ -0,0 +1,6 @@
+#ifndef GENQVM_H_
+#define GENQVM_H_
+#include <stddef.h>
+
+int genqvm_write(int fd, unsigned iterations, size_t data_length, int page_align);
+#endif
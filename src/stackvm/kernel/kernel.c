@@ -24,6 +24,7 @@
 extern int stackvm_verbose; // HACK
 
 static int opt_vm_disasm;
+static int opt_vm_profile;
 
 static struct task_channel *ready, *sleeping;
 static int kernel_task_count;
@@ -152,6 +153,9 @@ add_vm(struct vm_env *env, const char *vm_filename)
 	if (opt_vm_disasm)
 		vm_disassemble(vm);
 
+	if (opt_vm_profile && vm_profile_enable(vm, 997))
+		warn("%s:could not enable profiling", vm_filename);
+
 	struct task *task = task_new(vm_filename, vm, NULL, NULL);
 
 	vm_set_extra(vm, task);
@@ -181,6 +185,11 @@ done(struct task *task)
 			vm_filename(vm), vm_status(vm));
 	}
 
+	if (opt_vm_profile) {
+		vm_profile_summary(vm, stderr, 20);
+		vm_profile_collapsed(vm, stderr);
+	}
+
 	vm_free(vm);
 
 	task_free(task);
@@ -194,7 +203,7 @@ static int
 wait_for_next(void)
 {
 	struct prioq_elm elm;
-	if (!prioq_dequeue(timerq, &elm))
+	if (!prioq_peek(timerq, &elm))
 		return 0; /* nothing */
 
 	// TODO: loop through all prioq entries that have timed out
@@ -206,7 +215,7 @@ wait_for_next(void)
 		unsigned long long msec = elm.d - now;
 		struct timespec waittime = {
 			.tv_sec = msec / 1000,
-			.tv_nsec = (msec % 1000) * 1000,
+			.tv_nsec = (msec % 1000) * 1000000,
 		};
 		info("sleeping %lld msec", msec);
 		nanosleep(&waittime, NULL);
@@ -215,6 +224,8 @@ wait_for_next(void)
 		info("expired (%lld >= %lld)", now, elm.d);
 	}
 
+	prioq_dequeue(timerq, &elm);
+
 	trace("ptr=%p", (void*)elm.p);
 	struct task *task = elm.p;
 	task_remove_channel(task); /* take off SLEEPING queue */
@@ -269,7 +280,7 @@ run_all(void)
 static
 void usage(void)
 {
-	fprintf(stderr, "%s [-h] [-v] [-s] <file.vm>\n", program_invocation_short_name);
+	fprintf(stderr, "%s [-h] [-v] [-s] [-p] <file.vm>\n", program_invocation_short_name);
 	exit(EXIT_FAILURE);
 }
 
@@ -277,7 +288,7 @@ static void
 process_args(int argc, char **argv)
 {
 	int opt;
-	while ((opt = getopt(argc, argv, "hvs")) != -1) {
+	while ((opt = getopt(argc, argv, "hvsp")) != -1) {
 		switch (opt) {
 		case 'h':
 			usage();
@@ -288,6 +299,9 @@ process_args(int argc, char **argv)
 		case 's':
 			opt_vm_disasm = 1;
 			break;
+		case 'p':
+			opt_vm_profile = 1;
+			break;
 		}
 	}
 }
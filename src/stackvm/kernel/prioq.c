@@ -1,11 +1,14 @@
-/* prioq.c - priority queue, implement as a heap holding a complete binary tree
+/* prioq.c - priority queue, implement as a heap holding a complete 4-ary tree
  * This software is PUBLIC DOMAIN as of September 2008. No copyright is claimed.
  * Jon Mayo <jon@rm-f.net>
  * Initial: September 1, 2008
  * Updated: June 19, 2020
  */
+/* Every entry has a handle. A back-map from handle to heap position makes
+ * cancel and reschedule O(log n). Four children per node make the tree half
+ * as deep as a binary heap, and the children of a node share a cache line.
+ */
 /* TODO:
- * + support growth of queue through realloc()
  * + return error codes and error strings, remove stdio.h
  */
 #include "prioq.h"
@@ -19,44 +22,59 @@
 #define TRACEF(fmt, ...) /* ignored */
 #endif
 
-#define LEFT(i) (2*(i)+1)
-#define RIGHT(i) (2*(i)+2)
-#define PARENT(i) (((i)-1)/2)
+#ifndef PRIOQ_ARITY
+#define PRIOQ_ARITY 4
+#endif
+#define ARITY PRIOQ_ARITY
+#define CHILD(i) (ARITY*(i)+1) /* first child */
+#define PARENT(i) (((i)-1)/ARITY)
+
+#define NO_HANDLE (~0u)
 
 /* min heap is sorted by lowest value at root
  * return non-zero if a>b (greater-than)
  */
 static inline int
-compare(const struct prioq_elm *a, const struct prioq_elm *b)
+compare(const struct prioq_node *a, const struct prioq_node *b)
 {
 	assert(a != NULL);
 	assert(b != NULL);
 	return a->d > b->d;
 }
 
+/* put node into position i and update the back-map */
+static inline void
+place(struct prioq *h, unsigned i, const struct prioq_node *node)
+{
+	h->heap[i] = *node;
+	h->index[node->handle] = i;
+}
+
 /* i is the "hole" location
- * elm is the value to compare against
+ * node is the value to compare against
  * return new position of hole */
-static int
-siftdown(struct prioq *h, unsigned i, const struct prioq_elm *elm)
+static unsigned
+siftdown(struct prioq *h, unsigned i, const struct prioq_node *node)
 {
-	assert(elm != NULL);
-	assert(i < h->heap_len || i == 0);
-	while (LEFT(i) < h->heap_len) { /* keep going until at a leaf node */
-		unsigned child = LEFT(i);
-
-		/* compare left and right(child+1) - use the smaller of the two */
-		if (child + 1 < h->heap_len && compare(&h->heap[child], &h->heap[child+1])) {
-			child++; /* left is bigger than right, use right */
+	assert(node != NULL);
+	while (CHILD(i) < h->heap_len) { /* keep going until at a leaf node */
+		unsigned first = CHILD(i);
+		unsigned last = first + ARITY < h->heap_len ? first + ARITY : h->heap_len;
+		unsigned child = first, k;
+
+		/* find the smallest child */
+		for (k = first + 1; k < last; k++) {
+			if (compare(&h->heap[child], &h->heap[k]))
+				child = k;
 		}
 
-		/* child is the smallest child, if elm is smaller or equal then we're done */
-		if (!compare(elm, &h->heap[child])) /* elm <= child */
+		/* child is the smallest child, if node is smaller or equal then we're done */
+		if (!compare(node, &h->heap[child])) /* node <= child */
 			break;
 
-		/* swap "hole" and selected child */
+		/* move selected child into the "hole" */
 		TRACEF("%s():swap hole %d with entry %d", __func__, i, child);
-		h->heap[i] = h->heap[child];
+		place(h, i, &h->heap[child]);
 		i = child;
 	}
 	TRACEF("%s():chosen position %d for hole.", __func__, i);
@@ -65,36 +83,96 @@ siftdown(struct prioq *h, unsigned i, const struct prioq_elm *elm)
 }
 
 /* i is the "hole" location
- * elm is the value to compare against
+ * node is the value to compare against
  * return the new position of the hole
- * return -1 on error (EINVAL)
  */
-static int
-siftup(struct prioq *h, unsigned hole, const struct prioq_elm *elm)
+static unsigned
+siftup(struct prioq *h, unsigned i, const struct prioq_node *node)
 {
 	assert(h != NULL);
-	assert(elm != NULL);
-	assert(hole < h->heap_len);
-
-	if (!h || !elm || hole >= h->heap_len)
-		return -1;
+	assert(node != NULL);
+	assert(i < h->heap_len);
 
-	int i = hole;
 	while (i > 0) {
 		/* Compare the element with parent */
-		if (!compare(&h->heap[PARENT(i)], elm)) {
-			return i;
-		}
-		/* swap element with parent and keep going (keep tracking the "hole") */
-		h->heap[i] = h->heap[PARENT(i)];
+		if (!compare(&h->heap[PARENT(i)], node))
+			break;
+		/* move parent down and keep going (keep tracking the "hole") */
+		place(h, i, &h->heap[PARENT(i)]);
 		i = PARENT(i);
 	}
 
 	return i;
 }
 
+/* move node into the hole at i, sifting up or down as needed */
+static void
+fixup(struct prioq *h, unsigned i, const struct prioq_node *node)
+{
+	if (i > 0 && compare(&h->heap[PARENT(i)], node))
+		i = siftup(h, i, node);
+	else
+		i = siftdown(h, i, node);
+	place(h, i, node);
+}
+
+/* return heap position of handle, or -1 if it is not queued */
+static int
+lookup(const struct prioq *h, int handle)
+{
+	unsigned i;
+
+	if (handle < 0 || (unsigned)handle >= h->heap_max)
+		return -1;
+
+	i = h->index[handle];
+	/* free handles hold the next free handle, which can't point at itself */
+	if (i >= h->heap_len || h->heap[i].handle != (unsigned)handle)
+		return -1;
+
+	return i;
+}
+
+/* chain handles [from, to) onto the free list */
+static void
+free_handles(struct prioq *h, unsigned from, unsigned to)
+{
+	while (to > from) {
+		to--;
+		h->index[to] = h->free_handle;
+		h->free_handle = to;
+	}
+}
+
+static int
+grow(struct prioq *h)
+{
+	unsigned new_max = h->heap_max ? h->heap_max * 2 : 16;
+	struct prioq_node *heap;
+	unsigned *index;
+
+	if (new_max <= h->heap_max || new_max >= NO_HANDLE)
+		return -1;
+
+	heap = realloc(h->heap, new_max * sizeof(*heap));
+	if (!heap)
+		return -1;
+	h->heap = heap;
+
+	index = realloc(h->index, new_max * sizeof(*index));
+	if (!index)
+		return -1;
+	h->index = index;
+
+	free_handles(h, h->heap_max, new_max);
+	h->heap_max = new_max;
+
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////
 
+/* max_size is the initial size, the queue grows when full */
 struct prioq *
 prioq_new(unsigned max_size)
 {
@@ -102,15 +180,24 @@ prioq_new(unsigned max_size)
 	if (!h)
 		return NULL; /* failed to allocate prioq */
 
+	if (!max_size)
+		max_size = 1;
+
 	h->heap_len = 0;
 	h->heap_max = max_size;
+	h->free_handle = NO_HANDLE;
 
 	h->heap = calloc(h->heap_max, sizeof(*h->heap));
-	if (!h->heap) {
+	h->index = calloc(h->heap_max, sizeof(*h->index));
+	if (!h->heap || !h->index) {
+		free(h->heap);
+		free(h->index);
 		free(h);
 		return NULL; /* failed to allocate max_size */
 	}
 
+	free_handles(h, 0, h->heap_max);
+
 	return h;
 }
 
@@ -121,6 +208,8 @@ prioq_free(struct prioq *h)
 		return;
 	free(h->heap);
 	h->heap = NULL;
+	free(h->index);
+	h->index = NULL;
 	h->heap_max = 0;
 	h->heap_len = 0;
 	free(h);
@@ -130,24 +219,31 @@ prioq_free(struct prioq *h)
  * 1. Add the element on the bottom level of the heap.
  * 2. Compare the added element with its parent; if they are in the correct order, stop.
  * 3. If not, swap the element with its parent and return to the previous step.
+ * return a handle for cancel and reschedule, or -1 on error
  */
 int
 prioq_enqueue(struct prioq *h, const struct prioq_elm *elm)
 {
+	struct prioq_node node;
 	unsigned i;
 
-	if (h->heap_len >= h->heap_max)
-		return -1; /* error: heap is full (TODO: realloc) */
+	if (h->free_handle == NO_HANDLE && grow(h))
+		return -1; /* error: heap is full and could not grow */
+
+	node.d = elm->d;
+	node.p = elm->p;
+	node.handle = h->free_handle;
+	h->free_handle = h->index[node.handle];
 
 	i = h->heap_len++; /* add the element to the bottom of the heap (create a "hole") */
-	i = siftup(h, i, elm);
-	h->heap[i] = *elm; /* fill in the "hole" */
+	i = siftup(h, i, &node);
+	place(h, i, &node); /* fill in the "hole" */
 
-	return 0;
+	return node.handle;
 }
 
 /* sift-down operation for dequeueing
- * removes the root entry and copies it to ret
+ * removes the root entry and copies it to out
  */
 int
 prioq_dequeue(struct prioq *h, struct prioq_elm *out)
@@ -157,84 +253,82 @@ prioq_dequeue(struct prioq *h, struct prioq_elm *out)
 	if (h->heap_len <= 0)
 		return 0; /* nothing to dequeue */
 
-	*out = h->heap[0]; /* we have to copy the root element somewhere because we're removing it */
+	return prioq_cancel(h, h->heap[0].handle, out);
+}
 
-	/* move last entry to the root, then sift-down */
-	h->heap_len--;
-	int i = siftdown(h, 0, &h->heap[h->heap_len]);
-	h->heap[i] = h->heap[h->heap_len];
+/* copy the root entry to out without removing it.
+ * return 1 if there is an entry, 0 if the queue is empty */
+int
+prioq_peek(const struct prioq *h, struct prioq_elm *out)
+{
+	assert(out != NULL);
+
+	if (h->heap_len <= 0)
+		return 0; /* nothing queued */
+
+	out->d = h->heap[0].d;
+	out->p = h->heap[0].p;
 
 	return 1;
 }
 
-/* removes entry at i */
+/* removes entry with handle. out is optional.
+ * return 1 on success, 0 if handle is not queued */
 int
-prioq_cancel(struct prioq *h, unsigned i, struct prioq_elm *out)
+prioq_cancel(struct prioq *h, int handle, struct prioq_elm *out)
 {
-	/* 1. copy the value at i into out
-	 * 2. put last node into empty position
-	 * 3. sift-up if moved node smaller than parent, sift-down if larger than either child
-	 */
-	assert(out != NULL);
-	assert(i < h->heap_len);
-	assert(h->heap_len < h->heap_max);
-
-	*out = h->heap[i]; /* copy the value at i into ret */
-	TRACEF("canceling entry #%d: val=%d (parent=%d:>%u) (left %d:>%u) (right %d:>%u) (last %d)",
-		  i, ret->d,
-		  i>0 ? (int)PARENT(i) : -1,
-		  i>0 ? heap[PARENT(i)].d : 0,
-		  LEFT(i)<heap_len ? (int)LEFT(i) : -1,
-		  LEFT(i)<heap_len ? heap[LEFT(i)].d : 0,
-		  RIGHT(i)<heap_len ? (int)RIGHT(i) : -1,
-		  RIGHT(i)<heap_len ? heap[RIGHT(i)].d : 0,
-		  heap[heap_len-1].d
-		 );
-
-	/* move last entry to the empty position */
+	int i = lookup(h, handle);
+
+	if (i < 0)
+		return 0;
+
+	if (out) {
+		out->d = h->heap[i].d;
+		out->p = h->heap[i].p;
+	}
+	TRACEF("canceling entry #%d: val=%llu", i, h->heap[i].d);
+
+	/* release the handle */
+	h->index[handle] = h->free_handle;
+	h->free_handle = handle;
+
+	/* move last entry into the empty position */
 	h->heap_len--;
-	struct prioq_elm *last = &h->heap[h->heap_len];
-
-	/* i now holds the position of the last entry, we will move this "hole" until
-	 * it is in the correct place for last */
-
-	if (i > 0 && compare(&h->heap[PARENT(i)], last)) {
-		/* we already did the compare, so we'll perform the first move here */
-		TRACEF("%s():swap hole %d with entry %d", __func__, i, PARENT(i));
-		h->heap[i] = h->heap[PARENT(i)]; /* move parent down */
-		i = siftup(h, PARENT(i), last); /* sift the "hole" up */
-	} else if ((RIGHT(i) < h->heap_len) && (compare(last, &h->heap[RIGHT(i)]) || compare(last, &h->heap[LEFT(i)]))) {
-		/* if right is on the list, then left is as well */
-		if (compare(&h->heap[LEFT(i)], &h->heap[RIGHT(i)])) {
-			/* left is larger - use the right hole */
-			TRACEF("%s():swap hole %d with entry %d", __func__, i, RIGHT(i));
-			h->heap[i] = h->heap[RIGHT(i)]; /* move right up */
-			i = siftdown(h, RIGHT(i), last); /* sift the "hole" down */
-		} else {
-			/* right is the larger or equal - use the left hole */
-			TRACEF("%s():swap hole %d with entry %d", __func__, i, LEFT(i));
-			h->heap[i] = h->heap[LEFT(i)]; /* move left up */
-			i = siftdown(h, LEFT(i), last); /* sift the "hole" down */
-		}
-	} else if (LEFT(i) < h->heap_len && compare(last, &h->heap[LEFT(i)])) {
-		/* at this point there is no right node */
-		TRACEF("%s():swap hole %d with entry %d", __func__, i, LEFT(i));
-		h->heap[i] = h->heap[LEFT(i)]; /* move left up */
-		i = siftdown(h, LEFT(i), last); /* sift the "hole" down */
+	if ((unsigned)i < h->heap_len) {
+		struct prioq_node last = h->heap[h->heap_len];
+		fixup(h, i, &last);
 	}
 
-	h->heap[i] = *last;
+	return 1;
+}
+
+/* change the key of a queued entry.
+ * return 1 on success, 0 if handle is not queued */
+int
+prioq_reschedule(struct prioq *h, int handle, unsigned long long d)
+{
+	int i = lookup(h, handle);
+	struct prioq_node node;
+
+	if (i < 0)
+		return 0;
+
+	node = h->heap[i];
+	node.d = d;
+	fixup(h, i, &node);
 
 	return 1;
 }
 
+/* linear search for an entry.
+ * return the handle, or -1 if not found */
 int
 prioq_find(struct prioq *h, const void *p)
 {
 	unsigned i;
-	for (i = 1; i < h->heap_len; i++) {
+	for (i = 0; i < h->heap_len; i++) {
 		if (h->heap[i].p == p)
-			return i;
+			return h->heap[i].handle;
 
 	}
 
@@ -246,12 +340,16 @@ int
 prioq_test_if_valid(struct prioq *h)
 {
 	unsigned i;
-	for (i = 1; i < h->heap_len; i++) {
-		if (compare(&h->heap[PARENT(i)], &h->heap[i])) {
+	for (i = 0; i < h->heap_len; i++) {
+		if (i > 0 && compare(&h->heap[PARENT(i)], &h->heap[i])) {
 			// TODO: remove stdio.h usage, set some error code instead
 			errorf("%p:Bad heap at %d", (void*)h, i);
 			return -1; /* not a valid heap */
 		}
+		if (h->heap[i].handle >= h->heap_max || h->index[h->heap[i].handle] != i) {
+			errorf("%p:Bad index at %d", (void*)h, i);
+			return -1; /* back-map is wrong */
+		}
 	}
 	return 0; /* success */
 }
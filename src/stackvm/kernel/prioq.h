@@ -7,18 +7,28 @@ struct prioq_elm
     void *p;
 };
 
+/* entry in the heap, handle is returned by prioq_enqueue() */
+struct prioq_node {
+	unsigned long long d;
+	void *p;
+	unsigned handle;
+};
+
 struct prioq {
 	unsigned heap_len, heap_max;
-	struct prioq_elm *heap;
+	struct prioq_node *heap;
+	unsigned *index; /* handle to heap position, or next free handle */
+	unsigned free_handle;
 };
 
 struct prioq *prioq_new(unsigned max_size);
 void prioq_free(struct prioq *h);
 int prioq_enqueue(struct prioq *h, const struct prioq_elm *elm);
 int prioq_dequeue(struct prioq *h, struct prioq_elm *out);
-int prioq_cancel(struct prioq *h, unsigned i, struct prioq_elm *out);
+int prioq_peek(const struct prioq *h, struct prioq_elm *out);
+int prioq_cancel(struct prioq *h, int handle, struct prioq_elm *out);
+int prioq_reschedule(struct prioq *h, int handle, unsigned long long d);
 int prioq_find(struct prioq *h, const void *p);
 int prioq_test_if_valid(struct prioq *h);
-// TODO: an API to return the min value would be good for setting up minimum time outs
 
 #endif
@@ -0,0 +1,162 @@
+/* prioq_bench.c - compare the 4-ary indexed heap against a binary heap */
+/* PUBLIC DOMAIN - Jon Mayo */
+/* prioq2 is prioq.c built with PRIOQ_ARITY=2. "find+cancel" is the old way
+ * to cancel a timer: a linear prioq_find() to locate it.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prioq.h"
+
+struct prioq *prioq2_new(unsigned max_size);
+void prioq2_free(struct prioq *h);
+int prioq2_enqueue(struct prioq *h, const struct prioq_elm *elm);
+int prioq2_dequeue(struct prioq *h, struct prioq_elm *out);
+int prioq2_cancel(struct prioq *h, int handle, struct prioq_elm *out);
+int prioq2_reschedule(struct prioq *h, int handle, unsigned long long d);
+int prioq2_find(struct prioq *h, const void *p);
+
+struct prioq_ops {
+	const char *name;
+	struct prioq *(*new)(unsigned max_size);
+	void (*free)(struct prioq *h);
+	int (*enqueue)(struct prioq *h, const struct prioq_elm *elm);
+	int (*dequeue)(struct prioq *h, struct prioq_elm *out);
+	int (*cancel)(struct prioq *h, int handle, struct prioq_elm *out);
+	int (*reschedule)(struct prioq *h, int handle, unsigned long long d);
+	int (*find)(struct prioq *h, const void *p);
+};
+
+static const struct prioq_ops ops4 = {
+	"4-ary", prioq_new, prioq_free, prioq_enqueue, prioq_dequeue,
+	prioq_cancel, prioq_reschedule, prioq_find,
+};
+
+static const struct prioq_ops ops2 = {
+	"binary", prioq2_new, prioq2_free, prioq2_enqueue, prioq2_dequeue,
+	prioq2_cancel, prioq2_reschedule, prioq2_find,
+};
+
+static unsigned opt_timers = 1000000;
+static unsigned opt_finds = 200;
+
+//////////////////////////////////////////////////////////////////////////////
+
+static double
+timer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+/* xorshift, same sequence for both heaps */
+static unsigned long long rng_state;
+
+static unsigned long long
+rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static void
+report(const char *name, const char *op, unsigned count, double elapsed)
+{
+	printf("%-7s %-14s %9u ops %8.1f ns/op\n", name, op, count, elapsed * 1e9 / count);
+}
+
+static int
+run(const struct prioq_ops *o)
+{
+	struct prioq *pq = o->new(1024);
+	int *handles = malloc(opt_timers * sizeof(*handles));
+	struct prioq_elm elm;
+	unsigned i, n, cancels = opt_timers / 10;
+	double start;
+
+	if (!pq || !handles)
+		return -1;
+
+	rng_state = 88172645463325252ull;
+
+	start = timer_now();
+	for (i = 0; i < opt_timers; i++) {
+		elm.d = rng() % 1000000000;
+		elm.p = &handles[i];
+		handles[i] = o->enqueue(pq, &elm);
+	}
+	report(o->name, "enqueue", opt_timers, timer_now() - start);
+
+	start = timer_now();
+	for (i = 0; i < opt_timers; i++)
+		o->reschedule(pq, handles[rng() % opt_timers], rng() % 1000000000);
+	report(o->name, "reschedule", opt_timers, timer_now() - start);
+
+	start = timer_now();
+	for (n = 0; n < cancels; n++) {
+		i = rng() % opt_timers;
+		if (handles[i] >= 0 && o->cancel(pq, handles[i], NULL))
+			handles[i] = -1;
+	}
+	report(o->name, "cancel", cancels, timer_now() - start);
+
+	start = timer_now();
+	for (n = 0; n < opt_finds; n++) {
+		i = rng() % opt_timers;
+		int h = o->find(pq, &handles[i]);
+		if (h >= 0 && o->cancel(pq, h, NULL))
+			handles[i] = -1;
+	}
+	report(o->name, "find+cancel", opt_finds, timer_now() - start);
+
+	start = timer_now();
+	for (n = 0; o->dequeue(pq, &elm); n++)
+		;
+	report(o->name, "dequeue", n, timer_now() - start);
+
+	o->free(pq);
+	free(handles);
+
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "%s [-h] [-n timers] [-f finds]\n", program_invocation_short_name);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hn:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			opt_timers = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			opt_finds = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+
+	if (!opt_timers || !opt_finds)
+		usage();
+
+	if (run(&ops4) || run(&ops2))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -1,95 +1,136 @@
-
+/* prioq_test.c - test for the priority queue */
+/* PUBLIC DOMAIN - Jon Mayo */
 #include <stdio.h>
-#define TRACEF(fmt, ...) fprintf(stderr, ">>> %s():" fmt "\n", __func__, ## __VA_ARGS__)
+#include <stdlib.h>
 
-#include "prioq.c"
+#include "prioq.h"
 
-struct prioq *testpq;
+#define NR(x) (sizeof(x) / sizeof *(x))
+#define TEST_SIZE 2000
 
-static void
-prioq_dump(struct prioq *h)
-{
-	unsigned i;
-	fprintf(stderr, "::: Dumping heapqueue :::\n");
-	for (i=0; i < h->heap_len; i++) {
-		printf("%03u = %4u (p:%d l:%d r:%d)\n", i, h->heap[i].d, i>0 ? (int)HEAPQUEUE_PARENT(i) : -1, HEAPQUEUE_LEFT(i), HEAPQUEUE_RIGHT(i));
-	}
-	printf("heap valid? %d (%d entries)\n",
-		prioq_test_if_valid(testpq) ? "No" : "Yes",
-		h->heap_len);
-}
+static int failures;
 
-void
-heapqueue_test(void)
+#define CHECK(cond) do { if (!(cond)) { \
+	fprintf(stderr, "FAIL:%s():%d:%s\n", __func__, __LINE__, #cond); \
+	failures++; } } while (0)
+
+static void
+test_order(void)
 {
-	struct prioq_elm elm, tmp;
-	unsigned i;
+	struct prioq *pq = prioq_new(4); /* small so it has to grow */
+	struct prioq_elm elm;
 	const unsigned testdata[] = {
 		42, 2, 123, 88, 3, 3, 3, 3, 3, 1, 0,
 	};
+	unsigned long long last = 0;
+	unsigned i;
+
+	for (i = 0; i < NR(testdata); i++) {
+		elm.d = testdata[i];
+		elm.p = NULL;
+		CHECK(prioq_enqueue(pq, &elm) >= 0);
+	}
+	CHECK(prioq_test_if_valid(pq) == 0);
 
-	testpq = prioq_new(100);
+	CHECK(prioq_peek(pq, &elm) == 1 && elm.d == 0);
 
-	/* fill remaining with fake data */
-	for(i = testpq->heap_len; i < testpq->heap_max; i++)
-	{
-		testpq->heap[i].d=0xcafe;
-		testpq->heap[i].p=(void*)0xdeadbeef;
+	for (i = 0; prioq_dequeue(pq, &elm); i++) {
+		CHECK(elm.d >= last);
+		last = elm.d;
 	}
+	CHECK(i == NR(testdata));
+	CHECK(prioq_peek(pq, &elm) == 0);
+
+	prioq_free(pq);
+}
+
+/* mirror of the queue, tracks which handles are live and their key */
+static struct {
+	int handle;
+	unsigned long long d;
+} shadow[TEST_SIZE];
 
-	for(i=0; i < sizeof(testdata) / sizeof(*testdata); i++)
-	{
-		prioq_enqueue(testpq, testdata[i], NULL);
+static void
+test_random(void)
+{
+	struct prioq *pq = prioq_new(16);
+	struct prioq_elm elm;
+	unsigned i, n, live = 0;
+
+	for (i = 0; i < TEST_SIZE; i++) {
+		elm.d = rand() % 1000;
+		elm.p = &shadow[i];
+		shadow[i].handle = prioq_enqueue(pq, &elm);
+		shadow[i].d = elm.d;
+		CHECK(shadow[i].handle >= 0);
+		live++;
 	}
+	CHECK(prioq_test_if_valid(pq) == 0);
 
-	prioq_dump(testpq);
+	/* randomly cancel and reschedule */
+	for (n = 0; n < TEST_SIZE * 4; n++) {
+		i = rand() % TEST_SIZE;
 
-	/* test the cancel function and randomly delete everything */
-	while(heap_len>0)
-	{
-		unsigned valid;
-		i=rand()%heap_len;
-		if(heapqueue_cancel(i, &tmp))
-		{
-			printf("canceled at %d (data=%d)\n", i, tmp.d);
+		if (shadow[i].handle < 0) {
+			CHECK(prioq_cancel(pq, shadow[i].handle, NULL) == 0);
+			continue;
 		}
-		else
-		{
-			printf("canceled at %d failed!\n", i);
-			break;
+
+		if (rand() & 1) {
+			CHECK(prioq_cancel(pq, shadow[i].handle, &elm) == 1);
+			CHECK(elm.p == &shadow[i] && elm.d == shadow[i].d);
+			/* a canceled handle must not be found again */
+			CHECK(prioq_cancel(pq, shadow[i].handle, &elm) == 0);
+			shadow[i].handle = -1;
+			live--;
+		} else {
+			shadow[i].d = rand() % 1000;
+			CHECK(prioq_reschedule(pq, shadow[i].handle, shadow[i].d) == 1);
 		}
-		// heapqueue_dump();
-		valid=prioq_test_if_valid();
-		// printf("heap valid? %d (%d entries)\n", valid, heap_len);
-		if(!valid)
-		{
-			printf("BAD HEAP!!!\n");
-			heapqueue_dump();
+
+		if (prioq_test_if_valid(pq)) {
+			failures++;
 			break;
 		}
 	}
 
-	heapqueue_dump();
-
-	/* load the queue with test data again */
-	for(i=0; i<NR(testdata); i++)
-	{
-		elm.d=testdata[i];
-		heapqueue_enqueue(&elm);
+	/* find uses the pointer */
+	for (i = 0; i < TEST_SIZE; i++) {
+		if (shadow[i].handle >= 0) {
+			CHECK(prioq_find(pq, &shadow[i]) == shadow[i].handle);
+			break;
+		}
 	}
 
-	/* do a normal dequeue of everything */
-	while(heapqueue_dequeue(&tmp))
-	{
-		printf("removed head (data=%d)\n", tmp.d);
+	/* drain and check against the shadow */
+	unsigned long long last = 0;
+	for (n = 0; prioq_dequeue(pq, &elm); n++) {
+		typeof(&shadow[0]) s = elm.p;
+
+		CHECK(elm.d >= last);
+		CHECK(s->handle >= 0 && s->d == elm.d);
+		s->handle = -1;
+		last = elm.d;
 	}
+	CHECK(n == live);
 
-	heapqueue_dump();
+	prioq_free(pq);
 }
-#endif
 
-int main()
+int
+main(void)
 {
-	heapqueue_test();
-	return 0;
+	srand(1);
+
+	test_order();
+	test_random();
+
+	if (failures) {
+		fprintf(stderr, "%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("prioq_test: passed\n");
+
+	return EXIT_SUCCESS;
 }
@@ -0,0 +1,191 @@
+/* vmload_bench.c - boot time of loading many VM modules */
+/* PUBLIC DOMAIN - Jon Mayo */
+/* Writes N distinct modules and measures the time and resident memory to
+ * load all of them, as the server does at boot. Then loads N instances of a
+ * single module, which only decodes the code once.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stackvm.h"
+#include "genqvm.h"
+
+/* logging macros */
+#define info(format, ...) fprintf(stderr, "INFO:" format "\n", ## __VA_ARGS__)
+#define error(format, ...) fprintf(stderr, "ERROR:%s():%d:" format "\n", __func__, __LINE__, ## __VA_ARGS__)
+
+static unsigned opt_modules = 500;
+static size_t opt_data = 256 * 1024;
+static int opt_align;
+
+//////////////////////////////////////////////////////////////////////////////
+
+static double
+timer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+/* resident set size in KiB, 0 if unknown */
+static unsigned long
+rss_kb(void)
+{
+	unsigned long size, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (!f)
+		return 0;
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void
+module_name(char *buf, size_t len, const char *dir, unsigned i)
+{
+	snprintf(buf, len, "%s/m%04u.qvm", dir, i);
+}
+
+static int
+make_modules(const char *dir)
+{
+	char fn[256];
+	unsigned i;
+
+	for (i = 0; i < opt_modules; i++) {
+		int fd;
+
+		module_name(fn, sizeof(fn), dir, i);
+		fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			perror(fn);
+			return -1;
+		}
+		/* vary the iterations so every module is different */
+		if (genqvm_write(fd, 1000 + i, opt_data, opt_align)) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+
+	return 0;
+}
+
+static void
+remove_modules(const char *dir)
+{
+	char fn[256];
+	unsigned i;
+
+	for (i = 0; i < opt_modules; i++) {
+		module_name(fn, sizeof(fn), dir, i);
+		unlink(fn);
+	}
+	rmdir(dir);
+}
+
+/* load opt_modules VMs. distinct loads a different module for each.
+ * return 0 on success */
+static int
+run_load(const char *dir, struct vm_env *env, int distinct, const char *label)
+{
+	struct vm **vms = calloc(opt_modules, sizeof(*vms));
+	unsigned long rss_before = rss_kb();
+	char fn[256];
+	double start, elapsed;
+	unsigned i;
+	int e = -1;
+
+	if (!vms)
+		return -1;
+
+	start = timer_now();
+	for (i = 0; i < opt_modules; i++) {
+		module_name(fn, sizeof(fn), dir, distinct ? i : 0);
+		vms[i] = vm_new(env);
+		if (!vm_load(vms[i], fn))
+			goto out;
+	}
+	elapsed = timer_now() - start;
+
+	printf("%-10s modules=%u time=%.3fms per-module=%.1fus rss=+%luKiB\n",
+		label, opt_modules, elapsed * 1e3, elapsed * 1e6 / opt_modules,
+		rss_kb() - rss_before);
+	e = 0;
+out:
+	for (i = 0; i < opt_modules; i++)
+		vm_free(vms[i]);
+	free(vms);
+	return e;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "%s [-h] [-a] [-n modules] [-d data-bytes]\n", program_invocation_short_name);
+	exit(EXIT_FAILURE);
+}
+
+static void
+process_args(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "han:d:")) != -1) {
+		switch (opt) {
+		case 'a':
+			opt_align = 1;
+			break;
+		case 'n':
+			opt_modules = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			opt_data = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	char dir[] = "/tmp/vmload_benchXXXXXX";
+	struct vm_env *env;
+	int e;
+
+	process_args(argc, argv);
+
+	if (!opt_modules)
+		opt_modules = 1;
+
+	if (!mkdtemp(dir)) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+
+	env = vm_env_new(1);
+	if (!env || make_modules(dir)) {
+		remove_modules(dir);
+		return EXIT_FAILURE;
+	}
+
+	info("modules=%u data=%zu aligned=%d", opt_modules, opt_data, opt_align);
+
+	e = run_load(dir, env, 1, "distinct") || run_load(dir, env, 0, "shared");
+
+	remove_modules(dir);
+
+	return e ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+/* vmpool.c - run independent VM slices on a pool of worker threads */
+/* PUBLIC DOMAIN - Jon Mayo */
+/* Every VM owns its heap and op stack, so slices of different VMs can run
+ * in parallel. Anything that touches shared (game) state must not run on a
+ * worker, instead syscalls use vmpool_defer() to queue a message. Messages
+ * are applied on the thread calling vmpool_tick() after all slices have
+ * finished (the tick barrier), in submission order and then in the order
+ * each VM emitted them. The result does not depend on the number of threads.
+ *
+ * Scheduling: the ready list is split into one range per thread. A thread
+ * drains its own range first, then steals from the ranges of other threads.
+ */
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vmpool.h"
+
+/* logging macros */
+#define error(format, ...) fprintf(stderr, "ERROR:%s():%d:" format "\n", __func__, __LINE__, ## __VA_ARGS__)
+
+#define VMPOOL_MAX_THREADS 256
+
+/* a syscall side-effect waiting for the tick barrier */
+struct vmpool_msg {
+	vmpool_apply_fn apply;
+	void *p;
+	vmword_t arg;
+};
+
+/* one ready VM for the current tick */
+struct vmpool_job {
+	struct vm *vm;
+	int e; /* result of vm_run_slice() */
+	unsigned nr_msg, max_msg;
+	struct vmpool_msg *msg;
+};
+
+/* jobs [next, end) still belong to a thread. other threads may steal them. */
+struct vmpool_range {
+	atomic_uint next;
+	unsigned end;
+} __attribute__ ((aligned (64))); /* keep each range on its own cache line */
+
+struct vmpool {
+	unsigned nr_threads; /* including the thread calling vmpool_tick() */
+	pthread_t *threads;
+	struct vmpool_range *range;
+	unsigned nr_jobs, max_jobs;
+	struct vmpool_job *jobs;
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	unsigned generation; /* incremented to start a tick */
+	unsigned running; /* worker threads still busy in this tick */
+	int shutdown;
+};
+
+struct vmpool_worker {
+	struct vmpool *pool;
+	unsigned self;
+};
+
+/* job of the VM running on this thread, NULL when not inside a slice */
+static __thread struct vmpool_job *current_job;
+
+//////////////////////////////////////////////////////////////////////////////
+
+static void
+run_job(struct vmpool_job *job)
+{
+	current_job = job;
+	job->e = vm_run_slice(job->vm);
+	current_job = NULL;
+}
+
+/* drain our own range, then steal from the others */
+static void
+run_ranges(struct vmpool *pool, unsigned self)
+{
+	unsigned k, i;
+
+	for (k = 0; k < pool->nr_threads; k++) {
+		struct vmpool_range *r = &pool->range[(self + k) % pool->nr_threads];
+
+		while ((i = atomic_fetch_add_explicit(&r->next, 1, memory_order_relaxed)) < r->end)
+			run_job(&pool->jobs[i]);
+	}
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct vmpool_worker *w = arg;
+	struct vmpool *pool = w->pool;
+	unsigned self = w->self;
+	unsigned gen = 0; /* workers may start after the first tick began */
+
+	free(w);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (gen == pool->generation && !pool->shutdown)
+			pthread_cond_wait(&pool->start_cond, &pool->lock);
+		if (pool->shutdown)
+			break;
+		gen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_ranges(pool, self);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+/* create a pool that runs slices on nr_threads threads.
+ * the caller of vmpool_tick() counts as one of the threads. */
+struct vmpool *
+vmpool_new(unsigned nr_threads)
+{
+	struct vmpool *pool;
+	unsigned i;
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > VMPOOL_MAX_THREADS)
+		nr_threads = VMPOOL_MAX_THREADS;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->nr_threads = nr_threads;
+	pool->range = aligned_alloc(64, nr_threads * sizeof(*pool->range));
+	pool->threads = calloc(nr_threads, sizeof(*pool->threads));
+	if (!pool->range || !pool->threads) {
+		free(pool->range);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		atomic_init(&pool->range[i].next, 0);
+		pool->range[i].end = 0;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* thread 0 is the caller of vmpool_tick() */
+	for (i = 1; i < nr_threads; i++) {
+		struct vmpool_worker *w = malloc(sizeof(*w));
+		if (!w)
+			goto failure;
+		w->pool = pool;
+		w->self = i;
+		if (pthread_create(&pool->threads[i], NULL, worker_main, w)) {
+			error("pthread_create failed");
+			free(w);
+			goto failure;
+		}
+	}
+
+	return pool;
+failure:
+	/* only the threads that started are joined */
+	pool->nr_threads = i;
+	vmpool_free(pool);
+	return NULL;
+}
+
+void
+vmpool_free(struct vmpool *pool)
+{
+	unsigned i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->nr_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	for (i = 0; i < pool->max_jobs; i++)
+		free(pool->jobs[i].msg);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->jobs);
+	free(pool->threads);
+	free(pool->range);
+	free(pool);
+}
+
+unsigned
+vmpool_threads(const struct vmpool *pool)
+{
+	return pool ? pool->nr_threads : 0;
+}
+
+/* add a ready VM to the next tick.
+ * order of submission is the order messages are applied in.
+ * return 0 on success, -1 on error */
+int
+vmpool_submit(struct vmpool *pool, struct vm *vm)
+{
+	if (!pool || !vm)
+		return -1;
+
+	if (pool->nr_jobs >= pool->max_jobs) {
+		unsigned new_max = pool->max_jobs ? pool->max_jobs * 2 : 64;
+		struct vmpool_job *p = realloc(pool->jobs, new_max * sizeof(*p));
+		if (!p)
+			return -1;
+		memset(p + pool->max_jobs, 0, (new_max - pool->max_jobs) * sizeof(*p));
+		pool->jobs = p;
+		pool->max_jobs = new_max;
+	}
+
+	struct vmpool_job *job = &pool->jobs[pool->nr_jobs++];
+	job->vm = vm;
+	job->e = 0;
+	job->nr_msg = 0;
+
+	return 0;
+}
+
+/* run one slice of every submitted VM, then wait for all of them to finish.
+ * at the barrier the deferred messages of each VM are applied, followed by
+ * slice_done() with the result of vm_run_slice(). both happen on the calling
+ * thread in submission order.
+ * return number of VMs that were run, or -1 on error */
+int
+vmpool_tick(struct vmpool *pool, void (*slice_done)(struct vm *vm, int e, void *p), void *p)
+{
+	unsigned nr_jobs, per, i, j;
+
+	if (!pool)
+		return -1;
+
+	nr_jobs = pool->nr_jobs;
+	if (!nr_jobs)
+		return 0;
+
+	per = (nr_jobs + pool->nr_threads - 1) / pool->nr_threads;
+	for (i = 0; i < pool->nr_threads; i++) {
+		unsigned begin = i * per, end = begin + per;
+
+		if (begin > nr_jobs)
+			begin = nr_jobs;
+		if (end > nr_jobs)
+			end = nr_jobs;
+		atomic_store_explicit(&pool->range[i].next, begin, memory_order_relaxed);
+		pool->range[i].end = end;
+	}
+
+	if (pool->nr_threads > 1) {
+		pthread_mutex_lock(&pool->lock);
+		pool->running = pool->nr_threads - 1;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->start_cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	run_ranges(pool, 0);
+
+	if (pool->nr_threads > 1) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->running)
+			pthread_cond_wait(&pool->done_cond, &pool->lock);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	/* tick barrier - apply side-effects in a deterministic order */
+	for (i = 0; i < nr_jobs; i++) {
+		struct vmpool_job *job = &pool->jobs[i];
+
+		for (j = 0; j < job->nr_msg; j++) {
+			const struct vmpool_msg *m = &job->msg[j];
+			m->apply(job->vm, m->p, m->arg);
+		}
+		job->nr_msg = 0;
+
+		if (slice_done)
+			slice_done(job->vm, job->e, p);
+	}
+
+	pool->nr_jobs = 0;
+
+	return nr_jobs;
+}
+
+/* queue a message from inside a syscall. it is applied at the tick barrier.
+ * if the VM is not running in a pool then apply happens immediately.
+ * return 0 on success, -1 on error */
+int
+vmpool_defer(struct vm *vm, vmpool_apply_fn apply, void *p, vmword_t arg)
+{
+	struct vmpool_job *job = current_job;
+
+	assert(apply != NULL);
+
+	if (!job || job->vm != vm) {
+		apply(vm, p, arg);
+		return 0;
+	}
+
+	if (job->nr_msg >= job->max_msg) {
+		unsigned new_max = job->max_msg ? job->max_msg * 2 : 8;
+		struct vmpool_msg *m = realloc(job->msg, new_max * sizeof(*m));
+		if (!m)
+			return -1;
+		job->msg = m;
+		job->max_msg = new_max;
+	}
+
+	job->msg[job->nr_msg++] = (struct vmpool_msg){ apply, p, arg };
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef VMPOOL_H_
+#define VMPOOL_H_
+#include "stackvm.h"
+
+struct vmpool;
+
+/* callback used to apply a deferred message on the main thread */
+typedef void (*vmpool_apply_fn)(struct vm *vm, void *p, vmword_t arg);
+
+struct vmpool *vmpool_new(unsigned nr_threads);
+void vmpool_free(struct vmpool *pool);
+unsigned vmpool_threads(const struct vmpool *pool);
+int vmpool_submit(struct vmpool *pool, struct vm *vm);
+int vmpool_tick(struct vmpool *pool, void (*slice_done)(struct vm *vm, int e, void *p), void *p);
+int vmpool_defer(struct vm *vm, vmpool_apply_fn apply, void *p, vmword_t arg);
+#endif
@@ -0,0 +1,222 @@
+/* vmpool_bench.c - scaling benchmark for the VM worker pool */
+/* PUBLIC DOMAIN - Jon Mayo */
+/* Runs thousands of compute-heavy VMs with 1..N threads and reports the
+ * speed-up. A checksum over all results is compared between runs, it must
+ * be identical for every thread count.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stackvm.h"
+#include "vmpool.h"
+#include "genqvm.h"
+
+/* logging macros */
+#define info(format, ...) fprintf(stderr, "INFO:" format "\n", ## __VA_ARGS__)
+#define error(format, ...) fprintf(stderr, "ERROR:%s():%d:" format "\n", __func__, __LINE__, ## __VA_ARGS__)
+
+static unsigned opt_vms = 4000;
+static unsigned opt_iterations = 20000;
+static unsigned opt_threads;
+static int opt_profile;
+
+struct bench_result {
+	unsigned finished;
+	unsigned failed;
+	uint32_t checksum;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+static double
+timer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+/* write the test program to a temporary file. return 0 on success */
+static int
+make_program(char *filename)
+{
+	int fd = mkstemp(filename);
+
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+
+	if (genqvm_write(fd, opt_iterations, 0, 0)) {
+		close(fd);
+		unlink(filename);
+		return -1;
+	}
+
+	if (close(fd)) {
+		perror(filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+static void
+slice_done(struct vm *vm, int e, void *p)
+{
+	struct bench_result *res = p;
+	char *done = vm_get_extra(vm);
+
+	if (e != 0)
+		*done = 1;
+
+	if (e == 1) {
+		vmword_t result = vm_pop(vm);
+		res->checksum = res->checksum * 33 + result;
+		res->finished++;
+	} else if (e < 0) {
+		res->failed++;
+	}
+}
+
+/* load every VM, then run ticks until all have finished.
+ * return elapsed seconds of the run (not including load), or -1 on error */
+static double
+run_bench(const char *filename, unsigned nr_threads, struct bench_result *res)
+{
+	struct vm_env *env = vm_env_new(1);
+	struct vmpool *pool = vmpool_new(nr_threads);
+	struct vm **vms = calloc(opt_vms, sizeof(*vms));
+	char *done = calloc(opt_vms, 1);
+	double start, elapsed = -1;
+	unsigned i;
+
+	memset(res, 0, sizeof(*res));
+
+	if (!env || !pool || !vms || !done)
+		goto out;
+
+	for (i = 0; i < opt_vms; i++) {
+		vms[i] = vm_new(env);
+		if (!vm_load(vms[i], filename)) {
+			error("%s:could not load file", filename);
+			goto out;
+		}
+		if (opt_profile && vm_profile_enable(vms[i], 997))
+			goto out;
+		vm_set_extra(vms[i], &done[i]);
+		vm_call(vms[i], 0, 0);
+	}
+
+	start = timer_now();
+	do {
+		for (i = 0; i < opt_vms; i++) {
+			if (!done[i])
+				vmpool_submit(pool, vms[i]);
+		}
+	} while (vmpool_tick(pool, slice_done, res) > 0 && res->finished + res->failed < opt_vms);
+	elapsed = timer_now() - start;
+
+	if (opt_profile && nr_threads == 1)
+		vm_profile_summary(vms[0], stdout, 10);
+out:
+	if (vms) {
+		for (i = 0; i < opt_vms; i++)
+			vm_free(vms[i]);
+		free(vms);
+	}
+	free(done);
+	vmpool_free(pool);
+	// TODO: there is no vm_env_free()
+	return elapsed;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "%s [-h] [-p] [-n vms] [-i iterations] [-t max-threads]\n", program_invocation_short_name);
+	exit(EXIT_FAILURE);
+}
+
+static void
+process_args(int argc, char **argv)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "hpn:i:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			opt_vms = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			opt_iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opt_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			opt_profile = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	char filename[] = "/tmp/vmpool_benchXXXXXX";
+	struct bench_result base = { 0, 0, 0 }, res;
+	double base_time = 0;
+	unsigned t;
+
+	process_args(argc, argv);
+
+	if (!opt_threads) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		opt_threads = n > 0 ? n : 1;
+	}
+	if (!opt_iterations)
+		opt_iterations = 1;
+
+	if (make_program(filename))
+		return EXIT_FAILURE;
+
+	info("vms=%u iterations=%u max-threads=%u", opt_vms, opt_iterations, opt_threads);
+
+	for (t = 1; t <= opt_threads; t++) {
+		double elapsed = run_bench(filename, t, &res);
+
+		if (elapsed < 0 || res.failed || res.finished != opt_vms) {
+			error("run failed (threads=%u finished=%u failed=%u)", t, res.finished, res.failed);
+			unlink(filename);
+			return EXIT_FAILURE;
+		}
+
+		if (t == 1) {
+			base = res;
+			base_time = elapsed;
+		} else if (res.checksum != base.checksum) {
+			error("non-deterministic result (threads=%u checksum=%#x expected=%#x)",
+				t, res.checksum, base.checksum);
+			unlink(filename);
+			return EXIT_FAILURE;
+		}
+
+		printf("threads=%-3u time=%.3fs insns/sec=%.3g speedup=%.2fx\n",
+			t, elapsed, (double)opt_vms * opt_iterations * 19 / elapsed,
+			base_time / elapsed);
+	}
+
+	unlink(filename);
+
+	return EXIT_SUCCESS;
+}
@@ -2,6 +2,7 @@
 /* PUBLIC DOMAIN - Jon Mayo
  * original: June 23, 2011
  * updated: November 10, 2019 */
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
@@ -12,6 +13,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "stackvm.h"
 
 #if 0 /* useful for debugging */
@@ -44,6 +50,11 @@ int stackvm_verbose = 0;
 #define VM_STACK_SIZE 1024
 #define PROGRAM_STACK_SIZE 0x10000
 #define MAX_VMMAIN_ARGS 13
+#define VM_SNAPSHOT_MAGIC 0x4e534d56 /* "VMSN" */
+#define VM_SNAPSHOT_VERSION 1
+#define VM_SNAPSHOT_PAGE 512
+#define VM_PROFILE_MAX_DEPTH 32
+#define VM_PROFILE_MAX_STACKS 4096 /* must be a power of two */
 
 /* expanded instruction */
 struct vm_op {
@@ -75,6 +86,10 @@ struct vm {
 	} heap;
 	size_t heap_len;
 	size_t heap_mask;
+	/* DATA and LIT from the module, the initial contents of heap */
+	struct vm_module *module;
+	const uint8_t *image;
+	size_t image_len;
 	int status; /* stop loop when non-zero */
 	vmword_t pc; /* program counter */
 	vmword_t psp; /* program stack pointer */
@@ -83,6 +98,40 @@ struct vm {
 	unsigned op_stack;
 	/* bootstrap and input parameters */
 	char *vm_filename;
+	struct vm_profile *profile; /* NULL if profiling is off */
+};
+
+/* a unique call stack seen by the PC sampler */
+struct vm_profile_stack {
+	uint32_t hash;
+	unsigned depth;
+	unsigned long long count;
+	vmword_t func[VM_PROFILE_MAX_DEPTH];
+};
+
+struct vm_profile_syscall {
+	unsigned long long count;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+};
+
+/* profiling state - functions are identified by the address of their ENTER */
+struct vm_profile {
+	unsigned long long *insn_count; /* executions of each instruction */
+	vmword_t *func_of; /* instruction to function start */
+	size_t code_len;
+	unsigned long long total_insns;
+	/* PC sampler */
+	unsigned sample_interval;
+	unsigned sample_countdown;
+	unsigned depth; /* may exceed VM_PROFILE_MAX_DEPTH, deeper frames are not recorded */
+	vmword_t stack[VM_PROFILE_MAX_DEPTH];
+	unsigned nr_stacks;
+	unsigned long long dropped_samples;
+	struct vm_profile_stack *stacks; /* hash table of VM_PROFILE_MAX_STACKS */
+	/* syscalls */
+	unsigned nr_syscalls;
+	struct vm_profile_syscall *syscall;
 };
 
 static char *opcode_to_name[] = {
@@ -326,14 +375,21 @@ static const char *disassemble_opcode(const struct vm_op *op)
 	return buf;
 }
 
-static void disassemble(FILE *out, const struct vm_op *ops, size_t ops_len, vmword_t baseaddr)
+/* counts is optional, when set each line is annotated with an execution count */
+static void disassemble(FILE *out, const struct vm_op *ops, size_t ops_len, vmword_t baseaddr,
+                        const unsigned long long *counts)
 {
 	unsigned i;
 	fprintf(out, "---8<--- start of disassembly (len=%zd) ---8<---\n", ops_len);
 
-	for (i = 0; i < ops_len; i++)
-		fprintf(out, "%06x: %s\n",
-		        baseaddr + i, disassemble_opcode(ops + i));
+	for (i = 0; i < ops_len; i++) {
+		if (counts)
+			fprintf(out, "%12llu %06x: %s\n", counts[i],
+			        baseaddr + i, disassemble_opcode(ops + i));
+		else
+			fprintf(out, "%06x: %s\n",
+			        baseaddr + i, disassemble_opcode(ops + i));
+	}
 
 	fprintf(out, "---8<--- end of disassembly ---8<---\n");
 }
@@ -550,7 +606,7 @@ static void ppoke(struct vm *vm, int index, vmword_t val)
 
 void vm_disassemble(const struct vm *vm)
 {
-	disassemble(stdout, vm->code, vm->code_len, 0);
+	disassemble(stdout, vm->code, vm->code_len, 0, NULL);
 }
 
 #if 0
@@ -560,6 +616,96 @@ static void vm_stacktrace(const struct vm *vm)
 }
 #endif
 
+/**** profiling ****/
+
+static unsigned long long profile_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t profile_hash(const vmword_t *func, unsigned depth)
+{
+	uint32_t h = 2166136261u; /* FNV-1a */
+	unsigned i;
+
+	for (i = 0; i < depth; i++) {
+		h ^= func[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* record the current shadow call stack */
+static void profile_sample(struct vm_profile *prof)
+{
+	unsigned depth = prof->depth < VM_PROFILE_MAX_DEPTH ? prof->depth : VM_PROFILE_MAX_DEPTH;
+	uint32_t h = profile_hash(prof->stack, depth);
+	unsigned i, n;
+
+	for (n = 0, i = h; n < VM_PROFILE_MAX_STACKS; n++, i++) {
+		struct vm_profile_stack *ps = &prof->stacks[i & (VM_PROFILE_MAX_STACKS - 1)];
+
+		if (!ps->count) {
+			if (prof->nr_stacks >= VM_PROFILE_MAX_STACKS / 2)
+				break; /* table is getting full */
+			ps->hash = h;
+			ps->depth = depth;
+			memcpy(ps->func, prof->stack, depth * sizeof(*ps->func));
+			ps->count = 1;
+			prof->nr_stacks++;
+			return;
+		}
+
+		if (ps->hash == h && ps->depth == depth &&
+		    !memcmp(ps->func, prof->stack, depth * sizeof(*ps->func))) {
+			ps->count++;
+			return;
+		}
+	}
+
+	prof->dropped_samples++;
+}
+
+static inline void profile_insn(struct vm_profile *prof, vmword_t pc)
+{
+	prof->insn_count[pc]++;
+	prof->total_insns++;
+	if (--prof->sample_countdown == 0) {
+		prof->sample_countdown = prof->sample_interval;
+		profile_sample(prof);
+	}
+}
+
+static inline void profile_enter(struct vm_profile *prof, vmword_t pc)
+{
+	if (prof->depth < VM_PROFILE_MAX_DEPTH)
+		prof->stack[prof->depth] = pc;
+	prof->depth++;
+}
+
+static inline void profile_leave(struct vm_profile *prof)
+{
+	if (prof->depth)
+		prof->depth--;
+}
+
+static void profile_syscall(struct vm_profile *prof, int syscall_num, unsigned long long ns)
+{
+	unsigned ofs = -1 - syscall_num;
+
+	if (ofs >= prof->nr_syscalls)
+		return;
+
+	prof->syscall[ofs].count++;
+	prof->syscall[ofs].total_ns += ns;
+	if (ns > prof->syscall[ofs].max_ns)
+		prof->syscall[ofs].max_ns = ns;
+}
+
 /* return 1 if finished (re-entrant), 0 if not finished, and -1 on error. */
 int vm_run_slice(struct vm *vm)
 {
@@ -580,6 +726,9 @@ int vm_run_slice(struct vm *vm)
 	while (!vm->status && !_check_code_bounds(__func__, __LINE__, vm, vm->pc)) {
 		struct vm_op *op = &vm->code[vm->pc++];
 
+		if (vm->profile)
+			profile_insn(vm->profile, vm->pc - 1);
+
 #ifdef DEBUG_ENABLED
 		{ /* debug only */
 			vmword_t top = ~0;
@@ -604,8 +753,12 @@ int vm_run_slice(struct vm *vm)
 			break;
 		case 0x03: /* ENTER - increase program stack by amount */
 			vm->psp -= op->param;
+			if (vm->profile)
+				profile_enter(vm->profile, vm->pc - 1);
 			break;
 		case 0x04: /* LEAVE - shrink program stack by amount */
+			if (vm->profile)
+				profile_leave(vm->profile);
 			if (vm_leave(vm, op->param)) {
 				e = 1; /* finished - results on stack */
 				goto out;
@@ -623,9 +776,13 @@ int vm_run_slice(struct vm *vm)
 				// TODO: do system call if program counter is negative
 				vm->pc = 0xdeadbeef; /* system call better clean this up */
 				if (vm->env) {
+					unsigned long long t0 = vm->profile ? profile_clock() : 0;
+
 					vm->yield = 0;
 					if (vm_env_call(vm->env, a, vm))
 						vm_error_set(vm, VM_ERROR_BAD_SYSCALL);
+					if (vm->profile)
+						profile_syscall(vm->profile, a, profile_clock() - t0);
 					if (vm->yield) {
 						e = 0; /* not finished - yielding */
 						goto out;
@@ -1080,188 +1237,446 @@ struct vm_header {
 	int32_t jtrg_length; /* jump table target */
 };
 
-static int load_data_segment(struct vm *vm, FILE *f, const char *filename, const struct vm_header *header)
-{
-	uint32_t heap_len = header->data_length + header->lit_length + header->bss_length;
-	const unsigned data_length = header->data_length + header->lit_length;
-	const unsigned data_offset = header->data_offset;
-	heap_len = roundup_pow2(heap_len);
-	vm->heap_len = heap_len;
-	vm->heap_mask = heap_len ? heap_len - 1 : 0;
-	vm->heap.bytes = malloc(vm->heap_len);
+/* a loaded qvm file, shared by every VM running it.
+ * the file is mapped read-only, code is decoded once. */
+struct vm_module {
+	struct vm_module *next;
+	unsigned refcount;
+	char *filename;
+	/* identity of the file, a changed file is loaded again */
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	int fd; /* kept open to map the data image into heaps */
+	const uint8_t *map;
+	size_t map_len;
+	struct vm_op *code;
+	size_t code_len;
+	size_t code_mask;
+	const uint8_t *image; /* DATA + LIT, points into map */
+	size_t image_len;
+	int image_hashed;
+	uint32_t image_hash; /* computed on first use, it touches every page */
+	uint32_t data_offset;
+	size_t heap_len;
+};
 
-	if (fseek(f, data_offset, SEEK_SET))
-		goto failure_perror;
+static struct vm_module *module_cache;
 
-	if (fread(vm->heap.bytes, 1, data_length, f) != (size_t)data_length)
-		goto failure_perror; // TODO: check errno and print short read msg
+static uint32_t fnv1a(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t h = 2166136261u;
 
-#if 0
-	fprintf(stdout, "data_length=%d\n", data_length);
-	hexdump(vm->heap.bytes, data_length, stdout);
-#endif
-	memset(vm->heap.bytes + data_length, 0x00,
-	       vm->heap_mask - data_length);
-	return 0;
-failure_perror:
-	perror(filename);
-	return -1;
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+
+	return h;
 }
 
-void vm_free(struct vm *vm)
+static uint32_t module_image_hash(struct vm_module *mod)
 {
-	if (!vm)
-		return;
+	if (!mod->image_hashed) {
+		mod->image_hash = fnv1a(mod->image, mod->image_len);
+		mod->image_hashed = 1;
+	}
 
-	free(vm->vm_filename);
-	vm->vm_filename = NULL;
-	free(vm->heap.bytes);
-	vm->heap.bytes = NULL;
-	vm->heap_len = vm->heap_mask = 0;
-	free(vm->code);
-	vm->code = NULL;
-	vm->code_len = vm->code_mask = 0;
-	free(vm);
+	return mod->image_hash;
 }
 
-struct vm *vm_new(const struct vm_env *env)
+static void module_free(struct vm_module *mod)
 {
-	struct vm *vm = calloc(1, sizeof(*vm));
-	vm->env = env;
-	return vm;
+	if (!mod)
+		return;
+
+	free(mod->code);
+	if (mod->map)
+		munmap((void*)mod->map, mod->map_len);
+	if (mod->fd >= 0)
+		close(mod->fd);
+	free(mod->filename);
+	free(mod);
 }
 
-/* return 1 on success, 0 on failure */
-int vm_load(struct vm *vm, const char *filename)
+static void module_put(struct vm_module *mod)
 {
-	struct vm_header header;
-	FILE *f;
-	size_t header_len;
-	unsigned header_version;
-
-	if (!vm)
-		return 0;
+	struct vm_module **prev;
 
-	/* erase everything except the environment. */
-	const struct vm_env *env = vm->env;
-	memset(vm, 0, sizeof(*vm));
-	vm->env = env;
-
-	f = fopen(filename, "rb");
-	if (!f) {
-		perror(filename);
-		return 0;
-	}
-
-	vm->vm_filename = strdup(filename);
-
-	header_len = fread(&header, 1, sizeof(header), f);
+	if (!mod || --mod->refcount)
+		return;
 
-	if (header_len >= 36 && header.magic == VM_MAGIC_VER2) {
-		header_version = 2;
-	} else if (header_len >= 32 && header.magic == VM_MAGIC) {
-		header_version = 1;
-	} else {
-		error("%s:not a valid VM file (magic=0x%08" PRIx32 " len=%zd)\n",
-		      filename, header.magic, header_len);
-		goto failure;
+	for (prev = &module_cache; *prev; prev = &(*prev)->next) {
+		if (*prev == mod) {
+			*prev = mod->next;
+			break;
+		}
 	}
 
-	info("code_length=%d data_length=%d lit_length=%d bss_length=%d\n",
-	     header.code_length, header.data_length, header.lit_length,
-	     header.bss_length);
+	module_free(mod);
+}
 
-	/* validate */
+/* validate the header against the size of the file.
+ * return 0 on success, -1 on failure */
+static int validate_header(const char *filename, const struct vm_header *header,
+                           unsigned header_version, size_t header_len, uint64_t file_size)
+{
+	uint64_t code_end, data_end, heap_len;
 
 	/* checks that none of the sizes are negative
 	 * checks that bss_length has room for PROGRAM_STACK_SIZE.
 	 */
-	if (header.code_length < 0 || header.data_length < 0 || header.lit_length < 0
-	                || header.bss_length < PROGRAM_STACK_SIZE
-	                || (header_version >= 2 && header.jtrg_length < 0)) {
-		goto failure;
+	if (header->code_length < 0 || header->data_length < 0 || header->lit_length < 0
+	                || header->bss_length < PROGRAM_STACK_SIZE
+	                || (header_version >= 2 && header->jtrg_length < 0)) {
+		error("%s:bad segment size\n", filename);
+		return -1;
 	}
 
-	/* TODO: validate these:
-	instruction_count;
-	code_offset;
-	data_offset;
-	*/
-
-
-	/* load data segment */
-	int e;
-	e = load_data_segment(vm, f, filename, &header);
+	code_end = (uint64_t)header->code_offset + (uint64_t)header->code_length;
+	if (header->code_offset < header_len || code_end > file_size) {
+		error("%s:code segment out of range (offset=%#" PRIx32 " length=%" PRId32 ")\n",
+		      filename, header->code_offset, header->code_length);
+		return -1;
+	}
 
-	if (e)
-		goto failure_freevm;
+	data_end = (uint64_t)header->data_offset + (uint64_t)header->data_length +
+	           (uint64_t)header->lit_length;
+	if (header_version >= 2)
+		data_end += (uint64_t)header->jtrg_length;
+	if (header->data_offset < header_len || data_end > file_size) {
+		error("%s:data segment out of range (offset=%#" PRIx32 ")\n",
+		      filename, header->data_offset);
+		return -1;
+	}
 
-	/* load code segment */
-	size_t codebuf_len = header.code_length;
-	unsigned char *codebuf = malloc(codebuf_len);
+	/* heap must be addressable with a 32-bit word */
+	heap_len = (uint64_t)header->data_length + (uint64_t)header->lit_length +
+	           (uint64_t)header->bss_length;
+	if (heap_len > 0x80000000ull) {
+		error("%s:heap too large\n", filename);
+		return -1;
+	}
 
-	if (fseek(f, header.code_offset, SEEK_SET))
-		goto failure_perror;
+	if (header->instruction_count <= 0 || header->code_length == 0) {
+		error("%s:no instructions\n", filename);
+		return -1;
+	}
 
-	if (fread(codebuf, 1, codebuf_len, f) != codebuf_len)
-		goto failure_perror; // TODO: check errno and print short msg
+	return 0;
+}
 
-	/* expand code segment into ops */
-	trace("codebuf=%p codebuf_len=%zd\n", codebuf, codebuf_len);
-	unsigned instruction_count = count_instructions(codebuf, codebuf_len);
+/* expand the code segment into ops. return 0 on success, -1 on failure */
+static int decode_code(struct vm_module *mod, const unsigned char *codebuf,
+                       size_t codebuf_len, unsigned instruction_count)
+{
 	size_t code_size = roundup_pow2(instruction_count);
-	trace("instruction_count=%d code_size=%zd\n", instruction_count, code_size);
-	vm->code = malloc(code_size * sizeof(*vm->code));
 	unsigned i;
 	unsigned n = 0;
 
+	trace("instruction_count=%d code_size=%zd\n", instruction_count, code_size);
+	mod->code = malloc(code_size * sizeof(*mod->code));
+	if (!mod->code)
+		return -1;
+
 	for (i = 0; i < instruction_count; i++) {
 		if (n >= codebuf_len) {
 			error("incorrect instruction count at %d (i=%d cnt=%d)\n", n, i, instruction_count);
-			goto failure_freecodebuf;
+			return -1;
 		}
 
 		unsigned oplen = opcode_length(codebuf[n]);
 
 		if (oplen > codebuf_len - n) {
 			error("trucated opcode sequence at offset %d!\n", n);
-			goto failure_freecodebuf;
+			return -1;
 		}
 
 		if (oplen == 0) {
 			error("invalid opcode at offset %d!\n", n);
-			goto failure_freecodebuf;
+			return -1;
 		} else if (oplen == 1) {
-			vm->code[i].param = 0;
+			mod->code[i].param = 0;
 		} else if (oplen == 2) { /* 8-bit parameter */
-			vm->code[i].param = codebuf[n + 1];
+			mod->code[i].param = codebuf[n + 1];
 		} else if (oplen == 5) { /* 32-bit parameter */
-			vm->code[i].param =
+			mod->code[i].param =
 			        codebuf[n + 1] |
 			        ((vmword_t)codebuf[n + 2] << 8) |
 			        ((vmword_t)codebuf[n + 3] << 16) |
 			        ((vmword_t)codebuf[n + 4] << 24);
 		} else {
 			error("opcode size %d is not supported!\n", oplen);
-			goto failure_freecodebuf;
+			return -1;
 		}
 
 		// trace("i=%d n=%d oplen=%d\n", i, n, oplen);
-		vm->code[i].op = codebuf[n];
+		mod->code[i].op = codebuf[n];
 		n += oplen;
 	}
 
 	for (; i < code_size; i++) {
-		vm->code[i].op = 0x02; /* BREAK */
-		vm->code[i].param = 0;
+		mod->code[i].op = 0x02; /* BREAK */
+		mod->code[i].param = 0;
 	}
 
-	vm->code_len = instruction_count;
-	vm->code_mask = make_mask(code_size);
-	free(codebuf);
+	mod->code_len = instruction_count;
+	mod->code_mask = make_mask(code_size);
 	debug("Loaded %d opcodes\n", instruction_count);
 
-	fclose(f);
+	return 0;
+}
+
+static struct vm_module *module_load(const char *filename, int fd, const struct stat *st)
+{
+	struct vm_module *mod;
+	struct vm_header header;
+	size_t header_len;
+	unsigned header_version;
+
+	mod = calloc(1, sizeof(*mod));
+	if (!mod) {
+		close(fd);
+		return NULL;
+	}
+
+	mod->fd = fd;
+	mod->refcount = 1;
+	mod->dev = st->st_dev;
+	mod->ino = st->st_ino;
+	mod->mtime = st->st_mtime;
+	mod->size = st->st_size;
+	mod->filename = strdup(filename);
+	if (!mod->filename)
+		goto failure;
+
+	mod->map_len = st->st_size;
+	if (mod->map_len) {
+		void *p = mmap(NULL, mod->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			perror(filename);
+			goto failure;
+		}
+		mod->map = p;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header_len = mod->map_len < sizeof(header) ? mod->map_len : sizeof(header);
+	if (header_len)
+		memcpy(&header, mod->map, header_len);
+
+	if (header_len >= 36 && header.magic == VM_MAGIC_VER2) {
+		header_version = 2;
+		header_len = 36;
+	} else if (header_len >= 32 && header.magic == VM_MAGIC) {
+		header_version = 1;
+		header_len = 32;
+	} else {
+		error("%s:not a valid VM file (magic=0x%08" PRIx32 " len=%zd)\n",
+		      filename, header.magic, header_len);
+		goto failure;
+	}
+
+	info("code_length=%d data_length=%d lit_length=%d bss_length=%d\n",
+	     header.code_length, header.data_length, header.lit_length,
+	     header.bss_length);
+
+	if (validate_header(filename, &header, header_version, header_len, mod->map_len))
+		goto failure;
+
+	const unsigned char *codebuf = mod->map + header.code_offset;
+	size_t codebuf_len = header.code_length;
+	unsigned instruction_count = count_instructions(codebuf, codebuf_len);
+
+	trace("codebuf=%p codebuf_len=%zd\n", codebuf, codebuf_len);
+	if (instruction_count != (unsigned)header.instruction_count) {
+		error("%s:instruction count mismatch (header=%d actual=%u)\n",
+		      filename, header.instruction_count, instruction_count);
+		goto failure;
+	}
+
+	if (decode_code(mod, codebuf, codebuf_len, instruction_count))
+		goto failure;
+
+	mod->data_offset = header.data_offset;
+	mod->image = mod->map + header.data_offset;
+	mod->image_len = header.data_length + header.lit_length;
+	mod->heap_len = roundup_pow2(header.data_length + header.lit_length + header.bss_length);
+
+	/* the fd is only kept to map a page aligned image into each heap. */
+	if (!mod->image_len || mod->data_offset % sysconf(_SC_PAGESIZE)) {
+		close(mod->fd);
+		mod->fd = -1;
+	}
+
+	return mod;
+failure:
+	module_free(mod);
+	return NULL;
+}
+
+/* find a loaded module or load it */
+static struct vm_module *module_get(const char *filename)
+{
+	struct vm_module *mod;
+	struct stat st;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(filename);
+		return NULL;
+	}
+
+	if (fstat(fd, &st)) {
+		perror(filename);
+		close(fd);
+		return NULL;
+	}
+
+	for (mod = module_cache; mod; mod = mod->next) {
+		if (mod->dev == st.st_dev && mod->ino == st.st_ino &&
+		    mod->mtime == st.st_mtime && mod->size == st.st_size) {
+			close(fd);
+			mod->refcount++;
+			return mod;
+		}
+	}
+
+	mod = module_load(filename, fd, &st);
+	if (!mod)
+		return NULL;
+
+	mod->next = module_cache;
+	module_cache = mod;
+
+	return mod;
+}
+
+/* allocate a heap of len bytes. return NULL on failure */
+static uint8_t *heap_alloc(size_t len)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void heap_free(uint8_t *heap, size_t len)
+{
+	if (heap)
+		munmap(heap, len);
+}
+
+/* fill a new heap with the data image.
+ * if the image is page aligned in the file it is mapped copy-on-write,
+ * pages the program never writes stay shared with the page cache.
+ * return 0 on success, -1 on failure */
+static int heap_load_image(uint8_t *heap, const struct vm_module *mod)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	if (mod->image_len && mod->data_offset % page == 0) {
+		size_t map_len = (mod->image_len + page - 1) & ~(page - 1);
+		void *p = mmap(heap, map_len, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_FIXED, mod->fd, mod->data_offset);
+		if (p == MAP_FAILED) {
+			perror(mod->filename);
+			return -1;
+		}
+		/* the tail of the last page belongs to BSS. past the end of
+		 * the file it is already zero, avoid a copy if possible. */
+		size_t i, tail_end = mod->map_len - mod->data_offset;
+
+		if (tail_end > map_len)
+			tail_end = map_len;
+		for (i = mod->image_len; i < tail_end; i++) {
+			if (heap[i]) {
+				memset(heap + mod->image_len, 0, map_len - mod->image_len);
+				break;
+			}
+		}
+		return 0;
+	}
+
+	memcpy(heap, mod->image, mod->image_len);
+	return 0;
+}
+
+static void vm_unload(struct vm *vm)
+{
+	vm_profile_disable(vm);
+	free(vm->vm_filename);
+	vm->vm_filename = NULL;
+	heap_free(vm->heap.bytes, vm->heap_len);
+	vm->heap.bytes = NULL;
+	vm->heap_len = vm->heap_mask = 0;
+	module_put(vm->module);
+	vm->module = NULL;
+	vm->image = NULL;
+	vm->image_len = 0;
+	vm->code = NULL;
+	vm->code_len = vm->code_mask = 0;
+}
+
+/* attach a VM to a module and give it a fresh heap */
+static int vm_attach(struct vm *vm, struct vm_module *mod)
+{
+	vm->module = mod;
+	vm->code = mod->code;
+	vm->code_len = mod->code_len;
+	vm->code_mask = mod->code_mask;
+	vm->image = mod->image;
+	vm->image_len = mod->image_len;
+	vm->heap_len = mod->heap_len;
+	vm->heap_mask = vm->heap_len ? vm->heap_len - 1 : 0;
+	vm->heap.bytes = heap_alloc(vm->heap_len);
+
+	return vm->heap.bytes ? 0 : -1;
+}
+
+void vm_free(struct vm *vm)
+{
+	if (!vm)
+		return;
+
+	vm_unload(vm);
+	free(vm);
+}
+
+struct vm *vm_new(const struct vm_env *env)
+{
+	struct vm *vm = calloc(1, sizeof(*vm));
+	vm->env = env;
+	return vm;
+}
+
+/* return 1 on success, 0 on failure */
+int vm_load(struct vm *vm, const char *filename)
+{
+	struct vm_module *mod;
+
+	if (!vm)
+		return 0;
+
+	/* erase everything except the environment. */
+	vm_unload(vm);
+	const struct vm_env *env = vm->env;
+	memset(vm, 0, sizeof(*vm));
+	vm->env = env;
+
+	mod = module_get(filename);
+	if (!mod)
+		goto failure;
+
+	vm->vm_filename = strdup(filename);
+
+	if (!vm->vm_filename || vm_attach(vm, mod) ||
+	    heap_load_image(vm->heap.bytes, mod)) {
+		vm_unload(vm);
+		goto failure;
+	}
 
 	/* initialize fields */
 	vm->pc = 0;
@@ -1270,16 +1685,7 @@ int vm_load(struct vm *vm, const char *filename)
 	vm->status = 0;
 
 	return 1;
-failure_perror:
-	perror(filename);
-failure_freecodebuf:
-	free(codebuf);
-failure_freevm:
-	free(vm->heap.bytes);
-	free(vm->code);
-	// TODO: free other stuff
 failure:
-	fclose(f);
 	error("%s:could not load file\n", filename);
 	return 0;
 }
@@ -1371,3 +1777,369 @@ void vm_yield(struct vm *vm)
 {
 	vm->yield = 1;
 }
+
+/**** snapshots ****/
+
+/* snapshot layout, all fields are 32-bit little endian:
+ *   magic, version, image_hash, heap_len, code_len,
+ *   status, pc, psp, stack_bottom, op_stack,
+ *   op_stack words of the op stack,
+ *   nr_pages, then for every page: page number, VM_SNAPSHOT_PAGE bytes
+ * only heap pages that differ from the module image are stored.
+ */
+#define VM_SNAPSHOT_HEADER_WORDS 10
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+	return p + 4;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* return non-zero if the page differs from the initial heap */
+static int page_dirty(const struct vm *vm, size_t ofs)
+{
+	size_t i, end = ofs + VM_SNAPSHOT_PAGE;
+
+	if (end > vm->heap_len)
+		end = vm->heap_len;
+
+	for (i = ofs; i < end; i++) {
+		uint8_t orig = i < vm->image_len ? vm->image[i] : 0;
+
+		if (vm->heap.bytes[i] != orig)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* serialize the state of a VM into a malloc'd buffer.
+ * return NULL on error */
+void *vm_snapshot(const struct vm *vm, size_t *len)
+{
+	size_t nr_dirty = 0, ofs, out_len;
+	uint8_t *out, *p;
+	unsigned i;
+
+	if (!vm || !vm->module || !vm->heap.bytes || !len)
+		return NULL;
+
+	for (ofs = 0; ofs < vm->heap_len; ofs += VM_SNAPSHOT_PAGE)
+		nr_dirty += page_dirty(vm, ofs);
+
+	out_len = 4 * (VM_SNAPSHOT_HEADER_WORDS + vm->op_stack + 1) +
+	          nr_dirty * (4 + VM_SNAPSHOT_PAGE);
+	out = malloc(out_len);
+	if (!out)
+		return NULL;
+
+	p = out;
+	p = put32(p, VM_SNAPSHOT_MAGIC);
+	p = put32(p, VM_SNAPSHOT_VERSION);
+	p = put32(p, module_image_hash(vm->module));
+	p = put32(p, vm->heap_len);
+	p = put32(p, vm->code_len);
+	p = put32(p, vm->status);
+	p = put32(p, vm->pc);
+	p = put32(p, vm->psp);
+	p = put32(p, vm->stack_bottom);
+	p = put32(p, vm->op_stack);
+	for (i = 0; i < vm->op_stack; i++)
+		p = put32(p, vm->stack[i]);
+
+	p = put32(p, nr_dirty);
+	for (ofs = 0; ofs < vm->heap_len; ofs += VM_SNAPSHOT_PAGE) {
+		size_t n = vm->heap_len - ofs;
+
+		if (!page_dirty(vm, ofs))
+			continue;
+		if (n > VM_SNAPSHOT_PAGE)
+			n = VM_SNAPSHOT_PAGE;
+		p = put32(p, ofs / VM_SNAPSHOT_PAGE);
+		memcpy(p, vm->heap.bytes + ofs, n);
+		memset(p + n, 0, VM_SNAPSHOT_PAGE - n);
+		p += VM_SNAPSHOT_PAGE;
+	}
+
+	assert((size_t)(p - out) == out_len);
+	*len = out_len;
+
+	return out;
+}
+
+/* restore a snapshot into a VM that has loaded the same module.
+ * return 1 on success, 0 on failure (VM is unchanged on failure) */
+int vm_restore(struct vm *vm, const void *buf, size_t len)
+{
+	const uint8_t *p = buf, *end = p + len;
+	uint32_t nr_dirty, op_stack, i;
+
+	if (!vm || !buf || !vm->module || !vm->heap.bytes || len < 4 * (VM_SNAPSHOT_HEADER_WORDS + 1))
+		return 0;
+
+	if (get32(p) != VM_SNAPSHOT_MAGIC || get32(p + 4) != VM_SNAPSHOT_VERSION) {
+		error("%s:not a snapshot or unsupported version\n", vm->vm_filename);
+		return 0;
+	}
+
+	if (get32(p + 8) != module_image_hash(vm->module) || get32(p + 12) != vm->heap_len ||
+	    get32(p + 16) != vm->code_len) {
+		error("%s:snapshot is for a different module\n", vm->vm_filename);
+		return 0;
+	}
+
+	op_stack = get32(p + 36);
+	if (op_stack > ARRAY_SIZE(vm->stack) ||
+	    (size_t)(end - p) < 4 * (VM_SNAPSHOT_HEADER_WORDS + op_stack + 1))
+		goto truncated;
+
+	nr_dirty = get32(p + 4 * (VM_SNAPSHOT_HEADER_WORDS + op_stack));
+	if ((size_t)(end - p) != 4 * (VM_SNAPSHOT_HEADER_WORDS + op_stack + 1) +
+	                         (size_t)nr_dirty * (4 + VM_SNAPSHOT_PAGE))
+		goto truncated;
+
+	/* validate all pages before touching the VM */
+	const uint8_t *pages = p + 4 * (VM_SNAPSHOT_HEADER_WORDS + op_stack + 1);
+	for (i = 0; i < nr_dirty; i++) {
+		uint32_t page = get32(pages + i * (4 + VM_SNAPSHOT_PAGE));
+
+		if ((size_t)page * VM_SNAPSHOT_PAGE >= vm->heap_len)
+			goto truncated;
+	}
+
+	vm->status = get32(p + 20);
+	vm->pc = get32(p + 24);
+	vm->psp = get32(p + 28);
+	vm->stack_bottom = get32(p + 32);
+	vm->op_stack = op_stack;
+	for (i = 0; i < op_stack; i++)
+		vm->stack[i] = get32(p + 4 * (VM_SNAPSHOT_HEADER_WORDS + i));
+
+	memcpy(vm->heap.bytes, vm->image, vm->image_len);
+	memset(vm->heap.bytes + vm->image_len, 0, vm->heap_len - vm->image_len);
+	for (i = 0; i < nr_dirty; i++) {
+		const uint8_t *pg = pages + i * (4 + VM_SNAPSHOT_PAGE);
+		size_t ofs = (size_t)get32(pg) * VM_SNAPSHOT_PAGE;
+		size_t n = vm->heap_len - ofs;
+
+		if (n > VM_SNAPSHOT_PAGE)
+			n = VM_SNAPSHOT_PAGE;
+		memcpy(vm->heap.bytes + ofs, pg + 4, n);
+	}
+
+	return 1;
+truncated:
+	error("%s:snapshot is corrupt\n", vm->vm_filename);
+	return 0;
+}
+
+/* create a new VM from a pre-initialized template (a warm start).
+ * the clone shares the environment but not the extra pointer.
+ * return NULL on error */
+struct vm *vm_clone(const struct vm *tmpl)
+{
+	struct vm *vm;
+
+	if (!tmpl || !tmpl->module || !tmpl->heap.bytes)
+		return NULL;
+
+	vm = malloc(sizeof(*vm));
+	if (!vm)
+		return NULL;
+
+	memcpy(vm, tmpl, sizeof(*vm));
+	vm->extra = NULL;
+	vm->profile = NULL;
+	vm->yield = 0;
+	vm->vm_filename = NULL;
+	vm->heap.bytes = NULL;
+	vm->module = NULL;
+	vm->code = NULL;
+	vm->image = NULL;
+
+	/* the module is shared, only the heap is copied */
+	tmpl->module->refcount++;
+	if (vm_attach(vm, tmpl->module)) {
+		vm_free(vm);
+		return NULL;
+	}
+
+	vm->vm_filename = tmpl->vm_filename ? strdup(tmpl->vm_filename) : NULL;
+	if (tmpl->vm_filename && !vm->vm_filename) {
+		vm_free(vm);
+		return NULL;
+	}
+
+	memcpy(vm->heap.bytes, tmpl->heap.bytes, tmpl->heap_len);
+
+	return vm;
+}
+
+/* turn on profiling. a PC sample is taken every sample_interval instructions.
+ * return 0 on success, -1 on error */
+int vm_profile_enable(struct vm *vm, unsigned sample_interval)
+{
+	struct vm_profile *prof;
+	vmword_t func = 0;
+	size_t i;
+
+	if (!vm || !vm->code)
+		return -1;
+
+	vm_profile_disable(vm);
+
+	prof = calloc(1, sizeof(*prof));
+	if (!prof)
+		return -1;
+
+	prof->code_len = vm->code_mask + 1;
+	prof->sample_interval = sample_interval ? sample_interval : 1;
+	prof->sample_countdown = prof->sample_interval;
+	prof->insn_count = calloc(prof->code_len, sizeof(*prof->insn_count));
+	prof->func_of = calloc(prof->code_len, sizeof(*prof->func_of));
+	prof->stacks = calloc(VM_PROFILE_MAX_STACKS, sizeof(*prof->stacks));
+	if (vm->env) {
+		prof->nr_syscalls = vm->env->nr_syscalls;
+		prof->syscall = calloc(prof->nr_syscalls, sizeof(*prof->syscall));
+	}
+
+	if (!prof->insn_count || !prof->func_of || !prof->stacks ||
+	    (prof->nr_syscalls && !prof->syscall)) {
+		vm->profile = prof;
+		vm_profile_disable(vm);
+		return -1;
+	}
+
+	/* function boundaries come from ENTER */
+	for (i = 0; i < prof->code_len; i++) {
+		if (vm->code[i].op == 0x03)
+			func = i;
+		prof->func_of[i] = func;
+	}
+
+	vm->profile = prof;
+
+	return 0;
+}
+
+void vm_profile_disable(struct vm *vm)
+{
+	struct vm_profile *prof = vm ? vm->profile : NULL;
+
+	if (!prof)
+		return;
+
+	free(prof->insn_count);
+	free(prof->func_of);
+	free(prof->stacks);
+	free(prof->syscall);
+	free(prof);
+	vm->profile = NULL;
+}
+
+struct profile_func {
+	vmword_t start;
+	vmword_t end;
+	unsigned long long count;
+};
+
+static int profile_func_cmp(const void *a, const void *b)
+{
+	const struct profile_func *fa = a, *fb = b;
+
+	if (fa->count != fb->count)
+		return fa->count < fb->count ? 1 : -1;
+	return fa->start < fb->start ? -1 : fa->start > fb->start;
+}
+
+/* print per-function instruction counts, syscall statistics and the
+ * disassembly of the hottest function. top limits the function table. */
+void vm_profile_summary(const struct vm *vm, FILE *out, unsigned top)
+{
+	const struct vm_profile *prof = vm ? vm->profile : NULL;
+	struct profile_func *funcs;
+	unsigned nr_funcs = 0, i;
+	size_t n;
+
+	if (!prof) {
+		fprintf(out, "%s:profiling not enabled\n", vm ? vm->vm_filename : "<null>");
+		return;
+	}
+
+	funcs = calloc(prof->code_len, sizeof(*funcs));
+	if (!funcs)
+		return;
+
+	for (n = 0; n < vm->code_len; n++) {
+		if (!nr_funcs || funcs[nr_funcs - 1].start != prof->func_of[n]) {
+			funcs[nr_funcs].start = prof->func_of[n];
+			nr_funcs++;
+		}
+		funcs[nr_funcs - 1].end = n + 1;
+		funcs[nr_funcs - 1].count += prof->insn_count[n];
+	}
+
+	qsort(funcs, nr_funcs, sizeof(*funcs), profile_func_cmp);
+
+	fprintf(out, "%s: %llu instructions, %u stacks, %llu dropped samples\n",
+		vm->vm_filename, prof->total_insns, prof->nr_stacks,
+		prof->dropped_samples);
+
+	fprintf(out, "%-14s %14s %7s\n", "function", "instructions", "%");
+	for (i = 0; i < nr_funcs && (!top || i < top); i++) {
+		if (!funcs[i].count)
+			break;
+		fprintf(out, "func_%06x     %14llu %6.2f%%\n", funcs[i].start,
+			funcs[i].count,
+			100.0 * funcs[i].count / prof->total_insns);
+	}
+
+	fprintf(out, "%-14s %14s %14s %14s\n", "syscall", "calls", "avg ns", "max ns");
+	for (i = 0; i < prof->nr_syscalls; i++) {
+		const struct vm_profile_syscall *sc = &prof->syscall[i];
+
+		if (!sc->count)
+			continue;
+		fprintf(out, "%-14d %14llu %14llu %14llu\n", -1 - (int)i,
+			sc->count, sc->total_ns / sc->count, sc->max_ns);
+	}
+
+	/* annotate the hottest function */
+	if (nr_funcs && funcs[0].count)
+		disassemble(out, vm->code + funcs[0].start,
+		            funcs[0].end - funcs[0].start, funcs[0].start,
+		            prof->insn_count + funcs[0].start);
+
+	free(funcs);
+}
+
+/* write the PC samples in collapsed stack format, one stack per line:
+ * file;func_000000;func_00001a count
+ * suitable for flamegraph.pl */
+void vm_profile_collapsed(const struct vm *vm, FILE *out)
+{
+	const struct vm_profile *prof = vm ? vm->profile : NULL;
+	unsigned i, j;
+
+	if (!prof)
+		return;
+
+	for (i = 0; i < VM_PROFILE_MAX_STACKS; i++) {
+		const struct vm_profile_stack *ps = &prof->stacks[i];
+
+		if (!ps->count)
+			continue;
+		fputs(vm->vm_filename ? vm->vm_filename : "vm", out);
+		for (j = 0; j < ps->depth; j++)
+			fprintf(out, ";func_%06x", ps->func[j]);
+		fprintf(out, " %llu\n", ps->count);
+	}
+}
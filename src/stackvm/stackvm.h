@@ -1,5 +1,6 @@
 #ifndef STACKVM_H
 #define STACKVM_H
+#include <stdio.h>
 /* flags for vm.status
  * bit set means an error.
  */
@@ -44,4 +45,11 @@ void vm_abort(struct vm *vm);
 void *vm_get_extra(struct vm *vm);
 void *vm_set_extra(struct vm *vm, void *p);
 void vm_yield(struct vm *vm);
+void *vm_snapshot(const struct vm *vm, size_t *len);
+int vm_restore(struct vm *vm, const void *buf, size_t len);
+struct vm *vm_clone(const struct vm *tmpl);
+int vm_profile_enable(struct vm *vm, unsigned sample_interval);
+void vm_profile_disable(struct vm *vm);
+void vm_profile_summary(const struct vm *vm, FILE *out, unsigned top);
+void vm_profile_collapsed(const struct vm *vm, FILE *out);
 #endif
@@ -33,6 +33,9 @@
 #include <util.h>
 #include <eventlog.h>
 #include <help.h>
+#include <fdb.h>
+#include <metrics.h>
+#include <user.h>
 
 #include <assert.h>
 #include <stdlib.h>
@@ -264,6 +267,43 @@ command_do_help(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUS
 	return 1; /* success */
 }
 
+/** action callback to do the "save" command. */
+int
+command_do_save(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg UNUSED)
+{
+	room_save_all();
+	character_save_all();
+
+	/* wait for the persistence thread, so everything is on disk. */
+	if (fdb_flush())
+		telnetclient_puts(cl, "Saved.\n");
+	else
+		telnetclient_puts(cl, "Some records could not be written, they will be tried again.\n");
+
+	return 1; /* success */
+}
+
+/** action callback to do the "migrate" command. */
+static int
+command_do_migrate(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg UNUSED)
+{
+	if (fdb_migrate())
+		telnetclient_puts(cl, "Migrated.\n");
+	else
+		telnetclient_puts(cl, "Some records could not be moved, see the log.\n");
+
+	return 1; /* success */
+}
+
+/** action callback to do the "netstat" command. */
+static int
+command_do_netstat(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg UNUSED)
+{
+	telnetclient_netstat(cl);
+
+	return 1; /* success */
+}
+
 /** action callback to remote that a command is not implemented. */
 static int
 command_not_implemented(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *cmd UNUSED, const char *arg UNUSED)
@@ -277,24 +317,28 @@ command_not_implemented(DESCRIPTOR_DATA *cl, struct user *u UNUSED, const char *
 static const struct command_table {
 	char *name; /**< full command name. */
 	int (*cb)(DESCRIPTOR_DATA *cl, struct user *u, const char *cmd, const char *arg);
+	int admin; /**< only users at admin.level or above may run it. */
 } command_table[] = {
-	{ "who", command_not_implemented },
-	{ "quit", command_do_quit },
-	{ "page", command_not_implemented },
-	{ "say", command_do_say },
-	{ "yell", command_do_yell },
-	{ "emote", command_do_emote },
-	{ "pose", command_do_pose },
-	{ "chsay", command_do_chsay },
-	{ "sayto", command_not_implemented },
-	{ "tell", command_not_implemented },
-	{ "time", command_do_time },
-	{ "whisper", command_not_implemented },
-	{ "to", command_not_implemented },
-	{ "help", command_do_help },
-	{ "spoof", command_not_implemented },
-	{ "roomget", command_do_roomget },
-	{ "char", command_do_character },
+	{ "who", command_not_implemented, 0 },
+	{ "quit", command_do_quit, 0 },
+	{ "page", command_not_implemented, 0 },
+	{ "say", command_do_say, 0 },
+	{ "yell", command_do_yell, 0 },
+	{ "emote", command_do_emote, 0 },
+	{ "pose", command_do_pose, 0 },
+	{ "chsay", command_do_chsay, 0 },
+	{ "sayto", command_not_implemented, 0 },
+	{ "tell", command_not_implemented, 0 },
+	{ "time", command_do_time, 0 },
+	{ "whisper", command_not_implemented, 0 },
+	{ "to", command_not_implemented, 0 },
+	{ "help", command_do_help, 0 },
+	{ "spoof", command_not_implemented, 0 },
+	{ "roomget", command_do_roomget, 0 },
+	{ "char", command_do_character, 0 },
+	{ "save", command_do_save, 1 },
+	{ "migrate", command_do_migrate, 1 },
+	{ "netstat", command_do_netstat, 1 },
 };
 
 /**
@@ -314,6 +358,9 @@ static const struct command_short_table {
 	{ ";", "spoof" },
 };
 
+/** latency of each entry in command_table, registered on first use. */
+static struct metric *command_metric[NR(command_table)];
+
 /**
  * use cmd to run a command from the command_table array.
  */
@@ -325,7 +372,26 @@ command_run(DESCRIPTOR_DATA *cl, struct user *u, const char *cmd, const char *ar
 	/* search for a long command. */
 	for (i = 0; i < NR(command_table); i++) {
 		if (!strcasecmp(cmd, command_table[i].name)) {
-			return command_table[i].cb(cl, u, cmd, arg);
+			uint64_t start;
+			int result;
+
+			/* operator commands look unknown to everyone else. */
+			if (command_table[i].admin && user_level(u) < mud_config.admin_level)
+				break;
+
+			start = metrics_usec();
+			result = command_table[i].cb(cl, u, cmd, arg);
+
+			if (!command_metric[i]) {
+				char labels[96];
+
+				snprintf(labels, sizeof(labels), "command=\"%s\"", command_table[i].name);
+				command_metric[i] = metrics_histogram("boris_command_seconds", labels,
+					"Time taken to run each command.");
+			}
+			metrics_observe(command_metric[i], metrics_usec() - start);
+
+			return result;
 		}
 	}
 
@@ -414,7 +480,7 @@ command_lineinput(DESCRIPTOR_DATA *cl, const char *line)
 	eventlog_commandinput(telnetclient_socket_name(cl), telnetclient_username(cl), line);
 
 	/* do something with the command */
-	command_execute(cl, NULL, line); /** @todo pass current user and character */
+	command_execute(cl, cl->user, line); /** @todo pass current character */
 
 	/* check if we should update the prompt */
 	if (telnetclient_isstate(cl, command_lineinput, mud_config.command_prompt)) {
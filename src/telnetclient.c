@@ -24,6 +24,7 @@
 
 #include "telnetclient.h"
 #include <string.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -37,13 +38,22 @@
 #include <game.h>
 #include <mudconfig.h>
 #include <user.h>
+#include <pwhash.h>
+#include <timer.h>
 #include <menu.h>
 #include <mth.h>
 #include <buf.h>
+#include <webserver.h>
+#include <webstate.h>
+#include <metrics.h>
+#include <slab.h>
 
 #define OK (0)
 #define ERR (-1)
 
+/** largest chunk dyad passes to telnetclient_on_data(). */
+#define INPUT_CHUNK 8192
+
 /******************************************************************************
  * Data structures
  ******************************************************************************/
@@ -59,6 +69,27 @@ struct telnetserver {
  ******************************************************************************/
 
 static LIST_HEAD(struct server_list_head, struct telnetserver) server_list;
+/** websocket clients, listed with the telnet servers but without a stream. */
+static struct telnetserver *web_server;
+
+/** every telnet and websocket client. */
+static struct slab client_slab = SLAB_INIT("client", DESCRIPTOR_DATA);
+
+/** traffic and clients, indexed by TRANSPORT(). */
+#define TRANSPORT(cl) ((cl)->web_conn ? 1 : 0)
+static struct metric *metric_bytes_in[2], *metric_bytes_out[2], *metric_clients[2];
+static struct metric *metric_mccp_in, *metric_mccp_out, *metric_mccp_ratio;
+static uint64_t mccp_total_in, mccp_total_out;
+
+/** slow consumers, totals for every connection since startup. */
+static struct metric *metric_output_congested, *metric_output_dropped, *metric_output_disconnects;
+static unsigned long output_congested_total, output_dropped_total, output_disconnects_total;
+
+/** clients with buffered input, in the order telnetclient_input_all() serves them. */
+static DESCRIPTOR_DATA **input_order;
+static unsigned input_order_max;
+static unsigned input_turn; /**< rotates the first client served each pass. */
+static int input_backlog; /**< lines may be left over for the next pass. */
 
 /******************************************************************************
  * Prototypes
@@ -71,6 +102,8 @@ static int telnetclient_channel_remove(DESCRIPTOR_DATA *cl, struct channel *ch);
 static void telnetclient_on_destroy(dyad_Event *e);
 static void telnetclient_channel_send(struct channel_member *cm, struct channel *ch, const char *msg);
 static DESCRIPTOR_DATA *telnetclient_newclient(struct telnetserver *server, dyad_Stream *stream);
+static void telnetclient_signoff(DESCRIPTOR_DATA *client);
+static void telnetclient_free(DESCRIPTOR_DATA *client);
 
 /******************************************************************************
  * Functions
@@ -85,6 +118,71 @@ telnetclient_start_lineinput(DESCRIPTOR_DATA *cl, void (*line_input)(DESCRIPTOR_
 	cl->line_input = line_input;
 }
 
+/** true if a client has not been closed yet. */
+static int
+telnetclient_isopen(DESCRIPTOR_DATA *cl)
+{
+	return cl->web_conn ? !cl->web_closed : cl->stream != NULL;
+}
+
+/** run the next complete line in the input buffer through the current state.
+ * @return 1 if input was taken from the buffer, 0 if no line is complete. */
+static int
+telnetclient_line(DESCRIPTOR_DATA *cl)
+{
+	size_t cmdlen;
+	char *cmd = buf_data(cl->linebuf, &cmdlen);
+	/* the partial line left by the last call has no newline, skip it. */
+	char *end = cl->linescan < cmdlen ? memchr(cmd + cl->linescan, '\n', cmdlen - cl->linescan) : NULL;
+
+	if (!end) {
+		cl->linescan = cmdlen;
+		if (!cmdlen || cmdlen < mud_config.input_buffer)
+			return 0; /* wait for the rest of the line */
+
+		/* the line can never fit, drop it through its newline. */
+		LOG_WARNING("[%s] input line longer than %u bytes, discarded",
+			    telnetclient_socket_name(cl), mud_config.input_buffer);
+		if (!cl->input_discard)
+			telnetclient_puts(cl, "Input line too long, discarded.\n");
+		buf_consume(cl->linebuf, cmdlen);
+		cl->linescan = 0;
+		cl->input_discard = 1;
+		return 1;
+	}
+
+	size_t linelen = end - cmd;
+	*end = 0; /* null terminate the string */
+	cl->linescan = 0;
+
+	if (cl->input_discard) {
+		cl->input_discard = 0; /* tail of an overlong line */
+	} else if (linelen == 0) {
+		/* force redraw of prompt for blank lines */
+		cl->prompt_flag = 0;
+		telnetclient_prompt_refresh(cl);
+	} else if (cl->line_input) {
+		cl->line_input(cl, cmd);
+	} else {
+		LOG_WARNING("Missing or invalid line input handler [%s]", telnetclient_socket_name(cl));
+		telnetclient_printf(cl, "ERROR, missing or invalid line input handler: \"%.*s\"\n", linelen, cmd);
+	}
+	buf_consume(cl->linebuf, linelen + 1);
+
+	return 1;
+}
+
+/** true if the client has as much buffered input as it is allowed. */
+static int
+telnetclient_input_full(DESCRIPTOR_DATA *cl)
+{
+	size_t len;
+
+	buf_data(cl->linebuf, &len);
+
+	return len >= mud_config.input_buffer;
+}
+
 static void
 telnetclient_on_data(dyad_Event *e)
 {
@@ -115,41 +213,17 @@ telnetclient_on_data(dyad_Event *e)
 		  e->size,
 		  outlen);
 
+	metrics_add(metric_bytes_in[0], e->size);
+
 	int size = translate_telopts(cl, (unsigned char*)e->data, e->size, output, 0);
 	buf_commit(cl->linebuf, size);
+	input_backlog = 1;
 
-	size_t cmdlen;
-	char *cmd = buf_data(cl->linebuf, &cmdlen);
-	size_t consumed = 0;
-	while (consumed < cmdlen) {
-		char *start = cmd + consumed;
-		char *end = strchr(start, '\n');
-		if (!end) {
-			break; /* no more complete lines */
-		}
-
-		/* force redraw of prompt for blank lines */
-		if (end == start) {
-			end++;
-			consumed++;
-			cl->prompt_flag = 0;
-			telnetclient_prompt_refresh(cl);
-			continue; /* ignore blank lines */
-		}
-
-		size_t linelen = end - start;
-		*end = 0; /* null terminate the string */
-		if (linelen > 0) {
-			if (cl->line_input) {
-				cl->line_input(cl, start);
-			} else {
-				LOG_WARNING("Missing or invalid line input handler [fd=%ld %s]", (long)dyad_getSocket(e->remote), telnetclient_socket_name(cl));
-				telnetclient_printf(cl, "ERROR, missing or invalid line input handler: \"%.*s\"\n", linelen, start);
-			}
-		}
-		consumed += linelen + 1;
+	/* stop reading until the queued lines have been run. */
+	if (telnetclient_input_full(cl)) {
+		cl->input_paused = 1;
+		dyad_setPaused(cl->stream, 1);
 	}
-	buf_consume(cl->linebuf, consumed);
 }
 
 static void
@@ -193,28 +267,45 @@ telnetclient_on_destroy(dyad_Event *e)
 	if (!client)
 		return;
 
+	telnetclient_free(client);
+}
+
+static void
+telnetclient_free(DESCRIPTOR_DATA *client)
+{
 	LIST_REMOVE(client, list);
+	metrics_adjust(metric_clients[TRANSPORT(client)], -1);
 
 	telnetclient_close(client);
 
 	telnetclient_clear_statedata(client); /* free data associated with current state */
 
+	pwhash_cancel(client); /* pending password checks must not see this client */
+	timer_cancel_all(client);
+
 	free(client->prompt_string);
 	client->prompt_string = NULL;
 
-	uninit_mth_socket(client);
+	/* stream is already closed, MCCP must not flush its last block to it. */
+	if (client->mth) {
+		SET_BIT(client->mth->comm_flags, COMM_FLAG_DISCONNECT);
+		uninit_mth_socket(client);
+	}
 
 	buf_free(client->linebuf);
 	client->linebuf = NULL;
 
+	buf_free(client->outbuf);
+	client->outbuf = NULL;
+
+	free(client->host);
+	client->host = NULL;
+
 	LOG_TODO("free any other data structures associated with client"); /* TODO: be vigilant about memory leaks! */
 
-#ifndef NDEBUG
-	memset(client, 0xBB, sizeof * client); /* fill with fake data before freeing */
-#endif
 	user_put(&client->user);
 
-	free(client);
+	slab_free(&client_slab, client);
 }
 
 /** notifies a client's disconnect. */
@@ -228,6 +319,12 @@ telnetclient_on_close(dyad_Event *e)
 	if (!client)
 		return;
 
+	telnetclient_signoff(client);
+}
+
+static void
+telnetclient_signoff(DESCRIPTOR_DATA *client)
+{
 	LOG_TODO("Determine if connection was logged in first");
 	eventlog_signoff(telnetclient_username(client), telnetclient_socket_name(client));
 	/* forcefully leave all channels */
@@ -266,14 +363,29 @@ write_to_descriptor(DESCRIPTOR_DATA *d, const char *txt, int length)
 {
 	assert(d != NULL);
 
+	if (d->web_conn)
+		return 0; /* telnet negotiation means nothing to a websocket client */
+
 	/* treat as already closedif stream is NULL */
 	int state = d && d->stream ? dyad_getState(d->stream) : DYAD_STATE_CLOSED;
 
 	if (state == DYAD_STATE_CONNECTED) {
 		if (d->mth->mccp2) {
+			uLong before = d->mth->mccp2->total_out;
+			size_t out;
+
 			write_mccp2(d, txt, length);
+			out = d->mth->mccp2->total_out - before;
+			metrics_add(metric_bytes_out[0], out);
+			metrics_add(metric_mccp_in, length);
+			metrics_add(metric_mccp_out, out);
+			mccp_total_in += length;
+			mccp_total_out += out;
+			if (mccp_total_in)
+				metrics_set(metric_mccp_ratio, (double)mccp_total_out / mccp_total_in);
 		} else {
 			dyad_write(d->stream, txt, length);
+			metrics_add(metric_bytes_out[0], length);
 		}
 	} else if (state == DYAD_STATE_CLOSED) {
 		/* silently ignore - clean up will occur on next dyad_update() */
@@ -306,15 +418,101 @@ write_escaped(DESCRIPTOR_DATA *d, const char *txt, int length)
 	}
 }
 
+/** bytes of output waiting to be sent to the client. */
+static size_t
+telnetclient_output_queued(DESCRIPTOR_DATA *cl)
+{
+	size_t len = 0;
+
+	if (cl->outbuf)
+		buf_data(cl->outbuf, &len);
+	else if (cl->stream)
+		len = dyad_getWriteBufferLength(cl->stream);
+
+	return len;
+}
+
+/**
+ * apply the output limits before queuing length more bytes.
+ * a client past output.max is disconnected, and channel traffic
+ * (low_priority) is dropped while it is over output.high.
+ * @return OK if the output may be queued, ERR to discard it.
+ */
+static int
+telnetclient_output_limit(DESCRIPTOR_DATA *cl, size_t length, int low_priority)
+{
+	size_t queued = telnetclient_output_queued(cl);
+
+	if (mud_config.output_max && queued + length > mud_config.output_max) {
+		LOG_WARNING("[%s] %zu bytes of output waiting, disconnecting slow client",
+			    telnetclient_socket_name(cl), queued);
+		metrics_add(metric_output_disconnects, 1);
+		output_disconnects_total++;
+		if (cl->outbuf)
+			buf_consume(cl->outbuf, queued); /* do not pass the backlog on */
+		telnetclient_close(cl);
+		return ERR;
+	}
+
+	if (!cl->output_congested && mud_config.output_high && queued >= mud_config.output_high) {
+		LOG_INFO("[%s] %zu bytes of output waiting, dropping channel messages",
+			 telnetclient_socket_name(cl), queued);
+		cl->output_congested = 1;
+		metrics_add(metric_output_congested, 1);
+		output_congested_total++;
+	}
+
+	if (cl->output_congested && low_priority) {
+		cl->output_dropped++;
+		cl->output_dropped_total++;
+		metrics_add(metric_output_dropped, 1);
+		output_dropped_total++;
+		return ERR;
+	}
+
+	return OK;
+}
+
+/** once a congested client is back under output.low, tell it what it missed. */
+static void
+telnetclient_output_recover(DESCRIPTOR_DATA *cl)
+{
+	if (!cl->output_congested || telnetclient_output_queued(cl) > mud_config.output_low)
+		return;
+
+	cl->output_congested = 0;
+	if (cl->output_dropped)
+		telnetclient_printf(cl, "[%u channel messages dropped]\n", cl->output_dropped);
+	cl->output_dropped = 0;
+}
+
+/** queue text for a client, websocket clients get it on the next flush. */
+static void
+telnetclient_write(DESCRIPTOR_DATA *cl, const char *txt, int length)
+{
+	if (telnetclient_output_limit(cl, length, 0) != OK)
+		return;
+
+	if (cl->outbuf) {
+		if (!cl->web_closed)
+			buf_write(cl->outbuf, txt, length);
+	} else {
+		write_escaped(cl, txt, length);
+	}
+}
+
 /** write a null terminated string to a telnetclient buffer. */
 int
 telnetclient_puts(DESCRIPTOR_DATA *cl, const char *s)
 {
 	assert(cl != NULL);
-	assert(cl->stream != NULL);
+
+	/* output.max may have closed the client part way through a reply. */
+	if (!telnetclient_isopen(cl))
+		return ERR;
 
 	size_t n = strlen(s);
-	write_escaped(cl, s, n);
+	telnetclient_write(cl, s, n);
 	cl->prompt_flag = 0;
 
 	return OK;
@@ -325,13 +523,16 @@ int
 telnetclient_vprintf(DESCRIPTOR_DATA *cl, const char *fmt, va_list ap)
 {
 	assert(cl != NULL);
-	assert(cl->stream != NULL);
 	assert(fmt != NULL);
 
+	/* output.max may have closed the client part way through a reply. */
+	if (!telnetclient_isopen(cl))
+		return ERR;
+
 	char buf[1024];
 	vsnprintf(buf, sizeof(buf), fmt, ap);
 
-	write_escaped(cl, buf, strlen(buf));
+	telnetclient_write(cl, buf, strlen(buf));
 	cl->prompt_flag = 0;
 
 	return OK;
@@ -430,25 +631,26 @@ telnetclient_channel_send(struct channel_member *cm, struct channel *ch, const c
 
 	DESCRIPTOR_DATA *cl = cm->p;
 
+	/* a slow client loses channel traffic before anything else. */
+	if (telnetclient_output_limit(cl, strlen(msg), 1) != OK)
+		return;
+
 	/* TODO: fill in a channel name? */
 	telnetclient_printf(cl, "[%p] %s\n", (void*)ch, msg);
 }
 
-/** allocate a new telnetclient based on an existing valid dyad handle. */
+/** allocate the parts of a client shared by telnet and websockets. */
 static DESCRIPTOR_DATA *
-telnetclient_newclient(struct telnetserver *server, dyad_Stream *stream)
+telnetclient_alloc(void)
 {
-	DESCRIPTOR_DATA *cl = malloc(sizeof * cl);
-	FAILON(!cl, "malloc()", failed);
-
-	JUNKINIT(cl, sizeof * cl);
+	DESCRIPTOR_DATA *cl = slab_alloc(&client_slab);
+	FAILON(!cl, "slab_alloc()", failed);
 
-	*cl = (DESCRIPTOR_DATA){
-			.stream = stream,
-			.type = CLIENT_TYPE_USER,
-		};
+	cl->type = CLIENT_TYPE_USER;
 
 	cl->linebuf = buf_new();
+	/* capacity grows in powers of two past a full buffer and one more chunk. */
+	buf_set_limit(cl->linebuf, 2 * (mud_config.input_buffer + INPUT_CHUNK) + 1);
 
 	cl->terminal.width = cl->terminal.height = 0;
 	strcpy(cl->terminal.name, "");
@@ -466,6 +668,23 @@ telnetclient_newclient(struct telnetserver *server, dyad_Stream *stream)
 
 	telnetclient_channel_add(cl, channel_public(CHANNEL_SYS));
 
+	return cl;
+failed:
+	return NULL;
+}
+
+/** allocate a new telnetclient based on an existing valid dyad handle. */
+static DESCRIPTOR_DATA *
+telnetclient_newclient(struct telnetserver *server, dyad_Stream *stream)
+{
+	DESCRIPTOR_DATA *cl = telnetclient_alloc();
+
+	if (!cl)
+		return NULL;
+
+	cl->stream = stream;
+	metrics_adjust(metric_clients[0], 1);
+
 	dyad_addListener(stream, DYAD_EVENT_ERROR, telnetclient_on_error, server);
 	dyad_addListener(stream, DYAD_EVENT_DESTROY, telnetclient_on_destroy, cl);
 	dyad_addListener(stream, DYAD_EVENT_DATA, telnetclient_on_data, cl);
@@ -479,11 +698,328 @@ telnetclient_newclient(struct telnetserver *server, dyad_Stream *stream)
 
 	LIST_INSERT_HEAD(&server->client_list, cl, list);
 
+	return cl;
+}
+
+/** allocate a client for a websocket connection from the webserver. */
+static DESCRIPTOR_DATA *
+telnetclient_newwebclient(unsigned long conn, const char *addr)
+{
+	DESCRIPTOR_DATA *cl;
+
+	if (!web_server) {
+		web_server = calloc(1, sizeof(*web_server));
+		if (!web_server) {
+			LOG_PERROR("calloc()");
+			return NULL;
+		}
+		LIST_INIT(&web_server->client_list);
+		LIST_INSERT_HEAD(&server_list, web_server, list);
+	}
+
+	cl = telnetclient_alloc();
+
+	if (!cl)
+		return NULL;
+
+	/* listed first, so a failure below can use telnetclient_free(). */
+	cl->web_conn = conn;
+	metrics_adjust(metric_clients[1], 1);
+	LIST_INSERT_HEAD(&web_server->client_list, cl, list);
+
+	cl->host = strdup(addr ? addr : "");
+	FAILON(!cl->host, "strdup()", failed);
+	cl->outbuf = buf_new();
+
+	/* keeps MSDP state for the client, without telnet negotiation. */
+	cl->mth = calloc(1, sizeof(*cl->mth));
+	FAILON(!cl->mth, "calloc()", failed);
+	cl->mth->proxy = strdup("");
+	cl->mth->terminal_type = strdup("");
+	FAILON(!cl->mth->proxy || !cl->mth->terminal_type, "strdup()", failed);
+	if (!webstate_attach(cl))
+		LOG_ERROR("%s:could not keep game state", telnetclient_socket_name(cl));
+
+	telnetclient_puts(cl, mud_config.msgfile_welcome);
+
+	menu_start_input(cl, &gamemenu_login);
+
 	return cl;
 failed:
+	/* the caller tells the webserver to drop the connection. */
+	cl->web_closed = 1;
+	telnetclient_free(cl);
 	return NULL;
 }
 
+/** free the websocket clients, while the rest of the game is still up. */
+void
+telnetclient_web_shutdown(void)
+{
+	DESCRIPTOR_DATA *cl;
+
+	if (!web_server)
+		return;
+
+	while ((cl = LIST_TOP(web_server->client_list)))
+		telnetclient_free(cl);
+
+	LIST_REMOVE(web_server, list);
+	free(web_server);
+	web_server = NULL;
+}
+
+static DESCRIPTOR_DATA *
+telnetclient_findwebclient(unsigned long conn)
+{
+	DESCRIPTOR_DATA *cl;
+
+	if (!web_server)
+		return NULL;
+
+	for (cl = LIST_TOP(web_server->client_list); cl; cl = LIST_NEXT(cl, list)) {
+		if (cl->web_conn == conn)
+			return cl;
+	}
+
+	return NULL;
+}
+
+/** handle connect, input and disconnect of websocket clients. */
+void
+telnetclient_webevent(const struct webqueue_msg *msg)
+{
+	DESCRIPTOR_DATA *cl;
+
+	switch (msg->type) {
+	case WEBQUEUE_CONNECT:
+		cl = telnetclient_newwebclient(msg->conn, msg->data);
+		if (!cl) {
+			LOG_ERROR("Could not create new websocket client");
+			webserver_close(msg->conn);
+			return;
+		}
+		LOG_INFO("*** Connection %s", telnetclient_socket_name(cl));
+		break;
+	case WEBQUEUE_LINE:
+		cl = telnetclient_findwebclient(msg->conn);
+		if (!cl || cl->web_closed)
+			return;
+		/* each message is a line of input. */
+		metrics_add(metric_bytes_in[1], msg->len);
+		if (telnetclient_input_full(cl) || msg->len > INPUT_CHUNK) {
+			/* there is no socket to stop reading, drop the line instead. */
+			LOG_WARNING("[%s] input queue full, line dropped", telnetclient_socket_name(cl));
+			break;
+		}
+		buf_write(cl->linebuf, msg->data, msg->len);
+		if (!msg->len || msg->data[msg->len - 1] != '\n')
+			buf_append(cl->linebuf, '\n');
+		input_backlog = 1;
+		break;
+	case WEBQUEUE_CLOSE:
+		cl = telnetclient_findwebclient(msg->conn);
+		if (cl && !cl->web_closed) {
+			cl->web_closed = 1;
+			telnetclient_signoff(cl);
+		}
+		break;
+	case WEBQUEUE_OUTPUT:
+		break;
+	}
+}
+
+/** send the queued output of a websocket client as a single frame. */
+static void
+telnetclient_webflush(DESCRIPTOR_DATA *cl)
+{
+	size_t len;
+	void *data = buf_data(cl->outbuf, &len);
+	int res;
+
+	if (!len)
+		return;
+
+	metrics_add(metric_bytes_out[1], len);
+	res = webserver_send(cl->web_conn, data, len);
+	buf_consume(cl->outbuf, len);
+	if (res != OK)
+		telnetclient_close(cl);
+}
+
+/**
+ * send a message to a websocket client as a frame of its own, after the
+ * output already queued. it counts against output.max like other output.
+ * @return OK if it was sent, ERR if it was discarded.
+ */
+int
+telnetclient_webframe(DESCRIPTOR_DATA *cl, const char *data, size_t len)
+{
+	if (!cl->web_conn || cl->web_closed)
+		return ERR;
+
+	if (telnetclient_output_limit(cl, len, 0) != OK)
+		return ERR;
+
+	telnetclient_webflush(cl);
+	if (cl->web_closed)
+		return ERR;
+
+	metrics_add(metric_bytes_out[1], len);
+	if (webserver_send(cl->web_conn, data, len) != OK) {
+		telnetclient_close(cl);
+		return ERR;
+	}
+
+	return OK;
+}
+
+/**
+ * send the output of each websocket client as a single frame, and free
+ * the clients that closed since the last flush.
+ */
+void
+telnetclient_flush_all(struct telnetserver *server)
+{
+	DESCRIPTOR_DATA *curr, *next;
+
+	for (curr = LIST_TOP(server->client_list); curr; curr = next) {
+		next = LIST_NEXT(curr, list);
+
+		if (telnetclient_isopen(curr))
+			telnetclient_output_recover(curr);
+
+		if (!curr->outbuf)
+			continue;
+
+		if (curr->web_closed) {
+			telnetclient_free(curr);
+			continue;
+		}
+
+		telnetclient_webflush(curr);
+	}
+}
+
+/** send changed game state to every websocket client. */
+void
+telnetclient_webstate_all(void)
+{
+	DESCRIPTOR_DATA *curr;
+
+	if (!web_server)
+		return;
+
+	for (curr = LIST_TOP(web_server->client_list); curr; curr = LIST_NEXT(curr, list)) {
+		if (!curr->web_closed)
+			webstate_update(curr);
+	}
+}
+
+/**
+ * run queued input lines, one line from each client in turn.
+ * a client runs at most input.rate lines and all clients together at most
+ * input.budget lines per call, so one connection cannot stall the loop.
+ * reading resumes on clients whose buffer has room again.
+ */
+void
+telnetclient_input_all(void)
+{
+	struct telnetserver *server;
+	DESCRIPTOR_DATA *curr;
+	unsigned nr = 0, i, round, served;
+	unsigned rate = mud_config.input_rate ? mud_config.input_rate : UINT_MAX;
+	unsigned budget = mud_config.input_budget ? mud_config.input_budget : UINT_MAX;
+
+	if (!input_backlog)
+		return;
+	input_backlog = 0;
+
+	for (server = LIST_TOP(server_list); server; server = LIST_NEXT(server, list)) {
+		for (curr = LIST_TOP(server->client_list); curr; curr = LIST_NEXT(curr, list)) {
+			size_t len;
+
+			buf_data(curr->linebuf, &len);
+			if (!len || !telnetclient_isopen(curr))
+				continue;
+			if (nr >= input_order_max) {
+				unsigned newmax = input_order_max ? input_order_max * 2 : 16;
+				DESCRIPTOR_DATA **p = realloc(input_order, newmax * sizeof(*p));
+
+				if (!p) {
+					LOG_PERROR("realloc()");
+					input_backlog = 1;
+					break;
+				}
+				input_order = p;
+				input_order_max = newmax;
+			}
+			input_order[nr++] = curr;
+		}
+	}
+
+	if (!nr)
+		return;
+
+	/* start with a different client each call so the budget is shared fairly. */
+	input_turn++;
+	for (round = 0; round < rate && budget; round++) {
+		served = 0;
+		for (i = 0; i < nr && budget; i++) {
+			curr = input_order[(input_turn + i) % nr];
+			/* a line may have closed the connection. */
+			if (telnetclient_isopen(curr) && telnetclient_line(curr)) {
+				served++;
+				budget--;
+			}
+		}
+		if (!served)
+			break;
+		if (round + 1 == rate || !budget)
+			input_backlog = 1; /* stopped by a limit, try again next pass */
+	}
+
+	for (i = 0; i < nr; i++) {
+		curr = input_order[i];
+		if (curr->input_paused && curr->stream && !telnetclient_input_full(curr)) {
+			curr->input_paused = 0;
+			dyad_setPaused(curr->stream, 0);
+		}
+	}
+}
+
+/** list every connection's output queue and the slow consumer totals. */
+void
+telnetclient_netstat(DESCRIPTOR_DATA *cl)
+{
+	struct telnetserver *server;
+	DESCRIPTOR_DATA *curr;
+
+	telnetclient_printf(cl, "%-32s %10s %8s %s\n", "Connection", "Queued", "Dropped", "State");
+	for (server = LIST_TOP(server_list); server; server = LIST_NEXT(server, list)) {
+		for (curr = LIST_TOP(server->client_list); curr; curr = LIST_NEXT(curr, list)) {
+			if (!telnetclient_isopen(curr))
+				continue;
+			telnetclient_printf(cl, "%-32s %10lu %8lu %s\n",
+				telnetclient_socket_name(curr),
+				(unsigned long)telnetclient_output_queued(curr),
+				curr->output_dropped_total,
+				curr->output_congested ? "congested" : "ok");
+		}
+	}
+	telnetclient_printf(cl, "Congested %lu times, %lu channel messages dropped, %lu clients disconnected.\n",
+		output_congested_total, output_dropped_total, output_disconnects_total);
+	telnetclient_printf(cl, "Limits: high %u, low %u, max %u bytes.\n",
+		mud_config.output_high, mud_config.output_low, mud_config.output_max);
+}
+
+/** true if telnetclient_input_all() has lines left to run. */
+int
+telnetclient_input_pending(void)
+{
+	return input_backlog;
+}
+
 /**
  * replaces the current user with a different one and updates the reference counts.
  */
@@ -591,7 +1127,16 @@ telnetclient_isstate(DESCRIPTOR_DATA *cl, void (*line_input)(DESCRIPTOR_DATA *cl
 void
 telnetclient_close(DESCRIPTOR_DATA *cl)
 {
-	if (cl && cl->stream) {
+	if (cl && cl->web_conn && !cl->web_closed) {
+		size_t len;
+		void *data = buf_data(cl->outbuf, &len);
+
+		if (len)
+			webserver_send(cl->web_conn, data, len);
+		webserver_close(cl->web_conn);
+		cl->web_closed = 1;
+		telnetclient_signoff(cl);
+	} else if (cl && cl->stream) {
 		dyad_Stream *stream = cl->stream;
 		cl->stream = NULL;
 		dyad_close(stream);
@@ -641,6 +1186,8 @@ telnetclient_socket_name(DESCRIPTOR_DATA *cl)
 
 	if (cl && cl->stream) {
 		snprintf(tmp, sizeof(tmp), "%s:%u", dyad_getAddress(cl->stream), dyad_getPort(cl->stream));
+	} else if (cl && cl->web_conn) {
+		snprintf(tmp, sizeof(tmp), "%s:websocket#%lu", cl->host, cl->web_conn);
 	} else {
 		snprintf(tmp, sizeof(tmp), "INVALID");
 	}
@@ -648,15 +1195,61 @@ telnetclient_socket_name(DESCRIPTOR_DATA *cl)
 	return tmp;
 }
 
+/** remote address without the port. */
+const char *
+telnetclient_remote_addr(DESCRIPTOR_DATA *cl)
+{
+	if (cl && cl->web_conn)
+		return cl->host;
+
+	return cl && cl->stream ? dyad_getAddress(cl->stream) : "";
+}
+
 const struct terminal *
 telnetclient_get_terminal(DESCRIPTOR_DATA *cl)
 {
 	return cl ? &cl->terminal : NULL;
 }
 
+/** register the traffic metrics, once. */
+static void
+telnetclient_metrics_init(void)
+{
+	static const char *names[2] = { "transport=\"telnet\"", "transport=\"websocket\"" };
+	unsigned i;
+
+	if (metric_clients[0])
+		return;
+
+	for (i = 0; i < 2; i++) {
+		metric_bytes_in[i] = metrics_counter("boris_bytes_in_total", names[i],
+			"Bytes received from clients.");
+		metric_bytes_out[i] = metrics_counter("boris_bytes_out_total", names[i],
+			"Bytes sent to clients, after MCCP and before websocket compression.");
+		metric_clients[i] = metrics_gauge("boris_clients", names[i],
+			"Connected clients.");
+	}
+
+	metric_mccp_in = metrics_counter("boris_mccp_in_bytes_total", NULL,
+		"Bytes given to MCCP compression.");
+	metric_mccp_out = metrics_counter("boris_mccp_out_bytes_total", NULL,
+		"Bytes produced by MCCP compression.");
+	metric_mccp_ratio = metrics_gauge("boris_mccp_ratio", NULL,
+		"Compressed size over original size for all MCCP output.");
+
+	metric_output_congested = metrics_counter("boris_output_congested_total", NULL,
+		"Times a client went over output.high.");
+	metric_output_dropped = metrics_counter("boris_output_dropped_total", NULL,
+		"Channel messages dropped for congested clients.");
+	metric_output_disconnects = metrics_counter("boris_output_disconnects_total", NULL,
+		"Clients disconnected for reaching output.max.");
+}
+
 int
 telnetserver_listen(int port)
 {
+	telnetclient_metrics_init();
+
 	struct telnetserver *server = malloc(sizeof(*server));
 	if (!server) {
 		return ERR;
@@ -15,10 +15,20 @@ void telnetclient_clear_statedata(DESCRIPTOR_DATA *cl);
 struct channel_member *telnetclient_channel_member(DESCRIPTOR_DATA *cl);
 dyad_Stream *telnetclient_socket_handle(DESCRIPTOR_DATA *cl);
 const char *telnetclient_socket_name(DESCRIPTOR_DATA *cl);
+const char *telnetclient_remote_addr(DESCRIPTOR_DATA *cl);
 const struct terminal *telnetclient_get_terminal(DESCRIPTOR_DATA *cl);
 int telnetserver_listen(int port);
 void telnetclient_prompt_refresh(DESCRIPTOR_DATA *cl);
 void telnetclient_prompt_refresh_all(struct telnetserver *);
+void telnetclient_flush_all(struct telnetserver *server);
+struct webqueue_msg;
+void telnetclient_webevent(const struct webqueue_msg *msg);
+void telnetclient_webstate_all(void);
+int telnetclient_webframe(DESCRIPTOR_DATA *cl, const char *data, size_t len);
+void telnetclient_web_shutdown(void);
+void telnetclient_input_all(void);
+int telnetclient_input_pending(void);
+void telnetclient_netstat(DESCRIPTOR_DATA *cl);
 struct telnetserver *telnetserver_first(void);
 struct telnetserver *telnetserver_next(struct telnetserver *server);
 void telnetclient_setuser(DESCRIPTOR_DATA *cl, struct user *u);
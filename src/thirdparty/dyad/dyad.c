@@ -291,6 +291,7 @@ struct dyad_Stream {
 
 #define DYAD_FLAG_READY   (1 << 0)
 #define DYAD_FLAG_WRITTEN (1 << 1)
+#define DYAD_FLAG_PAUSED  (1 << 2)
 
 
 static dyad_Stream *dyad_streams;
@@ -301,6 +302,10 @@ static SelectSet dyad_selectSet;
 static double dyad_updateTimeout = 1;
 static double dyad_tickInterval = 1;
 static double dyad_lastTick = 0;
+static dyad_Socket dyad_wakeupFd = INVALID_SOCKET;
+static double dyad_phaseTimes[3]; /* prepare, wait, dispatch of last update */
+static dyad_Callback dyad_wakeupCallback;
+static void *dyad_wakeupUdata;
 
 
 static void panic(const char *fmt, ...) {
@@ -583,6 +588,11 @@ static void stream_handleReceivedData(dyad_Stream *stream) {
         vec_splice(&stream->lineBuffer, 0, start);
       }
     }
+
+    /* Leave the rest in the socket if a handler paused reading */
+    if (stream->flags & DYAD_FLAG_PAUSED) {
+      return;
+    }
   }
 }
 
@@ -677,6 +687,7 @@ static int stream_flushWriteBuffer(dyad_Stream *stream) {
 void dyad_update(void) {
   dyad_Stream *stream;
   struct timeval tv;
+  double start = dyad_getTime(), waited;
 
   destroyClosedStreams();
   updateTickTimer();
@@ -689,7 +700,9 @@ void dyad_update(void) {
   while (stream) {
     switch (stream->state) {
       case DYAD_STATE_CONNECTED:
-        select_add(&dyad_selectSet, SELECT_READ, stream->sockfd);
+        if (!(stream->flags & DYAD_FLAG_PAUSED)) {
+          select_add(&dyad_selectSet, SELECT_READ, stream->sockfd);
+        }
         if (!(stream->flags & DYAD_FLAG_READY) ||
             stream->writeBuffer.length != 0
         ) {
@@ -709,6 +722,9 @@ void dyad_update(void) {
     }
     stream = stream->next;
   }
+  if (dyad_wakeupFd != INVALID_SOCKET) {
+    select_add(&dyad_selectSet, SELECT_READ, dyad_wakeupFd);
+  }
 
   /* Init timeout value and do select */
   #ifdef _MSC_VER
@@ -723,16 +739,31 @@ void dyad_update(void) {
     #pragma warning(pop)
   #endif
 
+  waited = dyad_getTime();
+  dyad_phaseTimes[0] = waited - start;
   int e = select(dyad_selectSet.maxfd + 1,
          dyad_selectSet.fds[SELECT_READ],
          dyad_selectSet.fds[SELECT_WRITE],
          dyad_selectSet.fds[SELECT_EXCEPT],
          &tv);
+  start = dyad_getTime();
+  dyad_phaseTimes[1] = start - waited;
+  dyad_phaseTimes[2] = 0;
   if (e < 0) {
 	  perror("select()");
 	  return;
   }
 
+  /* Handle wakeup from another thread */
+  if (dyad_wakeupFd != INVALID_SOCKET &&
+      select_has(&dyad_selectSet, SELECT_READ, dyad_wakeupFd)
+  ) {
+    dyad_Event e = createEvent(DYAD_EVENT_DATA);
+    e.msg = "wakeup";
+    e.udata = dyad_wakeupUdata;
+    dyad_wakeupCallback(&e);
+  }
+
   /* Handle streams */
   stream = dyad_streams;
   while (stream) {
@@ -796,6 +827,8 @@ connectFailed:
 
     stream = stream->next;
   }
+
+  dyad_phaseTimes[2] = dyad_getTime() - start;
 }
 
 
@@ -850,11 +883,27 @@ int dyad_getStreamCount(void) {
 }
 
 
+void dyad_getUpdateTimes(double *prepare, double *wait, double *dispatch) {
+  *prepare = dyad_phaseTimes[0];
+  *wait = dyad_phaseTimes[1];
+  *dispatch = dyad_phaseTimes[2];
+}
+
+
 void dyad_setTickInterval(double seconds) {
   dyad_tickInterval = seconds;
 }
 
 
+/* Watch a descriptor that other threads make readable, such as an eventfd,
+ * to end dyad_update() early. Pass INVALID_SOCKET to stop watching. */
+void dyad_setWakeup(dyad_Socket fd, dyad_Callback callback, void *udata) {
+  dyad_wakeupFd = fd;
+  dyad_wakeupCallback = callback;
+  dyad_wakeupUdata = udata;
+}
+
+
 void dyad_setUpdateTimeout(double seconds) {
   dyad_updateTimeout = seconds;
 }
@@ -1130,6 +1179,15 @@ void dyad_setNoDelay(dyad_Stream *stream, int opt) {
 }
 
 
+void dyad_setPaused(dyad_Stream *stream, int paused) {
+  if (paused) {
+    stream->flags |= DYAD_FLAG_PAUSED;
+  } else {
+    stream->flags &= ~DYAD_FLAG_PAUSED;
+  }
+}
+
+
 int dyad_getState(dyad_Stream *stream) {
   return stream->state;
 }
@@ -1145,6 +1203,11 @@ int dyad_getPort(dyad_Stream *stream) {
 }
 
 
+int dyad_getWriteBufferLength(dyad_Stream *stream) {
+  return stream->writeBuffer.length;
+}
+
+
 int dyad_getBytesSent(dyad_Stream *stream) {
   return stream->bytesSent;
 }
@@ -71,8 +71,10 @@ void dyad_shutdown(void);
 const char *dyad_getVersion(void);
 double dyad_getTime(void);
 int  dyad_getStreamCount(void);
+void dyad_getUpdateTimes(double *prepare, double *wait, double *dispatch);
 void dyad_setTickInterval(double seconds);
 void dyad_setUpdateTimeout(double seconds);
+void dyad_setWakeup(dyad_Socket fd, dyad_Callback callback, void *udata);
 dyad_PanicCallback dyad_atPanic(dyad_PanicCallback func);
 
 dyad_Stream *dyad_newStream(void);
@@ -92,10 +94,12 @@ void dyad_vwritef(dyad_Stream *stream, const char *fmt, va_list args);
 void dyad_writef(dyad_Stream *stream, const char *fmt, ...);
 void dyad_setTimeout(dyad_Stream *stream, double seconds);
 void dyad_setNoDelay(dyad_Stream *stream, int opt);
+void dyad_setPaused(dyad_Stream *stream, int paused);
 int  dyad_getState(dyad_Stream *stream);
 const char *dyad_getAddress(dyad_Stream *stream);
 int  dyad_getPort(dyad_Stream *stream);
 int  dyad_getBytesSent(dyad_Stream *stream);
+int  dyad_getWriteBufferLength(dyad_Stream *stream);
 int  dyad_getBytesReceived(dyad_Stream *stream);
 dyad_Socket dyad_getSocket(dyad_Stream *stream);
 
@@ -566,6 +566,7 @@ struct msdp_type msdp_table[] =
 	{    "ALIGNMENT",                     MSDP_FLAG_SENDABLE|MSDP_FLAG_REPORTABLE,    NULL },
 	{    "ARACHNOS_DEVEL",            MSDP_FLAG_CONFIGURABLE|MSDP_FLAG_REPORTABLE,    msdp_configure_arachnos },
 	{    "ARACHNOS_MUDLIST",                               MSDP_FLAG_CONFIGURABLE,    msdp_configure_arachnos },
+	{    "CHARACTER_NAME",                MSDP_FLAG_SENDABLE|MSDP_FLAG_REPORTABLE,    NULL },
 	{    "COMMANDS",                             MSDP_FLAG_COMMAND|MSDP_FLAG_LIST,    NULL },
 	{    "CONFIGURABLE_VARIABLES",          MSDP_FLAG_CONFIGURABLE|MSDP_FLAG_LIST,    NULL },
 //	{    "EDIT_BUFFER",               MSDP_FLAG_CONFIGURABLE|MSDP_FLAG_REPORTABLE,    msdp_configure_edit_buffer },
@@ -591,6 +592,7 @@ struct msdp_type msdp_table[] =
 	{    "SENDABLE_VARIABLES",                  MSDP_FLAG_SENDABLE|MSDP_FLAG_LIST,    NULL },
 	{    "SPECIFICATION",                                      MSDP_FLAG_SENDABLE,    NULL },
 	{    "UNREPORT",                                            MSDP_FLAG_COMMAND,    msdp_command_unreport },
+	{    "WORLD_TIME",                    MSDP_FLAG_SENDABLE|MSDP_FLAG_REPORTABLE,    NULL },
 
 	{    "",                                                                    0,    NULL } // End of table marker
 };
@@ -26,8 +26,20 @@ void init_mth_socket(DESCRIPTOR_DATA *d)
 
 void uninit_mth_socket(DESCRIPTOR_DATA *d)
 {
+	int index;
+
 	unannounce_support(d);
 
+	if (d->mth->msdp_data)
+	{
+		for (index = 0 ; index < mud.msdp_table_size ; index++)
+		{
+			free(d->mth->msdp_data[index]->value);
+			free(d->mth->msdp_data[index]);
+		}
+		free(d->mth->msdp_data);
+	}
+
 	free(d->mth->proxy);
 	free(d->mth->terminal_type);
 	free(d->mth);
@@ -78,7 +90,10 @@ void log_descriptor_printf(DESCRIPTOR_DATA *d, char *fmt, ...)
 
 	va_end(args);
 
-	printf("D%ld@%s %s\n", (long)dyad_getSocket(d->stream), dyad_getAddress(d->stream), buf);
+	if (d->stream)
+		printf("D%ld@%s %s\n", (long)dyad_getSocket(d->stream), dyad_getAddress(d->stream), buf);
+	else
+		printf("D-1@%s %s\n", d->host ? d->host : "", buf);
 
 	return;
 }
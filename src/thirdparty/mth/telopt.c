@@ -6,6 +6,12 @@
 #include <dyad.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define TELOPT_SCAN_SSE2
+#endif
 
 #define TELOPT_DEBUG 1
 
@@ -136,6 +142,60 @@ void unannounce_support( DESCRIPTOR_DATA *d )
 	It also deals with \r and \0 so commands are separated by a single \n.
 */
 
+/*
+	Returns the length of the run at src holding no IAC, CR or NUL, the
+	only bytes translate_telopts() does not copy through unchanged.
+*/
+
+static int scan_plain(const unsigned char *src, int srclen)
+{
+	int pos = 0;
+
+#ifdef TELOPT_SCAN_SSE2
+	const __m128i iac = _mm_set1_epi8((char) IAC);
+	const __m128i cr  = _mm_set1_epi8('\r');
+	const __m128i nul = _mm_setzero_si128();
+
+	while (pos + 16 <= srclen)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + pos));
+		int mask  = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, iac), _mm_cmpeq_epi8(v, cr)), _mm_cmpeq_epi8(v, nul)));
+
+		if (mask)
+		{
+			return pos + __builtin_ctz(mask);
+		}
+		pos += 16;
+	}
+#else
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t high = 0x8080808080808080ULL;
+
+	while (pos + 8 <= srclen)
+	{
+		uint64_t w, c;
+
+		memcpy(&w, src + pos, sizeof(w));
+
+		// a byte of w is IAC when ~w has a zero byte, CR when w ^ CR does
+
+		c = w ^ (ones * '\r');
+
+		if (((w - ones) & ~w) & high || ((~w - ones) & w) & high || ((c - ones) & ~c) & high)
+		{
+			break;
+		}
+		pos += 8;
+	}
+#endif
+
+	while (pos < srclen && src[pos] != IAC && src[pos] != '\r' && src[pos] != '\0')
+	{
+		pos++;
+	}
+	return pos;
+}
+
 int translate_telopts(DESCRIPTOR_DATA *d, unsigned char *src, int srclen, unsigned char *out, int outlen)
 {
 	int cnt, skip;
@@ -329,7 +389,7 @@ int translate_telopts(DESCRIPTOR_DATA *d, unsigned char *src, int srclen, unsign
 					d->mth->teltop = srclen;
 
 					*pto = 0;
-					return strlen((char *) out);
+					return pto - out;
 				}
 				break;
 
@@ -348,8 +408,13 @@ int translate_telopts(DESCRIPTOR_DATA *d, unsigned char *src, int srclen, unsign
 				break;
 
 			default:
-				*pto++ = *pti++;
-				srclen--;
+				cnt = scan_plain(pti, srclen);
+
+				memcpy(pto, pti, cnt);
+
+				pto    += cnt;
+				pti    += cnt;
+				srclen -= cnt;
 				break;
 		}
 	}
@@ -359,7 +424,7 @@ int translate_telopts(DESCRIPTOR_DATA *d, unsigned char *src, int srclen, unsign
 
 	if (HAS_BIT(d->mth->comm_flags, COMM_FLAG_REMOTEECHO))
 	{
-		skip = strlen((char *) out);
+		skip = pto - out;
 
 		for (cnt = 0 ; cnt < skip ; cnt++)
 		{
@@ -388,7 +453,7 @@ int translate_telopts(DESCRIPTOR_DATA *d, unsigned char *src, int srclen, unsign
 			}
 		}
 	}
-	return strlen((char *) out);
+	return pto - out;
 }
 
 void debug_telopts( DESCRIPTOR_DATA *d, unsigned char *src, int srclen )
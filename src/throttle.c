@@ -0,0 +1,362 @@
+/**
+ * @file throttle.c
+ *
+ * Per-address login throttling.
+ *
+ * Each remote address gets a token bucket that holds up to burst tokens and
+ * refills at rate tokens per minute. A login attempt takes one token, and an
+ * address with an empty bucket is refused before any password is hashed.
+ *
+ * The table is a fixed number of hosts in a hash table. Hosts are kept in
+ * least recently used order, a host whose bucket has refilled completely is
+ * forgotten, and when the table is full the oldest host is reused.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @version 0.7
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2008-2026, Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "throttle.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <boris.h>
+#include <fnv.h>
+#define LOG_SUBSYSTEM "throttle"
+#include <log.h>
+#include <debug.h>
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+/** large enough for an IPv6 address. */
+#define THROTTLE_ADDR_MAX 48
+
+struct throttle_host {
+	struct throttle_host *hash_next; /**< also links the free list. */
+	struct throttle_host *lru_prev, *lru_next;
+	uint32_t hash;
+	uint64_t last; /**< ms when the bucket was last refilled. */
+	double tokens;
+	unsigned fails, throttled;
+	char addr[THROTTLE_ADDR_MAX];
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static struct throttle_host *throttle_hosts, *throttle_free;
+static struct throttle_host **throttle_bucket;
+static unsigned throttle_bucket_mask;
+/** most and least recently used hosts. */
+static struct throttle_host *throttle_newest, *throttle_oldest;
+static unsigned throttle_burst, throttle_rate;
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+static uint64_t
+throttle_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+throttle_lru_unlink(struct throttle_host *h)
+{
+	if (h->lru_prev)
+		h->lru_prev->lru_next = h->lru_next;
+	else
+		throttle_newest = h->lru_next;
+	if (h->lru_next)
+		h->lru_next->lru_prev = h->lru_prev;
+	else
+		throttle_oldest = h->lru_prev;
+	h->lru_prev = h->lru_next = NULL;
+}
+
+static void
+throttle_lru_push(struct throttle_host *h)
+{
+	h->lru_prev = NULL;
+	h->lru_next = throttle_newest;
+	if (throttle_newest)
+		throttle_newest->lru_prev = h;
+	else
+		throttle_oldest = h;
+	throttle_newest = h;
+}
+
+/** take a host out of the table, without returning it to the free list. */
+static void
+throttle_unlink(struct throttle_host *h)
+{
+	struct throttle_host **prev = &throttle_bucket[h->hash & throttle_bucket_mask];
+
+	while (*prev != h) {
+		assert(*prev != NULL);
+		prev = &(*prev)->hash_next;
+	}
+	*prev = h->hash_next;
+	h->hash_next = NULL;
+	throttle_lru_unlink(h);
+}
+
+/** ms for an empty bucket to fill up again. */
+static uint64_t
+throttle_refill_ms(void)
+{
+	if (!throttle_rate)
+		return UINT64_MAX;
+
+	return (uint64_t)throttle_burst * 60000 / throttle_rate;
+}
+
+static void
+throttle_refill(struct throttle_host *h, uint64_t now)
+{
+	if (now > h->last && throttle_rate) {
+		h->tokens += (double)(now - h->last) * throttle_rate / 60000.0;
+		if (h->tokens > throttle_burst)
+			h->tokens = throttle_burst;
+	}
+	h->last = now;
+}
+
+/** forget hosts that have been idle long enough to refill their bucket. */
+static void
+throttle_expire(uint64_t now)
+{
+	uint64_t idle = throttle_refill_ms();
+
+	while (throttle_oldest && now - throttle_oldest->last >= idle) {
+		struct throttle_host *h = throttle_oldest;
+
+		throttle_unlink(h);
+		h->hash_next = throttle_free;
+		throttle_free = h;
+	}
+}
+
+/** find a host, or add it with a full bucket if create is set. */
+static struct throttle_host *
+throttle_lookup(const char *addr, int create, uint64_t now)
+{
+	uint32_t hash = fnv1a_str(addr);
+	struct throttle_host *h;
+
+	throttle_expire(now);
+
+	for (h = throttle_bucket[hash & throttle_bucket_mask]; h; h = h->hash_next) {
+		if (h->hash == hash && !strcmp(h->addr, addr)) {
+			throttle_lru_unlink(h);
+			throttle_lru_push(h);
+			return h;
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	if (throttle_free) {
+		h = throttle_free;
+		throttle_free = h->hash_next;
+	} else {
+		/* table is full, reuse the least recently used host */
+		h = throttle_oldest;
+		assert(h != NULL);
+		LOG_DEBUG("dropping throttle entry for %s", h->addr);
+		throttle_unlink(h);
+	}
+
+	memset(h, 0, sizeof(*h));
+	snprintf(h->addr, sizeof(h->addr), "%s", addr);
+	h->hash = hash;
+	h->last = now;
+	h->tokens = throttle_burst;
+	h->hash_next = throttle_bucket[hash & throttle_bucket_mask];
+	throttle_bucket[hash & throttle_bucket_mask] = h;
+	throttle_lru_push(h);
+
+	return h;
+}
+
+/**
+ * take a token for a login attempt from addr.
+ * @return 1 if the attempt may go ahead, 0 if addr is throttled.
+ */
+int
+throttle_login_allow(const char *addr)
+{
+	uint64_t now = throttle_now();
+	struct throttle_host *h;
+
+	if (!throttle_burst || !throttle_hosts)
+		return 1; /* throttling is disabled */
+
+	h = throttle_lookup(addr, 1, now);
+	throttle_refill(h, now);
+	if (h->tokens < 1.0) {
+		h->throttled++;
+		return 0; /* throttled */
+	}
+	h->tokens -= 1.0;
+
+	return 1; /* allowed */
+}
+
+/** count a failed password for addr. */
+void
+throttle_login_failed(const char *addr)
+{
+	struct throttle_host *h;
+
+	if (!throttle_burst || !throttle_hosts)
+		return;
+
+	h = throttle_lookup(addr, 1, throttle_now());
+	h->fails++;
+}
+
+/** failures and throttled attempts for addr since it was last forgotten. */
+void
+throttle_login_counters(const char *addr, unsigned *fails, unsigned *throttled)
+{
+	struct throttle_host *h = NULL;
+
+	if (throttle_burst && throttle_hosts)
+		h = throttle_lookup(addr, 0, throttle_now());
+
+	if (fails)
+		*fails = h ? h->fails : 0;
+	if (throttled)
+		*throttled = h ? h->throttled : 0;
+}
+
+static int
+throttle_setup(unsigned burst, unsigned rate, unsigned max_hosts)
+{
+	unsigned i, nr_bucket;
+
+	throttle_burst = burst;
+	throttle_rate = rate;
+	throttle_newest = throttle_oldest = NULL;
+	throttle_free = NULL;
+
+	if (!burst || !max_hosts) {
+		LOG_INFO("login throttling is disabled");
+		return 1; /* success */
+	}
+
+	for (nr_bucket = 16; nr_bucket < max_hosts; nr_bucket *= 2)
+		;
+	throttle_bucket_mask = nr_bucket - 1;
+
+	throttle_hosts = calloc(max_hosts, sizeof(*throttle_hosts));
+	throttle_bucket = calloc(nr_bucket, sizeof(*throttle_bucket));
+	if (!throttle_hosts || !throttle_bucket) {
+		LOG_PERROR("calloc()");
+		free(throttle_hosts);
+		free(throttle_bucket);
+		throttle_hosts = NULL;
+		throttle_bucket = NULL;
+		return 0; /* failure */
+	}
+
+	for (i = max_hosts; i > 0; i--) {
+		throttle_hosts[i - 1].hash_next = throttle_free;
+		throttle_free = &throttle_hosts[i - 1];
+	}
+
+	return 1; /* success */
+}
+
+int
+throttle_init(void)
+{
+	return throttle_setup(mud_config.throttle_burst, mud_config.throttle_rate,
+		mud_config.throttle_hosts);
+}
+
+void
+throttle_shutdown(void)
+{
+	free(throttle_hosts);
+	free(throttle_bucket);
+	throttle_hosts = NULL;
+	throttle_bucket = NULL;
+	throttle_free = throttle_newest = throttle_oldest = NULL;
+}
+
+#ifndef NTEST
+/** test bucket exhaustion and eviction of the oldest host. */
+void
+throttle_test(void)
+{
+	unsigned fails, throttled;
+	int i;
+
+	if (!throttle_setup(3, 1, 2)) {
+		LOG_ERROR("throttle_setup() failed");
+		exit(1);
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (!throttle_login_allow("192.0.2.1")) {
+			LOG_ERROR("attempt %d was throttled", i);
+			exit(1);
+		}
+		throttle_login_failed("192.0.2.1");
+	}
+
+	if (throttle_login_allow("192.0.2.1")) {
+		LOG_ERROR("token bucket test failed");
+		exit(1);
+	}
+
+	throttle_login_counters("192.0.2.1", &fails, &throttled);
+	if (fails != 3 || throttled != 1) {
+		LOG_ERROR("counter test failed (fails=%u throttled=%u)", fails, throttled);
+		exit(1);
+	}
+
+	if (!throttle_login_allow("192.0.2.2")) {
+		LOG_ERROR("second host was throttled");
+		exit(1);
+	}
+
+	/* a third host pushes out 192.0.2.1, which was used before 192.0.2.2 */
+	throttle_login_allow("2001:db8::1");
+	throttle_login_counters("192.0.2.1", &fails, &throttled);
+	if (fails || throttled || !throttle_login_allow("192.0.2.1")) {
+		LOG_ERROR("eviction test failed");
+		exit(1);
+	}
+
+	throttle_shutdown();
+	LOG_DEBUG("throttle test PASSED");
+}
+#endif
@@ -0,0 +1,12 @@
+#ifndef THROTTLE_H_
+#define THROTTLE_H_
+
+int throttle_init(void);
+void throttle_shutdown(void);
+int throttle_login_allow(const char *addr);
+void throttle_login_failed(const char *addr);
+void throttle_login_counters(const char *addr, unsigned *fails, unsigned *throttled);
+#ifndef NTEST
+void throttle_test(void);
+#endif
+#endif
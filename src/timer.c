@@ -0,0 +1,314 @@
+/**
+ * @file timer.c
+ *
+ * One-shot timers run from the main loop.
+ *
+ * Timers live in a binary min-heap ordered by deadline. timer_run() calls
+ * every expired callback, and timer_next() tells the main loop how long it
+ * may sleep. Cancellation searches the heap, there are only ever a few
+ * timers per connection.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @version 0.7
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2008-2026, Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "timer.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <boris.h>
+#define LOG_SUBSYSTEM "timer"
+#include <log.h>
+#include <debug.h>
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+struct timer_entry {
+	uint64_t expire; /**< deadline in ms on the monotonic clock. */
+	unsigned id;
+	timer_fn fn;
+	void *p;
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static struct timer_entry *timer_heap;
+static unsigned timer_len, timer_max;
+static unsigned timer_last_id;
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+/** current time in milliseconds. */
+static uint64_t
+timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** earlier deadline first, then in order of creation. */
+static inline int
+timer_before(const struct timer_entry *a, const struct timer_entry *b)
+{
+	if (a->expire != b->expire)
+		return a->expire < b->expire;
+	return (int)(a->id - b->id) < 0;
+}
+
+static void
+timer_siftup(unsigned i)
+{
+	struct timer_entry elm = timer_heap[i];
+
+	while (i > 0) {
+		unsigned parent = (i - 1) / 2;
+		if (!timer_before(&elm, &timer_heap[parent]))
+			break;
+		timer_heap[i] = timer_heap[parent];
+		i = parent;
+	}
+
+	timer_heap[i] = elm;
+}
+
+static void
+timer_siftdown(unsigned i)
+{
+	struct timer_entry elm = timer_heap[i];
+
+	while (2 * i + 1 < timer_len) {
+		unsigned child = 2 * i + 1;
+		if (child + 1 < timer_len && timer_before(&timer_heap[child + 1], &timer_heap[child]))
+			child++;
+		if (!timer_before(&timer_heap[child], &elm))
+			break;
+		timer_heap[i] = timer_heap[child];
+		i = child;
+	}
+
+	timer_heap[i] = elm;
+}
+
+/** remove the entry at position i. */
+static void
+timer_remove(unsigned i)
+{
+	assert(i < timer_len);
+
+	timer_len--;
+	if (i == timer_len)
+		return;
+
+	timer_heap[i] = timer_heap[timer_len];
+	if (i > 0 && timer_before(&timer_heap[i], &timer_heap[(i - 1) / 2]))
+		timer_siftup(i);
+	else
+		timer_siftdown(i);
+}
+
+/**
+ * call fn(p) after delay_ms milliseconds.
+ * @return timer id, or 0 on failure.
+ */
+unsigned
+timer_add(unsigned delay_ms, timer_fn fn, void *p)
+{
+	assert(fn != NULL);
+
+	if (timer_len >= timer_max) {
+		unsigned new_max = timer_max ? timer_max * 2 : 64;
+		struct timer_entry *new_heap = realloc(timer_heap, new_max * sizeof(*new_heap));
+		if (!new_heap) {
+			LOG_PERROR("realloc()");
+			return 0; /* failure */
+		}
+		timer_heap = new_heap;
+		timer_max = new_max;
+	}
+
+	if (++timer_last_id == 0)
+		timer_last_id = 1; /* 0 is never a valid id */
+
+	timer_heap[timer_len] = (struct timer_entry){
+		.expire = timer_now() + delay_ms,
+		.id = timer_last_id,
+		.fn = fn,
+		.p = p,
+	};
+	timer_siftup(timer_len++);
+
+	return timer_last_id;
+}
+
+/**
+ * stop a timer before it runs.
+ * @return 1 if the timer was cancelled, 0 if it was not found.
+ */
+int
+timer_cancel(unsigned id)
+{
+	unsigned i;
+
+	for (i = 0; i < timer_len; i++) {
+		if (timer_heap[i].id == id) {
+			timer_remove(i);
+			return 1; /* success */
+		}
+	}
+
+	return 0; /* not found */
+}
+
+/** stop all timers that were given p, for when p is about to be freed. */
+void
+timer_cancel_all(void *p)
+{
+	unsigned i, n;
+
+	/* removing one at a time can sift an unchecked entry below i, so
+	 * compact the survivors and rebuild the heap once. */
+	for (i = n = 0; i < timer_len; i++) {
+		if (timer_heap[i].p != p)
+			timer_heap[n++] = timer_heap[i];
+	}
+
+	if (n == timer_len)
+		return;
+
+	timer_len = n;
+	for (i = timer_len / 2; i-- > 0; )
+		timer_siftdown(i);
+}
+
+/** call every expired timer. */
+void
+timer_run(void)
+{
+	uint64_t now = timer_now();
+
+	while (timer_len > 0 && timer_heap[0].expire <= now) {
+		struct timer_entry t = timer_heap[0];
+
+		timer_remove(0);
+		t.fn(t.p); /* may add or cancel timers */
+	}
+}
+
+/**
+ * time until the next timer expires.
+ * @return milliseconds, or -1 if there are no timers.
+ */
+long
+timer_next(void)
+{
+	uint64_t now;
+
+	if (!timer_len)
+		return -1;
+
+	now = timer_now();
+
+	return timer_heap[0].expire > now ? (long)(timer_heap[0].expire - now) : 0;
+}
+
+int
+timer_init(void)
+{
+	timer_heap = NULL;
+	timer_len = timer_max = 0;
+
+	return 1; /* success */
+}
+
+/** drop pending timers without calling them. */
+void
+timer_shutdown(void)
+{
+	free(timer_heap);
+	timer_heap = NULL;
+	timer_len = timer_max = 0;
+}
+
+#ifndef NTEST
+static unsigned timer_test_order[8], timer_test_count;
+
+static void
+timer_test_fn(void *p)
+{
+	timer_test_order[timer_test_count++] = (uintptr_t)p;
+}
+
+/** test the timer ordering and cancellation. */
+void
+timer_test(void)
+{
+	unsigned id;
+
+	timer_init();
+	timer_add(0, timer_test_fn, (void*)2);
+	id = timer_add(0, timer_test_fn, (void*)9);
+	timer_add(0, timer_test_fn, (void*)3);
+	timer_add(0, timer_test_fn, (void*)7);
+	timer_add(0, timer_test_fn, (void*)7);
+	timer_add(5000, timer_test_fn, (void*)5);
+	timer_cancel(id);
+	timer_cancel_all((void*)7);
+	timer_run();
+
+	if (timer_test_count != 2 || timer_test_order[0] != 2 || timer_test_order[1] != 3) {
+		LOG_ERROR("timer order test failed (count=%u)", timer_test_count);
+		exit(1);
+	}
+
+	if (timer_next() <= 0) {
+		LOG_ERROR("timer_next() failed");
+		exit(1);
+	}
+
+	/* many timers for one p, spread over the heap. */
+	timer_shutdown();
+	timer_init();
+	for (id = 0; id < 100; id++)
+		timer_add(id * 7 % 31, timer_test_fn, (void*)(uintptr_t)(id % 3 ? 1 : 4));
+	timer_cancel_all((void*)1);
+	for (id = 0; id < timer_len; id++) {
+		if (timer_heap[id].p != (void*)4
+			|| (id > 0 && timer_before(&timer_heap[id], &timer_heap[(id - 1) / 2]))) {
+			LOG_ERROR("timer_cancel_all() test failed at %u", id);
+			exit(1);
+		}
+	}
+	if (timer_len != 34) {
+		LOG_ERROR("timer_cancel_all() left %u timers", timer_len);
+		exit(1);
+	}
+
+	timer_shutdown();
+	LOG_DEBUG("timer test PASSED");
+}
+#endif
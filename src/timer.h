@@ -0,0 +1,16 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+typedef void (*timer_fn)(void *p);
+
+int timer_init(void);
+void timer_shutdown(void);
+unsigned timer_add(unsigned delay_ms, timer_fn fn, void *p);
+int timer_cancel(unsigned id);
+void timer_cancel_all(void *p);
+void timer_run(void);
+long timer_next(void);
+#ifndef NTEST
+void timer_test(void);
+#endif
+#endif
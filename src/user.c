@@ -31,8 +31,9 @@
 #include <log.h>
 #include <debug.h>
 #include <list.h>
-#include <sha1crypt.h>
+#include <pwhash.h>
 #include <acs.h>
+#include <atom.h>
 #include <freelist.h>
 #include <fdb.h>
 #include <user.h>
@@ -110,7 +111,6 @@ user_ll_free(struct user *u)
 	if (!u) return;
 
 	attr_list_free(&u->extra_values);
-	LIST_INIT(&u->extra_values);
 	free(u->username);
 	u->username = 0;
 	free(u->password_crypt);
@@ -157,7 +157,7 @@ user_defaults(void)
 	u->email = NULL;
 	u->acs.level = USER_LEVEL_NEWUSER;
 	u->acs.flags = USER_FLAGS_NEWUSER;
-	LIST_INIT(&u->extra_values);
+	memset(&u->extra_values, 0, sizeof(u->extra_values));
 	return u;
 }
 
@@ -239,20 +239,28 @@ user_load_byname(const char *username, int id_already_exists)
 	}
 
 	while (fdb_read_next(h, &name, &value)) {
-		if (!strcasecmp("id", name))
+		switch (atom_lookup(name)) {
+		case ATOM_ID:
 			parse_uint(name, value, &u->id);
-		else if (!strcasecmp("username", name))
+			break;
+		case ATOM_USERNAME:
 			parse_str(name, value, &u->username);
-		else if (!strcasecmp("pwcrypt", name))
+			break;
+		case ATOM_PWCRYPT:
 			parse_str(name, value, &u->password_crypt);
-		else if (!strcasecmp("email", name))
+			break;
+		case ATOM_EMAIL:
 			parse_str(name, value, &u->email);
-		else if (!strcasecmp("acs.level", name))
+			break;
+		case ATOM_ACS_LEVEL:
 			sscanf(value, "%hhu", &u->acs.level); /* TODO: add error checking. */
-		else if (!strcasecmp("acs.flags", name))
+			break;
+		case ATOM_ACS_FLAGS:
 			parse_uint(name, value, &u->acs.flags);
-		else
+			break;
+		default:
 			parse_attr(name, value, &u->extra_values);
+		}
 	}
 
 	if (!fdb_read_end(h)) {
@@ -293,7 +301,7 @@ static int
 user_write(const struct user *u)
 {
 	struct fdb_write_handle *h;
-	struct attr_entry *curr;
+	unsigned i;
 
 	assert(u != NULL);
 	assert(u->username != NULL);
@@ -312,8 +320,10 @@ user_write(const struct user *u)
 	fdb_write_format(h, "acs.level", "%u", u->acs.level);
 	fdb_write_format(h, "acs.flags", "0x%08x", u->acs.flags);
 
-	for (curr = LIST_TOP(u->extra_values); curr; curr = LIST_NEXT(curr, list)) {
-		fdb_write_pair(h, curr->name, curr->value);
+	for (i = 0; i < u->extra_values.nr; i++) {
+		const struct attr_entry *curr = &u->extra_values.ent[i];
+
+		fdb_write_pair(h, atom_name(curr->atom), curr->value);
 	}
 
 	if (!fdb_write_end(h)) {
@@ -411,13 +421,15 @@ user_lookup(const char *username)
 	return NULL; /* user not found. */
 }
 
-/** create a user and initialize the password. */
+/**
+ * create a user and initialize the password.
+ * @param password_crypt an already hashed password, see pwhash_make().
+ */
 struct user *
-user_create(const char *username, const char *password, const char *email)
+user_create(const char *username, const char *password_crypt, const char *email)
 {
 	struct user *u;
 	long id;
-	char password_crypt[SHA1PASSWD_MAX];
 
 	if (!username || !*username) {
 		LOG_ERROR("Username was NULL or empty");
@@ -434,9 +446,8 @@ user_create(const char *username, const char *password, const char *email)
 		return NULL; /* failure */
 	}
 
-	/* encrypt password */
-	if (!sha1crypt_makepass(password_crypt, sizeof password_crypt, password)) {
-		LOG_ERROR("Could not hash password");
+	if (!password_crypt || !*password_crypt) {
+		LOG_ERROR("Password hash was NULL or empty");
 		return NULL; /* failure */
 	}
 
@@ -486,19 +497,61 @@ int
 user_password_check(struct user *u, const char *cleartext)
 {
 	// LOG_DEBUG("cleartext=\"%s\"", cleartext);
-	if (u && cleartext && sha1crypt_checkpass(u->password_crypt, cleartext)) {
+	if (u && cleartext && pwhash_checkpass(u->password_crypt, cleartext)) {
 		return 1; /* success */
 	}
 
 	return 0; /* failure */
 }
 
+/** the stored password hash. */
+const char *
+user_password_crypt(struct user *u)
+{
+	return u ? u->password_crypt : NULL;
+}
+
+/** replace the password hash and save the account. */
+int
+user_password_set(struct user *u, const char *password_crypt)
+{
+	char *old;
+
+	if (!u || !password_crypt || !*password_crypt)
+		return 0; /* failure */
+
+	old = u->password_crypt;
+	u->password_crypt = strdup(password_crypt);
+	if (!u->password_crypt) {
+		u->password_crypt = old;
+		return 0; /* failure */
+	}
+
+	if (!user_write(u)) {
+		LOG_ERROR("Could not save account username(%s)", u->username);
+		free(u->password_crypt);
+		u->password_crypt = old;
+		return 0; /* failure */
+	}
+
+	free(old);
+
+	return 1; /* success */
+}
+
 const char *
 user_username(struct user *u)
 {
 	return u ? u->username : NULL;
 }
 
+/** access level of a user, 0 for NULL. */
+unsigned
+user_level(struct user *u)
+{
+	return u ? u->acs.level : 0;
+}
+
 /** initialize the user system. */
 int
 user_init(void)
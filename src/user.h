@@ -5,9 +5,12 @@ struct user;
 int user_illegal(const char *username);
 int user_exists(const char *username);
 struct user *user_lookup(const char *username);
-struct user *user_create(const char *username, const char *password, const char *email);
+struct user *user_create(const char *username, const char *password_crypt, const char *email);
 int user_password_check(struct user *u, const char *cleartext);
+const char *user_password_crypt(struct user *u);
+int user_password_set(struct user *u, const char *password_crypt);
 const char *user_username(struct user *u);
+unsigned user_level(struct user *u);
 int user_init(void);
 void user_shutdown(void);
 void user_put(struct user **user);
@@ -0,0 +1,10 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+#include <stddef.h>
+#include <stdint.h>
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32c_portable(uint32_t crc, const void *buf, size_t len);
+#ifndef NTEST
+void crc32c_test(void);
+#endif
+#endif
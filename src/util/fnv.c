@@ -0,0 +1,103 @@
+/**
+ * @file fnv.c
+ *
+ * 32-bit FNV-1a, the hash used for the in-memory hash tables.
+ *
+ * Fast on short keys and good enough to spread them over buckets. Not for
+ * checksums, use crc32c() for those.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "fnv.h"
+#include <ctype.h>
+#ifndef NTEST
+#include <stdlib.h>
+#define LOG_SUBSYSTEM "fnv"
+#include <log.h>
+#endif
+
+#define FNV1A_PRIME 16777619u
+
+/**
+ * hash len bytes of buf, continuing from h. start with FNV1A_INIT.
+ */
+uint32_t
+fnv1a(uint32_t h, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len--) {
+		h ^= *p++;
+		h *= FNV1A_PRIME;
+	}
+
+	return h;
+}
+
+/**
+ * hash a string.
+ */
+uint32_t
+fnv1a_str(const char *s)
+{
+	uint32_t h = FNV1A_INIT;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= FNV1A_PRIME;
+	}
+
+	return h;
+}
+
+/**
+ * hash the lower case spelling of a string, for case-insensitive keys.
+ */
+uint32_t
+fnv1a_strcase(const char *s)
+{
+	uint32_t h = FNV1A_INIT;
+
+	for (; *s; s++) {
+		h ^= (unsigned char)tolower((unsigned char)*s);
+		h *= FNV1A_PRIME;
+	}
+
+	return h;
+}
+
+#ifndef NTEST
+void
+fnv1a_test(void)
+{
+	if (fnv1a_str("") != 0x811c9dc5 || fnv1a_str("a") != 0xe40c292c
+		|| fnv1a_str("foobar") != 0xbf9cf968) {
+		LOG_ERROR("fnv1a check value test failed");
+		exit(1);
+	}
+
+	if (fnv1a(fnv1a(FNV1A_INIT, "foo", 3), "bar", 3) != fnv1a_str("foobar")
+		|| fnv1a_strcase("FooBar") != fnv1a_str("foobar")) {
+		LOG_ERROR("fnv1a continuation test failed");
+		exit(1);
+	}
+
+	LOG_DEBUG("fnv1a test PASSED");
+}
+#endif
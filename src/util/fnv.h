@@ -0,0 +1,12 @@
+#ifndef FNV_H_
+#define FNV_H_
+#include <stddef.h>
+#include <stdint.h>
+#define FNV1A_INIT 2166136261u
+uint32_t fnv1a(uint32_t h, const void *buf, size_t len);
+uint32_t fnv1a_str(const char *s);
+uint32_t fnv1a_strcase(const char *s);
+#ifndef NTEST
+void fnv1a_test(void);
+#endif
+#endif
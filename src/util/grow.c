@@ -74,7 +74,7 @@ grow(void **ptr, unsigned *max, unsigned min, size_t elem)
 	memset(p + oldsize, 0, newsize - oldsize);
 
 	/* copy paramters back out */
-	assert(ptr != NULL && *(void**)ptr != NULL);
+	assert(ptr != NULL && p != NULL);
 	*(void**)ptr = p;
 	*max = newsize / elem;
 
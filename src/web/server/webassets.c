@@ -0,0 +1,450 @@
+/**
+ * @file webassets.c
+ *
+ * Static files of the web client, served from memory.
+ *
+ * Every file under the web root is read at startup with its ETag and, when
+ * it helps, a gzip copy. A timer compares the sizes and times of the files
+ * and loads the tree again if anything changed. Only the webserver thread
+ * touches the table.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "webassets.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <crc32c.h>
+#include <fnv.h>
+#define LOG_SUBSYSTEM "webserver"
+#include <log.h>
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+#define WEBASSETS_BUCKETS 256
+#define WEBASSETS_CHECK_MS 2000 /**< how often the web root is checked for changes. */
+#define WEBASSETS_MAX_SIZE (16 << 20) /**< larger files are left to mg_http_serve_dir(). */
+
+struct webasset {
+	struct webasset *next;
+	char *uri; /**< "/" followed by the path under the web root. */
+	const char *mime;
+	char etag[24];
+	int immutable_fl; /**< name carries a content hash, cache it for good. */
+	char *data;
+	size_t len;
+	char *gz; /**< gzip copy, NULL if it would not be smaller. */
+	size_t gz_len;
+};
+
+struct webassets_table {
+	struct webasset *bucket[WEBASSETS_BUCKETS];
+	unsigned count;
+	uint32_t signature; /**< of the names, sizes and times it was loaded from. */
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static struct webassets_table *webassets;
+static char *webassets_root;
+static struct mg_timer *webassets_timer;
+
+static const struct {
+	const char *ext, *mime;
+	int compress_fl;
+} webassets_types[] = {
+	{ "html", "text/html; charset=utf-8", 1 },
+	{ "htm", "text/html; charset=utf-8", 1 },
+	{ "css", "text/css; charset=utf-8", 1 },
+	{ "js", "text/javascript; charset=utf-8", 1 },
+	{ "json", "application/json", 1 },
+	{ "svg", "image/svg+xml", 1 },
+	{ "txt", "text/plain; charset=utf-8", 1 },
+	{ "ttf", "font/ttf", 1 },
+	{ "ico", "image/x-icon", 1 },
+	{ "woff", "font/woff", 0 },
+	{ "woff2", "font/woff2", 0 },
+	{ "png", "image/png", 0 },
+	{ "jpg", "image/jpeg", 0 },
+	{ "gif", "image/gif", 0 },
+};
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+static unsigned
+webassets_hash(const char *s, size_t len)
+{
+	return fnv1a(FNV1A_INIT, s, len) % WEBASSETS_BUCKETS;
+}
+
+static int
+webassets_type(const char *name, const char **mime)
+{
+	const char *ext = strrchr(name, '.');
+	unsigned i;
+
+	*mime = "application/octet-stream";
+
+	if (!ext)
+		return 0;
+
+	for (i = 0; i < sizeof(webassets_types) / sizeof(*webassets_types); i++) {
+		if (!strcasecmp(ext + 1, webassets_types[i].ext)) {
+			*mime = webassets_types[i].mime;
+			return webassets_types[i].compress_fl;
+		}
+	}
+
+	return 0;
+}
+
+/** names like "app.3f9a2c1d.js" carry a hash of their content. */
+static int
+webassets_ishashed(const char *name)
+{
+	const char *p = strchr(name, '.'), *end;
+
+	while (p) {
+		end = strchr(p + 1, '.');
+		if (!end)
+			break;
+		if (end - (p + 1) >= 8) {
+			const char *q;
+
+			for (q = p + 1; q < end && isxdigit((unsigned char)*q); q++)
+				;
+			if (q == end)
+				return 1;
+		}
+		p = end;
+	}
+
+	return 0;
+}
+
+static char *
+webassets_gzip(const char *data, size_t len, size_t *len_out)
+{
+	z_stream z;
+	char *out;
+	size_t max;
+
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	max = deflateBound(&z, len);
+	out = malloc(max);
+	if (!out) {
+		deflateEnd(&z);
+		return NULL;
+	}
+
+	z.next_in = (unsigned char *)data;
+	z.avail_in = len;
+	z.next_out = (unsigned char *)out;
+	z.avail_out = max;
+
+	if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&z);
+		free(out);
+		return NULL;
+	}
+
+	*len_out = max - z.avail_out;
+	deflateEnd(&z);
+
+	return out;
+}
+
+static void
+webassets_free(struct webassets_table *t)
+{
+	unsigned i;
+
+	if (!t)
+		return;
+
+	for (i = 0; i < WEBASSETS_BUCKETS; i++) {
+		struct webasset *cur;
+
+		while ((cur = t->bucket[i])) {
+			t->bucket[i] = cur->next;
+			free(cur->uri);
+			free(cur->data);
+			free(cur->gz);
+			free(cur);
+		}
+	}
+
+	free(t);
+}
+
+static struct webasset *
+webassets_load_file(const char *path, const char *uri, size_t size)
+{
+	struct webasset *a;
+	FILE *f;
+
+	a = calloc(1, sizeof(*a));
+	if (!a || !(a->uri = strdup(uri)) || !(a->data = malloc(size ? size : 1))) {
+		LOG_PERROR("malloc()");
+		goto failure;
+	}
+
+	f = fopen(path, "rb");
+	if (!f) {
+		LOG_PERROR(path);
+		goto failure;
+	}
+	a->len = fread(a->data, 1, size, f);
+	fclose(f);
+
+	snprintf(a->etag, sizeof(a->etag), "\"%08x-%zx\"", (unsigned)crc32c(0, a->data, a->len), a->len);
+	a->immutable_fl = webassets_ishashed(strrchr(uri, '/') + 1);
+
+	if (webassets_type(uri, &a->mime) && a->len > 256) {
+		a->gz = webassets_gzip(a->data, a->len, &a->gz_len);
+		if (a->gz && a->gz_len >= a->len - a->len / 8) {
+			free(a->gz); /* not worth the decompression */
+			a->gz = NULL;
+		}
+	}
+
+	return a;
+failure:
+	if (a) {
+		free(a->uri);
+		free(a->data);
+		free(a);
+	}
+	return NULL;
+}
+
+/**
+ * walk the web root. fills in t if given, otherwise only the signature.
+ */
+static int
+webassets_scan(const char *dir, const char *uri, struct webassets_table *t, uint32_t *signature)
+{
+	struct dirent *d;
+	DIR *dh;
+	int ret = 1;
+
+	dh = opendir(dir);
+	if (!dh)
+		return 0; /* failure */
+
+	while (ret && (d = readdir(dh))) {
+		char path[1024], sub[1024];
+		struct stat st;
+
+		if (d->d_name[0] == '.')
+			continue; /* hidden files, and . and .. */
+
+		snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+		snprintf(sub, sizeof(sub), "%s/%s", uri, d->d_name);
+
+		if (stat(path, &st))
+			continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			ret = webassets_scan(path, sub, t, signature);
+			continue;
+		}
+
+		if (!S_ISREG(st.st_mode) || st.st_size > WEBASSETS_MAX_SIZE)
+			continue;
+
+		/* order of readdir() is stable while nothing changes. */
+		*signature = crc32c(*signature, sub, strlen(sub));
+		*signature = crc32c(*signature, &st.st_size, sizeof(st.st_size));
+		*signature = crc32c(*signature, &st.st_mtim, sizeof(st.st_mtim));
+
+		if (t) {
+			struct webasset *a = webassets_load_file(path, sub, st.st_size);
+			unsigned h;
+
+			if (!a) {
+				ret = 0;
+				break;
+			}
+
+			h = webassets_hash(a->uri, strlen(a->uri));
+			a->next = t->bucket[h];
+			t->bucket[h] = a;
+			t->count++;
+		}
+	}
+
+	closedir(dh);
+
+	return ret;
+}
+
+/** load the web root into a new table, keeping the old one on failure. */
+static int
+webassets_reload(void)
+{
+	struct webassets_table *t = calloc(1, sizeof(*t));
+
+	if (!t) {
+		LOG_PERROR("calloc()");
+		return 0; /* failure */
+	}
+
+	if (!webassets_scan(webassets_root, "", t, &t->signature)) {
+		LOG_ERROR("%s:could not load web client files", webassets_root);
+		webassets_free(t);
+		return 0; /* failure */
+	}
+
+	webassets_free(webassets);
+	webassets = t;
+
+	LOG_INFO("loaded %u web client files from %s", t->count, webassets_root);
+
+	return 1; /* success */
+}
+
+static void
+webassets_check(void *arg)
+{
+	uint32_t signature = 0;
+
+	(void)arg;
+
+	if (!webassets_scan(webassets_root, "", NULL, &signature))
+		return;
+
+	if (!webassets || signature != webassets->signature)
+		webassets_reload();
+}
+
+static struct webasset *
+webassets_find(struct mg_str uri)
+{
+	struct webasset *a;
+	char path[1024];
+	int len;
+
+	len = mg_url_decode(uri.ptr, uri.len, path, sizeof(path), 0);
+	if (len <= 0)
+		return NULL;
+
+	if (path[len - 1] == '/')
+		len += snprintf(path + len, sizeof(path) - len, "index.html");
+
+	for (a = webassets->bucket[webassets_hash(path, len)]; a; a = a->next) {
+		if (!strcmp(a->uri, path))
+			return a;
+	}
+
+	return NULL;
+}
+
+/** @return 1 if the header lists the token. */
+static int
+webassets_header_has(struct mg_http_message *hm, const char *name, const char *token)
+{
+	struct mg_str *v = mg_http_get_header(hm, name);
+
+	return v && mg_strstr(*v, mg_str(token)) != NULL;
+}
+
+/**
+ * answer a GET or HEAD from memory.
+ * @return 1 if the request was answered, 0 if the file is not loaded.
+ */
+int
+webassets_serve(struct mg_connection *c, struct mg_http_message *hm)
+{
+	const char *cache;
+	struct webasset *a;
+	int head_fl, gz_fl;
+
+	if (!webassets || !(a = webassets_find(hm->uri)))
+		return 0;
+
+	head_fl = !mg_vcmp(&hm->method, "HEAD");
+	if (!head_fl && mg_vcmp(&hm->method, "GET")) {
+		mg_http_reply(c, 405, "Allow: GET, HEAD\r\n", "");
+		return 1;
+	}
+
+	cache = a->immutable_fl ? "public, max-age=31536000, immutable" : "no-cache";
+
+	if (webassets_header_has(hm, "If-None-Match", a->etag)) {
+		mg_printf(c, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nCache-Control: %s\r\n"
+			"Content-Length: 0\r\n\r\n", a->etag, cache);
+		return 1;
+	}
+
+	gz_fl = a->gz && webassets_header_has(hm, "Accept-Encoding", "gzip");
+
+	mg_printf(c, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nETag: %s\r\nCache-Control: %s\r\n"
+		"%s%sContent-Length: %lu\r\n\r\n",
+		a->mime, a->etag, cache,
+		a->gz ? "Vary: Accept-Encoding\r\n" : "",
+		gz_fl ? "Content-Encoding: gzip\r\n" : "",
+		(unsigned long)(gz_fl ? a->gz_len : a->len));
+
+	if (!head_fl)
+		mg_send(c, gz_fl ? a->gz : a->data, gz_fl ? a->gz_len : a->len);
+
+	return 1;
+}
+
+/** load the web root and watch it for changes. */
+int
+webassets_init(struct mg_mgr *mgr, const char *root)
+{
+	webassets_root = strdup(root);
+	if (!webassets_root) {
+		LOG_PERROR("strdup()");
+		return 0; /* failure */
+	}
+
+	/* a missing root is not fatal, the files may be installed later. */
+	webassets_reload();
+
+	webassets_timer = mg_timer_add(mgr, WEBASSETS_CHECK_MS, MG_TIMER_REPEAT, webassets_check, NULL);
+
+	return 1; /* success */
+}
+
+void
+webassets_shutdown(void)
+{
+	webassets_free(webassets);
+	webassets = NULL;
+	free(webassets_root);
+	webassets_root = NULL;
+	webassets_timer = NULL; /* freed with the mg_mgr */
+}
@@ -0,0 +1,8 @@
+#ifndef WEBASSETS_H_
+#define WEBASSETS_H_
+#include <mongoose.h>
+
+int webassets_init(struct mg_mgr *mgr, const char *root);
+void webassets_shutdown(void);
+int webassets_serve(struct mg_connection *c, struct mg_http_message *hm);
+#endif
@@ -0,0 +1,270 @@
+/**
+ * @file webqueue.c
+ *
+ * Message rings between the webserver thread and the game loop.
+ *
+ * Each direction is a bounded single-producer single-consumer ring, so
+ * neither side takes a lock. The producer only writes tail and the
+ * consumer only writes head. When the ring is full the producer keeps
+ * messages in a private overflow list and moves them over in order on
+ * its next push or flush, so nothing is reordered.
+ *
+ * The overflow list holds at most overflow_max bytes of lines and output,
+ * past that a push is refused and the caller drops the connection. Connects
+ * and closes are always queued, so both sides agree on who is connected.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "webqueue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define LOG_SUBSYSTEM "webserver"
+#include <log.h>
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+/**
+ * initialize a queue that holds size messages, rounded up to a power of 2,
+ * and up to overflow_max bytes waiting behind them.
+ */
+int
+webqueue_init(struct webqueue *q, size_t size, size_t overflow_max)
+{
+	size_t n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	q->slot = calloc(n, sizeof(*q->slot));
+	if (!q->slot) {
+		LOG_PERROR("calloc()");
+		return 0; /* failure */
+	}
+
+	q->mask = n - 1;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	q->overflow_head = NULL;
+	q->overflow_tail = &q->overflow_head;
+	q->overflow_len = 0;
+	q->overflow_max = overflow_max;
+
+	return 1; /* success */
+}
+
+/** free the queue and any messages left in it. */
+void
+webqueue_free(struct webqueue *q)
+{
+	struct webqueue_msg msg, *cur;
+
+	while (webqueue_pop(q, &msg))
+		free(msg.data);
+
+	while ((cur = q->overflow_head)) {
+		q->overflow_head = cur->next;
+		free(cur->data);
+		free(cur);
+	}
+
+	q->overflow_tail = &q->overflow_head;
+	q->overflow_len = 0;
+	free(q->slot);
+	q->slot = NULL;
+}
+
+/**
+ * move waiting messages from the overflow list into the ring.
+ * producer only.
+ * @return 1 if the overflow list is empty.
+ */
+int
+webqueue_flush(struct webqueue *q)
+{
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+	struct webqueue_msg *cur;
+
+	while ((cur = q->overflow_head) && tail - head <= q->mask) {
+		q->overflow_head = cur->next;
+		q->overflow_len -= cur->len;
+		q->slot[tail & q->mask] = *cur;
+		free(cur);
+		tail++;
+	}
+
+	if (!q->overflow_head)
+		q->overflow_tail = &q->overflow_head;
+
+	atomic_store_explicit(&q->tail, tail, memory_order_release);
+
+	return !q->overflow_head;
+}
+
+/**
+ * queue a copy of data. producer only.
+ * @return 1 on success, 0 if out of memory or the overflow list is full.
+ */
+int
+webqueue_push(struct webqueue *q, enum webqueue_type type, unsigned long conn, const void *data, size_t len)
+{
+	struct webqueue_msg msg = { .type = type, .conn = conn, .len = len };
+	int limited = type == WEBQUEUE_LINE || type == WEBQUEUE_OUTPUT;
+	size_t tail, head;
+
+	if (limited && q->overflow_max && !webqueue_flush(q)
+		&& q->overflow_len + len > q->overflow_max)
+		return 0; /* full */
+
+	if (len) {
+		msg.data = malloc(len + 1);
+		if (!msg.data) {
+			LOG_PERROR("malloc()");
+			return 0; /* failure */
+		}
+		memcpy(msg.data, data, len);
+		msg.data[len] = 0;
+	}
+
+	if (webqueue_flush(q)) {
+		tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		head = atomic_load_explicit(&q->head, memory_order_acquire);
+		if (tail - head <= q->mask) {
+			q->slot[tail & q->mask] = msg;
+			atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+			return 1; /* success */
+		}
+	}
+
+	/* ring is full, wait for the consumer to catch up. */
+	struct webqueue_msg *cur = malloc(sizeof(*cur));
+
+	if (!cur) {
+		LOG_PERROR("malloc()");
+		free(msg.data);
+		return 0; /* failure */
+	}
+
+	*cur = msg;
+	cur->next = NULL;
+	*q->overflow_tail = cur;
+	q->overflow_tail = &cur->next;
+	q->overflow_len += len;
+
+	return 1; /* success */
+}
+
+/**
+ * take the oldest message. consumer only.
+ * @return 1 if msg was filled in, 0 if the ring is empty.
+ */
+int
+webqueue_pop(struct webqueue *q, struct webqueue_msg *msg)
+{
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	if (head == tail)
+		return 0; /* empty */
+
+	*msg = q->slot[head & q->mask];
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+	return 1; /* success */
+}
+
+#ifndef NTEST
+/** test ordering across the overflow list. */
+void
+webqueue_test(void)
+{
+	struct webqueue q;
+	struct webqueue_msg msg;
+	unsigned i, n = 0;
+	char s[16];
+
+	if (!webqueue_init(&q, 3, 0)) {
+		LOG_ERROR("webqueue_init() failed");
+		exit(1);
+	}
+
+	for (i = 0; i < 10; i++) {
+		snprintf(s, sizeof(s), "%u", i);
+		webqueue_push(&q, WEBQUEUE_LINE, i, s, strlen(s));
+	}
+
+	while (n < 10) {
+		if (!webqueue_pop(&q, &msg)) {
+			webqueue_flush(&q);
+			continue;
+		}
+		snprintf(s, sizeof(s), "%u", n);
+		if (msg.conn != n || strcmp(msg.data, s)) {
+			LOG_ERROR("webqueue order test failed at %u", n);
+			exit(1);
+		}
+		free(msg.data);
+		n++;
+	}
+
+	if (webqueue_pop(&q, &msg) || !webqueue_flush(&q)) {
+		LOG_ERROR("webqueue not empty");
+		exit(1);
+	}
+
+	webqueue_free(&q);
+
+	/* a full overflow list refuses lines, but not closes. */
+	if (!webqueue_init(&q, 1, 4)
+		|| !webqueue_push(&q, WEBQUEUE_LINE, 1, "ab", 2)
+		|| !webqueue_push(&q, WEBQUEUE_LINE, 1, "cd", 2)
+		|| !webqueue_push(&q, WEBQUEUE_LINE, 1, "ef", 2)
+		|| webqueue_push(&q, WEBQUEUE_LINE, 1, "gh", 2)
+		|| !webqueue_push(&q, WEBQUEUE_CLOSE, 1, NULL, 0)
+		|| q.overflow_len != 4) {
+		LOG_ERROR("webqueue limit test failed");
+		exit(1);
+	}
+
+	for (n = 0; n < 4; ) {
+		static const char *const expect[] = { "ab", "cd", "ef", NULL };
+
+		if (!webqueue_pop(&q, &msg)) {
+			webqueue_flush(&q);
+			continue;
+		}
+		if (expect[n] ? !msg.data || strcmp(msg.data, expect[n]) : msg.type != WEBQUEUE_CLOSE) {
+			LOG_ERROR("webqueue limit order test failed at %u", n);
+			exit(1);
+		}
+		free(msg.data);
+		n++;
+	}
+
+	if (q.overflow_len) {
+		LOG_ERROR("webqueue overflow count test failed");
+		exit(1);
+	}
+
+	webqueue_free(&q);
+	LOG_DEBUG("webqueue test PASSED");
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef WEBQUEUE_H_
+#define WEBQUEUE_H_
+#include <stdatomic.h>
+#include <stddef.h>
+
+enum webqueue_type {
+	WEBQUEUE_CONNECT, /**< a websocket client arrived. */
+	WEBQUEUE_LINE, /**< a line of input from a client. */
+	WEBQUEUE_OUTPUT, /**< text to send to a client. */
+	WEBQUEUE_CLOSE, /**< client went away, or should be disconnected. */
+};
+
+struct webqueue_msg {
+	enum webqueue_type type;
+	unsigned long conn; /**< connection id. */
+	size_t len;
+	char *data; /**< malloc'd, owned by whoever holds the message. */
+	struct webqueue_msg *next; /**< for the overflow list only. */
+};
+
+/**
+ * bounded single-producer single-consumer ring.
+ * messages that do not fit wait in an overflow list owned by the producer,
+ * up to overflow_max bytes of lines and output.
+ */
+struct webqueue {
+	atomic_size_t head __attribute__ ((aligned (64))); /**< next to pop, written by the consumer. */
+	atomic_size_t tail __attribute__ ((aligned (64))); /**< next to push, written by the producer. */
+	size_t mask;
+	struct webqueue_msg *slot;
+	struct webqueue_msg *overflow_head, **overflow_tail;
+	size_t overflow_len; /**< bytes of data in the overflow list. */
+	size_t overflow_max; /**< limit on overflow_len, 0 for none. */
+};
+
+int webqueue_init(struct webqueue *q, size_t size, size_t overflow_max);
+void webqueue_free(struct webqueue *q);
+int webqueue_push(struct webqueue *q, enum webqueue_type type, unsigned long conn, const void *data, size_t len);
+int webqueue_flush(struct webqueue *q);
+int webqueue_pop(struct webqueue *q, struct webqueue_msg *msg);
+#ifndef NTEST
+void webqueue_test(void);
+#endif
+#endif
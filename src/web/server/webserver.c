@@ -6,33 +6,253 @@
 #include <mongoose.h>
 #include <dyad.h>
 #include <webserver.h>
+#include <webqueue.h>
+#include <webassets.h>
+#include <metrics.h>
+#include <errno.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #define OK  (0)
 #define ERR (-1)
 
-static struct webserver_context web_context;
-static struct mg_connection *upstream;
+/** messages per direction before the producer has to hold them back. */
+#define WEBSERVER_QUEUE_SIZE 4096
+/** bytes per direction held back before connections are dropped. */
+#define WEBSERVER_OVERFLOW_MAX (4 * 1048576)
+
+/* permessage-deflate (RFC 7692). */
+#define WEBSERVER_WS_RSV1 0x40 /**< frame is compressed. */
+#define WEBSERVER_DEFLATE_BITS 12 /**< our window, 4K instead of 32K per client. */
+#define WEBSERVER_DEFLATE_MIN 64 /**< smaller frames are sent as they are. */
+#define WEBSERVER_INFLATE_MAX 65536 /**< largest message we inflate from a client. */
+
+struct webserver_deflate {
+	z_stream tx; /**< keeps its context between frames. */
+	z_stream rx; /**< reset for every message, clients do not keep context. */
+};
+
 static sig_atomic_t interrupted = 0;
 static pthread_t webserver_thread;
 
 static const char *web_root = "./bin/www";
 static struct mg_mgr webserver_mgr;
 
-void
-webserver_test_callback(dyad_Event *ev)
+/* the webserver thread produces to_game, the game loop produces to_web. */
+static struct webqueue to_game, to_web;
+static webserver_fn game_handler;
+static int game_wakefd = -1; /**< eventfd watched by the game loop. */
+static int web_wakefd = -1; /**< our end of the pipe that wakes mg_mgr_poll(). */
+static atomic_int game_wake_pending, web_wake_pending;
+
+/* set by the webserver thread when it queued something for the game. */
+static int to_game_dirty;
+/* set when a connection was told to close, mongoose only closes it on a poll. */
+static int web_closing;
+
+/******************************************************************************
+ * Webserver thread
+ ******************************************************************************/
+
+static int
+webserver_to_game(enum webqueue_type type, unsigned long conn, const void *data, size_t len)
+{
+	to_game_dirty = 1;
+	return webqueue_push(&to_game, type, conn, data, len);
+}
+
+/** send a line to the game, or drop the client if the game is behind. */
+static void
+webserver_line_to_game(struct mg_connection *c, const void *data, size_t len)
 {
-	char buf[48] = { 0 };
+	if (!webserver_to_game(WEBQUEUE_LINE, c->id, data, len)) {
+		LOG_WARNING("game is not keeping up, disconnecting websocket client %lu", c->id);
+		c->is_draining = 1;
+	}
+}
 
-	snprintf(buf, 47, "Webserver Event: %s", ev->data);
-	log_logf(LOG_LEVEL_INFO, "server", "%s", buf);
+/** wake the game loop unless it was already told to look. */
+static void
+webserver_wake_game(void)
+{
+	uint64_t one = 1;
+
+	if (!atomic_exchange(&game_wake_pending, 1)) {
+		if (write(game_wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			LOG_PERROR("eventfd");
+	}
 }
 
-void
-webserver_accept_callback(dyad_Event *ev)
+static struct webserver_deflate *
+webserver_deflate_get(struct mg_connection *c)
+{
+	struct webserver_deflate *z;
+
+	memcpy(&z, c->data, sizeof(z));
+
+	return z;
+}
+
+static void
+webserver_deflate_set(struct mg_connection *c, struct webserver_deflate *z)
+{
+	memcpy(c->data, &z, sizeof(z));
+}
+
+static struct webserver_deflate *
+webserver_deflate_new(void)
+{
+	struct webserver_deflate *z = calloc(1, sizeof(*z));
+
+	if (!z) {
+		LOG_PERROR("calloc()");
+		return NULL;
+	}
+
+	if (deflateInit2(&z->tx, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -WEBSERVER_DEFLATE_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(z);
+		return NULL;
+	}
+
+	if (inflateInit2(&z->rx, -15) != Z_OK) {
+		deflateEnd(&z->tx);
+		free(z);
+		return NULL;
+	}
+
+	return z;
+}
+
+static void
+webserver_deflate_free(struct webserver_deflate *z)
+{
+	if (!z)
+		return;
+
+	deflateEnd(&z->tx);
+	inflateEnd(&z->rx);
+	free(z);
+}
+
+/** send a text frame, compressed if the client agreed to it. */
+static void
+webserver_ws_send(struct mg_connection *c, const char *data, size_t len)
+{
+	struct webserver_deflate *z = webserver_deflate_get(c);
+	unsigned char *out;
+	size_t max;
+
+	if (!z || len < WEBSERVER_DEFLATE_MIN) {
+		mg_ws_send(c, data, len, WEBSOCKET_OP_TEXT);
+		return;
+	}
+
+	max = deflateBound(&z->tx, len) + 16;
+	out = malloc(max);
+	if (!out) {
+		LOG_PERROR("malloc()");
+		mg_ws_send(c, data, len, WEBSOCKET_OP_TEXT);
+		return;
+	}
+
+	z->tx.next_in = (unsigned char *)data;
+	z->tx.avail_in = len;
+	z->tx.next_out = out;
+	z->tx.avail_out = max;
+
+	if (deflate(&z->tx, Z_SYNC_FLUSH) != Z_OK || z->tx.avail_in || z->tx.avail_out < 4) {
+		/* the context no longer matches the client's, stop compressing. */
+		LOG_ERROR("deflate failed, closing websocket client %lu", c->id);
+		c->is_draining = 1;
+		free(out);
+		return;
+	}
+
+	/* the message leaves off the 00 00 ff ff that ends a sync flush. */
+	mg_ws_send(c, out, max - z->tx.avail_out - 4, WEBSOCKET_OP_TEXT | WEBSERVER_WS_RSV1);
+	free(out);
+}
+
+/**
+ * inflate a compressed message from a client.
+ * @return a malloc'd buffer, or NULL if it is damaged or too large.
+ */
+static char *
+webserver_inflate(struct webserver_deflate *z, const char *data, size_t len, size_t *len_out)
+{
+	static const unsigned char tail[4] = { 0x00, 0x00, 0xff, 0xff };
+	unsigned char *out = malloc(WEBSERVER_INFLATE_MAX);
+	int e;
+
+	if (!out) {
+		LOG_PERROR("malloc()");
+		return NULL;
+	}
+
+	inflateReset(&z->rx);
+	z->rx.next_out = out;
+	z->rx.avail_out = WEBSERVER_INFLATE_MAX;
+	z->rx.next_in = (unsigned char *)data;
+	z->rx.avail_in = len;
+	e = inflate(&z->rx, Z_SYNC_FLUSH);
+	if (e == Z_OK && !z->rx.avail_in) {
+		z->rx.next_in = (unsigned char *)tail;
+		z->rx.avail_in = sizeof(tail);
+		e = inflate(&z->rx, Z_SYNC_FLUSH);
+	}
+
+	if ((e != Z_OK && e != Z_STREAM_END && e != Z_BUF_ERROR) || z->rx.avail_in || !z->rx.avail_out) {
+		free(out);
+		return NULL;
+	}
+
+	*len_out = WEBSERVER_INFLATE_MAX - z->rx.avail_out;
+
+	return (char *)out;
+}
+
+static struct mg_connection *
+webserver_find(unsigned long conn)
+{
+	struct mg_connection *c;
+
+	for (c = webserver_mgr.conns; c; c = c->next) {
+		if (c->id == conn)
+			return c;
+	}
+
+	return NULL;
+}
+
+/** send everything the game queued for websocket clients. */
+static void
+webserver_drain(void)
 {
-	dyad_addListener(ev->remote, DYAD_EVENT_DATA, webserver_test_callback, NULL);
+	struct webqueue_msg msg;
+
+	atomic_store(&web_wake_pending, 0);
+
+	while (webqueue_pop(&to_web, &msg)) {
+		struct mg_connection *c = webserver_find(msg.conn);
+
+		if (c && c->is_websocket && !c->is_closing) {
+			/* a browser that stopped reading is cut off like a telnet client. */
+			if (msg.type == WEBQUEUE_OUTPUT && mud_config.output_max && c->send.len > mud_config.output_max) {
+				LOG_WARNING("websocket client %lu has %lu bytes unsent, disconnecting",
+					c->id, (unsigned long)c->send.len);
+				c->is_closing = 1;
+			} else if (msg.type == WEBQUEUE_OUTPUT)
+				webserver_ws_send(c, msg.data, msg.len);
+			else if (msg.type == WEBQUEUE_CLOSE)
+				c->is_draining = web_closing = 1;
+		}
+
+		free(msg.data);
+	}
 }
 
 static void
@@ -40,75 +260,230 @@ webserver_handler(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
 {
 
 	if (ev == MG_EV_WS_OPEN) {
-		mg_send(upstream, "@NEWCLIENT@", 12);
+		char addr[64];
+
+		mg_snprintf(addr, sizeof(addr), "%I", c->rem.is_ip6 ? 16 : 4,
+			c->rem.is_ip6 ? (void *)c->rem.ip6 : (void *)&c->rem.ip);
 		LOG_INFO("websocket client connected");
-		mg_ws_send(c, mud_config.msgfile_welcome, strlen(mud_config.msgfile_welcome), WEBSOCKET_OP_TEXT);
-		char json_sample[] = "{\"data\": {\"motd\": \"Welcome to BorisMUD\"}}\n";
-		mg_ws_send(c, json_sample, strlen(json_sample), WEBSOCKET_OP_TEXT);
+		webserver_to_game(WEBQUEUE_CONNECT, c->id, addr, strlen(addr));
 	} else if (ev == MG_EV_HTTP_MSG) {
 		struct mg_http_message *hm = (struct mg_http_message *)ev_data;
 		if (mg_http_match_uri(hm, "/ws")) {
 			// Upgrade to websocket. From now on, a connection is a full-duplex
 			// Websocket connection, which will receive MG_EV_WS_MSG events.
-			mg_ws_upgrade(c, hm, NULL);
+			struct mg_str *ext = mg_http_get_header(hm, "Sec-WebSocket-Extensions");
+			struct webserver_deflate *z = NULL;
+
+			if (mud_config.webserver_deflate && ext && mg_strstr(*ext, mg_str("permessage-deflate")))
+				z = webserver_deflate_new();
+			webserver_deflate_set(c, z);
+			if (z)
+				mg_ws_upgrade(c, hm, "Sec-WebSocket-Extensions: permessage-deflate; "
+					"server_max_window_bits=%d; client_no_context_takeover\r\n",
+					WEBSERVER_DEFLATE_BITS);
+			else
+				mg_ws_upgrade(c, hm, NULL);
+		} else if (mg_http_match_uri(hm, "/api/metrics")) {
+			size_t len;
+			char *text = metrics_text(&len);
+
+			if (!text) {
+				mg_http_reply(c, 500, "", "out of memory\n");
+				return;
+			}
+			mg_printf(c, "HTTP/1.1 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Cache-Control: no-store\r\n"
+				"Content-Length: %lu\r\n\r\n", (unsigned long)len);
+			mg_send(c, text, len);
+			free(text);
 		} else if (mg_http_match_uri(hm, "/api")) {
 			// Serve REST response
 			mg_http_reply(c, 200, "", "{\"result\": \"%s\"}\n", "boris");
 		} else {
-			// Serve static files
-			struct mg_http_serve_opts opts = { .root_dir = web_root };
-			mg_http_serve_dir(c, ev_data, &opts);
+			// Serve static files, from memory unless added since the last check
+			if (!webassets_serve(c, hm)) {
+				struct mg_http_serve_opts opts = { .root_dir = web_root };
+				mg_http_serve_dir(c, ev_data, &opts);
+			}
 		}
 	} else if (ev == MG_EV_WS_MSG) {
-		// Got websocket frame. Received data is wm->data. Echo it back!
 		struct mg_ws_message *wm = (struct mg_ws_message *)ev_data;
-		mg_ws_send(c, wm->data.ptr, wm->data.len, WEBSOCKET_OP_TEXT);
-		mg_send(upstream, "@MESSAGE@", 10);
+		struct webserver_deflate *z = webserver_deflate_get(c);
+
+		if (z && (wm->flags & WEBSERVER_WS_RSV1)) {
+			size_t len;
+			char *line = webserver_inflate(z, wm->data.ptr, wm->data.len, &len);
+
+			if (!line) {
+				LOG_WARNING("damaged or oversized message from websocket client %lu", c->id);
+				c->is_draining = 1;
+				return;
+			}
+			webserver_line_to_game(c, line, len);
+			free(line);
+		} else {
+			webserver_line_to_game(c, wm->data.ptr, wm->data.len);
+		}
+	} else if (ev == MG_EV_CLOSE) {
+		if (c->is_websocket) {
+			webserver_to_game(WEBQUEUE_CLOSE, c->id, NULL, 0);
+			webserver_deflate_free(webserver_deflate_get(c));
+			webserver_deflate_set(c, NULL);
+		}
 	}
 	(void)fn_data;
 }
 
+/** the game loop sent a byte to say to_web has messages. */
 static void
-webserver_upstream_handler(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
+webserver_wake_handler(struct mg_connection *c, int ev, void *ev_data, void *fn_data)
 {
-	if (ev == MG_EV_CONNECT) {
-		LOG_INFO("Connected to main thread");
-	} else if (ev == MG_EV_CLOSE) {
-		LOG_INFO("Disconnected from main thread");
-	} else if (ev == MG_EV_POLL) {
-		// Nothing yet
+	if (ev == MG_EV_READ) {
+		c->recv.len = 0;
+		webserver_drain();
 	}
+	(void)ev_data;
 	(void)fn_data;
 }
 
-void *
+static void *
 webserver_service(void *arg)
 {
-	const struct webserver_context *options = (struct webserver_context *)arg;
-	char upstream_addr[32] = { 0 };
-	snprintf(upstream_addr, 31, "tcp://localhost:%d", options->upstream_port);
-
-	upstream = mg_connect(&webserver_mgr, upstream_addr,
-			      webserver_upstream_handler, NULL);
 	while (!interrupted) {
-		mg_mgr_poll(&webserver_mgr, 1000);
+		int timeout = 1000;
+
+		/* poll again soon if the game has not made room for everything. */
+		if (web_closing)
+			timeout = 0;
+		else if (to_game.overflow_head)
+			timeout = 10;
+		web_closing = 0;
+		mg_mgr_poll(&webserver_mgr, timeout);
+		webserver_drain();
+		if (to_game_dirty) {
+			to_game_dirty = !webqueue_flush(&to_game);
+			webserver_wake_game();
+		}
 	}
+	(void)arg;
 	return NULL;
 }
 
+/******************************************************************************
+ * Game loop
+ ******************************************************************************/
+
+/** wake the webserver thread unless it was already told to look. */
+static void
+webserver_wake_web(void)
+{
+	if (!atomic_exchange(&web_wake_pending, 1)) {
+		if (send(web_wakefd, "", 1, 0) < 0 && errno != EAGAIN)
+			LOG_PERROR("send()");
+	}
+}
+
+/** handle everything the webserver thread queued for the game. */
+void
+webserver_poll(void)
+{
+	struct webqueue_msg msg;
+
+	if (game_wakefd < 0)
+		return;
+
+	atomic_store(&game_wake_pending, 0);
+
+	while (webqueue_pop(&to_game, &msg)) {
+		game_handler(&msg);
+		free(msg.data);
+	}
+
+	if (to_web.overflow_head && webqueue_flush(&to_web))
+		webserver_wake_web();
+}
+
+/** @return non-zero if output is held back waiting for room in the queue. */
 int
-webserver_init(struct webserver_context ctx, unsigned port)
+webserver_pending(void)
+{
+	return to_web.overflow_head != NULL;
+}
+
+static void
+webserver_game_wakeup(dyad_Event *ev)
+{
+	uint64_t count;
+
+	if (read(game_wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		LOG_PERROR("eventfd");
+	webserver_poll();
+	(void)ev;
+}
+
+/**
+ * queue text for a websocket client.
+ * @return ERR if the webserver thread is too far behind, and the client
+ * should be dropped.
+ */
+int
+webserver_send(unsigned long conn, const void *data, size_t len)
+{
+	if (!webqueue_push(&to_web, WEBQUEUE_OUTPUT, conn, data, len)) {
+		LOG_WARNING("webserver is not keeping up, dropping output for websocket client %lu", conn);
+		return ERR;
+	}
+	webserver_wake_web();
+	return OK;
+}
+
+/** disconnect a websocket client after its output is sent. */
+int
+webserver_close(unsigned long conn)
+{
+	if (!webqueue_push(&to_web, WEBQUEUE_CLOSE, conn, NULL, 0))
+		return ERR;
+	webserver_wake_web();
+	return OK;
+}
+
+int
+webserver_init(unsigned port, webserver_fn fn)
 {
 	static char webserver_addr[32] = { 0 };
-	web_context = ctx;
+
+	game_handler = fn;
+
+	if (!webqueue_init(&to_game, WEBSERVER_QUEUE_SIZE, WEBSERVER_OVERFLOW_MAX)
+		|| !webqueue_init(&to_web, WEBSERVER_QUEUE_SIZE, WEBSERVER_OVERFLOW_MAX))
+		return ERR;
+
+	game_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (game_wakefd < 0) {
+		LOG_PERROR("eventfd()");
+		return ERR;
+	}
 
 	mg_mgr_init(&webserver_mgr);
+
+	web_wakefd = mg_mkpipe(&webserver_mgr, webserver_wake_handler, NULL, true);
+	if (web_wakefd < 0) {
+		LOG_ERROR("could not create webserver wakeup pipe");
+		return ERR;
+	}
+
+	if (!webassets_init(&webserver_mgr, web_root))
+		return ERR;
+
 	snprintf(webserver_addr, 31, "http://0.0.0.0:%d", port);
 	mg_http_listen(&webserver_mgr, webserver_addr, webserver_handler, NULL);
 
+	dyad_setWakeup(game_wakefd, webserver_game_wakeup, NULL);
+
 	LOG_INFO("Starting webserver..");
 
-	int err = pthread_create(&webserver_thread, NULL, webserver_service, (void *)&web_context);
+	int err = pthread_create(&webserver_thread, NULL, webserver_service, NULL);
 	if (err) {
 		LOG_ERROR("failed to start webserver service");
 		return ERR;
@@ -123,12 +498,20 @@ webserver_shutdown(void)
 {
 	LOG_INFO("webserver shutting down...");
 	interrupted = 1;
+	webserver_wake_web();
 
 	int err = pthread_join(webserver_thread, NULL);
 	if (err) {
 		LOG_ERROR("failed to join webserver thread");
 	}
 	mg_mgr_free(&webserver_mgr);
+	webassets_shutdown();
+	dyad_setWakeup(-1, NULL, NULL);
+	close(web_wakefd);
+	close(game_wakefd);
+	web_wakefd = game_wakefd = -1;
+	webqueue_free(&to_game);
+	webqueue_free(&to_web);
 	LOG_INFO("webserver ended");
 	return;
 }
@@ -1,16 +1,17 @@
 #ifndef WEBSERVER_H_
 #define WEBSERVER_H_
 
-#include "dyad.h"
-struct webserver_context {
-    unsigned upstream_port;
-    int family;
-};
+#include <stddef.h>
+#include "webqueue.h"
 
-int webserver_init(struct webserver_context ctx, unsigned port);
-void webserver_shutdown(void);
+/** called on the game loop for each connect, line and close of a client. */
+typedef void (*webserver_fn)(const struct webqueue_msg *msg);
 
-void webserver_test_callback(dyad_Event* ev);
-void webserver_accept_callback(dyad_Event* ev);
+int webserver_init(unsigned port, webserver_fn fn);
+void webserver_shutdown(void);
+void webserver_poll(void);
+int webserver_pending(void);
+int webserver_send(unsigned long conn, const void *data, size_t len);
+int webserver_close(unsigned long conn);
 
 #endif /* WEBSERVER_H_ */
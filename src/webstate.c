@@ -0,0 +1,510 @@
+/**
+ * @file webstate.c
+ *
+ * Game state stream for websocket clients.
+ *
+ * Every websocket client keeps MSDP variables with everything reportable
+ * turned on. Once per tick the variables are refreshed, and each client
+ * that has changes gets one JSON frame holding only the changed fields:
+ *
+ *   {"type":"state","WORLD_TIME":"1998-12-25 00:10:02"}
+ *
+ * Most of a tick is the same for every client, so each "NAME":value pair
+ * is encoded once per tick and shared, and a whole frame that is made of
+ * the same pairs as an earlier frame in the tick is sent again as is.
+ *
+ * @author Jon Mayo <jon@rm-f.net>
+ * @date 2026 Oct 16
+ *
+ * Copyright (c) 2026 Jon Mayo <jon@rm-f.net>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "webstate.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <boris.h>
+#include <mth.h>
+#include <buf.h>
+#include <crc32c.h>
+#include <timer.h>
+#include <worldclock.h>
+#include <webserver.h>
+#define LOG_SUBSYSTEM "webstate"
+#include <log.h>
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+#define WEBSTATE_FRAG_BUCKETS 256
+#define WEBSTATE_FRAME_BUCKETS 64
+/** deepest table or array nesting that is converted. */
+#define WEBSTATE_DEPTH_MAX 8
+#define WEBSTATE_PREFIX "{\"type\":\"state\""
+
+/** one variable and value, encoded as "NAME":value. */
+struct webstate_frag {
+	struct webstate_frag *next;
+	uint32_t hash;
+	unsigned index;
+	char *value;
+	char *json;
+	size_t len;
+};
+
+/** a complete frame, found by the fragments it was built from. */
+struct webstate_frame {
+	struct webstate_frame *next;
+	uint32_t hash;
+	unsigned nr_frag;
+	struct webstate_frag **frag;
+	char *json;
+	size_t len;
+};
+
+/******************************************************************************
+ * Globals
+ ******************************************************************************/
+
+static struct webstate_frag *webstate_frag_bucket[WEBSTATE_FRAG_BUCKETS];
+static struct webstate_frame *webstate_frame_bucket[WEBSTATE_FRAME_BUCKETS];
+/** fragments of the client being encoded. */
+static struct webstate_frag **webstate_pending;
+static struct buf *webstate_scratch;
+static unsigned webstate_timer;
+static char webstate_clock[32];
+/** encodes and sends during the current tick. */
+static unsigned webstate_encoded, webstate_sent;
+
+/******************************************************************************
+ * Functions
+ ******************************************************************************/
+
+/** append s as a JSON string, up to the next MSDP marker. */
+static const char *
+webstate_json_string(struct buf *b, const char *s)
+{
+	buf_append(b, '"');
+
+	for (; (unsigned char)*s > MSDP_ARRAY_CLOSE; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			buf_append(b, '\\');
+			buf_append(b, c);
+		} else if (c < 0x20) {
+			char hex[8];
+
+			snprintf(hex, sizeof(hex), "\\u%04x", c);
+			buf_write(b, hex, 6);
+		} else {
+			buf_append(b, c);
+		}
+	}
+
+	buf_append(b, '"');
+
+	return s;
+}
+
+/** append an MSDP value, which may hold tables and arrays, as JSON. */
+static const char *
+webstate_json_value(struct buf *b, const char *s, int depth)
+{
+	int first = 1;
+
+	if (depth >= WEBSTATE_DEPTH_MAX ||
+		(*s != MSDP_TABLE_OPEN && *s != MSDP_ARRAY_OPEN))
+		return webstate_json_string(b, s);
+
+	if (*s++ == MSDP_TABLE_OPEN) {
+		buf_append(b, '{');
+		while (*s && *s != MSDP_TABLE_CLOSE) {
+			if (*s != MSDP_VAR) {
+				s++;
+				continue;
+			}
+			if (!first)
+				buf_append(b, ',');
+			first = 0;
+			s = webstate_json_string(b, s + 1);
+			buf_append(b, ':');
+			if (*s == MSDP_VAL)
+				s = webstate_json_value(b, s + 1, depth + 1);
+			else
+				buf_write(b, "\"\"", 2);
+		}
+		buf_append(b, '}');
+	} else {
+		buf_append(b, '[');
+		while (*s && *s != MSDP_ARRAY_CLOSE) {
+			if (*s != MSDP_VAL) {
+				s++;
+				continue;
+			}
+			if (!first)
+				buf_append(b, ',');
+			first = 0;
+			s = webstate_json_value(b, s + 1, depth + 1);
+		}
+		buf_append(b, ']');
+	}
+
+	if (*s)
+		s++; /* closing marker */
+
+	return s;
+}
+
+/** copy what was written to the scratch buffer and empty it. */
+static char *
+webstate_scratch_take(size_t *len_out)
+{
+	size_t len;
+	void *data = buf_data(webstate_scratch, &len);
+	char *s = malloc(len + 1);
+
+	if (s) {
+		memcpy(s, data, len);
+		s[len] = 0;
+		*len_out = len;
+	} else {
+		LOG_PERROR("malloc()");
+	}
+
+	buf_consume(webstate_scratch, len);
+
+	return s;
+}
+
+/** find or encode the fragment for a variable and value. */
+static struct webstate_frag *
+webstate_frag_get(unsigned index, const char *value)
+{
+	uint32_t hash = crc32c(crc32c(0, &index, sizeof(index)), value, strlen(value));
+	struct webstate_frag **bucket = &webstate_frag_bucket[hash % WEBSTATE_FRAG_BUCKETS];
+	struct webstate_frag *f;
+
+	for (f = *bucket; f; f = f->next) {
+		if (f->hash == hash && f->index == index && !strcmp(f->value, value))
+			return f;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f) {
+		LOG_PERROR("calloc()");
+		return NULL;
+	}
+
+	webstate_json_string(webstate_scratch, msdp_table[index].name);
+	buf_append(webstate_scratch, ':');
+	webstate_json_value(webstate_scratch, value, 0);
+
+	f->hash = hash;
+	f->index = index;
+	f->value = strdup(value);
+	f->json = webstate_scratch_take(&f->len);
+	if (!f->value || !f->json) {
+		free(f->value);
+		free(f->json);
+		free(f);
+		return NULL;
+	}
+
+	f->next = *bucket;
+	*bucket = f;
+
+	return f;
+}
+
+/** find or build the frame for a list of fragments. */
+static struct webstate_frame *
+webstate_frame_get(struct webstate_frag **frag, unsigned nr_frag)
+{
+	uint32_t hash = crc32c(0, frag, nr_frag * sizeof(*frag));
+	struct webstate_frame **bucket = &webstate_frame_bucket[hash % WEBSTATE_FRAME_BUCKETS];
+	struct webstate_frame *fr;
+	unsigned i;
+
+	for (fr = *bucket; fr; fr = fr->next) {
+		if (fr->hash == hash && fr->nr_frag == nr_frag &&
+			!memcmp(fr->frag, frag, nr_frag * sizeof(*frag)))
+			return fr;
+	}
+
+	fr = calloc(1, sizeof(*fr));
+	if (!fr) {
+		LOG_PERROR("calloc()");
+		return NULL;
+	}
+
+	fr->frag = malloc(nr_frag * sizeof(*frag));
+	if (!fr->frag) {
+		LOG_PERROR("malloc()");
+		free(fr);
+		return NULL;
+	}
+
+	buf_write(webstate_scratch, WEBSTATE_PREFIX, strlen(WEBSTATE_PREFIX));
+	for (i = 0; i < nr_frag; i++) {
+		buf_append(webstate_scratch, ',');
+		buf_write(webstate_scratch, frag[i]->json, frag[i]->len);
+	}
+	buf_append(webstate_scratch, '}');
+
+	fr->json = webstate_scratch_take(&fr->len);
+	if (!fr->json) {
+		free(fr->frag);
+		free(fr);
+		return NULL;
+	}
+
+	memcpy(fr->frag, frag, nr_frag * sizeof(*frag));
+	fr->hash = hash;
+	fr->nr_frag = nr_frag;
+	fr->next = *bucket;
+	*bucket = fr;
+	webstate_encoded++;
+
+	return fr;
+}
+
+/** forget everything encoded during the last tick. */
+static void
+webstate_cache_clear(void)
+{
+	unsigned i;
+
+	for (i = 0; i < WEBSTATE_FRAG_BUCKETS; i++) {
+		struct webstate_frag *f;
+
+		while ((f = webstate_frag_bucket[i])) {
+			webstate_frag_bucket[i] = f->next;
+			free(f->value);
+			free(f->json);
+			free(f);
+		}
+	}
+
+	for (i = 0; i < WEBSTATE_FRAME_BUCKETS; i++) {
+		struct webstate_frame *fr;
+
+		while ((fr = webstate_frame_bucket[i])) {
+			webstate_frame_bucket[i] = fr->next;
+			free(fr->frag);
+			free(fr->json);
+			free(fr);
+		}
+	}
+}
+
+/**
+ * build the frame of changed variables for a client and clear the updated
+ * flags.
+ * @return the frame, or NULL if nothing changed.
+ */
+static struct webstate_frame *
+webstate_collect(DESCRIPTOR_DATA *cl)
+{
+	struct msdp_data **data = cl->mth->msdp_data;
+	unsigned n = 0;
+	int index;
+
+	if (!HAS_BIT(cl->mth->comm_flags, COMM_FLAG_MSDPUPDATE))
+		return NULL;
+
+	DEL_BIT(cl->mth->comm_flags, COMM_FLAG_MSDPUPDATE);
+
+	if (!webstate_pending) {
+		webstate_pending = calloc(mud.msdp_table_size, sizeof(*webstate_pending));
+		if (!webstate_pending) {
+			LOG_PERROR("calloc()");
+			return NULL;
+		}
+	}
+
+	for (index = 0; index < mud.msdp_table_size; index++) {
+		if (!HAS_BIT(data[index]->flags, MSDP_FLAG_UPDATED))
+			continue;
+
+		DEL_BIT(data[index]->flags, MSDP_FLAG_UPDATED);
+
+		webstate_pending[n] = webstate_frag_get(index, data[index]->value);
+		if (webstate_pending[n])
+			n++;
+	}
+
+	if (!n)
+		return NULL;
+
+	return webstate_frame_get(webstate_pending, n);
+}
+
+/**
+ * give a websocket client MSDP variables, reporting everything that is
+ * reportable.
+ */
+int
+webstate_attach(DESCRIPTOR_DATA *cl)
+{
+	int index;
+
+	if (cl->mth->msdp_data)
+		return 1; /* success */
+
+	cl->mth->msdp_data = calloc(mud.msdp_table_size, sizeof(*cl->mth->msdp_data));
+	if (!cl->mth->msdp_data) {
+		LOG_PERROR("calloc()");
+		return 0; /* failure */
+	}
+
+	for (index = 0; index < mud.msdp_table_size; index++) {
+		struct msdp_data *v = calloc(1, sizeof(*v));
+
+		if (!v || !(v->value = strdup(""))) {
+			LOG_PERROR("calloc()");
+			free(v);
+			return 0; /* failure */
+		}
+
+		v->flags = msdp_table[index].flags;
+		if (HAS_BIT(v->flags, MSDP_FLAG_REPORTABLE))
+			SET_BIT(v->flags, MSDP_FLAG_REPORTED);
+		cl->mth->msdp_data[index] = v;
+	}
+
+	return 1; /* success */
+}
+
+/** refresh the variables of a client and send what changed since last tick. */
+void
+webstate_update(DESCRIPTOR_DATA *cl)
+{
+	struct webstate_frame *fr;
+
+	if (!cl->web_conn || !cl->mth || !cl->mth->msdp_data)
+		return;
+
+	msdp_update_var(cl, "WORLD_TIME", "%s", webstate_clock);
+	if (cl->user)
+		msdp_update_var(cl, "CHARACTER_NAME", "%s", telnetclient_username(cl));
+
+	fr = webstate_collect(cl);
+	if (fr && telnetclient_webframe(cl, fr->json, fr->len) == OK)
+		webstate_sent++;
+}
+
+static void
+webstate_tick(void *p UNUSED)
+{
+	if (worldclock_datetimestr(webstate_clock, sizeof(webstate_clock), worldclock_now()) == -1)
+		webstate_clock[0] = 0;
+
+	webstate_encoded = webstate_sent = 0;
+	telnetclient_webstate_all();
+	if (webstate_sent)
+		LOG_DEBUG("sent %u state frames, %u encoded", webstate_sent, webstate_encoded);
+	webstate_cache_clear();
+
+	webstate_timer = timer_add(mud_config.webstate_interval, webstate_tick, NULL);
+	if (!webstate_timer)
+		LOG_ERROR("could not schedule the next state update");
+}
+
+int
+webstate_init(void)
+{
+	webstate_scratch = buf_new();
+	if (!webstate_scratch)
+		return 0; /* failure */
+
+	if (!mud_config.webstate_interval)
+		return 1; /* success - disabled */
+
+	webstate_timer = timer_add(mud_config.webstate_interval, webstate_tick, NULL);
+	if (!webstate_timer) {
+		LOG_ERROR("could not schedule state updates");
+		return 0; /* failure */
+	}
+
+	return 1; /* success */
+}
+
+void
+webstate_shutdown(void)
+{
+	if (webstate_timer)
+		timer_cancel(webstate_timer);
+	webstate_timer = 0;
+	webstate_cache_clear();
+	free(webstate_pending);
+	webstate_pending = NULL;
+	buf_free(webstate_scratch);
+	webstate_scratch = NULL;
+}
+
+#ifndef NTEST
+/** test the conversion of nested values and sharing of encoded frames. */
+void
+webstate_test(void)
+{
+	static const char nested[] = {
+		MSDP_TABLE_OPEN,
+		MSDP_VAR, 'n', MSDP_VAL, 'a', '"', 'b',
+		MSDP_VAR, 'x', MSDP_VAL, MSDP_ARRAY_OPEN,
+			MSDP_VAL, '1', MSDP_VAL, '\t', MSDP_ARRAY_CLOSE,
+		MSDP_TABLE_CLOSE, 0 };
+	static const char expect[] = "{\"n\":\"a\\\"b\",\"x\":[\"1\",\"\\u0009\"]}";
+	struct webstate_frag *a, *b, *frag[2];
+	struct webstate_frame *f1, *f2;
+	size_t len;
+	char *s;
+
+	webstate_scratch = buf_new();
+	if (!webstate_scratch) {
+		LOG_ERROR("buf_new() failed");
+		exit(1);
+	}
+
+	webstate_json_value(webstate_scratch, nested, 0);
+	s = webstate_scratch_take(&len);
+	if (!s || strcmp(s, expect)) {
+		LOG_ERROR("webstate conversion failed: %s", s ? s : "(null)");
+		exit(1);
+	}
+	free(s);
+
+	a = webstate_frag_get(0, "12");
+	b = webstate_frag_get(1, "x");
+	if (!a || !b || a != webstate_frag_get(0, "12") || a == webstate_frag_get(0, "13")) {
+		LOG_ERROR("webstate fragment cache failed");
+		exit(1);
+	}
+
+	frag[0] = a;
+	frag[1] = b;
+	f1 = webstate_frame_get(frag, 2);
+	f2 = webstate_frame_get(frag, 2);
+	if (!f1 || f1 != f2 || webstate_encoded != 1 || f1 == webstate_frame_get(frag, 1)) {
+		LOG_ERROR("webstate frame cache failed");
+		exit(1);
+	}
+
+	webstate_encoded = 0;
+	webstate_shutdown();
+	LOG_DEBUG("webstate test PASSED");
+}
+#endif
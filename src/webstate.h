@@ -0,0 +1,12 @@
+#ifndef WEBSTATE_H_
+#define WEBSTATE_H_
+#include "mud.h"
+
+int webstate_init(void);
+void webstate_shutdown(void);
+int webstate_attach(DESCRIPTOR_DATA *cl);
+void webstate_update(DESCRIPTOR_DATA *cl);
+#ifndef NTEST
+void webstate_test(void);
+#endif
+#endif